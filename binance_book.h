@@ -0,0 +1,153 @@
+/**
+* binance_book.h
+*
+* Order book of one symbol, rebuilt from the level records of depth updates
+*
+* The collector appends every level of every depth update to the symbol's depth files and,
+* every checkpoint interval, the whole book to its book files with an index entry pointing at
+* both (bookindex files). To restore the book as of a past time, book_reader loads the last
+* checkpoint before it and applies only the depth records after that checkpoint, with the
+* same book_apply() the collector built the checkpoint with.
+*/
+
+#ifndef BINANCE_BOOK_H
+#define BINANCE_BOOK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Include our common header file
+#include "binance_common.h"
+
+#define BOOK_INITIAL_LEVELS 256               // Levels allocated per side at the first insert
+
+// One price level
+typedef struct {
+    double price;
+    double quantity;
+} book_level_t;
+
+// Levels of one side, best price first
+typedef struct {
+    book_level_t *levels;
+    size_t count;
+    size_t capacity;
+} book_side_t;
+
+// Order book
+struct order_book {
+    book_side_t bids;          // Highest price first
+    book_side_t asks;          // Lowest price first
+    int64_t event_time;        // Event time of the last update applied (0: none)
+    int64_t update_id;         // Final update id of the last update applied (-1: none)
+    int complete;              // Seeded by a whole book since the last gap (0: only the levels updated since)
+};
+
+/**
+ * Initialize an empty book
+ */
+static inline void book_init(order_book_t *book) {
+    memset(book, 0, sizeof(*book));
+    book->update_id = -1;
+}
+
+/**
+ * Remove every level (the allocations are kept)
+ */
+static inline void book_clear(order_book_t *book) {
+    book->bids.count = 0;
+    book->asks.count = 0;
+}
+
+/**
+ * Release a book's levels
+ */
+static inline void book_free(order_book_t *book) {
+    free(book->bids.levels);
+    free(book->asks.levels);
+    book_init(book);
+}
+
+/**
+ * Position of a price on a side: the index of its level, or where it would be inserted
+ * Returns 1 if the level exists, 0 otherwise
+ */
+static inline int book_find(const book_side_t *side, int is_bid, double price, size_t *index) {
+    size_t low = 0, high = side->count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        double level = side->levels[mid].price;
+        if (level == price) {
+            *index = mid;
+            return 1;
+        }
+        if (is_bid ? level > price : level < price) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *index = low;
+    return 0;
+}
+
+/**
+ * Set the quantity at a price (a quantity of 0 removes the level)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static inline int book_set_level(order_book_t *book, int side_id, double price, double quantity) {
+    int is_bid = side_id == BOOK_SIDE_BID;
+    book_side_t *side = is_bid ? &book->bids : &book->asks;
+    size_t index;
+
+    if (book_find(side, is_bid, price, &index)) {
+        if (quantity == 0) {
+            memmove(&side->levels[index], &side->levels[index + 1],
+                    (side->count - index - 1) * sizeof(book_level_t));
+            side->count--;
+        } else {
+            side->levels[index].quantity = quantity;
+        }
+        return 0;
+    }
+    if (quantity == 0) {
+        return 0;
+    }
+
+    if (side->count == side->capacity) {
+        size_t capacity = side->capacity ? side->capacity * 2 : BOOK_INITIAL_LEVELS;
+        book_level_t *levels = (book_level_t *)realloc(side->levels, capacity * sizeof(book_level_t));
+        if (!levels) {
+            return -1;
+        }
+        side->levels = levels;
+        side->capacity = capacity;
+    }
+
+    memmove(&side->levels[index + 1], &side->levels[index], (side->count - index) * sizeof(book_level_t));
+    side->levels[index].price = price;
+    side->levels[index].quantity = quantity;
+    side->count++;
+    return 0;
+}
+
+/**
+ * Apply one level record of a depth update or of a checkpoint
+ * A record flagged BOOK_LEVEL_GAP starts the book over, complete if it is a snapshot level.
+ * Returns 0 on success, -1 on allocation failure
+ */
+static inline int book_apply(order_book_t *book, const book_level_record_t *record) {
+    if (record->flags & BOOK_LEVEL_GAP) {
+        book_clear(book);
+        book->complete = (record->flags & BOOK_LEVEL_SNAPSHOT) != 0;
+    }
+
+    book->event_time = record->event_time;
+    book->update_id = record->update_id;
+    return book_set_level(book, record->side, record->price, record->quantity);
+}
+
+#endif /* BINANCE_BOOK_H */
@@ -0,0 +1,423 @@
+/**
+* binance_catalog.c
+*
+* Lists the segments of a data directory from its catalog (catalog.bin), so that finding the
+* segments of a symbol, type and time range takes one small read instead of opening every
+* segment. Also catalogs segments written before the catalog existed (--rebuild) and checks
+* cataloged segments against their checksums (--verify).
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+
+// Global variables
+static const char *data_dir = "./data";
+static const char *symbol_filter = NULL;
+static int type_filter = 0;            // data_type_t, 0 for every type
+static int64_t from_ms = INT64_MIN;
+static int64_t to_ms = INT64_MAX;
+
+// Forward declarations
+void print_usage(const char *program_name);
+int64_t parse_time_ms(const char *text);
+int parse_type(const char *text);
+void format_time(int64_t ms, char *buffer, size_t size);
+int entry_selected(const catalog_entry_t *entry);
+int entry_path(const catalog_entry_t *entry, char *path, size_t size);
+int find_entry(const catalog_entry_t *entries, size_t count, const catalog_entry_t *entry);
+int compare_entries(const void *a, const void *b);
+int rebuild_catalog(void);
+int verify_entries(const catalog_entry_t *entries, size_t count);
+
+/**
+ * Print usage information
+ */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] [DIR]\n", program_name);
+    printf("Lists the cataloged segments of a data directory (default: ./data)\n");
+    printf("Options:\n");
+    printf("  -s, --symbol SYMBOLS    Comma-separated symbols to list (default: all)\n");
+    printf("  -T, --type TYPE         trades, klines, depth, book or bookindex (default: all)\n");
+    printf("  -f, --from TIME         Segments with records at or after this time (ms since epoch or\n");
+    printf("                          YYYY-MM-DD[THH:MM:SS], UTC)\n");
+    printf("  -t, --to TIME           Segments with records at or before this time\n");
+    printf("  -r, --rebuild           Catalog the finalized segments in DIR that are not cataloged yet\n");
+    printf("  -V, --verify            Read the listed segments back and check their record counts and checksums\n");
+    printf("  -h, --help              Show this help message\n");
+}
+
+/**
+ * Parse a time argument: milliseconds since the epoch, or a UTC date with optional time
+ * Returns the time in ms, or -1 if it cannot be parsed
+ */
+int64_t parse_time_ms(const char *text) {
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    if (*end == '\0' && end != text) {
+        return value;
+    }
+
+    struct tm tm = { 0 };
+    const char *rest = strptime(text, "%Y-%m-%d", &tm);
+    if (rest && (*rest == 'T' || *rest == ' ')) {
+        rest = strptime(rest + 1, "%H:%M:%S", &tm);
+    }
+    if (!rest || *rest != '\0') {
+        return -1;
+    }
+    return (int64_t)timegm(&tm) * 1000;
+}
+
+/**
+ * Parse a record type by its file name prefix
+ * Returns the data_type_t, or 0 if the name is unknown
+ */
+int parse_type(const char *text) {
+    static const data_type_t types[] = {
+        DATA_TYPE_TRADE, DATA_TYPE_KLINE, DATA_TYPE_DEPTH, DATA_TYPE_BOOK, DATA_TYPE_BOOK_INDEX
+    };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcasecmp(text, data_type_prefix(types[i])) == 0) {
+            return types[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Format a time in ms as a UTC date and time
+ */
+void format_time(int64_t ms, char *buffer, size_t size) {
+    time_t seconds = ms / 1000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    size_t len = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buffer + len, size - len, ".%03d", (int)(ms % 1000));
+}
+
+/**
+ * Whether an entry matches the symbol, type and time filters
+ */
+int entry_selected(const catalog_entry_t *entry) {
+    if (type_filter && entry->record_type != type_filter) {
+        return 0;
+    }
+    if ((from_ms != INT64_MIN || to_ms != INT64_MAX) &&
+        (entry->record_count == 0 || entry->last_time < from_ms || entry->first_time > to_ms)) {
+        return 0;
+    }
+    if (!symbol_filter) {
+        return 1;
+    }
+
+    size_t symbol_len = strnlen(entry->symbol, MAX_SYMBOL_LENGTH);
+    const char *p = symbol_filter;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        if (len == symbol_len && strncasecmp(p, entry->symbol, len) == 0) {
+            return 1;
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+/**
+ * Path of the segment an entry describes
+ * Returns 0 on success, -1 if the path does not fit
+ */
+int entry_path(const catalog_entry_t *entry, char *path, size_t size) {
+    int len = snprintf(path, size, "%s/%.*s/%s_%lld_%06u.bin", data_dir, MAX_SYMBOL_LENGTH, entry->symbol,
+                       data_type_prefix((data_type_t)entry->record_type), (long long)entry->run_id,
+                       entry->segment_index);
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+/**
+ * Whether a segment (symbol, type, run and index) is already in a list of entries
+ */
+int find_entry(const catalog_entry_t *entries, size_t count, const catalog_entry_t *entry) {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].record_type == entry->record_type && entries[i].run_id == entry->run_id &&
+            entries[i].segment_index == entry->segment_index &&
+            strncmp(entries[i].symbol, entry->symbol, MAX_SYMBOL_LENGTH) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * qsort comparator: symbol, then type, run and segment index
+ */
+int compare_entries(const void *a, const void *b) {
+    const catalog_entry_t *x = (const catalog_entry_t *)a;
+    const catalog_entry_t *y = (const catalog_entry_t *)b;
+    int order = strncmp(x->symbol, y->symbol, MAX_SYMBOL_LENGTH);
+    if (order != 0) {
+        return order;
+    }
+    if (x->record_type != y->record_type) {
+        return x->record_type < y->record_type ? -1 : 1;
+    }
+    if (x->run_id != y->run_id) {
+        return x->run_id < y->run_id ? -1 : 1;
+    }
+    return x->segment_index < y->segment_index ? -1 : x->segment_index > y->segment_index;
+}
+
+/**
+ * Catalog the finalized segments of the symbol directories that are not cataloged yet
+ * Segments still being written (or cut short by a crash) are not finalized and are left out.
+ * Returns 0 on success, -1 on failure
+ */
+int rebuild_catalog(void) {
+    size_t count;
+    catalog_entry_t *entries = catalog_read(data_dir, &count);
+    segment_catalog_t catalog;
+    if (catalog_open(&catalog, data_dir) != 0) {
+        free(entries);
+        return -1;
+    }
+
+    DIR *top = opendir(data_dir);
+    if (!top) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", data_dir, strerror(errno));
+        catalog_close(&catalog);
+        free(entries);
+        return -1;
+    }
+
+    size_t added = 0, skipped = 0;
+    int ret = 0;
+    struct dirent *symbol_entry;
+    while (ret == 0 && (symbol_entry = readdir(top)) != NULL) {
+        char symbol_dir[PATH_MAX];
+        if (symbol_entry->d_name[0] == '.' ||
+            snprintf(symbol_dir, sizeof(symbol_dir), "%s/%s", data_dir, symbol_entry->d_name) >= (int)sizeof(symbol_dir)) {
+            continue;
+        }
+        DIR *dir = opendir(symbol_dir);
+        if (!dir) {
+            continue;
+        }
+
+        struct dirent *file_entry;
+        while ((file_entry = readdir(dir)) != NULL) {
+            char path[PATH_MAX];
+            catalog_entry_t entry;
+            size_t name_len = strlen(file_entry->d_name);
+            if (name_len < 4 || strcmp(file_entry->d_name + name_len - 4, ".bin") != 0 ||
+                snprintf(path, sizeof(path), "%s/%s", symbol_dir, file_entry->d_name) >= (int)sizeof(path)) {
+                continue;
+            }
+
+            // Already cataloged segments are recognized by name, without reading them
+            char prefix[16];
+            long long run;
+            unsigned int index;
+            memset(&entry, 0, sizeof(entry));
+            if (sscanf(file_entry->d_name, "%15[a-z]_%lld_%u.bin", prefix, &run, &index) == 3) {
+                entry.record_type = parse_type(prefix);
+                entry.run_id = run;
+                entry.segment_index = index;
+                snprintf(entry.symbol, sizeof(entry.symbol), "%.*s", MAX_SYMBOL_LENGTH - 1, symbol_entry->d_name);
+                if (find_entry(entries, count, &entry)) {
+                    continue;
+                }
+            }
+
+            int r = catalog_scan_segment(path, &entry);
+            if (r < 0) {
+                fprintf(stderr, "Error: Failed to read %s\n", path);
+                ret = -1;
+                break;
+            }
+            if (r == 0) {
+                skipped++;
+                continue;
+            }
+            if (find_entry(entries, count, &entry)) {
+                continue;
+            }
+            if (catalog_append(&catalog, &entry) != 0) {
+                fprintf(stderr, "Error: Failed to write %s: %s\n", catalog.path, strerror(errno));
+                ret = -1;
+                break;
+            }
+            added++;
+        }
+        closedir(dir);
+    }
+    closedir(top);
+    catalog_close(&catalog);
+    free(entries);
+
+    printf("Cataloged %zu segments (%zu files skipped: not finalized or not segments)\n", added, skipped);
+    return ret;
+}
+
+/**
+ * Read the selected segments back and compare them with their entries
+ * Returns 0 if every segment matches, -1 otherwise
+ */
+int verify_entries(const catalog_entry_t *entries, size_t count) {
+    size_t checked = 0, bad = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!entry_selected(&entries[i])) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        catalog_entry_t actual;
+        checked++;
+        if (entry_path(&entries[i], path, sizeof(path)) != 0 || catalog_scan_segment(path, &actual) != 1) {
+            printf("MISSING %s\n", path);
+            bad++;
+        } else if (actual.record_count != entries[i].record_count || actual.checksum != entries[i].checksum) {
+            printf("MISMATCH %s: %llu records, crc %08x (cataloged: %llu records, crc %08x)\n", path,
+                   (unsigned long long)actual.record_count, actual.checksum,
+                   (unsigned long long)entries[i].record_count, entries[i].checksum);
+            bad++;
+        }
+    }
+
+    printf("Verified %zu segments: %zu bad\n", checked, bad);
+    return bad ? -1 : 0;
+}
+
+/**
+ * Main function for the catalog tool
+ */
+int main(int argc, char **argv) {
+    int rebuild = 0, verify = 0;
+    int c;
+    int opt_index = 0;
+
+    static struct option long_options[] = {
+        {"symbol", required_argument, NULL, 's'},
+        {"type", required_argument, NULL, 'T'},
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"rebuild", no_argument, NULL, 'r'},
+        {"verify", no_argument, NULL, 'V'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "s:T:f:t:rVh", long_options, &opt_index)) != -1) {
+        switch (c) {
+            case 's':
+                symbol_filter = optarg;
+                break;
+            case 'T':
+                type_filter = parse_type(optarg);
+                if (!type_filter) {
+                    fprintf(stderr, "Error: Invalid type: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+            case 't': {
+                int64_t ms = parse_time_ms(optarg);
+                if (ms < 0) {
+                    fprintf(stderr, "Error: Invalid time: %s\n", optarg);
+                    return 1;
+                }
+                if (c == 'f') {
+                    from_ms = ms;
+                } else {
+                    to_ms = ms;
+                }
+                break;
+            }
+            case 'r':
+                rebuild = 1;
+                break;
+            case 'V':
+                verify = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        data_dir = argv[optind];
+    }
+
+    if (rebuild && rebuild_catalog() != 0) {
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t count;
+    catalog_entry_t *entries = catalog_read(data_dir, &count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!entries) {
+        printf("No catalog entries in %s\n", data_dir);
+        return 1;
+    }
+
+    if (verify) {
+        int ret = verify_entries(entries, count);
+        free(entries);
+        return ret == 0 ? 0 : 1;
+    }
+
+    // Entries are in the order the segments were closed (or found by --rebuild)
+    qsort(entries, count, sizeof(catalog_entry_t), compare_entries);
+    printf("%-12s %-9s %-10s %6s %12s  %-23s  %-23s  %-25s %s\n", "Symbol", "Type", "Run", "Index", "Records",
+           "First (UTC)", "Last (UTC)", "Ids", "CRC-32C");
+    uint64_t records = 0, bytes = 0;
+    size_t selected = 0;
+    for (size_t i = 0; i < count; i++) {
+        const catalog_entry_t *entry = &entries[i];
+        if (!entry_selected(entry)) {
+            continue;
+        }
+
+        char first[32], last[32], ids[48] = "-"; // Two 20-digit ids and a dash
+        format_time(entry->first_time, first, sizeof(first));
+        format_time(entry->last_time, last, sizeof(last));
+        if (entry->first_id >= 0) {
+            snprintf(ids, sizeof(ids), "%lld-%lld", (long long)entry->first_id, (long long)entry->last_id);
+        } else if (entry->interval_ms > 0) {
+            snprintf(ids, sizeof(ids), "(%lld ms candles)", (long long)entry->interval_ms);
+        }
+        printf("%-12.*s %-9s %-10lld %6u %12llu  %-23s  %-23s  %-25s %08x\n", MAX_SYMBOL_LENGTH, entry->symbol,
+               data_type_prefix((data_type_t)entry->record_type), (long long)entry->run_id, entry->segment_index,
+               (unsigned long long)entry->record_count, first, last, ids, entry->checksum);
+
+        selected++;
+        records += entry->record_count;
+        bytes += entry->record_count * entry->record_size;
+    }
+
+    double read_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("\n%zu of %zu segments, %llu records (%.1f MB); catalog of %zu bytes read in %.3f ms\n", selected, count,
+           (unsigned long long)records, bytes / 1e6, count * sizeof(catalog_entry_t), read_ms);
+
+    free(entries);
+    return 0;
+}
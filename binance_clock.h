@@ -0,0 +1,193 @@
+/**
+* binance_clock.h
+*
+* Cheap nanosecond wall-clock timestamps, comparable across processes
+*
+* Stamps are raw TSC ticks (one rdtsc, no system call). The writer of the shared memory
+* calibrates the TSC against CLOCK_REALTIME at startup and every CLOCK_RECALIBRATION_SEC, and
+* publishes the calibration in the shared memory header; producers and consumers convert ticks
+* to nanoseconds since the epoch with that same calibration. Without an invariant TSC the ticks
+* are CLOCK_REALTIME nanoseconds and the calibration is the identity.
+*
+* The collector also publishes its estimate of the exchange's clock (exchange_clock_t), so that
+* exchange event times and receive times can be compared without the skew of the two clocks.
+*/
+
+#ifndef BINANCE_CLOCK_H
+#define BINANCE_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+// Include our common header file
+#include "binance_common.h"
+
+// Clock sources
+#define CLOCK_SOURCE_TSC 1
+#define CLOCK_SOURCE_REALTIME 2
+
+// Calibration
+#define CLOCK_SHIFT 32                        // Fraction bits of the ns-per-tick multiplier
+#define CLOCK_CALIBRATION_WINDOW_MS 20        // Initial rate measurement at startup
+#define CLOCK_CALIBRATION_READS 16            // Reads around each calibration point (tightest kept)
+#define CLOCK_RECALIBRATION_SEC 60            // Re-measure the rate over the whole run this often
+
+/**
+ * Current time in ticks of the calibration's source
+ */
+static inline uint64_t clock_ticks(const clock_calibration_t *clock) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (clock->source == CLOCK_SOURCE_TSC) {
+        return __rdtsc();
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Convert ticks of clock_ticks() to nanoseconds since the epoch
+ */
+static inline int64_t clock_ticks_to_ns(const clock_calibration_t *clock, uint64_t ticks) {
+    unsigned sequence;
+    int64_t ns;
+
+    do {
+        sequence = atomic_load_explicit(&clock->sequence, memory_order_acquire);
+        int64_t delta = (int64_t)(ticks - clock->tsc_base);
+        ns = clock->ns_base + (int64_t)(((__int128)delta * clock->mult) >> clock->shift);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&clock->sequence, memory_order_relaxed));
+
+    return ns;
+}
+
+/**
+ * Current time in nanoseconds since the epoch
+ */
+static inline int64_t clock_now_ns(const clock_calibration_t *clock) {
+    return clock_ticks_to_ns(clock, clock_ticks(clock));
+}
+
+/**
+ * Whether the TSC runs at a constant rate in all power states (and so can be calibrated once)
+ */
+static inline int clock_tsc_invariant(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return (edx >> 8) & 1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Read the TSC and CLOCK_REALTIME together: the pair from the read bracketed most tightly
+ */
+static inline void clock_sample(uint64_t *ticks, int64_t *ns) {
+    *ticks = 0;
+    *ns = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CLOCK_CALIBRATION_READS; i++) {
+        struct timespec ts;
+        uint64_t before = __rdtsc();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t after = __rdtsc();
+        if (after - before < best) {
+            best = after - before;
+            *ticks = before + (after - before) / 2;
+            *ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+    }
+#endif
+}
+
+/**
+ * Calibrate the clock (single writer): the first call picks the source and measures the TSC
+ * rate over CLOCK_CALIBRATION_WINDOW_MS; later calls measure it again since the first call and
+ * restart the conversion from the current time, so readers converting a tick count at that
+ * moment see at most the drift accumulated since the previous calibration.
+ */
+static inline void clock_calibrate(clock_calibration_t *clock) {
+    uint64_t ticks;
+    int64_t ns;
+
+    if (clock->source == 0) {
+        if (!clock_tsc_invariant()) {
+            clock->shift = 0;
+            clock->mult = 1;
+            clock->tsc_base = 0;
+            clock->ns_base = 0;
+            clock->tsc_hz = 1000000000ULL;
+            atomic_store_explicit(&clock->sequence, 0, memory_order_release);
+            clock->source = CLOCK_SOURCE_REALTIME;
+            return;
+        }
+
+        clock_sample(&clock->tsc_origin, &clock->ns_origin);
+        struct timespec window = { 0, CLOCK_CALIBRATION_WINDOW_MS * 1000000L };
+        nanosleep(&window, NULL);
+    } else if (clock->source != CLOCK_SOURCE_TSC) {
+        return;
+    }
+
+    clock_sample(&ticks, &ns);
+    uint64_t elapsed_ticks = ticks - clock->tsc_origin;
+    int64_t elapsed_ns = ns - clock->ns_origin;
+    if (elapsed_ticks == 0 || elapsed_ns <= 0) {
+        // CLOCK_REALTIME was stepped back; keep the previous rate
+        if (clock->mult != 0) {
+            return;
+        }
+        elapsed_ns = 1;
+        elapsed_ticks = 1;
+    }
+
+    unsigned sequence = atomic_load_explicit(&clock->sequence, memory_order_relaxed);
+    atomic_store_explicit(&clock->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    clock->shift = CLOCK_SHIFT;
+    clock->mult = (uint64_t)(((unsigned __int128)elapsed_ns << CLOCK_SHIFT) / elapsed_ticks);
+    clock->tsc_base = ticks;
+    clock->ns_base = ns;
+    clock->tsc_hz = (uint64_t)((unsigned __int128)elapsed_ticks * 1000000000ULL / elapsed_ns);
+
+    atomic_store_explicit(&clock->sequence, sequence + 2, memory_order_release);
+    clock->source = CLOCK_SOURCE_TSC;
+}
+
+/**
+ * Offset of the receive clock from the exchange's clock at receive time local_ns (0 if not estimated)
+ */
+static inline int64_t exchange_clock_offset(const exchange_clock_t *exchange, int64_t local_ns) {
+    unsigned sequence;
+    int64_t offset;
+
+    do {
+        sequence = atomic_load_explicit(&exchange->sequence, memory_order_acquire);
+        offset = exchange->offset_ns + (exchange->drift_ppb * ((local_ns - exchange->ref_ns) / 1000)) / 1000000;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&exchange->sequence, memory_order_relaxed));
+
+    return offset;
+}
+
+/**
+ * Delay from an exchange event (ms on the exchange's clock) to receive time local_ns, without the skew
+ * of the two clocks. Probed estimates give the one-way delay; event-time estimates give the delay
+ * above the smallest one seen.
+ */
+static inline int64_t exchange_latency_ns(const exchange_clock_t *exchange, int64_t event_time_ms,
+                                          int64_t local_ns) {
+    return local_ns - event_time_ms * 1000000 - exchange_clock_offset(exchange, local_ns);
+}
+
+#endif /* BINANCE_CLOCK_H */
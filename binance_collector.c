@@ -6,9 +6,12 @@
 * both on disk and in shared memory for other processes to access.
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include <signal.h>
 #include <getopt.h>
 #include <ctype.h>
@@ -20,40 +23,327 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/mempolicy.h>
+#include <sys/prctl.h>
+#include <malloc.h>
+#include <linux/futex.h>
 #include <libwebsockets.h>
 #include <json-c/json.h>
 #include <immintrin.h> // For AVX instructions
 #include <limits.h>
+#include <math.h>
 
 // Include our common header file
 #include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_probes.h"
+#include "binance_clock.h"
+#include "binance_book.h"
+
+// Command queue depth and size of one command of a connection
+#define SHARD_MAX_COMMANDS 8
+#define SHARD_COMMAND_SIZE 256
+
+// One WebSocket connection and the thread servicing it
+typedef struct {
+    int id;
+    struct lws_context *context;
+    struct lws *wsi;
+    pthread_t thread;          // Servicing thread (0 for connection 0, which runs on the main thread)
+    atomic_int tid;            // Kernel thread id of the servicing thread
+    char path[1024];           // Stream path the connection was opened with
+    atomic_int connected;
+    atomic_int acked_id;       // Id of the last subscription change the exchange confirmed
+    pthread_mutex_t command_mutex;
+    char commands[SHARD_MAX_COMMANDS][SHARD_COMMAND_SIZE]; // Queued SUBSCRIBE/UNSUBSCRIBE requests
+    int command_count;
+    atomic_uint_fast64_t message_count; // Messages received, duplicates included (servicing thread only writes)
+    uint32_t established;      // Times the connection was established (servicing thread only)
+} shard_t;
+
+// Frame queue of the parse workers
+#define MAX_PARSE_WORKERS 64
+#define PARSE_RING_SLOTS 4096                 // Frames in flight between receive threads and workers (power of two)
+#define PARSE_FRAME_INLINE 1024               // Frames up to this size are copied into their slot
+#define PARSE_SPIN_LIMIT 500                  // Polls of an empty slot before a worker sleeps
+
+// One received frame on its way through a parse worker
+typedef struct {
+    atomic_uint turn;          // Low 32 bits of the position the slot is free for (pos) or filled with (pos + 1)
+    atomic_int waiting;        // Set while a worker sleeps on turn
+    atomic_int parsed;         // Set once the worker has parsed the frame
+    uint64_t position;         // Position of the frame in the queue
+    int shard;                 // Connection that delivered the frame
+    uint64_t receive_ticks;    // Clock ticks when the frame was received
+    int symbol_idx;
+    uint64_t symbol_seq;       // Arrival order of the frame within its symbol
+    char *data;                // NUL-terminated frame (inline_data, or allocated if larger)
+    data_type_t type;          // Parse result (0 if the frame holds no record)
+    int64_t event_time;
+    union {
+        trade_record_t trade;
+        kline_record_t kline;
+    } record;
+    depth_update_t depth;      // Depth update (levels allocated)
+    char inline_data[PARSE_FRAME_INLINE];
+} parse_slot_t;
+
+// A frame spilled by the parse stage, followed by its bytes in the overflow file
+typedef struct {
+    uint32_t len;
+    int32_t shard;
+    int32_t symbol_idx;
+    uint32_t reserved;
+    uint64_t receive_ticks;
+} spilled_frame_t;
+
+// Commit order of one symbol's parsed frames
+typedef struct {
+    uint64_t next_seq;         // Sequence of the symbol's next frame (under parse_enqueue_mutex)
+    uint64_t commit_seq;       // Sequence of the next frame to commit (by the committing worker)
+    atomic_int committing;     // Set while a worker commits the symbol's frames
+    parse_slot_t *_Atomic pending[PARSE_RING_SLOTS]; // Slot of each sequence in flight (by sequence)
+} parse_order_t;
+
+// Depth snapshot request of the snapshot thread
+typedef struct {
+    int symbol_idx;            // Symbol asked for (-1: no request in flight)
+    uintptr_t generation;      // Number of the request, the opaque user data of its connection
+    time_t deadline;           // Time the request is given up at
+    int status;                // HTTP status of the response
+    int done;                  // 1 once the response is complete, -1 if the request failed
+    char *body;                // Response body, NUL-terminated
+    size_t length;
+    size_t capacity;
+} snapshot_request_t;
+
+// Raw frame journal
+#define JOURNAL_BUFFER_SIZE (1024 * 1024)     // stdio buffer of the journal (frames lost on a crash at most)
+#define EXCHANGE_WINDOW_SEC 10                // Window of the smallest event-time-to-receive delay
+#define EXCHANGE_WINDOWS 30                   // Windows the exchange clock offset and drift are fitted to
+#define EXCHANGE_PROBE_INTERVAL_SEC 5         // Interval between bursts of server-time probes
+#define EXCHANGE_PROBE_BURST 5                // Probes per burst (the one with the shortest round trip counts)
+#define EXCHANGE_PROBE_PATH "/fapi/v1/time"   // Server-time endpoint ({"serverTime":<ms>})
+#define PERSIST_BATCH 1024                    // Records the persist thread appends to a file before moving on
+#define PERSIST_IDLE_WAIT_MS 100              // Longest sleep of the persist thread
+#define PERSIST_RETRY_DELAY_MS 10             // Wait before retrying a failed append
+#define STATS_MIN_INTERVAL_MS 100             // Shortest interval between statistics reports
+#define DEPTH_STREAM "depth@100ms"          // Diff depth stream collected with --depth
+#define DEPTH_SNAPSHOT_HOST "fapi.binance.com"  // REST host of the depth snapshots
+#define DEPTH_SNAPSHOT_PATH "/fapi/v1/depth"  // Depth snapshot endpoint ({"lastUpdateId":..,"bids":..,"asks":..})
+#define DEPTH_SNAPSHOT_LIMIT 1000             // Levels per side of a snapshot
+#define DEPTH_SNAPSHOT_MAX_SIZE (4 * 1024 * 1024) // Largest snapshot response accepted
+#define DEPTH_SNAPSHOT_TIMEOUT_SEC 10         // Longest wait for a snapshot response
+#define DEPTH_SNAPSHOT_RETRY_SEC 5            // Wait before asking again after a failed snapshot
+#define DEPTH_BACKLOG_UPDATES 600             // Depth updates held back per symbol while its snapshot is fetched
+#define LATENCY_BUCKETS 12                    // Exchange latency histogram: below 0, up to each bound, above the last
+
+// Upper bounds (ms) of the bounded exchange latency buckets
+static const int64_t latency_bucket_ms[LATENCY_BUCKETS - 2] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
 
 // Global variables
-static struct lws_context *lws_context = NULL;
 static volatile int force_exit = 0;
-static symbol_data_t symbols[MAX_SYMBOLS];
+static symbol_data_t symbols[MAX_SYMBOLS] __attribute__((aligned(4096))); // Page aligned for mbind
 static size_t symbol_count = 0;
 static char *output_dir = "./data";
+static segment_catalog_t catalog = { .fd = -1 }; // Catalog of the output directory's finalized segments
 static int shm_fd = -1;
 static void *shared_memory = NULL;
 static shared_memory_header_t *shm_header = NULL;
 static pthread_t stats_thread;
+static int stats_interval_ms = LOG_INTERVAL_SEC * 1000; // Interval between statistics reports
 static pthread_t shm_update_thread;
 static time_t last_update_time = 0;
+static int receive_cpu = -1;           // CPU the receive thread is pinned to (-1 if not pinned)
+static const char *nic_name = NULL;    // NIC whose NUMA node anchors memory placement
+static int numa_node = -1;             // NUMA node owning ingestion memory (-1 if unbound)
+static cpu_set_t helper_cpus;          // CPUs on numa_node available to helper threads
+static int harden_mode = 0;            // Latency-hardening mode (mlockall, SCHED_FIFO, pre-touch)
+static int receive_rt_priority = 0;    // SCHED_FIFO priority of the receive thread (0: SCHED_OTHER)
+static int publish_rt_priority = 0;    // SCHED_FIFO priority of the shm publish thread (0: SCHED_OTHER)
+static atomic_int publish_tid = 0;     // Kernel thread id of the shm publish thread
+static pthread_t sync_thread;
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+static int blocks_ready = 0;            // Set (under sync_mutex) when a direct block waits to be written
+static durability_policy_t trade_durability_policy = { DURABILITY_NONE, 0 };
+static durability_policy_t kline_durability_policy = { DURABILITY_NONE, 0 };
+static writer_mode_t writer_mode = WRITER_STDIO;  // Backend for data files
+static size_t segment_size = 0;        // Data segment size in bytes (0: writer default)
+static int64_t run_id = 0;             // Run id (start time), part of every segment name
+static shard_t shards[MAX_SHARDS];     // WebSocket connections; connection 0 is serviced by the main thread
+static size_t shard_count = 1;
+static pthread_t balance_thread;
+static atomic_int next_command_id = 0;  // Id of the last subscription change sent
+static size_t parse_worker_count = 0;   // Parse workers (0: parse on the receive threads)
+static pthread_t parse_threads[MAX_PARSE_WORKERS];
+static parse_slot_t *parse_slots = NULL;
+static parse_order_t *parse_orders = NULL; // One per symbol
+static pthread_mutex_t parse_enqueue_mutex = PTHREAD_MUTEX_INITIALIZER; // Keeps positions in arrival order
+static atomic_uint_fast64_t parse_head = 0;  // Position of the next frame to queue
+static atomic_uint_fast64_t parse_tail = 0;  // Position of the next frame a worker claims
+static atomic_int parse_stop = 0;       // Set once no more frames are queued
+static int journal_mode = 0;            // Journal every received frame (see journal_frame())
+static FILE *journal_file = NULL;
+static char *journal_buffer = NULL;
+static atomic_int_fast64_t exchange_window_min = INT64_MAX; // Smallest receive minus event time (ns) this window
+static int64_t exchange_window_mins[EXCHANGE_WINDOWS];  // Minimum of each past window, oldest first
+static int64_t exchange_window_times[EXCHANGE_WINDOWS]; // Receive time of the middle of each past window
+static size_t exchange_window_count = 0;
+static char time_server[256];           // host:port[/path] answering server-time probes (empty: no probes)
+static pthread_t probe_thread;
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t probe_local_ns = 0;      // Receive time of the best probe of the last burst (0: none)
+static int64_t probe_offset_ns = 0;     // Receive clock minus server clock measured by that probe
+static int64_t probe_rtt_ns = 0;
+static overflow_policy_t parse_overflow = OVERFLOW_BLOCK;   // Frames that find the parse queue full
+static overflow_policy_t persist_overflow = OVERFLOW_BLOCK; // Records that find a persist queue full
+static int parse_spill_fd = -1;         // Frames spilled by the parse stage (unlinked overflow file)
+static uint64_t parse_spill_written = 0; // Bytes spilled (under parse_enqueue_mutex)
+static uint64_t parse_spill_read = 0;   // Bytes queued back (under parse_enqueue_mutex)
+static atomic_int parse_spilling = 0;   // Set while spilled frames wait; later frames spill behind them
+static atomic_uint_fast64_t frames_blocked = 0; // Frames that waited for room in the parse queue
+static atomic_uint_fast64_t frames_dropped = 0;
+static atomic_uint_fast64_t frames_spilled = 0;
+static pthread_t persist_thread;
+static pthread_t snapshot_thread;
+static atomic_uint persist_wake = 0;    // Futex word, bumped when records are queued while the persist thread waits
+static atomic_int persist_waiting = 0;  // Set while the persist thread waits
+static atomic_int persist_stop = 0;     // Set once no more records are queued
+static int depth_checkpoint_sec = 0;    // Interval between order book checkpoints (0: depth not collected)
+
+// Fault and preemption counters of a thread, as reported by procfs
+typedef struct {
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t involuntary_switches;
+} thread_fault_stats_t;
+
+// Ingest counters of one thread. Each block has a single writer, which bumps its counters with a
+// relaxed load and store (no locked instruction, no shared cache line); readers sum all blocks.
+typedef struct {
+    atomic_uint_fast64_t trades[MAX_SYMBOLS];     // Records accepted, by symbol
+    atomic_uint_fast64_t klines[MAX_SYMBOLS];
+    atomic_uint_fast64_t depth_updates[MAX_SYMBOLS];
+    atomic_uint_fast64_t depth_levels[MAX_SYMBOLS];
+    atomic_uint_fast64_t latency[LATENCY_BUCKETS]; // Records by corrected exchange latency
+} __attribute__((aligned(64))) thread_counters_t;
+
+#define MAX_COUNTER_BLOCKS (MAX_SHARDS + MAX_PARSE_WORKERS) // Threads that record (receive threads, workers)
+
+static thread_counters_t counter_blocks[MAX_COUNTER_BLOCKS];
+static atomic_int counter_block_count = 0;     // Blocks claimed
+static thread_counters_t shared_counters;      // Threads beyond the blocks (atomic increments)
+static __thread thread_counters_t *thread_counters = NULL; // Block of the calling thread
 
 // Forward declarations
 void init_symbol_data(symbol_data_t *symbol);
 void *stats_thread_func(void *arg);
+uint64_t sum_counter(const atomic_uint_fast64_t *counter);
+void format_time(int64_t ns, char *text, size_t size);
 void *shm_update_thread_func(void *arg);
 static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason,
                       void *user, void *in, size_t len);
-void handle_aggTrade(json_object *root, const char *symbol);
-void handle_kline(json_object *root, const char *symbol);
+int find_symbol(const char *symbol);
+void handle_aggTrade(json_object *root, const char *symbol, int shard, uint64_t receive_ticks);
+void parse_aggTrade(json_object *root, trade_record_t *record);
+void record_trade(int symbol_idx, const trade_record_t *trade, int shard, uint64_t receive_ticks);
+void handle_kline(json_object *root, const char *symbol, int shard, uint64_t receive_ticks);
+int parse_kline(json_object *root, kline_record_t *record, int64_t *event_time);
+void record_kline(int symbol_idx, const kline_record_t *kline, int64_t event_time, int shard,
+                  uint64_t receive_ticks);
+void handle_depth(json_object *root, const char *symbol, int shard);
+int parse_depth(json_object *root, depth_update_t *update);
+int parse_depth_levels(json_object *root, const char *bids_key, const char *asks_key, depth_update_t *update);
+void record_depth(int symbol_idx, const depth_update_t *update, int shard);
+int accept_trade(symbol_data_t *symbol, int64_t trade_id, int shard);
+int accept_kline(symbol_data_t *symbol, int64_t event_time, int64_t open_time);
+int accept_depth(symbol_data_t *symbol, int64_t update_id, int64_t prev_update_id, int shard, int *gap);
+void queue_depth_levels(int symbol_idx, const depth_update_t *update, uint8_t flags);
+void restart_depth_sync(symbol_data_t *symbol);
+int hold_depth_update(symbol_data_t *symbol, const depth_update_t *update);
+void sync_depth(int symbol_idx);
 int init_shared_memory();
 void cleanup_shared_memory();
 void update_shared_memory();
+void publish_record(shm_ring_t *ring, const message_header_t *header, const void *record, size_t size);
 void signal_handler(int sig);
+int numa_node_of_cpu(int cpu);
+int numa_node_of_nic(const char *ifname);
+int numa_node_cpuset(int node, cpu_set_t *set);
+int bind_memory_to_node(void *addr, size_t len, int node);
+int init_numa_placement();
+int create_helper_thread(pthread_t *thread, void *(*func)(void *), void *arg);
+int init_latency_hardening();
+void pretouch_buffers();
+void prefault_stack();
+int set_realtime_priority(int priority);
+int read_thread_fault_stats(pid_t tid, thread_fault_stats_t *stats);
+void report_hot_thread_faults();
+int64_t current_time_ms();
+int parse_durability_policy(const char *spec, durability_policy_t *policy);
+void note_record_written(file_durability_t *durability, const durability_policy_t *policy, uint64_t count);
+void request_kline_final_sync(symbol_data_t *symbol);
+int sync_data_files(int force);
+void wake_block_writer(void);
+void *sync_thread_func(void *arg);
+int open_data_file(data_file_t **file, data_type_t type, const char *dir, const char *symbol,
+                   const durability_policy_t *policy);
+int connect_shard(shard_t *shard, const char *host);
+void *shard_thread_func(void *arg);
+int queue_shard_command(shard_t *shard, const char *method, const char *symbol);
+void *balance_thread_func(void *arg);
+int plan_symbol_move(int *to);
+int init_parse_workers();
+int queue_frame(const char *in, size_t len, int shard, uint64_t receive_ticks);
+char *slot_buffer(parse_slot_t *slot, size_t len);
+void publish_slot(parse_slot_t *slot, uint64_t pos, int shard, uint64_t receive_ticks, int symbol_idx);
+int open_parse_spill(void);
+void spill_frame(const char *in, size_t len, int shard, uint64_t receive_ticks, int symbol_idx);
+int requeue_spilled_frames(void);
+void try_requeue_spilled_frames(void);
+void *parse_worker_func(void *arg);
+void parse_frame(parse_slot_t *slot);
+void commit_parsed_frames(int symbol_idx);
+void stop_parse_workers();
+int open_journal(const char *name, FILE **file, char **buffer);
+void journal_frame(FILE *file, const char *in, size_t len);
+void close_journal(FILE **file, char **buffer);
+void observe_exchange_time(int64_t receive_ns, int64_t event_time_ms);
+void update_exchange_clock(int64_t now_ns);
+int connect_time_server(void);
+int probe_server_time(int fd, int64_t *local_ns, int64_t *offset_ns, int64_t *rtt_ns);
+void *probe_thread_func(void *arg);
+void report_exchange_clock(void);
+int parse_overflow_policies(const char *spec);
+int init_persist_queue(persist_queue_t *queue, const data_file_t *file);
+void free_persist_queue(persist_queue_t *queue);
+uint64_t queue_record(symbol_data_t *symbol, data_type_t type, const persist_entry_t *entry);
+void flush_spill(persist_queue_t *queue);
+void wake_persist_thread(void);
+size_t drain_persist_queue(int symbol_idx, data_type_t type);
+size_t flush_idle_spills(void);
+int persist_pending(void);
+void *persist_thread_func(void *arg);
+void stop_persist_thread(void);
+void report_overload(double interval);
+void update_book(int symbol_idx, const book_level_record_t *level);
+int write_book_checkpoint(symbol_data_t *symbol);
+static int snapshot_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                             void *user, void *in, size_t len);
+int request_depth_snapshot(struct lws_context *context, snapshot_request_t *request, int symbol_idx);
+int parse_depth_snapshot(const char *body, depth_update_t *snapshot);
+void apply_depth_snapshot(int symbol_idx, depth_update_t *snapshot);
+void *snapshot_thread_func(void *arg);
 
 // Protocol definition
 static const struct lws_protocols protocols[] = {
@@ -66,6 +356,17 @@ static const struct lws_protocols protocols[] = {
     { NULL, NULL, 0, 0 }             // terminator
 };
 
+// Protocol of the depth snapshot requests (HTTP client)
+static const struct lws_protocols snapshot_protocols[] = {
+    {
+        "binance-depth-snapshot",    // name
+        snapshot_callback,           // callback
+        0,                           // per_session_data_size
+        0,                           // rx_buffer_size
+    },
+    { NULL, NULL, 0, 0 }             // terminator
+};
+
 /**
  * Initialize a symbol's data structure
  */
@@ -75,41 +376,138 @@ void init_symbol_data(symbol_data_t *symbol) {
     // Initialize recent data storage
     memset(&symbol->recent_data, 0, sizeof(symbol->recent_data));
     
-    atomic_init(&symbol->trade_count, 0);
-    atomic_init(&symbol->kline_count, 0);
-    atomic_init(&symbol->message_count, 0);
-    atomic_init(&symbol->bytes_processed, 0);
+    // Nothing recorded yet; main() assigns the connection
+    pthread_mutex_init(&symbol->ingest_mutex, NULL);
+    symbol->last_trade_id = -1;
+    symbol->last_kline_event_time = 0;
+    symbol->last_kline_open_time = 0;
+    symbol->last_depth_update_id = -1;
+    symbol->depth_synced = 0;
+    symbol->depth_backlog = NULL;
+    symbol->depth_backlog_start = 0;
+    symbol->depth_backlog_count = 0;
+    memset(&symbol->depth_snapshot, 0, sizeof(symbol->depth_snapshot));
+    atomic_init(&symbol->depth_snapshot_wanted, 0);
+    symbol->book = NULL;
+    symbol->next_checkpoint_time = 0;
+    atomic_init(&symbol->owner_shard, 0);
+    atomic_init(&symbol->target_shard, -1);
+    symbol->rate = 0;
+    
+    // Initialize durability tracking
+    file_durability_t *durability[2] = { &symbol->trade_durability, &symbol->kline_durability };
+    for (int i = 0; i < 2; i++) {
+        atomic_init(&durability[i]->written, 0);
+        atomic_init(&durability[i]->synced, 0);
+        atomic_init(&durability[i]->oldest_unsynced_ms, 0);
+        atomic_init(&durability[i]->sync_requested, 0);
+        durability[i]->last_sync_ms = current_time_ms();
+    }
+}
+
+/**
+ * Counter block of the calling thread, claimed on its first use
+ */
+static inline thread_counters_t *own_counters(void) {
+    if (!thread_counters) {
+        int block = atomic_fetch_add(&counter_block_count, 1);
+        thread_counters = block < MAX_COUNTER_BLOCKS ? &counter_blocks[block] : &shared_counters;
+    }
+    return thread_counters;
+}
+
+/**
+ * Count events in a counter of the calling thread's block
+ */
+static inline void count_events(thread_counters_t *counters, atomic_uint_fast64_t *counter, uint64_t count) {
+    if (counters == &shared_counters) {
+        atomic_fetch_add_explicit(counter, count, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + count,
+                              memory_order_relaxed);
+    }
+}
+
+/**
+ * Sum of a counter over all threads, given the counter's instance in shared_counters
+ */
+uint64_t sum_counter(const atomic_uint_fast64_t *counter) {
+    size_t offset = (const char *)counter - (const char *)&shared_counters;
+    int blocks = atomic_load_explicit(&counter_block_count, memory_order_relaxed);
+    uint64_t sum = atomic_load_explicit(counter, memory_order_relaxed);
+    
+    for (int i = 0; i < blocks && i < MAX_COUNTER_BLOCKS; i++) {
+        sum += atomic_load_explicit((const atomic_uint_fast64_t *)((const char *)&counter_blocks[i] + offset),
+                                    memory_order_relaxed);
+    }
+    return sum;
+}
+
+/**
+ * Local time of a timestamp (ns since the epoch) as text, to the millisecond
+ */
+void format_time(int64_t ns, char *text, size_t size) {
+    time_t seconds = (time_t)(ns / 1000000000);
+    struct tm tm;
+    
+    localtime_r(&seconds, &tm);
+    size_t length = strftime(text, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(text + length, size - length, ".%03d", (int)(ns / 1000000 % 1000));
 }
 
 /**
  * Statistics thread function
- * Periodically logs statistics about data collection
+ * Periodically logs statistics about data collection. Everything is read from relaxed atomic
+ * snapshots and per-thread counters, so the report takes no lock the ingest threads use.
  */
 void *stats_thread_func(void *arg) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t prev_ns = (int64_t)deadline.tv_sec * 1000000000LL + deadline.tv_nsec;
+    
     while (!force_exit) {
-        // Sleep for the log interval
-        sleep(LOG_INTERVAL_SEC);
+        // Sleep until the end of the interval (absolute, so reports do not drift)
+        deadline.tv_nsec += (long)(stats_interval_ms % 1000) * 1000000L;
+        deadline.tv_sec += stats_interval_ms / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+        if (force_exit) {
+            break;
+        }
+        
+        // Rates are per second of the interval that actually elapsed
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t now_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+        double interval = (now_ns - prev_ns) / 1e9;
+        prev_ns = now_ns;
         
         // Print statistics for each symbol
-        printf("\n--- Statistics (as of %s) ---\n", ctime(&(time_t){time(NULL)}));
+        char time_text[32];
+        format_time(shm_header ? clock_now_ns(&shm_header->clock) : current_time_ms() * 1000000, time_text,
+                    sizeof(time_text));
+        printf("\n--- Statistics (as of %s) ---\n", time_text);
         printf("Symbol  | Trade Count | Kline Count | Messages/sec | MB/sec   \n");
         printf("--------|-------------|-------------|--------------|----------\n");
         
         for (size_t i = 0; i < symbol_count; i++) {
-            uint64_t trade_count = atomic_load(&symbols[i].trade_count);
-            uint64_t kline_count = atomic_load(&symbols[i].kline_count);
-            uint64_t message_count = atomic_load(&symbols[i].message_count);
-            uint64_t bytes_processed = atomic_load(&symbols[i].bytes_processed);
+            uint64_t trade_count = sum_counter(&shared_counters.trades[i]);
+            uint64_t kline_count = sum_counter(&shared_counters.klines[i]);
+            uint64_t depth_updates = sum_counter(&shared_counters.depth_updates[i]);
+            uint64_t message_count = trade_count + kline_count + depth_updates;
+            uint64_t bytes_processed = trade_count * sizeof(trade_record_t) + kline_count * sizeof(kline_record_t) +
+                                       sum_counter(&shared_counters.depth_levels[i]) * sizeof(book_level_record_t);
             
             // Calculate message rate and data rate
             static uint64_t prev_message_counts[MAX_SYMBOLS] = {0};
             static uint64_t prev_bytes_processed[MAX_SYMBOLS] = {0};
             
             uint64_t msg_diff = message_count - prev_message_counts[i];
-            double msg_rate = (double)msg_diff / LOG_INTERVAL_SEC;
+            double msg_rate = (double)msg_diff / interval;
             
             uint64_t bytes_diff = bytes_processed - prev_bytes_processed[i];
-            double mb_rate = (double)bytes_diff / (1024 * 1024) / LOG_INTERVAL_SEC;
+            double mb_rate = (double)bytes_diff / (1024 * 1024) / interval;
             
             printf("%-8s| %-11llu | %-11llu | %-12.2f | %-10.2f\n", 
                    symbols[i].name, trade_count, kline_count, msg_rate, mb_rate);
@@ -118,26 +516,88 @@ void *stats_thread_func(void *arg) {
             prev_bytes_processed[i] = bytes_processed;
         }
         
+        // Print connection load (received messages, duplicates of moving symbols included)
+        if (shard_count > 1) {
+            static uint64_t prev_shard_counts[MAX_SHARDS] = {0};
+            
+            printf("\nConnection | Messages/sec | Symbols\n");
+            printf("-----------|--------------|--------\n");
+            
+            for (size_t s = 0; s < shard_count; s++) {
+                uint64_t count = atomic_load_explicit(&shards[s].message_count, memory_order_relaxed);
+                printf("%-10zu | %-12.2f |", s, (double)(count - prev_shard_counts[s]) / interval);
+                for (size_t i = 0; i < symbol_count; i++) {
+                    if (atomic_load(&symbols[i].owner_shard) == (int)s) {
+                        printf(" %s", symbols[i].name);
+                    }
+                    if (atomic_load(&symbols[i].target_shard) == (int)s) {
+                        printf(" (%s)", symbols[i].name);
+                    }
+                }
+                printf("%s\n", atomic_load(&shards[s].connected) ? "" : " [disconnected]");
+                prev_shard_counts[s] = count;
+            }
+        }
+        
+        // Print the back pressure between the pipeline stages
+        report_overload(interval);
+        
+        // Print the exchange clock estimate and the latency it leaves
+        if (shm_header) {
+            report_exchange_clock();
+        }
+        
         // Print shared memory stats
         if (shm_header) {
-            printf("\nShared Memory: Write counter: %llu, Last update: %s", 
-                   atomic_load(&shm_header->write_counter),
-                   ctime((time_t*)&shm_header->last_update_time));
+            format_time((int64_t)atomic_load_explicit(&shm_header->last_update_time, memory_order_relaxed) *
+                        1000000000, time_text, sizeof(time_text));
+            printf("\nShared Memory: Write counter: %llu, Last update: %.19s\n", 
+                   (unsigned long long)atomic_load_explicit(&shm_header->write_counter, memory_order_relaxed),
+                   time_text);
             
-            // Print recent records count for each symbol
+            // Print recent records count for each symbol (every accepted record enters the recent
+            // buffers, which keep the last MAX_RECORDS_PER_SYMBOL)
             printf("Recent records in memory:\n");
             printf("Symbol  | Trades | Klines \n");
             printf("--------|--------|--------\n");
             
             for (size_t i = 0; i < symbol_count; i++) {
-                pthread_mutex_lock(&symbols[i].mutex);
-                printf("%-8s| %-6zu | %-6zu\n", 
+                uint64_t trades = sum_counter(&shared_counters.trades[i]);
+                uint64_t klines = sum_counter(&shared_counters.klines[i]);
+                printf("%-8s| %-6llu | %-6llu\n", 
                        symbols[i].name, 
-                       symbols[i].recent_data.trades.count,
-                       symbols[i].recent_data.klines.count);
-                pthread_mutex_unlock(&symbols[i].mutex);
+                       (unsigned long long)(trades < MAX_RECORDS_PER_SYMBOL ? trades : MAX_RECORDS_PER_SYMBOL),
+                       (unsigned long long)(klines < MAX_RECORDS_PER_SYMBOL ? klines : MAX_RECORDS_PER_SYMBOL));
+            }
+        }
+        
+        // Print durability lag (records and age of the oldest record not yet on stable storage)
+        if (trade_durability_policy.level != DURABILITY_NONE || 
+            kline_durability_policy.level != DURABILITY_NONE) {
+            int64_t now_ms = current_time_ms();
+            
+            printf("Durability lag:\n");
+            printf("Symbol  | Trades unsynced | Trade lag ms | Klines unsynced | Kline lag ms\n");
+            printf("--------|-----------------|--------------|-----------------|-------------\n");
+            
+            for (size_t i = 0; i < symbol_count; i++) {
+                file_durability_t *td = &symbols[i].trade_durability;
+                file_durability_t *kd = &symbols[i].kline_durability;
+                int64_t trade_oldest = atomic_load(&td->oldest_unsynced_ms);
+                int64_t kline_oldest = atomic_load(&kd->oldest_unsynced_ms);
+                
+                printf("%-8s| %-15llu | %-12lld | %-15llu | %lld\n", symbols[i].name,
+                       (unsigned long long)(atomic_load(&td->written) - atomic_load(&td->synced)),
+                       (long long)(trade_oldest ? now_ms - trade_oldest : 0),
+                       (unsigned long long)(atomic_load(&kd->written) - atomic_load(&kd->synced)),
+                       (long long)(kline_oldest ? now_ms - kline_oldest : 0));
             }
         }
+        
+        // Verify the hot threads run without page faults and preemption
+        if (harden_mode) {
+            report_hot_thread_faults();
+        }
     }
     
     return NULL;
@@ -147,10 +607,34 @@ void *stats_thread_func(void *arg) {
  * Thread function to update shared memory periodically
  */
 void *shm_update_thread_func(void *arg) {
+    if (harden_mode) {
+        prefault_stack();
+    }
+    if (publish_rt_priority > 0) {
+        set_realtime_priority(publish_rt_priority);
+    }
+    atomic_store(&publish_tid, (pid_t)syscall(SYS_gettid));
+    
+    time_t last_calibration = time(NULL);
+    time_t last_window = last_calibration;
+    
     while (!force_exit) {
         // Update shared memory with the latest data
         update_shared_memory();
         
+        // Re-measure the TSC rate so the conversion of receive stamps does not drift
+        time_t now = time(NULL);
+        if (now - last_calibration >= CLOCK_RECALIBRATION_SEC) {
+            clock_calibrate(&shm_header->clock);
+            last_calibration = now;
+        }
+        
+        // Close the window of event-time-to-receive delays and refit the exchange clock
+        if (now - last_window >= EXCHANGE_WINDOW_SEC) {
+            update_exchange_clock(clock_now_ns(&shm_header->clock));
+            last_window = now;
+        }
+        
         // Sleep for the update interval
         usleep(SHM_UPDATE_INTERVAL_MS * 1000);
     }
@@ -163,12 +647,32 @@ void *shm_update_thread_func(void *arg) {
  */
 static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason,
                       void *user, void *in, size_t len) {
+    shard_t *shard = wsi ? (shard_t *)lws_context_user(lws_get_context(wsi)) : NULL;
+    
     switch (reason) {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
-            fprintf(stderr, "WebSocket connection established\n");
+            fprintf(stderr, "WebSocket connection %d established\n", shard->id);
+            shard->wsi = wsi;
+            atomic_store(&shard->connected, 1);
+            shard->established++;
+            PROBE_CONNECTION_UP(shard->id, shard->established);
             break;
         
         case LWS_CALLBACK_CLIENT_RECEIVE: {
+            uint64_t receive_ticks = clock_ticks(&shm_header->clock);
+            uint64_t frame_seq = atomic_load_explicit(&shard->message_count, memory_order_relaxed);
+            atomic_store_explicit(&shard->message_count, frame_seq + 1, memory_order_relaxed);
+            PROBE_FRAME_RECEIVED(shard->id, len, frame_seq);
+            
+            if (journal_file) {
+                journal_frame(journal_file, (const char *)in, len);
+            }
+            
+            // Hand the frame to the parse workers if they run (replies and unknown streams stay here)
+            if (parse_worker_count > 0 && queue_frame((const char *)in, len, shard->id, receive_ticks) == 0) {
+                break;
+            }
+            
             // Parse JSON message
             json_object *root = json_tokener_parse((const char *)in);
             if (!root) {
@@ -195,9 +699,22 @@ static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason,
                 if (json_object_object_get_ex(root, "data", &data_obj)) {
                     // Process based on stream type
                     if (strstr(stream, "@aggTrade")) {
-                        handle_aggTrade(data_obj, symbol);
+                        handle_aggTrade(data_obj, symbol, shard->id, receive_ticks);
                     } else if (strstr(stream, "@kline")) {
-                        handle_kline(data_obj, symbol);
+                        handle_kline(data_obj, symbol, shard->id, receive_ticks);
+                    } else if (strstr(stream, "@depth")) {
+                        handle_depth(data_obj, symbol, shard->id);
+                    }
+                }
+            } else {
+                // Reply to a SUBSCRIBE/UNSUBSCRIBE request: {"result":null,"id":N} or an error
+                json_object *id_obj, *result_obj;
+                if (json_object_object_get_ex(root, "id", &id_obj)) {
+                    if (json_object_object_get_ex(root, "result", &result_obj)) {
+                        atomic_store(&shard->acked_id, json_object_get_int(id_obj));
+                    } else {
+                        fprintf(stderr, "Subscription change %d rejected on connection %d: %s\n",
+                                json_object_get_int(id_obj), shard->id, (const char *)in);
                     }
                 }
             }
@@ -206,13 +723,48 @@ static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason,
             break;
         }
         
+        case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+            // queue_shard_command() woke the service loop
+            if (atomic_load(&shard->connected)) {
+                lws_callback_on_writable(shard->wsi);
+            }
+            break;
+        
+        case LWS_CALLBACK_CLIENT_WRITEABLE: {
+            unsigned char buf[LWS_PRE + SHARD_COMMAND_SIZE];
+            size_t n = 0;
+            int more;
+            
+            pthread_mutex_lock(&shard->command_mutex);
+            if (shard->command_count > 0) {
+                n = strlen(shard->commands[0]);
+                memcpy(buf + LWS_PRE, shard->commands[0], n);
+                shard->command_count--;
+                memmove(shard->commands[0], shard->commands[1], shard->command_count * SHARD_COMMAND_SIZE);
+            }
+            more = shard->command_count > 0;
+            pthread_mutex_unlock(&shard->command_mutex);
+            
+            if (n > 0 && lws_write(wsi, buf + LWS_PRE, n, LWS_WRITE_TEXT) < (int)n) {
+                fprintf(stderr, "Failed to send subscription change on connection %d\n", shard->id);
+            }
+            if (more) {
+                lws_callback_on_writable(wsi);
+            }
+            break;
+        }
+        
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-            fprintf(stderr, "WebSocket connection error: %s\n", 
+            fprintf(stderr, "WebSocket connection %d error: %s\n", shard->id,
                    in ? (char *)in : "(null)");
+            atomic_store(&shard->connected, 0);
+            PROBE_CONNECTION_DOWN(shard->id, 1);
             break;
         
         case LWS_CALLBACK_CLOSED:
-            fprintf(stderr, "WebSocket connection closed\n");
+            fprintf(stderr, "WebSocket connection %d closed\n", shard->id);
+            atomic_store(&shard->connected, 0);
+            PROBE_CONNECTION_DOWN(shard->id, 0);
             break;
         
         default:
@@ -223,269 +775,738 @@ static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason,
 }
 
 /**
- * Handle aggTrade message
+ * Find a symbol in our array
+ * Returns the index, or -1 (logged) if the symbol is not collected
  */
-void handle_aggTrade(json_object *root, const char *symbol) {
-    // Find the symbol in our array
-    int symbol_idx = -1;
+int find_symbol(const char *symbol) {
     for (size_t i = 0; i < symbol_count; i++) {
         if (strcmp(symbols[i].name, symbol) == 0) {
-            symbol_idx = i;
-            break;
+            return i;
         }
     }
     
+    fprintf(stderr, "Received data for unknown symbol: %s\n", symbol);
+    return -1;
+}
+
+/**
+ * Handle aggTrade message delivered by a connection
+ */
+void handle_aggTrade(json_object *root, const char *symbol, int shard, uint64_t receive_ticks) {
+    int symbol_idx = find_symbol(symbol);
     if (symbol_idx == -1) {
-        fprintf(stderr, "Received data for unknown symbol: %s\n", symbol);
         return;
     }
     
-    // Extract trade data
     trade_record_t record;
-    
+    parse_aggTrade(root, &record);
+    PROBE_PARSE_DONE(shard, symbol_idx, DATA_TYPE_TRADE, record.event_time, record.trade_id);
+    record_trade(symbol_idx, &record, shard, receive_ticks);
+}
+
+/**
+ * Extract a trade record from an aggTrade message
+ */
+void parse_aggTrade(json_object *root, trade_record_t *record) {
     json_object *obj;
     if (json_object_object_get_ex(root, "E", &obj)) 
-        record.event_time = json_object_get_int64(obj);
+        record->event_time = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(root, "T", &obj)) 
-        record.trade_time = json_object_get_int64(obj);
+        record->trade_time = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(root, "p", &obj)) 
-        record.price = json_object_get_double(obj);
+        record->price = json_object_get_double(obj);
     
     if (json_object_object_get_ex(root, "q", &obj)) 
-        record.quantity = json_object_get_double(obj);
+        record->quantity = json_object_get_double(obj);
     
     if (json_object_object_get_ex(root, "a", &obj)) 
-        record.trade_id = json_object_get_int64(obj);
+        record->trade_id = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(root, "m", &obj)) 
-        record.is_buyer_maker = json_object_get_boolean(obj) ? 1 : 0;
+        record->is_buyer_maker = json_object_get_boolean(obj) ? 1 : 0;
+}
+
+/**
+ * Record a trade of a symbol delivered by a connection: persist queue, recent ring and live ring
+ */
+void record_trade(int symbol_idx, const trade_record_t *trade, int shard, uint64_t receive_ticks) {
+    trade_record_t record = *trade;
     
-    // Write directly to file
-    if (fwrite(&record, sizeof(record), 1, symbols[symbol_idx].trade_file) != 1) {
-        fprintf(stderr, "Failed to write trade data to file for symbol %s\n", symbols[symbol_idx].name);
-    } else {
-        // Update statistics
-        atomic_fetch_add(&symbols[symbol_idx].trade_count, 1);
-        atomic_fetch_add(&symbols[symbol_idx].message_count, 1);
-        atomic_fetch_add(&symbols[symbol_idx].bytes_processed, sizeof(record));
-        
-        // Also store in memory for shared memory updates
-        pthread_mutex_lock(&symbols[symbol_idx].mutex);
-        
-        // Get the next position in the circular buffer
-        size_t idx = symbols[symbol_idx].recent_data.trades.next_index;
-        
-        // Store the record
-        symbols[symbol_idx].recent_data.trades.records[idx] = record;
-        
-        // Create and store the header
-        message_header_t header;
-        header.type = DATA_TYPE_TRADE;
-        header.length = sizeof(record);
-        header.timestamp = time(NULL);
-        strncpy(header.symbol, symbol, MAX_SYMBOL_LENGTH - 1);
-        header.symbol[MAX_SYMBOL_LENGTH - 1] = '\0';
-        
-        symbols[symbol_idx].recent_data.trades.headers[idx] = header;
-        
-        // Update the index for next write
-        symbols[symbol_idx].recent_data.trades.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
-        
-        // Update count if we haven't filled the buffer yet
-        if (symbols[symbol_idx].recent_data.trades.count < MAX_RECORDS_PER_SYMBOL) {
-            symbols[symbol_idx].recent_data.trades.count++;
-        }
-        
-        pthread_mutex_unlock(&symbols[symbol_idx].mutex);
+    // While the symbol moves between connections both deliver it; record each trade once
+    pthread_mutex_lock(&symbols[symbol_idx].ingest_mutex);
+    if (!accept_trade(&symbols[symbol_idx], record.trade_id, shard)) {
+        pthread_mutex_unlock(&symbols[symbol_idx].ingest_mutex);
+        return;
+    }
+    
+    // Hand the record to the persist thread; its place in the data file is its sequence
+    persist_entry_t entry;
+    entry.event_time = record.event_time;
+    entry.record.trade = record;
+    uint64_t sequence = queue_record(&symbols[symbol_idx], DATA_TYPE_TRADE, &entry);
+    
+    // Update statistics (counters of this thread)
+    thread_counters_t *counters = own_counters();
+    count_events(counters, &counters->trades[symbol_idx], 1);
+    
+    // Also store in memory for shared memory updates
+    pthread_mutex_lock(&symbols[symbol_idx].mutex);
+    
+    // Get the next position in the circular buffer
+    size_t idx = symbols[symbol_idx].recent_data.trades.next_index;
+    
+    // Store the record
+    symbols[symbol_idx].recent_data.trades.records[idx] = record;
+    
+    // Create and store the header
+    message_header_t header;
+    header.type = DATA_TYPE_TRADE;
+    header.length = sizeof(record);
+    header.timestamp = clock_ticks_to_ns(&shm_header->clock, receive_ticks);
+    header.sequence = sequence;
+    observe_exchange_time(header.timestamp, record.event_time);
+    strncpy(header.symbol, symbols[symbol_idx].name, MAX_SYMBOL_LENGTH - 1);
+    header.symbol[MAX_SYMBOL_LENGTH - 1] = '\0';
+    
+    symbols[symbol_idx].recent_data.trades.headers[idx] = header;
+    
+    // Publish to the live ring right away; the snapshot area is refreshed periodically
+    if (symbols[symbol_idx].trade_ring) {
+        publish_record(symbols[symbol_idx].trade_ring, &header, &record, sizeof(record));
+        PROBE_SHM_PUBLISHED(symbol_idx, DATA_TYPE_TRADE, header.sequence, record.event_time);
+    }
+    
+    // Update the index for next write
+    symbols[symbol_idx].recent_data.trades.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
+    
+    // Update count if we haven't filled the buffer yet
+    if (symbols[symbol_idx].recent_data.trades.count < MAX_RECORDS_PER_SYMBOL) {
+        symbols[symbol_idx].recent_data.trades.count++;
     }
     
-    // Flush to ensure data is written
-    fflush(symbols[symbol_idx].trade_file);
+    pthread_mutex_unlock(&symbols[symbol_idx].mutex);
+    pthread_mutex_unlock(&symbols[symbol_idx].ingest_mutex);
 }
 
 /**
- * Handle kline message
+ * Handle kline message delivered by a connection
  */
-void handle_kline(json_object *root, const char *symbol) {
-    // Find the symbol in our array
-    int symbol_idx = -1;
-    for (size_t i = 0; i < symbol_count; i++) {
-        if (strcmp(symbols[i].name, symbol) == 0) {
-            symbol_idx = i;
-            break;
-        }
-    }
-    
+void handle_kline(json_object *root, const char *symbol, int shard, uint64_t receive_ticks) {
+    int symbol_idx = find_symbol(symbol);
     if (symbol_idx == -1) {
-        fprintf(stderr, "Received data for unknown symbol: %s\n", symbol);
         return;
     }
     
+    kline_record_t record;
+    int64_t event_time;
+    if (parse_kline(root, &record, &event_time) == 0) {
+        PROBE_PARSE_DONE(shard, symbol_idx, DATA_TYPE_KLINE, event_time, record.open_time);
+        record_kline(symbol_idx, &record, event_time, shard, receive_ticks);
+    }
+}
+
+/**
+ * Extract a kline record and its event time from a kline message
+ * Returns 0 on success, -1 if the message has no kline
+ */
+int parse_kline(json_object *root, kline_record_t *record, int64_t *event_time) {
     // Get kline object
     json_object *k_obj;
     if (!json_object_object_get_ex(root, "k", &k_obj)) {
         fprintf(stderr, "Failed to find kline object in message\n");
-        return;
+        return -1;
     }
     
-    // Extract kline data
-    kline_record_t record;
-    
     json_object *obj;
+    *event_time = 0;
+    if (json_object_object_get_ex(root, "E", &obj)) 
+        *event_time = json_object_get_int64(obj);
+    
     if (json_object_object_get_ex(k_obj, "t", &obj)) 
-        record.open_time = json_object_get_int64(obj);
+        record->open_time = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(k_obj, "T", &obj)) 
-        record.close_time = json_object_get_int64(obj);
+        record->close_time = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(k_obj, "o", &obj)) 
-        record.open_price = json_object_get_double(obj);
+        record->open_price = json_object_get_double(obj);
     
     if (json_object_object_get_ex(k_obj, "c", &obj)) 
-        record.close_price = json_object_get_double(obj);
+        record->close_price = json_object_get_double(obj);
     
     if (json_object_object_get_ex(k_obj, "h", &obj)) 
-        record.high_price = json_object_get_double(obj);
+        record->high_price = json_object_get_double(obj);
     
     if (json_object_object_get_ex(k_obj, "l", &obj)) 
-        record.low_price = json_object_get_double(obj);
+        record->low_price = json_object_get_double(obj);
     
     if (json_object_object_get_ex(k_obj, "v", &obj)) 
-        record.volume = json_object_get_double(obj);
+        record->volume = json_object_get_double(obj);
     
     if (json_object_object_get_ex(k_obj, "n", &obj)) 
-        record.num_trades = json_object_get_int64(obj);
+        record->num_trades = json_object_get_int64(obj);
     
     if (json_object_object_get_ex(k_obj, "x", &obj)) 
-        record.is_final = json_object_get_boolean(obj) ? 1 : 0;
-    
-    // Write directly to file
-    if (fwrite(&record, sizeof(record), 1, symbols[symbol_idx].kline_file) != 1) {
-        fprintf(stderr, "Failed to write kline data to file for symbol %s\n", symbols[symbol_idx].name);
-    } else {
-        // Update statistics
-        atomic_fetch_add(&symbols[symbol_idx].kline_count, 1);
-        atomic_fetch_add(&symbols[symbol_idx].message_count, 1);
-        atomic_fetch_add(&symbols[symbol_idx].bytes_processed, sizeof(record));
-        
-        // Also store in memory for shared memory updates
-        pthread_mutex_lock(&symbols[symbol_idx].mutex);
-        
-        // Get the next position in the circular buffer
-        size_t idx = symbols[symbol_idx].recent_data.klines.next_index;
-        
-        // Store the record
-        symbols[symbol_idx].recent_data.klines.records[idx] = record;
-        
-        // Create and store the header
-        message_header_t header;
-        header.type = DATA_TYPE_KLINE;
-        header.length = sizeof(record);
-        header.timestamp = time(NULL);
-        strncpy(header.symbol, symbol, MAX_SYMBOL_LENGTH - 1);
-        header.symbol[MAX_SYMBOL_LENGTH - 1] = '\0';
-        
-        symbols[symbol_idx].recent_data.klines.headers[idx] = header;
-        
-        // Update the index for next write
-        symbols[symbol_idx].recent_data.klines.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
-        
-        // Update count if we haven't filled the buffer yet
-        if (symbols[symbol_idx].recent_data.klines.count < MAX_RECORDS_PER_SYMBOL) {
-            symbols[symbol_idx].recent_data.klines.count++;
-        }
-        
-        pthread_mutex_unlock(&symbols[symbol_idx].mutex);
-    }
+        record->is_final = json_object_get_boolean(obj) ? 1 : 0;
     
-    // Flush to ensure data is written
-    fflush(symbols[symbol_idx].kline_file);
+    return 0;
 }
 
 /**
- * Initialize shared memory
- * Returns 0 on success, -1 on failure
+ * Record a kline update of a symbol delivered by a connection: persist queue, recent ring and live ring
  */
-int init_shared_memory() {
-    // Create/open shared memory
-    shm_fd = shm_open("/binance_market_data", O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
-        return -1;
+void record_kline(int symbol_idx, const kline_record_t *kline, int64_t event_time, int shard,
+                  uint64_t receive_ticks) {
+    kline_record_t record = *kline;
+    
+    // While the symbol moves between connections both deliver it; record each update once
+    pthread_mutex_lock(&symbols[symbol_idx].ingest_mutex);
+    if (!accept_kline(&symbols[symbol_idx], event_time, record.open_time)) {
+        pthread_mutex_unlock(&symbols[symbol_idx].ingest_mutex);
+        return;
     }
     
-    // Set the size of the shared memory
-    if (ftruncate(shm_fd, SHM_SIZE) == -1) {
-        perror("ftruncate failed");
-        close(shm_fd);
-        shm_unlink("/binance_market_data");
-        return -1;
+    // Hand the record to the persist thread; its place in the data file is its sequence
+    persist_entry_t entry;
+    entry.event_time = event_time;
+    entry.record.kline = record;
+    uint64_t sequence = queue_record(&symbols[symbol_idx], DATA_TYPE_KLINE, &entry);
+    
+    // Update statistics
+    thread_counters_t *counters = own_counters();
+    count_events(counters, &counters->klines[symbol_idx], 1);
+    
+    // Also store in memory for shared memory updates
+    pthread_mutex_lock(&symbols[symbol_idx].mutex);
+    
+    // Get the next position in the circular buffer
+    size_t idx = symbols[symbol_idx].recent_data.klines.next_index;
+    
+    // Store the record
+    symbols[symbol_idx].recent_data.klines.records[idx] = record;
+    
+    // Create and store the header
+    message_header_t header;
+    header.type = DATA_TYPE_KLINE;
+    header.length = sizeof(record);
+    header.timestamp = clock_ticks_to_ns(&shm_header->clock, receive_ticks);
+    header.sequence = sequence;
+    observe_exchange_time(header.timestamp, event_time);
+    strncpy(header.symbol, symbols[symbol_idx].name, MAX_SYMBOL_LENGTH - 1);
+    header.symbol[MAX_SYMBOL_LENGTH - 1] = '\0';
+    
+    symbols[symbol_idx].recent_data.klines.headers[idx] = header;
+    
+    // Publish to the live ring right away; the snapshot area is refreshed periodically
+    if (symbols[symbol_idx].kline_ring) {
+        publish_record(symbols[symbol_idx].kline_ring, &header, &record, sizeof(record));
+        PROBE_SHM_PUBLISHED(symbol_idx, DATA_TYPE_KLINE, header.sequence, event_time);
     }
     
-    // Map the shared memory
-    shared_memory = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (shared_memory == MAP_FAILED) {
-        perror("mmap failed");
-        close(shm_fd);
-        shm_unlink("/binance_market_data");
-        return -1;
+    // Update the index for next write
+    symbols[symbol_idx].recent_data.klines.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
+    
+    // Update count if we haven't filled the buffer yet
+    if (symbols[symbol_idx].recent_data.klines.count < MAX_RECORDS_PER_SYMBOL) {
+        symbols[symbol_idx].recent_data.klines.count++;
     }
     
-    // Initialize the shared memory header
-    shm_header = (shared_memory_header_t *)shared_memory;
-    atomic_init(&shm_header->write_counter, 0);
-    atomic_init(&shm_header->last_update_time, time(NULL));
-    shm_header->data_offset = sizeof(shared_memory_header_t);
-    shm_header->buffer_size = (SHM_SIZE - shm_header->data_offset) / MAX_SYMBOLS;
-    shm_header->symbol_count = symbol_count;
+    pthread_mutex_unlock(&symbols[symbol_idx].mutex);
+    pthread_mutex_unlock(&symbols[symbol_idx].ingest_mutex);
+}
+
+/**
+ * Decide whether to record a trade delivered by a connection (call with ingest_mutex held)
+ * Aggregate trade ids of a symbol are consecutive. The owning connection's trades are recorded
+ * unless already recorded; another connection's only when they continue the recorded ones, so
+ * a connection that runs ahead never skips trades the owner has yet to deliver. The connection
+ * a symbol moves to takes over once its trades overlap the owner's.
+ * Returns 1 to record the trade, 0 to drop it
+ */
+int accept_trade(symbol_data_t *symbol, int64_t trade_id, int shard) {
+    int owner = atomic_load_explicit(&symbol->owner_shard, memory_order_relaxed);
     
-    // Copy symbol names to shared memory
-    for (size_t i = 0; i < symbol_count; i++) {
-        strncpy(shm_header->symbols[i], symbols[i].name, MAX_SYMBOL_LENGTH - 1);
-        shm_header->symbols[i][MAX_SYMBOL_LENGTH - 1] = '\0';
+    if (shard != owner && shard == atomic_load_explicit(&symbol->target_shard, memory_order_relaxed) &&
+        trade_id <= symbol->last_trade_id + 1) {
+        atomic_store(&symbol->owner_shard, shard);
+        owner = shard;
     }
     
-    printf("Shared memory initialized at /binance_market_data (%d MB, %zu MB per symbol)\n", 
-           SHM_SIZE / (1024 * 1024), shm_header->buffer_size / (1024 * 1024));
+    if (trade_id <= symbol->last_trade_id ||
+        (shard != owner && trade_id != symbol->last_trade_id + 1)) {
+        return 0;
+    }
     
-    return 0;
+    symbol->last_trade_id = trade_id;
+    return 1;
 }
 
 /**
- * Clean up shared memory
+ * Decide whether to record a kline update (call with ingest_mutex held)
+ * Updates are snapshots of the candle, so only ones newer than the last recorded are kept.
+ * Returns 1 to record the update, 0 to drop it
  */
-void cleanup_shared_memory() {
-    if (shared_memory && shared_memory != MAP_FAILED) {
-        munmap(shared_memory, SHM_SIZE);
-        shared_memory = NULL;
+int accept_kline(symbol_data_t *symbol, int64_t event_time, int64_t open_time) {
+    if (event_time < symbol->last_kline_event_time ||
+        (event_time == symbol->last_kline_event_time && open_time <= symbol->last_kline_open_time)) {
+        return 0;
     }
     
-    if (shm_fd != -1) {
-        close(shm_fd);
-        shm_unlink("/binance_market_data");
-        shm_fd = -1;
+    symbol->last_kline_event_time = event_time;
+    symbol->last_kline_open_time = open_time;
+    return 1;
+}
+
+/**
+ * Handle a depth update delivered by a connection
+ */
+void handle_depth(json_object *root, const char *symbol, int shard) {
+    int symbol_idx = find_symbol(symbol);
+    if (symbol_idx == -1) {
+        return;
+    }
+    
+    depth_update_t update;
+    if (parse_depth(root, &update) == 0) {
+        PROBE_PARSE_DONE(shard, symbol_idx, DATA_TYPE_DEPTH, update.event_time, update.update_id);
+        record_depth(symbol_idx, &update, shard);
+        free(update.levels);
     }
 }
 
 /**
- * Update shared memory with latest data
+ * Extract a depth update: its first, final and previous final update ids ("U", "u", "pu") and
+ * its level records ("b" and "a" arrays of [price, quantity])
+ * Returns 0 on success (update->levels is allocated, NULL if there are none), -1 if the message is not a depth update
  */
-void update_shared_memory() {
-    if (!shm_header) return;
+int parse_depth(json_object *root, depth_update_t *update) {
+    json_object *obj;
     
-    // Update last update time
-    time_t now = time(NULL);
-    atomic_store(&shm_header->last_update_time, now);
+    if (!json_object_object_get_ex(root, "u", &obj)) {
+        fprintf(stderr, "Failed to find update id in depth message\n");
+        return -1;
+    }
+    update->update_id = json_object_get_int64(obj);
+    update->first_update_id = json_object_object_get_ex(root, "U", &obj) ? json_object_get_int64(obj) :
+                              update->update_id;
+    update->prev_update_id = json_object_object_get_ex(root, "pu", &obj) ? json_object_get_int64(obj) : -1;
+    update->event_time = json_object_object_get_ex(root, "E", &obj) ? json_object_get_int64(obj) : 0;
     
-    // Check if we need to update the data (avoid too frequent updates)
-    if (now - last_update_time < 1) {
-        return;
+    return parse_depth_levels(root, "b", "a", update);
+}
+
+/**
+ * Extract the level records of a depth update or snapshot from its bid and ask arrays of
+ * [price, quantity], stamped with its event time and final update id
+ * Returns 0 on success (update->levels is allocated, NULL if there are none), -1 on allocation failure
+ */
+int parse_depth_levels(json_object *root, const char *bids_key, const char *asks_key, depth_update_t *update) {
+    json_object *sides[2];
+    size_t lengths[2] = { 0, 0 };
+    
+    for (int s = 0; s < 2; s++) {
+        if (json_object_object_get_ex(root, s == 0 ? bids_key : asks_key, &sides[s]) &&
+            json_object_is_type(sides[s], json_type_array)) {
+            lengths[s] = json_object_array_length(sides[s]);
+        }
+    }
+    
+    update->count = 0;
+    update->levels = NULL;
+    if (lengths[0] + lengths[1] == 0) {
+        return 0;
+    }
+    update->levels = malloc((lengths[0] + lengths[1]) * sizeof(book_level_record_t));
+    if (!update->levels) {
+        return -1;
+    }
+    
+    for (int s = 0; s < 2; s++) {
+        for (size_t i = 0; i < lengths[s]; i++) {
+            json_object *level = json_object_array_get_idx(sides[s], i);
+            if (!json_object_is_type(level, json_type_array) || json_object_array_length(level) < 2) {
+                continue;
+            }
+            
+            book_level_record_t *record = &update->levels[update->count++];
+            record->event_time = update->event_time;
+            record->update_id = update->update_id;
+            record->price = json_object_get_double(json_object_array_get_idx(level, 0));
+            record->quantity = json_object_get_double(json_object_array_get_idx(level, 1));
+            record->side = s == 0 ? BOOK_SIDE_BID : BOOK_SIDE_ASK;
+            record->flags = 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Record a depth update of a symbol delivered by a connection
+ * Once the symbol's book is seeded by a snapshot, the update's levels go to the persist queue,
+ * flagged with where the update starts and ends. Until then (at the start of the stream and
+ * after updates were missed) updates are held back for sync_depth().
+ */
+void record_depth(int symbol_idx, const depth_update_t *update, int shard) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    int gap;
+    
+    // While the symbol moves between connections both deliver it; record each update once
+    pthread_mutex_lock(&symbol->ingest_mutex);
+    int64_t last_update_id = symbol->last_depth_update_id;
+    if (!accept_depth(symbol, update->update_id, update->prev_update_id, shard, &gap)) {
+        pthread_mutex_unlock(&symbol->ingest_mutex);
+        return;
+    }
+    
+    if (gap || last_update_id < 0) {
+        // The chain starts or breaks: the recorded book restarts empty until a new snapshot
+        if (symbol->depth_synced) {
+            fprintf(stderr, "Warning: Depth updates of %s missed before update %lld; its book waits for a snapshot\n",
+                    symbol->name, (long long)update->update_id);
+            
+            persist_entry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.event_time = update->event_time;
+            entry.record.level.event_time = update->event_time;
+            entry.record.level.update_id = update->update_id;
+            entry.record.level.side = BOOK_SIDE_BID;
+            entry.record.level.flags = BOOK_LEVEL_FIRST | BOOK_LEVEL_LAST | BOOK_LEVEL_GAP;
+            queue_record(symbol, DATA_TYPE_DEPTH, &entry);
+        }
+        restart_depth_sync(symbol);
+    }
+    
+    if (symbol->depth_synced) {
+        queue_depth_levels(symbol_idx, update, 0);
+    } else if (hold_depth_update(symbol, update) == 0) {
+        sync_depth(symbol_idx);
+    } else {
+        fprintf(stderr, "Error: Failed to hold back a depth update of %s\n", symbol->name);
+        restart_depth_sync(symbol);
+    }
+    
+    pthread_mutex_unlock(&symbol->ingest_mutex);
+}
+
+/**
+ * Decide whether to record a depth update (call with ingest_mutex held)
+ * Each update names the final update id of the one before it, so a broken chain means updates
+ * were missed. The owning connection's updates are recorded unless already recorded (a gap
+ * restarts the book); another connection's only when they continue the recorded ones.
+ * Returns 1 to record the update (*gap set if updates were missed), 0 to drop it
+ */
+int accept_depth(symbol_data_t *symbol, int64_t update_id, int64_t prev_update_id, int shard, int *gap) {
+    int owner = atomic_load_explicit(&symbol->owner_shard, memory_order_relaxed);
+    
+    *gap = symbol->last_depth_update_id >= 0 && prev_update_id != symbol->last_depth_update_id;
+    if (update_id <= symbol->last_depth_update_id || (shard != owner && *gap)) {
+        return 0;
+    }
+    
+    symbol->last_depth_update_id = update_id;
+    return 1;
+}
+
+/**
+ * Queue the levels of a depth update or snapshot for the depth file (call with ingest_mutex held)
+ * Every level is flagged with flags, and with where the update starts and ends; the first one
+ * also restarts the book if flags include BOOK_LEVEL_SNAPSHOT.
+ */
+void queue_depth_levels(int symbol_idx, const depth_update_t *update, uint8_t flags) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    
+    for (size_t i = 0; i < update->count; i++) {
+        persist_entry_t entry;
+        entry.event_time = update->levels[i].event_time;
+        entry.record.level = update->levels[i];
+        entry.record.level.flags = flags | (i == 0 ? BOOK_LEVEL_FIRST : 0) |
+                                   (i == update->count - 1 ? BOOK_LEVEL_LAST : 0);
+        if (i == 0 && (flags & BOOK_LEVEL_SNAPSHOT)) {
+            entry.record.level.flags |= BOOK_LEVEL_GAP;
+        }
+        queue_record(symbol, DATA_TYPE_DEPTH, &entry);
+    }
+    
+    // Update statistics (counters of this thread)
+    if (!(flags & BOOK_LEVEL_SNAPSHOT)) {
+        thread_counters_t *counters = own_counters();
+        count_events(counters, &counters->depth_updates[symbol_idx], 1);
+        count_events(counters, &counters->depth_levels[symbol_idx], update->count);
+    }
+}
+
+/**
+ * Stop recording a symbol's depth updates until a new snapshot is applied, dropping the
+ * updates held back and the snapshot waiting for them (call with ingest_mutex held)
+ */
+void restart_depth_sync(symbol_data_t *symbol) {
+    for (size_t i = 0; i < symbol->depth_backlog_count; i++) {
+        free(symbol->depth_backlog[(symbol->depth_backlog_start + i) % DEPTH_BACKLOG_UPDATES].levels);
+    }
+    symbol->depth_backlog_start = 0;
+    symbol->depth_backlog_count = 0;
+    free(symbol->depth_snapshot.levels);
+    symbol->depth_snapshot.levels = NULL;
+    symbol->depth_synced = 0;
+    atomic_store(&symbol->depth_snapshot_wanted, 1);
+}
+
+/**
+ * Hold back a copy of a depth update until a snapshot covers it (call with ingest_mutex held)
+ * A full backlog drops its oldest update; the snapshot then has to be newer than that one.
+ * Returns 0 on success, -1 on allocation failure
+ */
+int hold_depth_update(symbol_data_t *symbol, const depth_update_t *update) {
+    if (!symbol->depth_backlog) {
+        symbol->depth_backlog = calloc(DEPTH_BACKLOG_UPDATES, sizeof(depth_update_t));
+        if (!symbol->depth_backlog) {
+            return -1;
+        }
+    }
+    
+    depth_update_t copy = *update;
+    copy.levels = NULL;
+    if (update->count > 0) {
+        copy.levels = malloc(update->count * sizeof(book_level_record_t));
+        if (!copy.levels) {
+            return -1;
+        }
+        memcpy(copy.levels, update->levels, update->count * sizeof(book_level_record_t));
+    }
+    
+    if (symbol->depth_backlog_count == DEPTH_BACKLOG_UPDATES) {
+        free(symbol->depth_backlog[symbol->depth_backlog_start].levels);
+        symbol->depth_backlog_start = (symbol->depth_backlog_start + 1) % DEPTH_BACKLOG_UPDATES;
+        symbol->depth_backlog_count--;
+    }
+    size_t slot = (symbol->depth_backlog_start + symbol->depth_backlog_count) % DEPTH_BACKLOG_UPDATES;
+    symbol->depth_backlog[slot] = copy;
+    symbol->depth_backlog_count++;
+    return 0;
+}
+
+/**
+ * Seed a symbol's recorded book from its snapshot once the held-back updates reach it, as
+ * Binance documents for a local book (call with ingest_mutex held): updates with a final id
+ * below the snapshot's lastUpdateId are dropped, the first one left must cover lastUpdateId,
+ * and the snapshot is recorded (flagged BOOK_LEVEL_GAP and BOOK_LEVEL_SNAPSHOT) followed by
+ * that update and the ones after it. A snapshot older than the first update left is dropped
+ * for a newer one.
+ */
+void sync_depth(int symbol_idx) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    depth_update_t *snapshot = &symbol->depth_snapshot;
+    
+    if (!snapshot->levels) {
+        return;
+    }
+    while (symbol->depth_backlog_count > 0 &&
+           symbol->depth_backlog[symbol->depth_backlog_start].update_id < snapshot->update_id) {
+        free(symbol->depth_backlog[symbol->depth_backlog_start].levels);
+        symbol->depth_backlog_start = (symbol->depth_backlog_start + 1) % DEPTH_BACKLOG_UPDATES;
+        symbol->depth_backlog_count--;
+    }
+    if (symbol->depth_backlog_count == 0) {
+        return;
+    }
+    
+    if (symbol->depth_backlog[symbol->depth_backlog_start].first_update_id > snapshot->update_id) {
+        fprintf(stderr, "Warning: Depth snapshot of %s (update %lld) predates its held-back updates; asking again\n",
+                symbol->name, (long long)snapshot->update_id);
+        free(snapshot->levels);
+        snapshot->levels = NULL;
+        atomic_store(&symbol->depth_snapshot_wanted, 1);
+        return;
+    }
+    
+    queue_depth_levels(symbol_idx, snapshot, BOOK_LEVEL_SNAPSHOT);
+    printf("Order book of %s seeded from a snapshot at update %lld (%zu levels)\n", symbol->name,
+           (long long)snapshot->update_id, snapshot->count);
+    free(snapshot->levels);
+    snapshot->levels = NULL;
+    
+    for (size_t i = 0; i < symbol->depth_backlog_count; i++) {
+        depth_update_t *update = &symbol->depth_backlog[(symbol->depth_backlog_start + i) % DEPTH_BACKLOG_UPDATES];
+        queue_depth_levels(symbol_idx, update, 0);
+        free(update->levels);
+    }
+    symbol->depth_backlog_start = 0;
+    symbol->depth_backlog_count = 0;
+    symbol->depth_synced = 1;
+}
+
+/**
+ * Initialize shared memory
+ * Returns 0 on success, -1 on failure
+ */
+int init_shared_memory() {
+    // Create/open shared memory
+    shm_fd = shm_open("/binance_market_data", O_CREAT | O_RDWR, 0666);
+    if (shm_fd == -1) {
+        perror("shm_open failed");
+        return -1;
+    }
+    
+    // Set the size of the shared memory
+    if (ftruncate(shm_fd, SHM_SIZE) == -1) {
+        perror("ftruncate failed");
+        close(shm_fd);
+        shm_unlink("/binance_market_data");
+        return -1;
+    }
+    
+    // Map the shared memory
+    shared_memory = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shared_memory == MAP_FAILED) {
+        perror("mmap failed");
+        close(shm_fd);
+        shm_unlink("/binance_market_data");
+        return -1;
+    }
+    
+    // Bind the segment to the ingestion node before any page is touched
+    if (numa_node >= 0 && bind_memory_to_node(shared_memory, SHM_SIZE, numa_node) != 0) {
+        fprintf(stderr, "Warning: Shared memory is not bound to NUMA node %d\n", numa_node);
+    }
+    
+    // Initialize the shared memory header
+    shm_header = (shared_memory_header_t *)shared_memory;
+    atomic_init(&shm_header->write_counter, 0);
+    atomic_init(&shm_header->last_update_time, time(NULL));
+    atomic_init(&shm_header->notify_seq, 0);
+    atomic_init(&shm_header->notify_armed, 0);
+    
+    // Calibrate the receive clock before any frame is stamped; the exchange clock is estimated later
+    memset(&shm_header->clock, 0, sizeof(shm_header->clock));
+    clock_calibrate(&shm_header->clock);
+    memset(&shm_header->exchange_clock, 0, sizeof(shm_header->exchange_clock));
+    
+    shm_header->data_offset = sizeof(shared_memory_header_t);
+    shm_header->buffer_size = (SHM_SIZE - shm_header->data_offset) / MAX_SYMBOLS & ~(size_t)(SHM_BUFFER_ALIGN - 1);
+    shm_header->symbol_count = symbol_count;
+    
+    // Live rings follow the snapshot area in each symbol's buffer
+    shm_header->trade_ring_offset = SHM_SNAPSHOT_SIZE;
+    shm_header->kline_ring_offset = shm_header->trade_ring_offset + sizeof(shm_ring_t) +
+                                    SHM_TRADE_RING_SLOTS * sizeof(shm_slot_t);
+    if (shm_header->kline_ring_offset + sizeof(shm_ring_t) + SHM_KLINE_RING_SLOTS * sizeof(shm_slot_t) >
+        shm_header->buffer_size) {
+        fprintf(stderr, "Error: Live rings do not fit in the shared memory buffer of a symbol\n");
+        shm_header = NULL;
+        cleanup_shared_memory();
+        return -1;
+    }
+    
+    // Consumers locate the data files of this run from here
+    shm_header->run_id = run_id;
+    if (!realpath(output_dir, shm_header->output_dir)) {
+        strncpy(shm_header->output_dir, output_dir, PATH_MAX - 1);
+        shm_header->output_dir[PATH_MAX - 1] = '\0';
+    }
+    
+    // Copy symbol names to shared memory
+    for (size_t i = 0; i < symbol_count; i++) {
+        strncpy(shm_header->symbols[i], symbols[i].name, MAX_SYMBOL_LENGTH - 1);
+        shm_header->symbols[i][MAX_SYMBOL_LENGTH - 1] = '\0';
+    }
+    
+    // Tell consumers which node owns each symbol's buffer
+    for (size_t i = 0; i < MAX_SYMBOLS; i++) {
+        shm_header->numa_node[i] = i < symbol_count ? numa_node : -1;
+        atomic_init(&shm_header->persisted_trades[i], 0);
+        atomic_init(&shm_header->persisted_klines[i], 0);
     }
-    last_update_time = now;
     
-    // Update data for each symbol
+    for (size_t i = 0; i < symbol_count; i++) {
+        char *buffer = (char *)shared_memory + shm_header->data_offset + i * shm_header->buffer_size;
+        shm_ring_t *rings[2] = { (shm_ring_t *)(buffer + shm_header->trade_ring_offset),
+                                 (shm_ring_t *)(buffer + shm_header->kline_ring_offset) };
+        uint64_t capacities[2] = { SHM_TRADE_RING_SLOTS, SHM_KLINE_RING_SLOTS };
+        
+        for (int r = 0; r < 2; r++) {
+            assert(((uintptr_t)rings[r] & (SHM_BUFFER_ALIGN - 1)) == 0);
+            atomic_init(&rings[r]->published, 0);
+            rings[r]->capacity = capacities[r];
+            for (uint64_t s = 0; s < capacities[r]; s++) {
+                atomic_init(&rings[r]->slots[s].sequence, SHM_SLOT_BUSY);
+            }
+        }
+        
+        symbols[i].trade_ring = rings[0];
+        symbols[i].kline_ring = rings[1];
+    }
+    
+    printf("Shared memory initialized at /binance_market_data (%d MB, %zu MB per symbol)\n", 
+           SHM_SIZE / (1024 * 1024), shm_header->buffer_size / (1024 * 1024));
+    
+    return 0;
+}
+
+/**
+ * Clean up shared memory
+ */
+void cleanup_shared_memory() {
+    if (shared_memory && shared_memory != MAP_FAILED) {
+        munmap(shared_memory, SHM_SIZE);
+        shared_memory = NULL;
+    }
+    
+    if (shm_fd != -1) {
+        close(shm_fd);
+        shm_unlink("/binance_market_data");
+        shm_fd = -1;
+    }
+}
+
+/**
+ * Publish a record to a live ring
+ * The slot is marked busy while it is rewritten, so a reader that copies it concurrently sees
+ * the sequence change and knows it was overrun.
+ */
+void publish_record(shm_ring_t *ring, const message_header_t *header, const void *record, size_t size) {
+    uint64_t sequence = header->sequence;
+    shm_slot_t *slot = &ring->slots[sequence & (ring->capacity - 1)];
+    
+    atomic_store_explicit(&slot->sequence, SHM_SLOT_BUSY, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    slot->header = *header;
+    memcpy(&slot->record, record, size);
+    
+    atomic_store_explicit(&slot->sequence, sequence, memory_order_release);
+    atomic_store_explicit(&ring->published, sequence + 1, memory_order_release);
+    
+    // Order the publish before the check of notify_armed, as shm_notify_arm() orders arming
+    // before its check of published; one side then sees the other, so no wake is missed
+    atomic_thread_fence(memory_order_seq_cst);
+    
+    // Wake waiting readers; only the first publish after a reader armed pays for the syscall
+    if (atomic_load_explicit(&shm_header->notify_armed, memory_order_relaxed) &&
+        atomic_exchange_explicit(&shm_header->notify_armed, 0, memory_order_acq_rel)) {
+        atomic_fetch_add_explicit(&shm_header->notify_seq, 1, memory_order_release);
+        syscall(SYS_futex, &shm_header->notify_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Update shared memory with latest data
+ */
+void update_shared_memory() {
+    if (!shm_header) return;
+    
+    // Update last update time
+    time_t now = time(NULL);
+    atomic_store(&shm_header->last_update_time, now);
+    
+    // Check if we need to update the data (avoid too frequent updates)
+    if (now - last_update_time < 1) {
+        return;
+    }
+    last_update_time = now;
+    
+    // Update data for each symbol
     for (size_t i = 0; i < symbol_count; i++) {
         // Calculate offset for this symbol in shared memory
         size_t symbol_offset = shm_header->data_offset + i * shm_header->buffer_size;
@@ -507,11 +1528,11 @@ void update_shared_memory() {
         
         size_t total_data_size = trade_data_size + kline_data_size;
         
-        // Check if we have enough space in shared memory
-        if (total_data_size > shm_header->buffer_size - sizeof(size_t)) {
+        // Check if we have enough space in the snapshot area
+        if (total_data_size > SHM_SNAPSHOT_SIZE - sizeof(size_t)) {
             fprintf(stderr, "Warning: Not enough space in shared memory for symbol %s data\n", 
                    symbols[i].name);
-            total_data_size = shm_header->buffer_size - sizeof(size_t);
+            total_data_size = SHM_SNAPSHOT_SIZE - sizeof(size_t);
         }
         
         // Write the total data size at the beginning of the symbol's area
@@ -554,43 +1575,2472 @@ void update_shared_memory() {
         size_t klines_to_write = symbols[i].recent_data.klines.count;
         size_t kline_bytes = klines_to_write * (sizeof(message_header_t) + sizeof(kline_record_t));
         
-        if (kline_bytes > remaining_space) {
-            klines_to_write = remaining_space / (sizeof(message_header_t) + sizeof(kline_record_t));
-            kline_bytes = klines_to_write * (sizeof(message_header_t) + sizeof(kline_record_t));
+        if (kline_bytes > remaining_space) {
+            klines_to_write = remaining_space / (sizeof(message_header_t) + sizeof(kline_record_t));
+            kline_bytes = klines_to_write * (sizeof(message_header_t) + sizeof(kline_record_t));
+        }
+        
+        // Write klines in chronological order (oldest to newest)
+        start_idx = symbols[i].recent_data.klines.count >= MAX_RECORDS_PER_SYMBOL ?
+                  symbols[i].recent_data.klines.next_index : 0;
+        
+        for (size_t j = 0; j < klines_to_write; j++) {
+            size_t idx = (start_idx + j) % MAX_RECORDS_PER_SYMBOL;
+            
+            // Write header
+            memcpy((char *)shared_memory + current_offset, 
+                   &symbols[i].recent_data.klines.headers[idx], 
+                   sizeof(message_header_t));
+            current_offset += sizeof(message_header_t);
+            
+            // Write kline record
+            memcpy((char *)shared_memory + current_offset, 
+                   &symbols[i].recent_data.klines.records[idx], 
+                   sizeof(kline_record_t));
+            current_offset += sizeof(kline_record_t);
+        }
+        
+        pthread_mutex_unlock(&symbols[i].mutex);
+    }
+    
+    // Increment write counter
+    atomic_fetch_add(&shm_header->write_counter, 1);
+}
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
+
+/**
+ * Look up the NUMA node of a CPU from sysfs
+ * Returns the node number, or -1 if it cannot be determined
+ */
+int numa_node_of_cpu(int cpu) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    // The CPU directory contains a "nodeN" link for its node
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+/**
+ * Look up the NUMA node a network interface is attached to
+ * Returns the node number, or -1 if it cannot be determined
+ */
+int numa_node_of_nic(const char *ifname) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    int node = -1;
+    if (fscanf(file, "%d", &node) != 1) {
+        node = -1;
+    }
+
+    fclose(file);
+    return node;
+}
+
+/**
+ * Fill a CPU set with the CPUs of a NUMA node (parses the sysfs cpulist, e.g. "0-7,16-23")
+ * Returns the number of CPUs found, or -1 on failure
+ */
+int numa_node_cpuset(int node, cpu_set_t *set) {
+    char path[PATH_MAX];
+    char list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    if (!fgets(list, sizeof(list), file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    CPU_ZERO(set);
+    char *token, *str = list;
+    while ((token = strsep(&str, ",\n"))) {
+        int first, last;
+        if (sscanf(token, "%d-%d", &first, &last) == 2) {
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, set);
+            }
+        } else if (sscanf(token, "%d", &first) == 1 && first < CPU_SETSIZE) {
+            CPU_SET(first, set);
+        }
+    }
+
+    return CPU_COUNT(set);
+}
+
+/**
+ * Bind a memory range to a NUMA node, migrating any pages already faulted in
+ * Returns 0 on success, -1 on failure
+ */
+int bind_memory_to_node(void *addr, size_t len, int node) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page_size - 1);
+    size_t span = ((uintptr_t)addr + len) - start;
+    unsigned long nodemask = 1UL << node;
+
+    if (syscall(SYS_mbind, (void *)start, span, MPOL_BIND, &nodemask,
+                sizeof(nodemask) * 8, MPOL_MF_MOVE) != 0) {
+        perror("mbind failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Place the receive thread and ingestion memory on one NUMA node
+ * The node is taken from the pinned receive CPU, or from the NIC if no CPU is given.
+ * Must run before data files and shared memory are created so their pages land on the node.
+ * Returns 0 on success (or if no placement was requested), -1 on failure
+ */
+int init_numa_placement() {
+    if (receive_cpu < 0 && !nic_name) {
+        return 0;
+    }
+
+    int cpu_node = receive_cpu >= 0 ? numa_node_of_cpu(receive_cpu) : -1;
+    int nic_node = nic_name ? numa_node_of_nic(nic_name) : -1;
+
+    if (receive_cpu >= 0 && cpu_node < 0) {
+        fprintf(stderr, "Warning: Could not determine NUMA node of CPU %d\n", receive_cpu);
+    }
+    if (nic_name && nic_node < 0) {
+        fprintf(stderr, "Warning: Could not determine NUMA node of NIC %s\n", nic_name);
+    }
+    if (cpu_node >= 0 && nic_node >= 0 && cpu_node != nic_node) {
+        fprintf(stderr, "Warning: CPU %d is on node %d but NIC %s is on node %d; "
+                "frames will cross sockets\n", receive_cpu, cpu_node, nic_name, nic_node);
+    }
+
+    numa_node = cpu_node >= 0 ? cpu_node : nic_node;
+
+    // Pin the receive (main) thread
+    if (receive_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(receive_cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            fprintf(stderr, "Error: Failed to pin receive thread to CPU %d\n", receive_cpu);
+            return -1;
+        }
+    }
+
+    if (numa_node < 0 || numa_node >= (int)(sizeof(unsigned long) * 8)) {
+        numa_node = -1;
+        return 0;
+    }
+
+    // Prefer the node for everything this thread (and the threads it creates) allocates,
+    // which covers stdio buffers and libwebsockets/json-c allocations
+    unsigned long nodemask = 1UL << numa_node;
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8) != 0) {
+        perror("set_mempolicy failed");
+        return -1;
+    }
+
+    // Strictly bind the per-symbol state touched on every message
+    if (bind_memory_to_node(symbols, sizeof(symbols), numa_node) != 0) {
+        return -1;
+    }
+
+    // Helper threads run on the node's other CPUs so they never contend with the receive thread
+    if (numa_node_cpuset(numa_node, &helper_cpus) <= 0) {
+        CPU_ZERO(&helper_cpus);
+    } else if (receive_cpu >= 0 && CPU_COUNT(&helper_cpus) > 1) {
+        CPU_CLR(receive_cpu, &helper_cpus);
+    }
+
+    printf("NUMA placement: node %d (receive CPU: %d, NIC: %s)\n",
+           numa_node, receive_cpu, nic_name ? nic_name : "n/a");
+
+    return 0;
+}
+
+/**
+ * Create a helper thread, restricted to the ingestion NUMA node when placement is active
+ * Returns 0 on success, non-zero on failure
+ */
+int create_helper_thread(pthread_t *thread, void *(*func)(void *), void *arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (numa_node >= 0 && CPU_COUNT(&helper_cpus) > 0) {
+        pthread_attr_setaffinity_np(&attr, sizeof(helper_cpus), &helper_cpus);
+    }
+
+    int ret = pthread_create(thread, &attr, func, arg);
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+/**
+ * Enter latency-hardening mode: no THP, no heap trimming, all memory locked
+ * Must run before data files and shared memory are created so MCL_FUTURE covers them.
+ * Returns 0 on success, -1 on failure
+ */
+int init_latency_hardening() {
+    // Without THP there is nothing for khugepaged or fault-time compaction to stall on
+    if (prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) != 0) {
+        perror("prctl(PR_SET_THP_DISABLE) failed");
+    }
+
+    // Keep freed heap memory mapped so it never has to be faulted back in
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall failed");
+        fprintf(stderr, "Hint: raise RLIMIT_MEMLOCK (ulimit -l) or grant CAP_IPC_LOCK\n");
+        return -1;
+    }
+
+    printf("Latency hardening: memory locked, THP disabled\n");
+    return 0;
+}
+
+/**
+ * Pre-touch every buffer the hot threads write to, so no page is first faulted on the hot path
+ * Data file buffers and mappings are pre-touched by the segment writer as segments are opened.
+ */
+void pretouch_buffers() {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // Recent rings
+    for (size_t i = 0; i < symbol_count; i++) {
+        volatile char *ring = (volatile char *)&symbols[i].recent_data;
+        for (size_t off = 0; off < sizeof(symbols[i].recent_data); off += page_size) {
+            ring[off] = ring[off];
+        }
+    }
+
+    // Parse worker frame queue
+    if (parse_slots) {
+        volatile char *queue = (volatile char *)parse_slots;
+        for (size_t off = 0; off < PARSE_RING_SLOTS * sizeof(parse_slot_t); off += page_size) {
+            queue[off] = queue[off];
+        }
+    }
+    
+    // Shared memory (already initialized: the header, ring headers and slot sequences are kept)
+    if (shared_memory) {
+        volatile char *shm = (volatile char *)shared_memory;
+        for (size_t off = 0; off < SHM_SIZE; off += page_size) {
+            shm[off] = shm[off];
+        }
+    }
+}
+
+/**
+ * Fault in the calling thread's stack ahead of time
+ */
+void prefault_stack() {
+    volatile char stack[256 * 1024];
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+/**
+ * Switch the calling thread to SCHED_FIFO at the given priority
+ * Returns 0 on success, -1 on failure
+ */
+int set_realtime_priority(int priority) {
+    struct sched_param param = { .sched_priority = priority };
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        fprintf(stderr, "Warning: Failed to set SCHED_FIFO priority %d: %s\n", priority, strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read a thread's page fault and involuntary context switch counters from procfs
+ * Returns 0 on success, -1 on failure
+ */
+int read_thread_fault_stats(pid_t tid, thread_fault_stats_t *stats) {
+    char path[PATH_MAX];
+    char line[1024];
+
+    memset(stats, 0, sizeof(*stats));
+
+    // /proc/self/task/TID/stat: minflt is field 10 and majflt field 12, counted after the
+    // parenthesized command name (which may itself contain spaces)
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    if (!fgets(line, sizeof(line), file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    char *fields = strrchr(line, ')');
+    unsigned long long minflt, majflt;
+    if (!fields || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu",
+                          &minflt, &majflt) != 2) {
+        return -1;
+    }
+    stats->minor_faults = minflt;
+    stats->major_faults = majflt;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long nivcsw;
+        if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &nivcsw) == 1) {
+            stats->involuntary_switches = nivcsw;
+            break;
+        }
+    }
+    fclose(file);
+
+    return 0;
+}
+
+/**
+ * Report page faults and involuntary context switches on the hot threads since the last report
+ * The first call only records a baseline, since startup itself faults.
+ */
+void report_hot_thread_faults() {
+    static thread_fault_stats_t prev[MAX_SHARDS + 1];
+    static int have_baseline = 0;
+
+    // The receive threads of all connections, then the publish thread
+    int count = shard_count + 1;
+    char names[MAX_SHARDS + 1][16];
+    pid_t tids[MAX_SHARDS + 1];
+    thread_fault_stats_t now[MAX_SHARDS + 1];
+
+    for (int t = 0; t < count - 1; t++) {
+        snprintf(names[t], sizeof(names[t]), t == 0 ? "receive" : "receive %d", t);
+        tids[t] = atomic_load(&shards[t].tid);
+    }
+    snprintf(names[count - 1], sizeof(names[count - 1]), "publish");
+    tids[count - 1] = atomic_load(&publish_tid);
+
+    for (int t = 0; t < count; t++) {
+        if (tids[t] == 0 || read_thread_fault_stats(tids[t], &now[t]) != 0) {
+            return;
+        }
+    }
+
+    if (have_baseline) {
+        printf("Hot threads     | Minor faults | Major faults | Involuntary switches\n");
+        for (int t = 0; t < count; t++) {
+            uint64_t minflt = now[t].minor_faults - prev[t].minor_faults;
+            uint64_t majflt = now[t].major_faults - prev[t].major_faults;
+            uint64_t nivcsw = now[t].involuntary_switches - prev[t].involuntary_switches;
+
+            printf("%-16s| %-12llu | %-12llu | %llu\n", names[t],
+                   (unsigned long long)minflt, (unsigned long long)majflt, (unsigned long long)nivcsw);
+
+            if (minflt || majflt || nivcsw) {
+                fprintf(stderr, "Warning: %s thread took %llu page faults and %llu involuntary "
+                        "context switches in hardened mode\n", names[t],
+                        (unsigned long long)(minflt + majflt), (unsigned long long)nivcsw);
+            }
+        }
+    }
+
+    memcpy(prev, now, sizeof(prev));
+    have_baseline = 1;
+}
+
+/**
+ * Current wall-clock time in milliseconds (coarse clock, cheap enough for the ingest path)
+ */
+int64_t current_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Parse a durability policy: none, periodic:MS, records:N or kline-final
+ * Returns 0 on success, -1 on an invalid specification
+ */
+int parse_durability_policy(const char *spec, durability_policy_t *policy) {
+    unsigned int param;
+
+    if (strcmp(spec, "none") == 0) {
+        policy->level = DURABILITY_NONE;
+        policy->param = 0;
+    } else if (sscanf(spec, "periodic:%u", &param) == 1 && param > 0) {
+        policy->level = DURABILITY_PERIODIC;
+        policy->param = param;
+    } else if (sscanf(spec, "records:%u", &param) == 1 && param > 0) {
+        policy->level = DURABILITY_RECORDS;
+        policy->param = param;
+    } else if (strcmp(spec, "kline-final") == 0) {
+        policy->level = DURABILITY_KLINE_FINAL;
+        policy->param = 0;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Account for records handed to the kernel and wake the sync thread if the policy calls for it
+ */
+void note_record_written(file_durability_t *durability, const durability_policy_t *policy, uint64_t count) {
+    uint64_t written = atomic_fetch_add_explicit(&durability->written, count, memory_order_release) + count;
+
+    if (policy->level == DURABILITY_NONE) {
+        return;
+    }
+
+    if (atomic_load_explicit(&durability->oldest_unsynced_ms, memory_order_relaxed) == 0) {
+        atomic_store_explicit(&durability->oldest_unsynced_ms, current_time_ms(), memory_order_relaxed);
+    }
+
+    if (policy->level == DURABILITY_RECORDS &&
+        written - atomic_load_explicit(&durability->synced, memory_order_relaxed) >= policy->param &&
+        !atomic_exchange(&durability->sync_requested, 1)) {
+        pthread_mutex_lock(&sync_mutex);
+        pthread_cond_signal(&sync_cond);
+        pthread_mutex_unlock(&sync_mutex);
+    }
+}
+
+/**
+ * Request a sync of every file of the symbol whose policy is kline-final
+ */
+void request_kline_final_sync(symbol_data_t *symbol) {
+    int requested = 0;
+
+    if (trade_durability_policy.level == DURABILITY_KLINE_FINAL) {
+        atomic_store(&symbol->trade_durability.sync_requested, 1);
+        requested = 1;
+    }
+    if (kline_durability_policy.level == DURABILITY_KLINE_FINAL) {
+        atomic_store(&symbol->kline_durability.sync_requested, 1);
+        requested = 1;
+    }
+
+    if (requested) {
+        pthread_mutex_lock(&sync_mutex);
+        pthread_cond_signal(&sync_cond);
+        pthread_mutex_unlock(&sync_mutex);
+    }
+}
+
+/**
+ * Wake the maintenance thread to write a full block of a direct data file
+ */
+void wake_block_writer(void) {
+    pthread_mutex_lock(&sync_mutex);
+    blocks_ready = 1;
+    pthread_cond_signal(&sync_cond);
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+/**
+ * Finalize rotated-out segments and sync every data file that is due under its policy
+ * (or every file with unsynced records if force is set). mmap segments also get their new
+ * appends pushed to writeback, and direct segments their full blocks written, whatever the
+ * policy. Writeback is started on all due files first and then waited for, so one commit
+ * covers the whole batch. How far each file has reached disk is published in shared memory.
+ * Returns the number of files synced
+ */
+int sync_data_files(int force) {
+    struct {
+        int fd;
+        file_durability_t *durability;
+        uint64_t target;
+    } batch[MAX_SYMBOLS * 2];
+    int batch_count = 0;
+    int64_t now_ms = current_time_ms();
+
+    for (size_t i = 0; i < symbol_count; i++) {
+        // Depth, book and index files are maintained like the others but follow no durability policy
+        data_file_t *files[5] = { symbols[i].trade_file, symbols[i].kline_file, symbols[i].depth_file,
+                                  symbols[i].book_file, symbols[i].book_index_file };
+        file_durability_t *durability[2] = { &symbols[i].trade_durability, &symbols[i].kline_durability };
+        const durability_policy_t *policies[2] = { &trade_durability_policy, &kline_durability_policy };
+        atomic_uint_fast64_t *persisted[2] = { NULL, NULL };
+        if (shm_header) {
+            persisted[0] = &shm_header->persisted_trades[i];
+            persisted[1] = &shm_header->persisted_klines[i];
+        }
+
+        for (int f = 0; f < 5; f++) {
+            if (!files[f]) {
+                continue;
+            }
+
+            // Records counted as written up to here are in this segment or an older one
+            uint64_t written = f < 2 ? atomic_load_explicit(&durability[f]->written, memory_order_acquire) : 0;
+            segment_t *segment = atomic_load_explicit(&files[f]->current, memory_order_acquire);
+            if (!segment) {
+                continue;
+            }
+
+            // Older segments are synced as they are finalized (sync_on_retire follows the policy)
+            data_file_reap(files[f], segment);
+
+            if (files[f]->mode == WRITER_DIRECT) {
+                segment_write_blocks(files[f], segment);
+            }
+
+            size_t end = segment_flushed_end(files[f], segment);
+            if (files[f]->mode == WRITER_MMAP && end > segment->writeback_end) {
+                sync_file_range(segment->fd, segment->writeback_end, end - segment->writeback_end,
+                                SYNC_FILE_RANGE_WRITE);
+                segment->writeback_end = end;
+            }
+
+            // Records appended to a newer segment after we looked are not covered by this pass
+            uint64_t segment_records = segment->base_sequence + 
+                                       (end - segment->data_offset) / files[f]->record_size;
+            if (f >= 2) {
+                continue;
+            }
+            if (persisted[f]) {
+                atomic_store_explicit(persisted[f], segment_records, memory_order_release);
+            }
+
+            if (policies[f]->level == DURABILITY_NONE ||
+                written == atomic_load(&durability[f]->synced)) {
+                continue;
+            }
+
+            int due = force || atomic_exchange(&durability[f]->sync_requested, 0);
+            if (policies[f]->level == DURABILITY_PERIODIC &&
+                now_ms - durability[f]->last_sync_ms >= policies[f]->param) {
+                due = 1;
+            }
+            if (!due) {
+                continue;
+            }
+
+            batch[batch_count].fd = segment->fd;
+            batch[batch_count].durability = durability[f];
+            batch[batch_count].target = written < segment_records ? written : segment_records;
+
+            // Start writeback without waiting for it
+            sync_file_range(batch[batch_count].fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            batch_count++;
+        }
+    }
+
+    for (int b = 0; b < batch_count; b++) {
+        file_durability_t *durability = batch[b].durability;
+
+        if (fdatasync(batch[b].fd) != 0) {
+            perror("fdatasync failed");
+            continue;
+        }
+
+        atomic_store(&durability->synced, batch[b].target);
+        durability->last_sync_ms = now_ms;
+
+        // Records written while we synced keep the lag clock running from now
+        if (atomic_load(&durability->written) == batch[b].target) {
+            atomic_store(&durability->oldest_unsynced_ms, 0);
+        } else {
+            atomic_store(&durability->oldest_unsynced_ms, now_ms);
+        }
+    }
+
+    return batch_count;
+}
+
+/**
+ * Thread function maintaining data files: applies the durability policies, finalizes
+ * rotated-out segments, drives writeback of mmap segments and writes full direct blocks
+ * Wakes on requests from the ingest path and at the shortest periodic interval.
+ */
+void *sync_thread_func(void *arg) {
+    uint32_t interval_ms = 1000;
+
+    if (trade_durability_policy.level == DURABILITY_PERIODIC && trade_durability_policy.param < interval_ms) {
+        interval_ms = trade_durability_policy.param;
+    }
+    if (kline_durability_policy.level == DURABILITY_PERIODIC && kline_durability_policy.param < interval_ms) {
+        interval_ms = kline_durability_policy.param;
+    }
+
+    while (!force_exit) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval_ms / 1000;
+        deadline.tv_nsec += (long)(interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&sync_mutex);
+        if (!blocks_ready) {
+            pthread_cond_timedwait(&sync_cond, &sync_mutex, &deadline);
+        }
+        blocks_ready = 0;
+        pthread_mutex_unlock(&sync_mutex);
+
+        sync_data_files(0);
+    }
+
+    return NULL;
+}
+
+/**
+ * Allocate and open a segmented data file for one symbol and record type
+ * Returns 0 on success, -1 on failure
+ */
+int open_data_file(data_file_t **file, data_type_t type, const char *dir, const char *symbol,
+                   const durability_policy_t *policy) {
+    *file = calloc(1, sizeof(data_file_t));
+    if (!*file) {
+        return -1;
+    }
+
+    (*file)->stdio_buffer_size = harden_mode ? FILE_BUFFER_SIZE : 0;
+    (*file)->pretouch = harden_mode;
+    (*file)->sync_on_retire = policy->level != DURABILITY_NONE;
+    (*file)->wake_writer = wake_block_writer;
+    (*file)->catalog = catalog.fd != -1 ? &catalog : NULL;
+
+    return data_file_open(*file, writer_mode, type, dir, symbol, run_id, segment_size);
+}
+
+/**
+ * Create a connection's context and open it with the streams of the symbols it owns
+ * Returns 0 on success, -1 on failure
+ */
+int connect_shard(shard_t *shard, const char *host) {
+    struct lws_context_creation_info info;
+    struct lws_client_connect_info ccinfo;
+    
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = protocols;
+    info.gid = -1;
+    info.uid = -1;
+    info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    info.user = shard;          // ws_callback() finds the connection through its context
+    
+    shard->context = lws_create_context(&info);
+    if (!shard->context) {
+        fprintf(stderr, "Error: Failed to create libwebsocket context\n");
+        return -1;
+    }
+    
+    // Construct WebSocket path with the aggTrade and 1m kline streams (and depth) of each symbol
+    size_t len = snprintf(shard->path, sizeof(shard->path), "/stream?streams=");
+    const char *separator = "";
+    
+    for (size_t i = 0; i < symbol_count; i++) {
+        if (atomic_load(&symbols[i].owner_shard) != shard->id) {
+            continue;
+        }
+        
+        // Convert symbol to lowercase for Binance API
+        char lower_symbol[MAX_SYMBOL_LENGTH];
+        for (int j = 0; j < MAX_SYMBOL_LENGTH; j++) {
+            lower_symbol[j] = tolower(symbols[i].name[j]);
+        }
+        
+        len += snprintf(shard->path + len, sizeof(shard->path) - len, "%s%s@aggTrade/%s@kline_1m",
+                        separator, lower_symbol, lower_symbol);
+        if (depth_checkpoint_sec > 0 && len < sizeof(shard->path)) {
+            len += snprintf(shard->path + len, sizeof(shard->path) - len, "/%s@" DEPTH_STREAM, lower_symbol);
+        }
+        if (len >= sizeof(shard->path)) {
+            fprintf(stderr, "Error: Too many streams for connection %d\n", shard->id);
+            return -1;
+        }
+        separator = "/";
+    }
+    
+    printf("Connecting to WebSocket %d: wss://%s%s\n", shard->id, host, shard->path);
+    
+    // Connect to Binance WebSocket
+    memset(&ccinfo, 0, sizeof(ccinfo));
+    ccinfo.context = shard->context;
+    ccinfo.address = host;
+    ccinfo.port = 443;
+    ccinfo.path = shard->path;
+    ccinfo.host = ccinfo.address;
+    ccinfo.origin = ccinfo.address;
+    ccinfo.protocol = protocols[0].name;
+    ccinfo.ssl_connection = LCCSCF_USE_SSL;
+    
+    if (!lws_client_connect_via_info(&ccinfo)) {
+        fprintf(stderr, "Error: Failed to connect to Binance WebSocket\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Receive thread function of the connections after the first (which runs on the main thread)
+ */
+void *shard_thread_func(void *arg) {
+    shard_t *shard = (shard_t *)arg;
+    
+    if (harden_mode) {
+        prefault_stack();
+    }
+    if (receive_rt_priority > 0) {
+        set_realtime_priority(receive_rt_priority);
+    }
+    atomic_store(&shard->tid, (pid_t)syscall(SYS_gettid));
+    
+    // lws_service blocks in poll until there is work, so the loop does not spin
+    while (!force_exit) {
+        lws_service(shard->context, 100);
+    }
+    
+    return NULL;
+}
+
+/**
+ * Queue a SUBSCRIBE or UNSUBSCRIBE request for a symbol's streams on a connection
+ * The connection's receive thread sends it; the exchange's reply carries the returned id.
+ * Returns the request id, or -1 if the queue is full
+ */
+int queue_shard_command(shard_t *shard, const char *method, const char *symbol) {
+    char lower_symbol[MAX_SYMBOL_LENGTH];
+    for (int j = 0; j < MAX_SYMBOL_LENGTH; j++) {
+        lower_symbol[j] = tolower(symbol[j]);
+    }
+    
+    int id = atomic_fetch_add(&next_command_id, 1) + 1;
+    
+    pthread_mutex_lock(&shard->command_mutex);
+    if (shard->command_count == SHARD_MAX_COMMANDS) {
+        pthread_mutex_unlock(&shard->command_mutex);
+        return -1;
+    }
+    if (depth_checkpoint_sec > 0) {
+        snprintf(shard->commands[shard->command_count++], SHARD_COMMAND_SIZE,
+                 "{\"method\":\"%s\",\"params\":[\"%s@aggTrade\",\"%s@kline_1m\",\"%s@" DEPTH_STREAM "\"],"
+                 "\"id\":%d}", method, lower_symbol, lower_symbol, lower_symbol, id);
+    } else {
+        snprintf(shard->commands[shard->command_count++], SHARD_COMMAND_SIZE,
+                 "{\"method\":\"%s\",\"params\":[\"%s@aggTrade\",\"%s@kline_1m\"],\"id\":%d}",
+                 method, lower_symbol, lower_symbol, id);
+    }
+    pthread_mutex_unlock(&shard->command_mutex);
+    
+    // Wake the connection's service loop (ws_callback() asks for a writable callback)
+    lws_cancel_service(shard->context);
+    return id;
+}
+
+/**
+ * Balance thread function
+ * Measures each symbol's message rate and moves one symbol at a time from the busiest
+ * connection to the idlest, make-before-break: the new connection subscribes, takes over
+ * once its trades overlap the old one's (see accept_trade()), and only then does the old
+ * connection unsubscribe.
+ */
+void *balance_thread_func(void *arg) {
+    uint64_t prev_counts[MAX_SYMBOLS] = {0};
+    double alpha = (double)BALANCE_POLL_MS / (RATE_SMOOTHING_SEC * 1000);
+    int64_t last_move_ms = current_time_ms();
+    int moving = -1;            // Symbol being moved (-1 if none)
+    int from = -1, to = -1;
+    int request_id = 0;         // SUBSCRIBE request of the move
+    int64_t move_start_ms = 0;
+    uint64_t move_start_trades = 0;
+    
+    while (!force_exit) {
+        usleep(BALANCE_POLL_MS * 1000);
+        int64_t now_ms = current_time_ms();
+        
+        // Smooth the message rates
+        for (size_t i = 0; i < symbol_count; i++) {
+            uint64_t count = sum_counter(&shared_counters.trades[i]) + sum_counter(&shared_counters.klines[i]) +
+                             sum_counter(&shared_counters.depth_updates[i]);
+            double rate = (double)(count - prev_counts[i]) * 1000 / BALANCE_POLL_MS;
+            symbols[i].rate += alpha * (rate - symbols[i].rate);
+            prev_counts[i] = count;
+        }
+        
+        if (moving < 0) {
+            if (now_ms - last_move_ms < REBALANCE_INTERVAL_SEC * 1000) {
+                continue;
+            }
+            
+            moving = plan_symbol_move(&to);
+            if (moving < 0) {
+                continue;
+            }
+            
+            from = atomic_load(&symbols[moving].owner_shard);
+            atomic_store(&symbols[moving].target_shard, to);
+            request_id = queue_shard_command(&shards[to], "SUBSCRIBE", symbols[moving].name);
+            if (request_id < 0) {
+                atomic_store(&symbols[moving].target_shard, -1);
+                moving = -1;
+                continue;
+            }
+            
+            move_start_ms = last_move_ms = now_ms;
+            move_start_trades = sum_counter(&shared_counters.trades[moving]);
+            printf("Moving %s (%.1f msg/s) from connection %d to %d\n",
+                   symbols[moving].name, symbols[moving].rate, from, to);
+            continue;
+        }
+        
+        symbol_data_t *symbol = &symbols[moving];
+        int done = atomic_load(&symbol->owner_shard) == to;
+        
+        if (!done && now_ms - move_start_ms >= MIGRATION_TIMEOUT_SEC * 1000) {
+            if (atomic_load(&shards[to].acked_id) >= request_id &&
+                sum_counter(&shared_counters.trades[moving]) == move_start_trades) {
+                // A quiet symbol has no trades to overlap on, and none to lose
+                pthread_mutex_lock(&symbol->ingest_mutex);
+                atomic_store(&symbol->owner_shard, to);
+                pthread_mutex_unlock(&symbol->ingest_mutex);
+                done = 1;
+            } else {
+                fprintf(stderr, "Warning: Moving %s to connection %d timed out; it stays on %d\n",
+                        symbol->name, to, from);
+                atomic_store(&symbol->target_shard, -1);
+                queue_shard_command(&shards[to], "UNSUBSCRIBE", symbol->name);
+                moving = -1;
+                last_move_ms = now_ms;
+                continue;
+            }
+        }
+        
+        if (done) {
+            atomic_store(&symbol->target_shard, -1);
+            queue_shard_command(&shards[from], "UNSUBSCRIBE", symbol->name);
+            printf("Moved %s from connection %d to %d\n", symbol->name, from, to);
+            moving = -1;
+            last_move_ms = now_ms;
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Pick a symbol to move from the busiest connection to the idlest connected one
+ * Only a move that lowers the busiest connection's rate by REBALANCE_MIN_GAIN is worth the
+ * resubscription; a connection left with one symbol is already dedicated to it.
+ * Returns the symbol (and the connection to move it to in *to), or -1 if none is worth moving
+ */
+int plan_symbol_move(int *to) {
+    double load[MAX_SHARDS] = {0};
+    int count[MAX_SHARDS] = {0};
+    
+    for (size_t i = 0; i < symbol_count; i++) {
+        int owner = atomic_load(&symbols[i].owner_shard);
+        load[owner] += symbols[i].rate;
+        count[owner]++;
+    }
+    
+    int hi = 0, lo = -1;
+    for (size_t s = 0; s < shard_count; s++) {
+        if (load[s] > load[hi]) {
+            hi = s;
+        }
+        if (atomic_load(&shards[s].connected) && (lo < 0 || load[s] < load[lo])) {
+            lo = s;
+        }
+    }
+    if (lo < 0 || lo == hi || count[hi] < 2) {
+        return -1;
+    }
+    
+    int best = -1;
+    double best_load = load[hi] * (1 - REBALANCE_MIN_GAIN);
+    for (size_t i = 0; i < symbol_count; i++) {
+        if (atomic_load(&symbols[i].owner_shard) != hi) {
+            continue;
+        }
+        
+        // Busiest of the two connections after the move
+        double rate = symbols[i].rate;
+        double after = load[hi] - rate > load[lo] + rate ? load[hi] - rate : load[lo] + rate;
+        if (after < best_load) {
+            best = i;
+            best_load = after;
+        }
+    }
+    
+    if (best >= 0) {
+        *to = lo;
+    }
+    return best;
+}
+
+/**
+ * Allocate the frame queue and start the parse workers
+ * Returns 0 on success, -1 on failure
+ */
+int init_parse_workers() {
+    if (posix_memalign((void **)&parse_slots, 4096, PARSE_RING_SLOTS * sizeof(parse_slot_t)) != 0) {
+        parse_slots = NULL;
+        return -1;
+    }
+    memset(parse_slots, 0, PARSE_RING_SLOTS * sizeof(parse_slot_t));
+    for (size_t i = 0; i < PARSE_RING_SLOTS; i++) {
+        atomic_init(&parse_slots[i].turn, (uint32_t)i);
+    }
+    
+    parse_orders = calloc(symbol_count, sizeof(parse_order_t));
+    if (!parse_orders) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < parse_worker_count; i++) {
+        if (create_helper_thread(&parse_threads[i], parse_worker_func, NULL) != 0) {
+            return -1;
+        }
+    }
+    
+    printf("Parsing on %zu worker threads\n", parse_worker_count);
+    return 0;
+}
+
+/**
+ * Queue a frame of a collected symbol for the parse workers
+ * Queue positions and per-symbol sequences are taken under one lock, so both follow arrival
+ * order. If the workers have fallen a whole queue behind, the parse stage's overflow policy
+ * decides: the receive thread waits here, or the frame is dropped or spilled to the overflow file.
+ * Spilled frames are queued back ahead of newer ones as room frees up, so they are parsed in
+ * arrival order too.
+ * Returns 0 if queued (or shed), -1 if the frame is not a record of a collected symbol (parse it here)
+ */
+int queue_frame(const char *in, size_t len, int shard, uint64_t receive_ticks) {
+    // Records arrive as {"stream":"btcusdt@aggTrade","data":{...}}
+    static const char prefix[] = "{\"stream\":\"";
+    size_t prefix_len = sizeof(prefix) - 1;
+    if (len <= prefix_len || memcmp(in, prefix, prefix_len) != 0) {
+        return -1;
+    }
+    
+    char symbol[MAX_SYMBOL_LENGTH];
+    size_t n = 0;
+    while (n < MAX_SYMBOL_LENGTH - 1 && prefix_len + n < len && in[prefix_len + n] != '@' &&
+           in[prefix_len + n] != '"') {
+        symbol[n] = toupper(in[prefix_len + n]);
+        n++;
+    }
+    symbol[n] = '\0';
+    
+    int symbol_idx = -1;
+    for (size_t i = 0; i < symbol_count; i++) {
+        if (strcmp(symbols[i].name, symbol) == 0) {
+            symbol_idx = i;
+            break;
+        }
+    }
+    if (symbol_idx == -1) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&parse_enqueue_mutex);
+    
+    // Behind frames still spilled, this one waits its turn in the overflow file as well
+    if (atomic_load_explicit(&parse_spilling, memory_order_relaxed) && requeue_spilled_frames()) {
+        spill_frame(in, len, shard, receive_ticks, symbol_idx);
+        pthread_mutex_unlock(&parse_enqueue_mutex);
+        return 0;
+    }
+    
+    uint64_t pos = atomic_load_explicit(&parse_head, memory_order_relaxed);
+    parse_slot_t *slot = &parse_slots[pos & (PARSE_RING_SLOTS - 1)];
+    
+    // Wait until the frame a queue earlier in this slot has been committed
+    if (atomic_load_explicit(&slot->turn, memory_order_acquire) != (uint32_t)pos) {
+        if (parse_overflow == OVERFLOW_SPILL) {
+            atomic_store_explicit(&parse_spilling, 1, memory_order_relaxed);
+            fprintf(stderr, "Warning: Parse queue is full, spilling frames to its overflow file\n");
+            spill_frame(in, len, shard, receive_ticks, symbol_idx);
+            pthread_mutex_unlock(&parse_enqueue_mutex);
+            return 0;
+        }
+        if (parse_overflow == OVERFLOW_DROP) {
+            pthread_mutex_unlock(&parse_enqueue_mutex);
+            atomic_fetch_add_explicit(&frames_dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+        atomic_fetch_add_explicit(&frames_blocked, 1, memory_order_relaxed);
+        while (atomic_load_explicit(&slot->turn, memory_order_acquire) != (uint32_t)pos) {
+            sched_yield();
+        }
+    }
+    
+    char *data = slot_buffer(slot, len);
+    if (!data) {
+        pthread_mutex_unlock(&parse_enqueue_mutex);
+        return -1;
+    }
+    memcpy(data, in, len);
+    publish_slot(slot, pos, shard, receive_ticks, symbol_idx);
+    
+    pthread_mutex_unlock(&parse_enqueue_mutex);
+    return 0;
+}
+
+/**
+ * Point a free slot's data at room for a frame of len bytes (inline, or allocated if larger)
+ * Returns the buffer, NULL on allocation failure
+ */
+char *slot_buffer(parse_slot_t *slot, size_t len) {
+    slot->data = len < PARSE_FRAME_INLINE ? slot->inline_data : malloc(len + 1);
+    if (slot->data) {
+        slot->data[len] = '\0';
+    }
+    return slot->data;
+}
+
+/**
+ * Hand a filled slot at queue position pos to the workers (under parse_enqueue_mutex)
+ */
+void publish_slot(parse_slot_t *slot, uint64_t pos, int shard, uint64_t receive_ticks, int symbol_idx) {
+    slot->position = pos;
+    slot->shard = shard;
+    slot->receive_ticks = receive_ticks;
+    slot->symbol_idx = symbol_idx;
+    
+    parse_order_t *order = &parse_orders[symbol_idx];
+    slot->symbol_seq = order->next_seq++;
+    atomic_store_explicit(&order->pending[slot->symbol_seq & (PARSE_RING_SLOTS - 1)], slot,
+                          memory_order_release);
+    
+    atomic_store_explicit(&parse_head, pos + 1, memory_order_relaxed);
+    atomic_store(&slot->turn, (uint32_t)(pos + 1));
+    
+    if (atomic_load(&slot->waiting)) {
+        syscall(SYS_futex, &slot->turn, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Create the parse stage's overflow file in the output directory (unlinked, like the persist queues')
+ * Returns 0 on success, -1 on failure
+ */
+int open_parse_spill(void) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/overflow_frames_%lld.XXXXXX", output_dir, (long long)run_id);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        fprintf(stderr, "Error: Overflow file path too long in %s\n", output_dir);
+        return -1;
+    }
+    
+    parse_spill_fd = mkstemp(path);
+    if (parse_spill_fd == -1) {
+        fprintf(stderr, "Error: Failed to create overflow file in %s: %s\n", output_dir, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    return 0;
+}
+
+/**
+ * Append a frame to the parse stage's overflow file (under parse_enqueue_mutex)
+ * Retries until written: if the overflow file fails as well, the receive thread waits as under
+ * the block policy.
+ */
+void spill_frame(const char *in, size_t len, int shard, uint64_t receive_ticks, int symbol_idx) {
+    spilled_frame_t header = {
+        .len = (uint32_t)len, .shard = shard, .symbol_idx = symbol_idx, .receive_ticks = receive_ticks
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = (void *)in, .iov_len = len }
+    };
+    size_t total = sizeof(header) + len, done = 0;
+    int reported = 0;
+    
+    while (done < total) {
+        // Skip what an earlier short write already covered
+        struct iovec rest[2];
+        int count = 0;
+        size_t skip = done;
+        for (int i = 0; i < 2; i++) {
+            if (skip >= iov[i].iov_len) {
+                skip -= iov[i].iov_len;
+                continue;
+            }
+            rest[count].iov_base = (char *)iov[i].iov_base + skip;
+            rest[count].iov_len = iov[i].iov_len - skip;
+            skip = 0;
+            count++;
+        }
+        
+        ssize_t n = pwritev(parse_spill_fd, rest, count, parse_spill_written + done);
+        if (n <= 0) {
+            if (n < 0 && errno != EINTR && !reported) {
+                fprintf(stderr, "Error: Failed to write overflow file: %s\n", strerror(errno));
+                reported = 1;
+            }
+            usleep(1000);
+            continue;
+        }
+        done += n;
+    }
+    
+    parse_spill_written += total;
+    atomic_fetch_add_explicit(&frames_spilled, 1, memory_order_relaxed);
+}
+
+/**
+ * Queue spilled frames back, oldest first, into whatever slots have been freed (under parse_enqueue_mutex)
+ * Once the overflow file is empty it is truncated and frames are queued directly again.
+ * Returns 1 if spilled frames remain, 0 otherwise
+ */
+int requeue_spilled_frames(void) {
+    while (parse_spill_read < parse_spill_written) {
+        uint64_t pos = atomic_load_explicit(&parse_head, memory_order_relaxed);
+        parse_slot_t *slot = &parse_slots[pos & (PARSE_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->turn, memory_order_acquire) != (uint32_t)pos) {
+            return 1;
+        }
+        
+        spilled_frame_t header;
+        char *data = NULL;
+        if (pread(parse_spill_fd, &header, sizeof(header), parse_spill_read) != sizeof(header) ||
+            !(data = slot_buffer(slot, header.len)) ||
+            pread(parse_spill_fd, data, header.len, parse_spill_read + sizeof(header)) != (ssize_t)header.len) {
+            // Unreadable: the rest of the overflow file is lost
+            fprintf(stderr, "Error: Failed to read overflow file: %s; %llu bytes of spilled frames lost\n",
+                    data ? strerror(errno) : "out of memory",
+                    (unsigned long long)(parse_spill_written - parse_spill_read));
+            if (data && data != slot->inline_data) {
+                free(data);
+            }
+            parse_spill_read = parse_spill_written;
+            break;
+        }
+        
+        publish_slot(slot, pos, header.shard, header.receive_ticks, header.symbol_idx);
+        parse_spill_read += sizeof(header) + header.len;
+    }
+    
+    if (ftruncate(parse_spill_fd, 0) != 0) {
+        fprintf(stderr, "Warning: Failed to truncate overflow file: %s\n", strerror(errno));
+    }
+    parse_spill_read = 0;
+    parse_spill_written = 0;
+    atomic_store_explicit(&parse_spilling, 0, memory_order_relaxed);
+    fprintf(stderr, "Parse queue caught up with its overflow file\n");
+    return 0;
+}
+
+/**
+ * Queue spilled frames back from a parse worker, unless a receive thread holds the queue (it does the same)
+ */
+void try_requeue_spilled_frames(void) {
+    if (!atomic_load_explicit(&parse_spilling, memory_order_relaxed) ||
+        pthread_mutex_trylock(&parse_enqueue_mutex) != 0) {
+        return;
+    }
+    if (atomic_load_explicit(&parse_spilling, memory_order_relaxed)) {
+        requeue_spilled_frames();
+    }
+    pthread_mutex_unlock(&parse_enqueue_mutex);
+}
+
+/**
+ * Parse worker thread function
+ * Each worker claims the next queue position, waits for its frame (spinning briefly, then
+ * sleeping on the slot), parses it and commits whatever its symbol has ready in order.
+ */
+void *parse_worker_func(void *arg) {
+    if (harden_mode) {
+        prefault_stack();
+    }
+    if (receive_rt_priority > 0) {
+        set_realtime_priority(receive_rt_priority);
+    }
+    
+    for (;;) {
+        uint64_t pos = atomic_fetch_add(&parse_tail, 1);
+        parse_slot_t *slot = &parse_slots[pos & (PARSE_RING_SLOTS - 1)];
+        
+        int spins = 0;
+        uint32_t turn;
+        while ((turn = atomic_load_explicit(&slot->turn, memory_order_acquire)) != (uint32_t)(pos + 1)) {
+            // Every queued frame has a worker; those past the end are left once queueing stops
+            if (atomic_load(&parse_stop) && pos >= atomic_load(&parse_head)) {
+                return NULL;
+            }
+            if (spins < PARSE_SPIN_LIMIT) {
+                spins++;
+                _mm_pause();
+                continue;
+            }
+            
+            // Idle workers queue spilled frames back themselves (the receive threads may have gone quiet)
+            try_requeue_spilled_frames();
+            
+            atomic_store(&slot->waiting, 1);
+            if (atomic_load(&slot->turn) == turn) {
+                struct timespec timeout = { 0, 100 * 1000000 };
+                syscall(SYS_futex, &slot->turn, FUTEX_WAIT_PRIVATE, turn, &timeout, NULL, 0);
+            }
+            atomic_store(&slot->waiting, 0);
+        }
+        
+        // The slot may be committed and reused as soon as it is marked parsed
+        int symbol_idx = slot->symbol_idx;
+        parse_frame(slot);
+        atomic_store(&slot->parsed, 1);
+        commit_parsed_frames(symbol_idx);
+        
+        // Committing freed slots: let spilled frames have them before newer frames do
+        try_requeue_spilled_frames();
+    }
+}
+
+/**
+ * Parse a queued frame into its slot (type 0 if the frame holds no record)
+ */
+void parse_frame(parse_slot_t *slot) {
+    slot->type = 0;
+    
+    json_object *root = json_tokener_parse(slot->data);
+    if (!root) {
+        fprintf(stderr, "Failed to parse JSON message\n");
+        return;
+    }
+    
+    json_object *stream_obj, *data_obj;
+    if (json_object_object_get_ex(root, "stream", &stream_obj) &&
+        json_object_object_get_ex(root, "data", &data_obj)) {
+        const char *stream = json_object_get_string(stream_obj);
+        
+        if (strstr(stream, "@aggTrade")) {
+            parse_aggTrade(data_obj, &slot->record.trade);
+            slot->type = DATA_TYPE_TRADE;
+            PROBE_PARSE_DONE(slot->shard, slot->symbol_idx, DATA_TYPE_TRADE, slot->record.trade.event_time,
+                             slot->record.trade.trade_id);
+        } else if (strstr(stream, "@kline") &&
+                   parse_kline(data_obj, &slot->record.kline, &slot->event_time) == 0) {
+            slot->type = DATA_TYPE_KLINE;
+            PROBE_PARSE_DONE(slot->shard, slot->symbol_idx, DATA_TYPE_KLINE, slot->event_time,
+                             slot->record.kline.open_time);
+        } else if (strstr(stream, "@depth") &&
+                   parse_depth(data_obj, &slot->depth) == 0) {
+            slot->type = DATA_TYPE_DEPTH;
+            PROBE_PARSE_DONE(slot->shard, slot->symbol_idx, DATA_TYPE_DEPTH, slot->depth.event_time,
+                             slot->depth.update_id);
+        }
+    }
+    
+    json_object_put(root);
+}
+
+/**
+ * Commit a symbol's parsed frames in arrival order, freeing their slots
+ * The worker that finds the next frame parsed commits it and the parsed frames after it. A
+ * worker that finds another one committing leaves its frame to that one, which checks again
+ * after letting go, so no parsed frame is left behind.
+ */
+void commit_parsed_frames(int symbol_idx) {
+    parse_order_t *order = &parse_orders[symbol_idx];
+    
+    for (;;) {
+        int expected = 0;
+        if (!atomic_compare_exchange_strong(&order->committing, &expected, 1)) {
+            return;
+        }
+        
+        for (;;) {
+            parse_slot_t *_Atomic *entry = &order->pending[order->commit_seq & (PARSE_RING_SLOTS - 1)];
+            parse_slot_t *slot = atomic_load_explicit(entry, memory_order_acquire);
+            if (!slot || !atomic_load(&slot->parsed)) {
+                break;
+            }
+            atomic_store_explicit(entry, NULL, memory_order_relaxed);
+            
+            if (slot->type == DATA_TYPE_TRADE) {
+                record_trade(symbol_idx, &slot->record.trade, slot->shard, slot->receive_ticks);
+            } else if (slot->type == DATA_TYPE_KLINE) {
+                record_kline(symbol_idx, &slot->record.kline, slot->event_time, slot->shard,
+                             slot->receive_ticks);
+            } else if (slot->type == DATA_TYPE_DEPTH) {
+                record_depth(symbol_idx, &slot->depth, slot->shard);
+                free(slot->depth.levels);
+                slot->depth.levels = NULL;
+            }
+            order->commit_seq++;
+            
+            // Free the slot for the frame a queue later
+            if (slot->data != slot->inline_data) {
+                free(slot->data);
+            }
+            atomic_store_explicit(&slot->parsed, 0, memory_order_relaxed);
+            atomic_store(&slot->turn, (uint32_t)(slot->position + PARSE_RING_SLOTS));
+        }
+        
+        uint64_t next = order->commit_seq;
+        atomic_store(&order->committing, 0);
+        
+        parse_slot_t *slot = atomic_load(&order->pending[next & (PARSE_RING_SLOTS - 1)]);
+        if (!slot || !atomic_load(&slot->parsed)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Let the parse workers finish the queued frames and stop them
+ * Call once the receive threads have stopped queueing.
+ */
+void stop_parse_workers() {
+    // Spilled frames are queued back before the workers may run out of queued frames
+    while (atomic_load(&parse_spilling)) {
+        pthread_mutex_lock(&parse_enqueue_mutex);
+        int remaining = atomic_load(&parse_spilling) && requeue_spilled_frames();
+        pthread_mutex_unlock(&parse_enqueue_mutex);
+        if (remaining) {
+            usleep(1000);
+        }
+    }
+    atomic_store(&parse_stop, 1);
+    
+    for (size_t i = 0; i < parse_worker_count; i++) {
+        if (parse_threads[i]) {
+            pthread_join(parse_threads[i], NULL);
+        }
+    }
+    
+    free(parse_slots);
+    parse_slots = NULL;
+    free(parse_orders);
+    parse_orders = NULL;
+    if (parse_spill_fd != -1) {
+        close(parse_spill_fd);
+        parse_spill_fd = -1;
+    }
+}
+
+/**
+ * Create a raw frame journal of this run: <output>/<name>_<run_id>.jsonl
+ * Returns 0 on success, -1 on failure
+ */
+int open_journal(const char *name, FILE **file, char **buffer) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s_%lld.jsonl", output_dir, name, (long long)run_id);
+    
+    *file = fopen(path, "wx");
+    if (!*file) {
+        fprintf(stderr, "Error: Failed to create journal %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    *buffer = malloc(JOURNAL_BUFFER_SIZE);
+    if (*buffer) {
+        setvbuf(*file, *buffer, _IOFBF, JOURNAL_BUFFER_SIZE);
+    }
+    
+    printf("Journaling %s frames to %s\n", name, path);
+    return 0;
+}
+
+/**
+ * Append a received frame to the journal as one line: "<receive time ms> <frame>\n"
+ * Frames are compact JSON (no raw newlines), so the journal is a stream of JSON documents that
+ * binance_journal decodes in bulk. The receive threads of all connections share the journal;
+ * the stdio lock keeps each line whole.
+ */
+void journal_frame(FILE *file, const char *in, size_t len) {
+    char prefix[24];
+    int n = snprintf(prefix, sizeof(prefix), "%lld ", (long long)current_time_ms());
+    
+    flockfile(file);
+    fwrite_unlocked(prefix, 1, n, file);
+    fwrite_unlocked(in, 1, len, file);
+    putc_unlocked('\n', file);
+    funlockfile(file);
+}
+
+/**
+ * Flush and close a journal (after the receive threads have stopped)
+ */
+void close_journal(FILE **file, char **buffer) {
+    if (*file) {
+        if (fclose(*file) != 0) {
+            fprintf(stderr, "Error: Failed to write journal: %s\n", strerror(errno));
+        }
+        *file = NULL;
+    }
+    free(*buffer);
+    *buffer = NULL;
+}
+
+/**
+ * Account a record's event time (exchange clock) against its receive time
+ * Feeds the window minimum the exchange clock is fitted to, and the latency histogram corrected with
+ * the current estimate. Called by every thread that commits records, so both are lock-free.
+ */
+void observe_exchange_time(int64_t receive_ns, int64_t event_time_ms) {
+    int64_t delay = receive_ns - event_time_ms * 1000000;
+    int64_t window_min = atomic_load_explicit(&exchange_window_min, memory_order_relaxed);
+    while (delay < window_min &&
+           !atomic_compare_exchange_weak_explicit(&exchange_window_min, &window_min, delay,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    
+    int64_t latency = exchange_latency_ns(&shm_header->exchange_clock, event_time_ms, receive_ns);
+    int bucket = 0;
+    if (latency >= 0) {
+        bucket = 1;
+        while (bucket < LATENCY_BUCKETS - 1 && latency > latency_bucket_ms[bucket - 1] * 1000000) {
+            bucket++;
+        }
+    }
+    thread_counters_t *counters = own_counters();
+    count_events(counters, &counters->latency[bucket], 1);
+}
+
+/**
+ * Close the current window and publish the exchange clock fitted to the past windows
+ * Receive minus event time is the clock offset plus the network delay, so the smallest value of a
+ * window follows the offset with the delay floor on top. A least-squares line through the window
+ * minima gives the drift; shifted down onto the lowest minimum it is the offset (plus floor). With
+ * server-time probes the offset comes from the best probe instead, advanced by the drift, and the
+ * floor is what the events add to it. Runs on the shm update thread only.
+ */
+void update_exchange_clock(int64_t now_ns) {
+    int64_t window_min = atomic_exchange(&exchange_window_min, INT64_MAX);
+    if (window_min == INT64_MAX) {
+        return;
+    }
+    
+    if (exchange_window_count == EXCHANGE_WINDOWS) {
+        memmove(exchange_window_mins, exchange_window_mins + 1, (EXCHANGE_WINDOWS - 1) * sizeof(int64_t));
+        memmove(exchange_window_times, exchange_window_times + 1, (EXCHANGE_WINDOWS - 1) * sizeof(int64_t));
+        exchange_window_count--;
+    }
+    exchange_window_mins[exchange_window_count] = window_min;
+    exchange_window_times[exchange_window_count] = now_ns - EXCHANGE_WINDOW_SEC * 1000000000LL / 2;
+    exchange_window_count++;
+    
+    // Fit relative to the newest window (x in seconds, y in ns: the slope is in ppb)
+    size_t n = exchange_window_count;
+    int64_t ref_ns = exchange_window_times[n - 1];
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < n; i++) {
+        double x = (double)(exchange_window_times[i] - ref_ns) / 1e9;
+        double y = (double)(exchange_window_mins[i] - exchange_window_mins[n - 1]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    double drift = n > 1 && denominator > 0 ? (n * sxy - sx * sy) / denominator : 0;
+    
+    // Lower envelope: the fitted line moved down until it touches the lowest window
+    double envelope = INFINITY;
+    for (size_t i = 0; i < n; i++) {
+        double x = (double)(exchange_window_times[i] - ref_ns) / 1e9;
+        double y = (double)(exchange_window_mins[i] - exchange_window_mins[n - 1]);
+        if (y - drift * x < envelope) {
+            envelope = y - drift * x;
+        }
+    }
+    int64_t envelope_ns = exchange_window_mins[n - 1] + (int64_t)envelope;
+    
+    pthread_mutex_lock(&probe_mutex);
+    int64_t probe_local = probe_local_ns;
+    int64_t probe_offset = probe_offset_ns;
+    int64_t probe_rtt = probe_rtt_ns;
+    pthread_mutex_unlock(&probe_mutex);
+    
+    exchange_clock_t *exchange = &shm_header->exchange_clock;
+    unsigned sequence = atomic_load_explicit(&exchange->sequence, memory_order_relaxed);
+    atomic_store_explicit(&exchange->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    exchange->ref_ns = ref_ns;
+    exchange->drift_ppb = (int64_t)drift;
+    exchange->windows = n;
+    if (probe_local != 0) {
+        exchange->flags = EXCHANGE_CLOCK_EVENTS | EXCHANGE_CLOCK_PROBED;
+        exchange->offset_ns = probe_offset + (int64_t)(drift * (double)(ref_ns - probe_local) / 1e9);
+        exchange->floor_ns = envelope_ns - exchange->offset_ns;
+        exchange->probe_rtt_ns = probe_rtt;
+    } else {
+        exchange->flags = EXCHANGE_CLOCK_EVENTS;
+        exchange->offset_ns = envelope_ns;
+        exchange->floor_ns = 0;
+        exchange->probe_rtt_ns = 0;
+    }
+    
+    atomic_store_explicit(&exchange->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Connect to the time server (host:port of time_server)
+ * Returns the socket, or -1 on failure
+ */
+int connect_time_server(void) {
+    char host[256];
+    const char *port = "80";
+    
+    size_t host_len = strcspn(time_server, "/");
+    snprintf(host, sizeof(host), "%.*s", (int)host_len, time_server);
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+    
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+        return -1;
+    }
+    
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    // Requests go out at once; a server that stops answering fails the probe
+    int one = 1;
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/**
+ * Ask the time server for its time over a kept-alive HTTP connection
+ * The server time is taken to be read halfway through the round trip, in the middle of its
+ * millisecond (it is truncated to the millisecond).
+ * Returns 0 with the midpoint (receive clock), offset (receive clock minus server clock) and round
+ * trip of the probe, -1 on failure (the connection is then unusable)
+ */
+int probe_server_time(int fd, int64_t *local_ns, int64_t *offset_ns, int64_t *rtt_ns) {
+    char request[512];
+    const char *path = strchr(time_server, '/');
+    size_t host_len = strcspn(time_server, "/");
+    int len = snprintf(request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %.*s\r\nConnection: keep-alive\r\n\r\n",
+                       path ? path : EXCHANGE_PROBE_PATH, (int)host_len, time_server);
+    
+    char response[4096];
+    size_t used = 0;
+    char *body = NULL;
+    int64_t sent_ns = clock_now_ns(&shm_header->clock);
+    int64_t received_ns = 0;
+    
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        return -1;
+    }
+    
+    // Read until the body holds the whole JSON object; the first byte marks the arrival
+    while (!body || !strchr(body, '}')) {
+        ssize_t n = recv(fd, response + used, sizeof(response) - 1 - used, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        if (used == 0) {
+            received_ns = clock_now_ns(&shm_header->clock);
+        }
+        used += n;
+        response[used] = '\0';
+        body = strstr(response, "\r\n\r\n");
+        if (!body && used == sizeof(response) - 1) {
+            return -1;
+        }
+    }
+    
+    const char *field = strstr(body, "\"serverTime\"");
+    if (strncmp(response, "HTTP/1.1 200", 12) != 0 || !field || !(field = strchr(field, ':'))) {
+        return -1;
+    }
+    int64_t server_ns = strtoll(field + 1, NULL, 10) * 1000000 + 500000;
+    
+    *rtt_ns = received_ns - sent_ns;
+    *local_ns = sent_ns + *rtt_ns / 2;
+    *offset_ns = *local_ns - server_ns;
+    return 0;
+}
+
+/**
+ * Server-time probe thread: every EXCHANGE_PROBE_INTERVAL_SEC, a burst of probes whose shortest
+ * round trip bounds the offset error best
+ */
+void *probe_thread_func(void *arg) {
+    int fd = -1;
+    int failing = 0;
+    
+    while (!force_exit) {
+        int64_t best_local = 0, best_offset = 0, best_rtt = INT64_MAX;
+        
+        for (int i = 0; i < EXCHANGE_PROBE_BURST && !force_exit; i++) {
+            if (fd == -1 && (fd = connect_time_server()) == -1) {
+                break;
+            }
+            int64_t local, offset, rtt;
+            if (probe_server_time(fd, &local, &offset, &rtt) != 0) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            if (rtt < best_rtt) {
+                best_local = local;
+                best_offset = offset;
+                best_rtt = rtt;
+            }
+        }
+        
+        if (best_rtt != INT64_MAX) {
+            pthread_mutex_lock(&probe_mutex);
+            probe_local_ns = best_local;
+            probe_offset_ns = best_offset;
+            probe_rtt_ns = best_rtt;
+            pthread_mutex_unlock(&probe_mutex);
+            failing = 0;
+        } else if (!failing) {
+            fprintf(stderr, "Warning: Time server %s does not answer server-time probes\n", time_server);
+            failing = 1;
+        }
+        
+        for (int i = 0; i < EXCHANGE_PROBE_INTERVAL_SEC && !force_exit; i++) {
+            sleep(1);
+        }
+    }
+    
+    if (fd != -1) {
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * Depth snapshot HTTP client callback: collects the response body of the request in flight
+ */
+static int snapshot_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                             void *user, void *in, size_t len) {
+    snapshot_request_t *request = wsi ? (snapshot_request_t *)lws_context_user(lws_get_context(wsi)) : NULL;
+    
+    // Connections of earlier requests may still report closing
+    if (!request || (uintptr_t)lws_get_opaque_user_data(wsi) != request->generation || request->done != 0) {
+        return 0;
+    }
+    
+    switch (reason) {
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            fprintf(stderr, "Depth snapshot request for %s failed: %s\n", symbols[request->symbol_idx].name,
+                    in ? (char *)in : "(null)");
+            request->done = -1;
+            break;
+        
+        case LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP:
+            request->status = lws_http_client_http_response(wsi);
+            lws_set_timeout(wsi, PENDING_TIMEOUT_HTTP_CONTENT, DEPTH_SNAPSHOT_TIMEOUT_SEC);
+            break;
+        
+        case LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ:
+            if (request->length + len >= request->capacity) {
+                size_t capacity = request->capacity ? request->capacity : 64 * 1024;
+                while (request->length + len >= capacity) {
+                    capacity *= 2;
+                }
+                char *body = capacity <= DEPTH_SNAPSHOT_MAX_SIZE ? realloc(request->body, capacity) : NULL;
+                if (!body) {
+                    request->done = -1;
+                    return -1;
+                }
+                request->body = body;
+                request->capacity = capacity;
+            }
+            memcpy(request->body + request->length, in, len);
+            request->length += len;
+            request->body[request->length] = '\0';
+            break;
+        
+        case LWS_CALLBACK_RECEIVE_CLIENT_HTTP: {
+            // Hand the data waiting on the connection to LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ
+            char buffer[LWS_PRE + 4096];
+            char *p = buffer + LWS_PRE;
+            int n = sizeof(buffer) - LWS_PRE;
+            if (lws_http_client_read(wsi, &p, &n) < 0) {
+                return -1;
+            }
+            break;
+        }
+        
+        case LWS_CALLBACK_COMPLETED_CLIENT_HTTP:
+            request->done = 1;
+            break;
+        
+        case LWS_CALLBACK_CLOSED_CLIENT_HTTP:
+            request->done = -1;
+            break;
+        
+        default:
+            break;
+    }
+    
+    return 0;
+}
+
+/**
+ * Ask for the depth snapshot of a symbol (DEPTH_SNAPSHOT_LIMIT levels per side)
+ * Returns 0 if the request is on its way, -1 on failure
+ */
+int request_depth_snapshot(struct lws_context *context, snapshot_request_t *request, int symbol_idx) {
+    static char path[128];      // Kept until the request is done
+    struct lws_client_connect_info ccinfo;
+    
+    request->symbol_idx = symbol_idx;
+    request->generation++;
+    request->deadline = time(NULL) + 2 * DEPTH_SNAPSHOT_TIMEOUT_SEC;
+    request->status = 0;
+    request->done = 0;
+    request->length = 0;
+    
+    int len = snprintf(path, sizeof(path), DEPTH_SNAPSHOT_PATH "?symbol=%s&limit=%d", symbols[symbol_idx].name,
+                       DEPTH_SNAPSHOT_LIMIT);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        request->done = -1;
+        return -1;
+    }
+    
+    memset(&ccinfo, 0, sizeof(ccinfo));
+    ccinfo.context = context;
+    ccinfo.address = DEPTH_SNAPSHOT_HOST;
+    ccinfo.port = 443;
+    ccinfo.path = path;
+    ccinfo.host = ccinfo.address;
+    ccinfo.origin = ccinfo.address;
+    ccinfo.method = "GET";
+    ccinfo.protocol = snapshot_protocols[0].name;
+    ccinfo.ssl_connection = LCCSCF_USE_SSL;
+    ccinfo.opaque_user_data = (void *)request->generation;
+    
+    if (!lws_client_connect_via_info(&ccinfo)) {
+        request->done = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Extract a depth snapshot ({"lastUpdateId":..,"E":..,"T":..,"bids":[..],"asks":[..]}); its levels
+ * are stamped with lastUpdateId and the transaction time
+ * Returns 0 on success (snapshot->levels is allocated), -1 if the body is not a snapshot with levels
+ */
+int parse_depth_snapshot(const char *body, depth_update_t *snapshot) {
+    json_object *root = json_tokener_parse(body);
+    json_object *obj;
+    
+    if (!root) {
+        return -1;
+    }
+    if (!json_object_object_get_ex(root, "lastUpdateId", &obj)) {
+        json_object_put(root);
+        return -1;
+    }
+    snapshot->update_id = json_object_get_int64(obj);
+    snapshot->first_update_id = snapshot->update_id;
+    snapshot->prev_update_id = -1;
+    if (json_object_object_get_ex(root, "T", &obj) || json_object_object_get_ex(root, "E", &obj)) {
+        snapshot->event_time = json_object_get_int64(obj);
+    } else {
+        snapshot->event_time = current_time_ms();
+    }
+    
+    int ret = parse_depth_levels(root, "bids", "asks", snapshot);
+    json_object_put(root);
+    if (ret == 0 && snapshot->count == 0) {
+        free(snapshot->levels);
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * Hand a symbol's depth snapshot to sync_depth(), which takes its levels
+ * A snapshot that arrives once the book no longer waits for one is dropped.
+ */
+void apply_depth_snapshot(int symbol_idx, depth_update_t *snapshot) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    
+    pthread_mutex_lock(&symbol->ingest_mutex);
+    if (symbol->depth_synced) {
+        free(snapshot->levels);
+    } else {
+        free(symbol->depth_snapshot.levels);
+        symbol->depth_snapshot = *snapshot;
+        sync_depth(symbol_idx);
+    }
+    pthread_mutex_unlock(&symbol->ingest_mutex);
+}
+
+/**
+ * Depth snapshot thread: fetches the REST snapshot of each symbol whose book waits for one, one
+ * request at a time, and asks again after DEPTH_SNAPSHOT_RETRY_SEC if a request fails
+ */
+void *snapshot_thread_func(void *arg) {
+    snapshot_request_t request = { .symbol_idx = -1 };
+    struct lws_context_creation_info info;
+    size_t next = 0;
+    time_t retry_time = 0;
+    
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = snapshot_protocols;
+    info.gid = -1;
+    info.uid = -1;
+    info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    info.user = &request;       // snapshot_callback() finds the request through its context
+    
+    struct lws_context *context = lws_create_context(&info);
+    if (!context) {
+        fprintf(stderr, "Error: Failed to create libwebsocket context for depth snapshots\n");
+        return NULL;
+    }
+    
+    while (!force_exit) {
+        // Next symbol whose book waits for a snapshot, in turn
+        for (size_t n = 0; request.symbol_idx == -1 && n < symbol_count && time(NULL) >= retry_time; n++) {
+            size_t i = (next + n) % symbol_count;
+            if (atomic_exchange(&symbols[i].depth_snapshot_wanted, 0)) {
+                request_depth_snapshot(context, &request, (int)i);
+                next = i + 1;
+            }
+        }
+        
+        lws_service(context, 100);
+        
+        if (request.symbol_idx == -1) {
+            continue;
+        }
+        if (request.done == 0) {
+            if (time(NULL) < request.deadline) {
+                continue;
+            }
+            request.done = -1;  // Connection stuck before its own timeouts: later callbacks are ignored
+        }
+        depth_update_t snapshot;
+        if (request.done == 1 && request.status == 200 && request.body &&
+            parse_depth_snapshot(request.body, &snapshot) == 0) {
+            apply_depth_snapshot(request.symbol_idx, &snapshot);
+        } else {
+            fprintf(stderr, "Warning: No depth snapshot of %s (HTTP status %d); asking again in %d seconds\n",
+                    symbols[request.symbol_idx].name, request.status, DEPTH_SNAPSHOT_RETRY_SEC);
+            atomic_store(&symbols[request.symbol_idx].depth_snapshot_wanted, 1);
+            retry_time = time(NULL) + DEPTH_SNAPSHOT_RETRY_SEC;
+        }
+        request.symbol_idx = -1;
+    }
+    
+    lws_context_destroy(context);
+    free(request.body);
+    return NULL;
+}
+
+/**
+ * Print the exchange clock estimate and the corrected latency histogram of the last interval
+ */
+void report_exchange_clock(void) {
+    static uint64_t prev_counts[LATENCY_BUCKETS] = {0};
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total = 0;
+    
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        uint64_t count = sum_counter(&shared_counters.latency[i]);
+        counts[i] = count - prev_counts[i];
+        prev_counts[i] = count;
+        total += counts[i];
+    }
+    
+    const exchange_clock_t *exchange = &shm_header->exchange_clock;
+    int64_t now_ns = clock_now_ns(&shm_header->clock);
+    if (!exchange->flags) {
+        printf("\nExchange clock: not estimated yet\n");
+    } else if (exchange->flags & EXCHANGE_CLOCK_PROBED) {
+        printf("\nExchange clock: offset %+.3f ms, drift %+.3f ppm, network floor %.3f ms (probe rtt %.3f ms)\n",
+               exchange_clock_offset(exchange, now_ns) / 1e6, exchange->drift_ppb / 1e3,
+               exchange->floor_ns / 1e6, exchange->probe_rtt_ns / 1e6);
+    } else {
+        printf("\nExchange clock: offset %+.3f ms incl. network floor, drift %+.3f ppm (%u windows)\n",
+               exchange_clock_offset(exchange, now_ns) / 1e6, exchange->drift_ppb / 1e3, exchange->windows);
+    }
+    if (total == 0) {
+        return;
+    }
+    
+    printf("Exchange latency (event to receive, %s): ",
+           exchange->flags & EXCHANGE_CLOCK_PROBED ? "one-way" : "above floor");
+    printf("<0: %llu", (unsigned long long)counts[0]);
+    for (int i = 1; i < LATENCY_BUCKETS; i++) {
+        if (i < LATENCY_BUCKETS - 1) {
+            printf(" | <=%lldms: %llu", (long long)latency_bucket_ms[i - 1], (unsigned long long)counts[i]);
+        } else {
+            printf(" | >%lldms: %llu", (long long)latency_bucket_ms[i - 2], (unsigned long long)counts[i]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * Parse overflow policies: comma-separated STAGE:POLICY with stages parse (block, drop or spill)
+ * and persist (block or spill)
+ * Returns 0 on success, -1 if invalid
+ */
+int parse_overflow_policies(const char *spec) {
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    
+    for (char *save = NULL, *item = strtok_r(buffer, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *policy = strchr(item, ':');
+        if (!policy) {
+            return -1;
+        }
+        *policy++ = '\0';
+        
+        overflow_policy_t value;
+        if (strcmp(policy, "block") == 0) {
+            value = OVERFLOW_BLOCK;
+        } else if (strcmp(policy, "drop") == 0) {
+            value = OVERFLOW_DROP;
+        } else if (strcmp(policy, "spill") == 0) {
+            value = OVERFLOW_SPILL;
+        } else {
+            return -1;
+        }
+        
+        if (strcmp(item, "parse") == 0) {
+            parse_overflow = value;
+        } else if (strcmp(item, "persist") == 0 && value != OVERFLOW_DROP) {
+            // Data files hold every sequence: records can wait or spill, not disappear
+            persist_overflow = value;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Set up the persist queue of a data file (and its overflow file under the spill policy)
+ * The overflow file is unlinked right away: it only lives while the collector runs.
+ * Returns 0 on success, -1 on failure
+ */
+int init_persist_queue(persist_queue_t *queue, const data_file_t *file) {
+    queue->spill_fd = -1;
+    queue->spill_buffer = NULL;
+    
+    // Fault the queue in now rather than on the ingest path
+    queue->entries = malloc(PERSIST_QUEUE_ENTRIES * sizeof(persist_entry_t));
+    if (!queue->entries) {
+        return -1;
+    }
+    memset(queue->entries, 0, PERSIST_QUEUE_ENTRIES * sizeof(persist_entry_t));
+    
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->next_sequence = file->next_sequence;
+    queue->spilling = 0;
+    queue->spill_fill = 0;
+    atomic_init(&queue->spill_pending, 0);
+    atomic_init(&queue->spill_written, 0);
+    atomic_init(&queue->spill_read, 0);
+    atomic_init(&queue->spilled, 0);
+    atomic_init(&queue->blocked, 0);
+    
+    if (persist_overflow == OVERFLOW_SPILL) {
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/overflow_%s_%lld.XXXXXX", file->dir, file->prefix,
+                           (long long)run_id);
+        if (len < 0 || (size_t)len >= sizeof(path)) {
+            fprintf(stderr, "Error: Overflow file path too long in %s\n", file->dir);
+            return -1;
+        }
+        
+        queue->spill_buffer = malloc(PERSIST_SPILL_BUFFER);
+        queue->spill_fd = mkstemp(path);
+        if (!queue->spill_buffer || queue->spill_fd == -1) {
+            fprintf(stderr, "Error: Failed to create overflow file in %s: %s\n", file->dir, strerror(errno));
+            return -1;
+        }
+        unlink(path);
+    }
+    return 0;
+}
+
+/**
+ * Release a persist queue (after the persist thread has stopped)
+ */
+void free_persist_queue(persist_queue_t *queue) {
+    // Queues of symbols that were never set up are all zero
+    if (queue->spill_buffer && queue->spill_fd != -1) {
+        close(queue->spill_fd);
+    }
+    queue->spill_fd = -1;
+    free(queue->spill_buffer);
+    queue->spill_buffer = NULL;
+    free(queue->entries);
+    queue->entries = NULL;
+}
+
+/**
+ * Queue a record for the persist thread (call with the symbol's ingest_mutex held)
+ * If the queue is full, the persist stage's overflow policy decides: wait for the persist thread,
+ * or continue in the overflow file. The persist thread takes spilled records after the queued
+ * ones, and records go back to the queue once it has taken them all, so the data file keeps
+ * arrival order.
+ * Returns the record's sequence
+ */
+uint64_t queue_record(symbol_data_t *symbol, data_type_t type, const persist_entry_t *entry) {
+    persist_queue_t *queue = type == DATA_TYPE_TRADE ? &symbol->trade_queue :
+                             type == DATA_TYPE_KLINE ? &symbol->kline_queue : &symbol->depth_queue;
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    
+    if (queue->spilling && queue->spill_fill == 0 &&
+        atomic_load_explicit(&queue->spill_read, memory_order_acquire) ==
+        atomic_load_explicit(&queue->spill_written, memory_order_relaxed)) {
+        queue->spilling = 0;
+        fprintf(stderr, "Persist queue of %s %s caught up with its overflow file\n", symbol->name,
+                data_type_prefix(type));
+    }
+    
+    if (!queue->spilling) {
+        if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == PERSIST_QUEUE_ENTRIES) {
+            if (persist_overflow == OVERFLOW_SPILL) {
+                queue->spilling = 1;
+                fprintf(stderr, "Warning: Persist queue of %s %s is full, spilling to its overflow file\n",
+                        symbol->name, data_type_prefix(type));
+            } else {
+                atomic_fetch_add_explicit(&queue->blocked, 1, memory_order_relaxed);
+                while (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == PERSIST_QUEUE_ENTRIES) {
+                    wake_persist_thread();
+                    sched_yield();
+                }
+            }
+        }
+        
+        if (!queue->spilling) {
+            queue->entries[head & (PERSIST_QUEUE_ENTRIES - 1)] = *entry;
+            atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+            wake_persist_thread();
+            return queue->next_sequence++;
+        }
+    }
+    
+    // Behind the records already spilled; written out in chunks, or at once if the persist thread waits for them
+    memcpy(queue->spill_buffer + queue->spill_fill, entry, sizeof(*entry));
+    queue->spill_fill += sizeof(*entry);
+    atomic_store_explicit(&queue->spill_pending, queue->spill_fill / sizeof(*entry), memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->spilled, 1, memory_order_relaxed);
+    
+    if (queue->spill_fill + sizeof(*entry) > PERSIST_SPILL_BUFFER ||
+        atomic_load_explicit(&queue->spill_read, memory_order_acquire) ==
+        atomic_load_explicit(&queue->spill_written, memory_order_relaxed)) {
+        flush_spill(queue);
+    }
+    return queue->next_sequence++;
+}
+
+/**
+ * Write the gathered spilled records to the overflow file (under the symbol's ingest_mutex)
+ * Retries until written: if the overflow file fails as well, ingestion waits as under the block policy.
+ */
+void flush_spill(persist_queue_t *queue) {
+    uint64_t offset = atomic_load_explicit(&queue->spill_written, memory_order_relaxed);
+    size_t done = 0;
+    int reported = 0;
+    
+    while (done < queue->spill_fill) {
+        ssize_t n = pwrite(queue->spill_fd, queue->spill_buffer + done, queue->spill_fill - done, offset + done);
+        if (n <= 0) {
+            if (n < 0 && errno != EINTR && !reported) {
+                fprintf(stderr, "Error: Failed to write overflow file: %s\n", strerror(errno));
+                reported = 1;
+            }
+            usleep(1000);
+            continue;
+        }
+        done += n;
+    }
+    
+    atomic_store_explicit(&queue->spill_written, offset + done, memory_order_release);
+    atomic_store_explicit(&queue->spill_pending, 0, memory_order_relaxed);
+    queue->spill_fill = 0;
+    wake_persist_thread();
+}
+
+/**
+ * Wake the persist thread if it waits for records
+ */
+void wake_persist_thread(void) {
+    // Pairs with the persist thread announcing its wait before it checks the queues
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&persist_waiting, memory_order_relaxed)) {
+        atomic_fetch_add(&persist_wake, 1);
+        syscall(SYS_futex, &persist_wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Append a batch of a data file's queued records, or of its spilled records once the queue is
+ * empty, and account for them under the file's durability policy (persist thread)
+ * Returns the number of records taken
+ */
+size_t drain_persist_queue(int symbol_idx, data_type_t type) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    int is_trade = type == DATA_TYPE_TRADE;
+    int is_depth = type == DATA_TYPE_DEPTH;
+    persist_queue_t *queue = is_trade ? &symbol->trade_queue : is_depth ? &symbol->depth_queue : &symbol->kline_queue;
+    data_file_t *file = is_trade ? symbol->trade_file : is_depth ? symbol->depth_file : symbol->kline_file;
+    persist_entry_t spilled[PERSIST_SPILL_BUFFER / sizeof(persist_entry_t)];
+    const persist_entry_t *entries = NULL;
+    size_t count = 0;
+    uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    uint64_t spill_read = atomic_load_explicit(&queue->spill_read, memory_order_relaxed);
+    
+    if (tail == head && spill_read < atomic_load_explicit(&queue->spill_written, memory_order_acquire)) {
+        uint64_t len = atomic_load_explicit(&queue->spill_written, memory_order_relaxed) - spill_read;
+        ssize_t n = pread(queue->spill_fd, spilled, len < sizeof(spilled) ? len : sizeof(spilled), spill_read);
+        if (n <= 0) {
+            return 0;
+        }
+        count = n / sizeof(persist_entry_t);
+        entries = spilled;
+    } else {
+        count = head - tail < PERSIST_BATCH ? head - tail : PERSIST_BATCH;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint64_t appended = 0;
+    int final = 0;
+    for (size_t i = 0; i < count; i++) {
+        const persist_entry_t *entry = entries ? &entries[i] : &queue->entries[(tail + i) & (PERSIST_QUEUE_ENTRIES - 1)];
+        
+        // The record's sequence is already published: retry until it lands at that file position,
+        // as a skipped record would shift every later one (ingestion backs up behind the queue meanwhile)
+        int failures = 0;
+        while (data_file_append(file, &entry->record) != 0) {
+            if (failures++ == 0) {
+                fprintf(stderr, "Error: Failed to write %s data to file for symbol %s, retrying\n", file->prefix,
+                        symbol->name);
+            }
+            usleep(PERSIST_RETRY_DELAY_MS * 1000);
+        }
+        if (failures > 0) {
+            fprintf(stderr, "Wrote %s data for symbol %s after %d failed attempts\n", file->prefix, symbol->name,
+                    failures);
+        }
+        
+        PROBE_RECORD_PERSISTED(symbol_idx, type, file->next_sequence - 1, entry->event_time);
+        appended++;
+        if (is_depth) {
+            update_book(symbol_idx, &entry->record.level);
+        } else if (!is_trade && entry->record.kline.is_final) {
+            final = 1;
+        }
+        
+        if (!entries) {
+            atomic_store_explicit(&queue->tail, tail + i + 1, memory_order_release);
+        }
+    }
+    
+    // Release the overflow file's disk space behind the records taken
+    if (entries) {
+        fallocate(queue->spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, spill_read,
+                  count * sizeof(persist_entry_t));
+        atomic_store_explicit(&queue->spill_read, spill_read + count * sizeof(persist_entry_t),
+                              memory_order_release);
+    }
+    
+    // Flush to ensure data is written (depth files are outside the durability policies)
+    data_file_flush(file);
+    if (!is_depth) {
+        note_record_written(is_trade ? &symbol->trade_durability : &symbol->kline_durability,
+                            is_trade ? &trade_durability_policy : &kline_durability_policy, appended);
+    }
+    if (final) {
+        request_kline_final_sync(symbol);
+    }
+    return count;
+}
+
+/**
+ * Write out spilled records still gathered by an ingest path that has gone quiet, once the
+ * persist thread has taken everything before them (persist thread)
+ * Returns the number of overflow files written to
+ */
+size_t flush_idle_spills(void) {
+    size_t flushed = 0;
+    
+    for (size_t i = 0; i < symbol_count; i++) {
+        persist_queue_t *queues[3] = { &symbols[i].trade_queue, &symbols[i].kline_queue, &symbols[i].depth_queue };
+        
+        for (int q = 0; q < 3; q++) {
+            if (atomic_load_explicit(&queues[q]->spill_pending, memory_order_relaxed) == 0 ||
+                atomic_load_explicit(&queues[q]->spill_read, memory_order_relaxed) !=
+                atomic_load_explicit(&queues[q]->spill_written, memory_order_acquire)) {
+                continue;
+            }
+            
+            pthread_mutex_lock(&symbols[i].ingest_mutex);
+            if (queues[q]->spill_fill > 0) {
+                flush_spill(queues[q]);
+                flushed++;
+            }
+            pthread_mutex_unlock(&symbols[i].ingest_mutex);
         }
+    }
+    return flushed;
+}
+
+/**
+ * Whether any persist queue or overflow file holds records not yet taken (persist thread)
+ */
+int persist_pending(void) {
+    for (size_t i = 0; i < symbol_count; i++) {
+        persist_queue_t *queues[3] = { &symbols[i].trade_queue, &symbols[i].kline_queue, &symbols[i].depth_queue };
         
-        // Write klines in chronological order (oldest to newest)
-        start_idx = symbols[i].recent_data.klines.count >= MAX_RECORDS_PER_SYMBOL ?
-                  symbols[i].recent_data.klines.next_index : 0;
+        for (int q = 0; q < 3; q++) {
+            if (atomic_load(&queues[q]->head) != atomic_load_explicit(&queues[q]->tail, memory_order_relaxed) ||
+                atomic_load(&queues[q]->spill_written) != atomic_load_explicit(&queues[q]->spill_read, memory_order_relaxed) ||
+                atomic_load(&queues[q]->spill_pending) > 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Persist thread: appends queued records to the data files, so that a slow disk holds up this
+ * thread instead of the receive threads
+ */
+void *persist_thread_func(void *arg) {
+    for (;;) {
+        size_t count = 0;
+        for (size_t i = 0; i < symbol_count; i++) {
+            count += drain_persist_queue(i, DATA_TYPE_TRADE);
+            count += drain_persist_queue(i, DATA_TYPE_KLINE);
+            count += drain_persist_queue(i, DATA_TYPE_DEPTH);
+        }
+        if (count > 0 || flush_idle_spills() > 0) {
+            continue;
+        }
         
-        for (size_t j = 0; j < klines_to_write; j++) {
-            size_t idx = (start_idx + j) % MAX_RECORDS_PER_SYMBOL;
-            
-            // Write header
-            memcpy((char *)shared_memory + current_offset, 
-                   &symbols[i].recent_data.klines.headers[idx], 
-                   sizeof(message_header_t));
-            current_offset += sizeof(message_header_t);
-            
-            // Write kline record
-            memcpy((char *)shared_memory + current_offset, 
-                   &symbols[i].recent_data.klines.records[idx], 
-                   sizeof(kline_record_t));
-            current_offset += sizeof(kline_record_t);
+        // Everything queued before the stop has been appended
+        if (atomic_load(&persist_stop)) {
+            break;
         }
         
-        pthread_mutex_unlock(&symbols[i].mutex);
+        uint32_t seen = atomic_load(&persist_wake);
+        atomic_store(&persist_waiting, 1);
+        if (!persist_pending()) {
+            struct timespec timeout = { 0, PERSIST_IDLE_WAIT_MS * 1000000L };
+            syscall(SYS_futex, &persist_wake, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+        }
+        atomic_store(&persist_waiting, 0);
     }
     
-    // Increment write counter
-    atomic_fetch_add(&shm_header->write_counter, 1);
+    return NULL;
 }
 
 /**
- * Signal handler for clean exit
+ * Stop the persist thread once it has appended every queued and spilled record (after the
+ * receive threads and parse workers have stopped)
  */
-void signal_handler(int sig) {
-    force_exit = 1;
+void stop_persist_thread(void) {
+    atomic_store(&persist_stop, 1);
+    atomic_fetch_add(&persist_wake, 1);
+    syscall(SYS_futex, &persist_wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(persist_thread, NULL);
+}
+
+/**
+ * Apply a persisted depth level to the symbol's book, and checkpoint the book once the update
+ * it ends is due (persist thread)
+ * Checkpoints fall on the first update at or after each multiple of the checkpoint interval
+ * (exchange time), and right after the first update.
+ */
+void update_book(int symbol_idx, const book_level_record_t *level) {
+    symbol_data_t *symbol = &symbols[symbol_idx];
+    
+    if (book_apply(symbol->book, level) != 0) {
+        fprintf(stderr, "Error: Failed to grow the order book of %s\n", symbol->name);
+    }
+    // A snapshot is checkpointed at once, so restoring a book after it never replays it
+    if (!(level->flags & BOOK_LEVEL_LAST) ||
+        (level->event_time < symbol->next_checkpoint_time && !(level->flags & BOOK_LEVEL_SNAPSHOT))) {
+        return;
+    }
+    
+    if (write_book_checkpoint(symbol) != 0) {
+        fprintf(stderr, "Error: Failed to checkpoint the order book of %s\n", symbol->name);
+    }
+    int64_t interval_ms = (int64_t)depth_checkpoint_sec * 1000;
+    symbol->next_checkpoint_time = (level->event_time / interval_ms + 1) * interval_ms;
+}
+
+/**
+ * Append the whole book to the book files (bids, then asks, best first) and index it with the
+ * position of the depth records that follow it (persist thread)
+ * The index entry is written last, so it never points at a partial checkpoint. The first level
+ * restarts the book, as a snapshot if the book was seeded by one.
+ * Returns 0 on success (or if the book is empty), -1 on failure
+ */
+int write_book_checkpoint(symbol_data_t *symbol) {
+    const order_book_t *book = symbol->book;
+    const book_side_t *sides[2] = { &book->bids, &book->asks };
+    size_t total = book->bids.count + book->asks.count;
+    size_t written = 0;
+    
+    if (total == 0) {
+        return 0;
+    }
+    
+    book_index_record_t index;
+    index.event_time = book->event_time;
+    index.update_id = book->update_id;
+    index.book_sequence = symbol->book_file->next_sequence;
+    index.level_count = total;
+    index.depth_sequence = symbol->depth_file->next_sequence;
+    
+    for (int s = 0; s < 2; s++) {
+        for (size_t i = 0; i < sides[s]->count; i++) {
+            book_level_record_t record;
+            record.event_time = book->event_time;
+            record.update_id = book->update_id;
+            record.price = sides[s]->levels[i].price;
+            record.quantity = sides[s]->levels[i].quantity;
+            record.side = s == 0 ? BOOK_SIDE_BID : BOOK_SIDE_ASK;
+            record.flags = (written == 0 ? BOOK_LEVEL_FIRST | BOOK_LEVEL_GAP : 0) |
+                           (written == total - 1 ? BOOK_LEVEL_LAST : 0) | (book->complete ? BOOK_LEVEL_SNAPSHOT : 0);
+            if (data_file_append(symbol->book_file, &record) != 0) {
+                return -1;
+            }
+            written++;
+        }
+    }
+    data_file_flush(symbol->book_file);
+    
+    if (data_file_append(symbol->book_index_file, &index) != 0) {
+        return -1;
+    }
+    data_file_flush(symbol->book_index_file);
+    return 0;
+}
+
+/**
+ * Print the back pressure between the pipeline stages over the last interval (seconds), and
+ * alert on every frame dropped or spilled and every record spilled
+ */
+void report_overload(double interval) {
+    static uint64_t prev_frames[3] = {0};
+    static uint64_t prev_spilled[MAX_SYMBOLS][3] = {{0}};
+    static uint64_t prev_blocked[MAX_SYMBOLS][3] = {{0}};
+    uint64_t frames[3] = {
+        atomic_load(&frames_blocked), atomic_load(&frames_dropped), atomic_load(&frames_spilled)
+    };
+    
+    if (parse_worker_count > 0) {
+        printf("\nParse queue: %llu frames waited, %llu dropped, %llu spilled\n",
+               (unsigned long long)(frames[0] - prev_frames[0]), (unsigned long long)(frames[1] - prev_frames[1]),
+               (unsigned long long)(frames[2] - prev_frames[2]));
+        if (frames[1] > prev_frames[1]) {
+            fprintf(stderr, "Alert: %llu frames dropped by the parse stage in the last %.1f seconds\n",
+                    (unsigned long long)(frames[1] - prev_frames[1]), interval);
+        }
+        if (frames[2] > prev_frames[2]) {
+            fprintf(stderr, "Alert: %llu frames spilled to the parse overflow file in the last %.1f seconds\n",
+                    (unsigned long long)(frames[2] - prev_frames[2]), interval);
+        }
+    }
+    memcpy(prev_frames, frames, sizeof(frames));
+    
+    printf("Persist queue | Trades queued | Klines queued | Depth queued | Overflow backlog | Spilled | Waits\n");
+    printf("--------------|---------------|---------------|--------------|------------------|---------|------\n");
+    for (size_t i = 0; i < symbol_count; i++) {
+        persist_queue_t *queues[3] = { &symbols[i].trade_queue, &symbols[i].kline_queue, &symbols[i].depth_queue };
+        uint64_t queued[3], backlog = 0, spilled = 0, blocked = 0;
+        
+        for (int q = 0; q < 3; q++) {
+            queued[q] = atomic_load(&queues[q]->head) - atomic_load(&queues[q]->tail);
+            backlog += (atomic_load(&queues[q]->spill_written) - atomic_load(&queues[q]->spill_read)) /
+                       sizeof(persist_entry_t) + atomic_load(&queues[q]->spill_pending);
+            
+            uint64_t count = atomic_load(&queues[q]->spilled);
+            spilled += count - prev_spilled[i][q];
+            prev_spilled[i][q] = count;
+            count = atomic_load(&queues[q]->blocked);
+            blocked += count - prev_blocked[i][q];
+            prev_blocked[i][q] = count;
+        }
+        
+        printf("%-14s| %-13llu | %-13llu | %-12llu | %-16llu | %-7llu | %llu\n", symbols[i].name,
+               (unsigned long long)queued[0], (unsigned long long)queued[1], (unsigned long long)queued[2],
+               (unsigned long long)backlog,
+               (unsigned long long)spilled, (unsigned long long)blocked);
+        if (spilled > 0) {
+            fprintf(stderr, "Alert: %llu records of %s spilled to overflow files in the last %.1f seconds\n",
+                    (unsigned long long)spilled, symbols[i].name, interval);
+        }
+        if (blocked > 0) {
+            fprintf(stderr, "Alert: Ingestion of %s waited for the disk %llu times in the last %.1f seconds\n",
+                    symbols[i].name, (unsigned long long)blocked, interval);
+        }
+    }
 }
 
 /**
@@ -598,13 +4048,9 @@ void signal_handler(int sig) {
  */
 int main(int argc, char **argv) {
     int ret = 0;
-    struct lws_client_connect_info ccinfo = {0};
-    struct lws *wsi_binance = NULL;
     const char *binance_host = "fstream.binance.com";
-    const char *path = "/stream";
     int logs_stdout = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE;
     int c;
-    char stream_path[1024] = {0};
     char **symbol_list = NULL;
     int opt_index = 0;
     
@@ -612,12 +4058,28 @@ int main(int argc, char **argv) {
     static struct option long_options[] = {
         {"symbol", required_argument, NULL, 's'},
         {"output", required_argument, NULL, 'o'},
+        {"cpu", required_argument, NULL, 'c'},
+        {"nic", required_argument, NULL, 'n'},
+        {"harden", no_argument, NULL, 'H'},
+        {"rt-priority", required_argument, NULL, 'p'},
+        {"durability", required_argument, NULL, 'd'},
+        {"trade-durability", required_argument, NULL, 'T'},
+        {"kline-durability", required_argument, NULL, 'K'},
+        {"writer", required_argument, NULL, 'w'},
+        {"segment-size", required_argument, NULL, 'S'},
+        {"connections", required_argument, NULL, 'C'},
+        {"parse-workers", required_argument, NULL, 'P'},
+        {"journal", no_argument, NULL, 'J'},
+        {"time-server", required_argument, NULL, 't'},
+        {"overflow", required_argument, NULL, 'O'},
+        {"stats-interval", required_argument, NULL, 'i'},
+        {"depth", required_argument, NULL, 'D'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0}
     };
 
     // Parse command line arguments
-    while ((c = getopt_long(argc, argv, "s:o:h", long_options, &opt_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "s:o:c:n:Hp:d:w:S:C:P:Jt:O:i:D:h", long_options, &opt_index)) != -1) {
         switch (c) {
             case 's':
                 // Parse symbol list (comma-separated)
@@ -652,12 +4114,179 @@ int main(int argc, char **argv) {
                 output_dir = strdup(optarg);
                 break;
                 
+            case 'c':
+                {
+                    char *end;
+                    errno = 0;
+                    long cpu = strtol(optarg, &end, 10);
+                    if (errno != 0 || end == optarg || *end != '\0' || cpu < 0 || cpu >= CPU_SETSIZE) {
+                        fprintf(stderr, "Error: Invalid CPU: %s (must be between 0 and %d)\n", optarg,
+                                CPU_SETSIZE - 1);
+                        return 1;
+                    }
+                    receive_cpu = (int)cpu;
+                }
+                break;
+                
+            case 'n':
+                nic_name = optarg;
+                break;
+                
+            case 'H':
+                harden_mode = 1;
+                break;
+                
+            case 'p':
+                // RECV[,PUB]: the publish priority defaults to one below the receive priority
+                {
+                    int min_priority = sched_get_priority_min(SCHED_FIFO);
+                    int max_priority = sched_get_priority_max(SCHED_FIFO);
+                    int fields, consumed = 0;
+                    fields = sscanf(optarg, "%d%n,%d%n", &receive_rt_priority, &consumed, &publish_rt_priority,
+                                    &consumed);
+                    if (fields == 1) {
+                        publish_rt_priority = receive_rt_priority > min_priority ? receive_rt_priority - 1 : 0;
+                    }
+                    if (fields < 1 || optarg[consumed] != '\0' ||
+                        receive_rt_priority < min_priority || receive_rt_priority > max_priority ||
+                        (publish_rt_priority != 0 &&
+                         (publish_rt_priority < min_priority || publish_rt_priority > max_priority))) {
+                        fprintf(stderr, "Error: Invalid SCHED_FIFO priority: %s (must be between %d and %d)\n",
+                                optarg, min_priority, max_priority);
+                        return 1;
+                    }
+                }
+                break;
+                
+            case 'd':
+            case 'T':
+            case 'K':
+                {
+                    durability_policy_t policy;
+                    if (parse_durability_policy(optarg, &policy) != 0) {
+                        fprintf(stderr, "Error: Invalid durability policy: %s\n", optarg);
+                        return 1;
+                    }
+                    if (c != 'K') trade_durability_policy = policy;
+                    if (c != 'T') kline_durability_policy = policy;
+                }
+                break;
+                
+            case 'w':
+                if (strcmp(optarg, "stdio") == 0) {
+                    writer_mode = WRITER_STDIO;
+                } else if (strcmp(optarg, "mmap") == 0) {
+                    writer_mode = WRITER_MMAP;
+                } else if (strcmp(optarg, "direct") == 0) {
+                    writer_mode = WRITER_DIRECT;
+                } else {
+                    fprintf(stderr, "Error: Unknown writer: %s\n", optarg);
+                    return 1;
+                }
+                break;
+                
+            case 'S':
+                segment_size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+                break;
+                
+            case 'C':
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "Error: Invalid connection count: %s\n", optarg);
+                    return 1;
+                }
+                shard_count = atoi(optarg);
+                break;
+                
+            case 'P':
+                if (atoi(optarg) < 0 || atoi(optarg) > MAX_PARSE_WORKERS) {
+                    fprintf(stderr, "Error: Parse workers must be between 0 and %d\n", MAX_PARSE_WORKERS);
+                    return 1;
+                }
+                parse_worker_count = atoi(optarg);
+                break;
+                
+            case 'J':
+                journal_mode = 1;
+                break;
+                
+            case 'O':
+                if (parse_overflow_policies(optarg) != 0) {
+                    fprintf(stderr, "Error: Invalid overflow policy: %s\n", optarg);
+                    return 1;
+                }
+                break;
+                
+            case 'D':
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "Error: Invalid order book checkpoint interval: %s\n", optarg);
+                    return 1;
+                }
+                depth_checkpoint_sec = atoi(optarg);
+                break;
+                
+            case 'i':
+                if (atoi(optarg) < STATS_MIN_INTERVAL_MS) {
+                    fprintf(stderr, "Error: Statistics interval must be at least %d ms\n", STATS_MIN_INTERVAL_MS);
+                    return 1;
+                }
+                stats_interval_ms = atoi(optarg);
+                break;
+                
+            case 't':
+                if (strncmp(optarg, "http://", 7) == 0) {
+                    optarg += 7;
+                } else if (strstr(optarg, "://")) {
+                    fprintf(stderr, "Error: Time server must be a plain HTTP host:port[/path]: %s\n", optarg);
+                    return 1;
+                }
+                if (strlen(optarg) >= sizeof(time_server)) {
+                    fprintf(stderr, "Error: Time server address too long: %s\n", optarg);
+                    return 1;
+                }
+                strcpy(time_server, optarg);
+                break;
+                
             case 'h':
             default:
                 printf("Usage: %s [options]\n", argv[0]);
                 printf("Options:\n");
                 printf("  -s, --symbol=SYM1,SYM2,...  Comma-separated list of symbols (e.g., btcusdt,ethusdt)\n");
                 printf("  -o, --output=DIR           Output directory for data files (default: ./data)\n");
+                printf("  -c, --cpu=N                Pin the receive thread to CPU N and keep its memory on N's NUMA node\n");
+                printf("  -n, --nic=IFACE            Place memory on the NUMA node of network interface IFACE\n");
+                printf("  -H, --harden               Latency-hardening mode: lock and pre-touch memory, SCHED_FIFO,\n");
+                printf("                             no THP, and report page faults/preemption on the hot threads\n");
+                printf("  -p, --rt-priority=RECV[,PUB]  SCHED_FIFO priorities of the receive and publish threads\n");
+                printf("                             (1-99, PUB 0 leaves it unprioritized; default with --harden: 80,79)\n");
+                printf("  -d, --durability=POLICY    fsync policy for all data files: none (default), periodic:MS,\n");
+                printf("                             records:N or kline-final\n");
+                printf("      --trade-durability=POLICY  fsync policy for trade files only\n");
+                printf("      --kline-durability=POLICY  fsync policy for kline files only\n");
+                printf("  -w, --writer=MODE          Data file writer: stdio (default), mmap (preallocated,\n");
+                printf("                             memory-mapped segments) or direct (O_DIRECT block writes\n");
+                printf("                             that bypass the page cache)\n");
+                printf("  -S, --segment-size=MB      Rotate data files into segments of MB megabytes\n");
+                printf("                             (default: unbounded for stdio, 256 for mmap)\n");
+                printf("  -C, --connections=N        Spread the symbols over up to N WebSocket connections, each\n");
+                printf("                             with its own receive thread, rebalanced by message rate\n");
+                printf("                             (default: 1)\n");
+                printf("  -P, --parse-workers=N      Parse frames on N worker threads, committed in arrival\n");
+                printf("                             order per symbol (default: 0, parse on the receive threads)\n");
+                printf("  -J, --journal              Also journal every received frame to DIR/journal_<run>.jsonl\n");
+                printf("                             (decoded into data segments by binance_journal)\n");
+                printf("  -O, --overflow=STAGE:POLICY[,...]  What a stage does when the queue to the next one is\n");
+                printf("                             full: parse:block|drop|spill (frames), persist:block|spill\n");
+                printf("                             (records); spill continues in an overflow file that is\n");
+                printf("                             drained in order. Default: block\n");
+                printf("  -t, --time-server=HOST:PORT[/PATH]  Probe a server-time endpoint over plain HTTP (e.g. a\n");
+                printf("                             local stand-in; default path %s) to separate the exchange\n", EXCHANGE_PROBE_PATH);
+                printf("                             clock offset from the network delay\n");
+                printf("  -D, --depth=SEC            Also collect the diff depth stream: every level of every update\n");
+                printf("                             to depth files, and the whole order book every SEC seconds to\n");
+                printf("                             book files with an index (restored at any time by book_reader);\n");
+                printf("                             books are seeded from REST snapshots of %s\n", DEPTH_SNAPSHOT_HOST);
+                printf("  -i, --stats-interval=MS    Interval between statistics reports (default: %d, at least %d)\n",
+                       LOG_INTERVAL_SEC * 1000, STATS_MIN_INTERVAL_MS);
                 printf("  -h, --help                 Show this help message\n");
                 return c == 'h' ? 0 : 1;
         }
@@ -676,6 +4305,34 @@ int main(int argc, char **argv) {
         symbol_count = MAX_SYMBOLS;
     }
     
+    // More connections than symbols would leave some without streams
+    if (shard_count > symbol_count) {
+        shard_count = symbol_count;
+    }
+    
+    // Without parse workers frames are parsed as they arrive: there is no parse queue to overflow
+    if (parse_overflow != OVERFLOW_BLOCK && parse_worker_count == 0) {
+        fprintf(stderr, "Error: The parse stage overflow policy needs parse workers (--parse-workers)\n");
+        return 1;
+    }
+    
+    // Place threads and memory before anything is allocated
+    if (init_numa_placement() != 0) {
+        fprintf(stderr, "Error: Failed to apply NUMA placement\n");
+        return 1;
+    }
+    
+    if (harden_mode) {
+        if (receive_rt_priority == 0) {
+            receive_rt_priority = 80;
+            publish_rt_priority = 79;
+        }
+        if (init_latency_hardening() != 0) {
+            fprintf(stderr, "Error: Failed to enter latency-hardening mode\n");
+            return 1;
+        }
+    }
+    
     // Register signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -690,11 +4347,17 @@ int main(int argc, char **argv) {
         }
     }
     
+    // Finalized segments are listed in the catalog; collection goes on without it
+    if (catalog_open(&catalog, output_dir) != 0) {
+        fprintf(stderr, "Warning: Segments of this run will not be cataloged\n");
+    }
+    
+    // All segments of this run share its start time in their names
+    run_id = time(NULL);
+    
     // Initialize symbol data structures
     for (size_t i = 0; i < symbol_count; i++) {
         char symbol_dir[PATH_MAX];
-        char trade_file_path[PATH_MAX];
-        char kline_file_path[PATH_MAX];
         
         // Convert symbol to uppercase
         char *symbol = symbol_list[i];
@@ -716,27 +4379,55 @@ int main(int argc, char **argv) {
         }
         
         // Create and open output files
-        snprintf(trade_file_path, sizeof(trade_file_path), 
-                 "%s/%s/trades_%ld.bin", output_dir, symbols[i].name, time(NULL));
-        snprintf(kline_file_path, sizeof(kline_file_path), 
-                 "%s/%s/klines_%ld.bin", output_dir, symbols[i].name, time(NULL));
-        
-        symbols[i].trade_file = fopen(trade_file_path, "wb");
-        if (!symbols[i].trade_file) {
+        if (open_data_file(&symbols[i].trade_file, DATA_TYPE_TRADE, symbol_dir, 
+                           symbols[i].name, &trade_durability_policy) != 0) {
             fprintf(stderr, "Error: Failed to open trade file for symbol %s\n", symbols[i].name);
             ret = 1;
             goto cleanup;
         }
         
-        symbols[i].kline_file = fopen(kline_file_path, "wb");
-        if (!symbols[i].kline_file) {
+        if (open_data_file(&symbols[i].kline_file, DATA_TYPE_KLINE, symbol_dir, 
+                           symbols[i].name, &kline_durability_policy) != 0) {
             fprintf(stderr, "Error: Failed to open kline file for symbol %s\n", symbols[i].name);
             ret = 1;
             goto cleanup;
         }
         
+        // Depth updates, order book checkpoints and their index
+        if (depth_checkpoint_sec > 0) {
+            durability_policy_t depth_policy = { DURABILITY_NONE, 0 };
+            if (open_data_file(&symbols[i].depth_file, DATA_TYPE_DEPTH, symbol_dir, symbols[i].name,
+                               &depth_policy) != 0 ||
+                open_data_file(&symbols[i].book_file, DATA_TYPE_BOOK, symbol_dir, symbols[i].name,
+                               &depth_policy) != 0 ||
+                open_data_file(&symbols[i].book_index_file, DATA_TYPE_BOOK_INDEX, symbol_dir, symbols[i].name,
+                               &depth_policy) != 0) {
+                fprintf(stderr, "Error: Failed to open depth files for symbol %s\n", symbols[i].name);
+                ret = 1;
+                goto cleanup;
+            }
+        }
+        
         // Initialize other data fields
         init_symbol_data(&symbols[i]);
+        if (init_persist_queue(&symbols[i].trade_queue, symbols[i].trade_file) != 0 ||
+            init_persist_queue(&symbols[i].kline_queue, symbols[i].kline_file) != 0) {
+            fprintf(stderr, "Error: Failed to set up persist queues for symbol %s\n", symbols[i].name);
+            ret = 1;
+            goto cleanup;
+        }
+        if (depth_checkpoint_sec > 0) {
+            symbols[i].book = malloc(sizeof(order_book_t));
+            if (!symbols[i].book || init_persist_queue(&symbols[i].depth_queue, symbols[i].depth_file) != 0) {
+                fprintf(stderr, "Error: Failed to set up the order book of symbol %s\n", symbols[i].name);
+                ret = 1;
+                goto cleanup;
+            }
+            book_init(symbols[i].book);
+        }
+        
+        // Start round-robin over the connections; the balance thread moves symbols by rate
+        atomic_store(&symbols[i].owner_shard, (int)(i % shard_count));
         
         printf("Initialized data collection for symbol: %s\n", symbols[i].name);
     }
@@ -747,100 +4438,151 @@ int main(int argc, char **argv) {
         ret = 1;
         goto cleanup;
     }
+    if (shm_header->clock.source == CLOCK_SOURCE_TSC) {
+        printf("Receive clock: TSC at %.3f MHz\n", shm_header->clock.tsc_hz / 1e6);
+    } else {
+        printf("Receive clock: CLOCK_REALTIME (no invariant TSC)\n");
+    }
+    
+    // Open the journal before any frame arrives
+    if (journal_mode && open_journal("journal", &journal_file, &journal_buffer) != 0) {
+        ret = 1;
+        goto cleanup;
+    }
+    
+    if (parse_overflow == OVERFLOW_SPILL && parse_worker_count > 0 && open_parse_spill() != 0) {
+        ret = 1;
+        goto cleanup;
+    }
+    
+    // Start the persist thread and the parse workers before any frame arrives
+    if (create_helper_thread(&persist_thread, persist_thread_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to create persist thread\n");
+        ret = 1;
+        goto cleanup;
+    }
+    
+    if (parse_worker_count > 0 && init_parse_workers() != 0) {
+        fprintf(stderr, "Error: Failed to start parse workers\n");
+        ret = 1;
+        goto cleanup;
+    }
+    
+    if (harden_mode) {
+        pretouch_buffers();
+    }
+    
+    // The receive thread is the one running the event loop
+    atomic_store(&shards[0].tid, (pid_t)syscall(SYS_gettid));
+    if (harden_mode) {
+        prefault_stack();
+    }
+    if (receive_rt_priority > 0) {
+        set_realtime_priority(receive_rt_priority);
+    }
     
     // Start statistics thread
-    if (pthread_create(&stats_thread, NULL, stats_thread_func, NULL) != 0) {
+    if (create_helper_thread(&stats_thread, stats_thread_func, NULL) != 0) {
         fprintf(stderr, "Error: Failed to create statistics thread\n");
         ret = 1;
         goto cleanup;
     }
     
     // Start shared memory update thread
-    if (pthread_create(&shm_update_thread, NULL, shm_update_thread_func, NULL) != 0) {
+    if (create_helper_thread(&shm_update_thread, shm_update_thread_func, NULL) != 0) {
         fprintf(stderr, "Error: Failed to create shared memory update thread\n");
         ret = 1;
         goto cleanup;
     }
     
-    // Initialize libwebsockets
-    lws_set_log_level(logs_stdout, NULL);
-    
-    struct lws_context_creation_info info;
-    memset(&info, 0, sizeof(info));
-    
-    info.port = CONTEXT_PORT_NO_LISTEN;
-    info.protocols = protocols;
-    info.gid = -1;
-    info.uid = -1;
-    info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
-    
-    lws_context = lws_create_context(&info);
-    if (!lws_context) {
-        fprintf(stderr, "Error: Failed to create libwebsocket context\n");
+    // Start data file maintenance (durability, segment finalization) thread
+    if (create_helper_thread(&sync_thread, sync_thread_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to create durability thread\n");
         ret = 1;
         goto cleanup;
     }
     
-    // Construct WebSocket path with streams
-    strcat(stream_path, path);
-    strcat(stream_path, "?streams=");
+    // Initialize libwebsockets
+    lws_set_log_level(logs_stdout, NULL);
     
-    // Add streams for each symbol (aggTrade and kline)
-    for (size_t i = 0; i < symbol_count; i++) {
-        // Convert symbol to lowercase for Binance API
-        char lower_symbol[MAX_SYMBOL_LENGTH];
-        strncpy(lower_symbol, symbols[i].name, sizeof(lower_symbol) - 1);
-        lower_symbol[sizeof(lower_symbol) - 1] = '\0';
+    // Open the connections; connection 0 is serviced by this (receive) thread
+    for (size_t i = 0; i < shard_count; i++) {
+        shards[i].id = i;
+        pthread_mutex_init(&shards[i].command_mutex, NULL);
         
-        for (int j = 0; lower_symbol[j]; j++) {
-            lower_symbol[j] = tolower(lower_symbol[j]);
+        if (connect_shard(&shards[i], binance_host) != 0) {
+            ret = 1;
+            goto cleanup;
         }
         
-        // Add aggTrade stream
-        if (i > 0) strcat(stream_path, "/");
-        strcat(stream_path, lower_symbol);
-        strcat(stream_path, "@aggTrade");
-        
-        // Add kline stream for 1m interval
-        strcat(stream_path, "/");
-        strcat(stream_path, lower_symbol);
-        strcat(stream_path, "@kline_1m");
+        if (i > 0 && create_helper_thread(&shards[i].thread, shard_thread_func, &shards[i]) != 0) {
+            fprintf(stderr, "Error: Failed to create receive thread for connection %zu\n", i);
+            ret = 1;
+            goto cleanup;
+        }
     }
     
-    printf("Connecting to WebSocket: wss://%s%s\n", binance_host, stream_path);
+    // Start symbol rebalancing between connections
+    if (shard_count > 1 && create_helper_thread(&balance_thread, balance_thread_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to create balance thread\n");
+        ret = 1;
+        goto cleanup;
+    }
     
-    // Connect to Binance WebSocket
-    memset(&ccinfo, 0, sizeof(ccinfo));
-    ccinfo.context = lws_context;
-    ccinfo.address = binance_host;
-    ccinfo.port = 443;
-    ccinfo.path = stream_path;
-    ccinfo.host = ccinfo.address;
-    ccinfo.origin = ccinfo.address;
-    ccinfo.protocol = protocols[0].name;
-    ccinfo.ssl_connection = LCCSCF_USE_SSL;
+    // Start the server-time probes
+    if (time_server[0] && create_helper_thread(&probe_thread, probe_thread_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to create time probe thread\n");
+        ret = 1;
+        goto cleanup;
+    }
     
-    wsi_binance = lws_client_connect_via_info(&ccinfo);
-    if (!wsi_binance) {
-        fprintf(stderr, "Error: Failed to connect to Binance WebSocket\n");
+    // Start fetching the depth snapshots the books are seeded from
+    if (depth_checkpoint_sec > 0 && create_helper_thread(&snapshot_thread, snapshot_thread_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to create depth snapshot thread\n");
         ret = 1;
         goto cleanup;
     }
     
     printf("Data collection started. Press Ctrl+C to exit.\n");
     
-    // Event loop
+    // Event loop of the first connection (blocks in poll like the other receive threads)
     while (!force_exit) {
-        lws_service(lws_context, 100);
-        
-        // Small sleep to avoid CPU spinning
-        usleep(1000); // 1ms
+        lws_service(shards[0].context, 100);
     }
     
     printf("\nShutting down...\n");
     
 cleanup:
-    // Join threads
+    // Stop and join threads
+    force_exit = 1;
+    
+    // Stop the receive threads first: the parse workers finish their frames, and appends may
+    // still need the maintenance thread
+    for (size_t i = 1; i < shard_count; i++) {
+        if (shards[i].thread) {
+            pthread_join(shards[i].thread, NULL);
+        }
+    }
+    
+    if (snapshot_thread) {
+        pthread_join(snapshot_thread, NULL);
+    }
+    
+    if (parse_slots) {
+        stop_parse_workers();
+    }
+    
+    // Then the persist thread, once the records still queued or spilled are in the data files
+    if (persist_thread) {
+        stop_persist_thread();
+    }
+    
+    close_journal(&journal_file, &journal_buffer);
+    
+    pthread_mutex_lock(&sync_mutex);
+    pthread_cond_signal(&sync_cond);
+    pthread_mutex_unlock(&sync_mutex);
+    
     if (stats_thread) {
         pthread_join(stats_thread, NULL);
     }
@@ -849,20 +4591,59 @@ cleanup:
         pthread_join(shm_update_thread, NULL);
     }
     
+    if (sync_thread) {
+        pthread_join(sync_thread, NULL);
+    }
+    
+    if (balance_thread) {
+        pthread_join(balance_thread, NULL);
+    }
+    
+    if (probe_thread) {
+        pthread_join(probe_thread, NULL);
+    }
+    
+    // Make everything written so far durable before closing, per policy
+    sync_data_files(1);
+    
     // Cleanup symbol data
     for (size_t i = 0; i < symbol_count; i++) {
         pthread_mutex_destroy(&symbols[i].mutex);
+        free_persist_queue(&symbols[i].trade_queue);
+        free_persist_queue(&symbols[i].kline_queue);
+        free_persist_queue(&symbols[i].depth_queue);
+        
+        if (symbols[i].book) {
+            book_free(symbols[i].book);
+            free(symbols[i].book);
+            symbols[i].book = NULL;
+        }
+        restart_depth_sync(&symbols[i]);
+        free(symbols[i].depth_backlog);
+        symbols[i].depth_backlog = NULL;
+        
+        data_file_t **depth_files[3] = { &symbols[i].depth_file, &symbols[i].book_file, &symbols[i].book_index_file };
+        for (int f = 0; f < 3; f++) {
+            if (*depth_files[f]) {
+                data_file_close(*depth_files[f]);
+                free(*depth_files[f]);
+                *depth_files[f] = NULL;
+            }
+        }
         
         if (symbols[i].trade_file) {
-            fclose(symbols[i].trade_file);
+            data_file_close(symbols[i].trade_file);
+            free(symbols[i].trade_file);
             symbols[i].trade_file = NULL;
         }
         
         if (symbols[i].kline_file) {
-            fclose(symbols[i].kline_file);
+            data_file_close(symbols[i].kline_file);
+            free(symbols[i].kline_file);
             symbols[i].kline_file = NULL;
         }
     }
+    catalog_close(&catalog);
     
     // Free symbol list
     if (symbol_list) {
@@ -873,9 +4654,11 @@ cleanup:
     }
     
     // Cleanup libwebsockets
-    if (lws_context) {
-        lws_context_destroy(lws_context);
-        lws_context = NULL;
+    for (size_t i = 0; i < shard_count; i++) {
+        if (shards[i].context) {
+            lws_context_destroy(shards[i].context);
+            shards[i].context = NULL;
+        }
     }
     
     // Cleanup shared memory
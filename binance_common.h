@@ -10,8 +10,27 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#if defined(__cplusplus) && __cplusplus <= 202002L
+// C++ has <stdatomic.h> only from C++23; std::atomic of the same types has the same layout
+#include <atomic>
+#define _Atomic(T) std::atomic<T>
+typedef std::atomic<int> atomic_int;
+typedef std::atomic<unsigned int> atomic_uint;
+typedef std::atomic<size_t> atomic_size_t;
+typedef std::atomic<int_fast64_t> atomic_int_fast64_t;
+typedef std::atomic<uint_fast64_t> atomic_uint_fast64_t;
+// For the inline helpers shared with C (binance_clock.h)
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_thread_fence;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+#else
 #include <stdatomic.h>
+#endif
 #include <pthread.h>
+#include <limits.h>
 
 // Define the maximum number of symbols to track
 #define MAX_SYMBOLS 10
@@ -19,15 +38,32 @@
 
 // Define buffer sizes
 #define MAX_PAYLOAD 65536                     // 64KB max for a single message
-#define MAX_RECORDS_PER_SYMBOL 100            // Maximum records to store per symbol in shared memory
+#define MAX_RECORDS_PER_SYMBOL 256            // Maximum records to store per symbol in shared memory
+                                              // (covers the two unwritten blocks of an O_DIRECT data file)
+#define FILE_BUFFER_SIZE (64 * 1024)          // stdio buffer per data segment in latency-hardening mode
+#define PERSIST_QUEUE_ENTRIES 8192            // Records queued per data file for the persist thread (power of two)
+#define PERSIST_SPILL_BUFFER (64 * 1024)      // Records gathered before a write to the overflow file
 
 // Define shared memory size
 #define SHM_SIZE (64 * 1024 * 1024)          // 64MB shared memory
+#define SHM_BUFFER_ALIGN 64                   // Symbol buffers start on a cache line, as their rings must
+#define SHM_SNAPSHOT_SIZE (64 * 1024)         // Snapshot area at the start of each symbol's buffer
+#define SHM_TRADE_RING_SLOTS 32768            // Slots in each symbol's live trade ring (power of two)
+#define SHM_KLINE_RING_SLOTS 8192             // Slots in each symbol's live kline ring (power of two)
+#define SHM_SLOT_BUSY UINT64_MAX              // Slot sequence while the producer rewrites the slot
 
 // Define log intervals
-#define LOG_INTERVAL_SEC 5                    // Log stats every 5 seconds
+#define LOG_INTERVAL_SEC 5                    // Log stats every 5 seconds (default)
 #define SHM_UPDATE_INTERVAL_MS 500            // Update shared memory every 500ms
 
+// Define connection sharding
+#define MAX_SHARDS MAX_SYMBOLS                // WebSocket connections (one per symbol at most)
+#define BALANCE_POLL_MS 1000                  // Sample message rates and check moves every second
+#define RATE_SMOOTHING_SEC 10                 // Time constant of the measured message rates
+#define REBALANCE_INTERVAL_SEC 30             // Minimum time between two symbol moves
+#define REBALANCE_MIN_GAIN 0.25               // Move only if the busiest connection's rate drops by 25%
+#define MIGRATION_TIMEOUT_SEC 10              // Give up on (or, for a quiet symbol, finish) a move after 10s
+
 // Trading record structure (packed to minimize memory usage)
 typedef struct __attribute__((packed)) {
     int64_t event_time;     // Event timestamp
@@ -51,37 +87,233 @@ typedef struct __attribute__((packed)) {
     uint8_t is_final;       // Indicates if this kline is final
 } kline_record_t;           // 57 bytes without padding
 
+// Order book level flags
+#define BOOK_LEVEL_FIRST 1          // First level of a depth update or of a checkpoint
+#define BOOK_LEVEL_LAST 2           // Last level of a depth update or of a checkpoint
+#define BOOK_LEVEL_GAP 4            // The book restarts empty: updates were missed before this one, or a whole book follows
+#define BOOK_LEVEL_SNAPSHOT 8       // Level of a whole book (a REST snapshot, or a checkpoint of a book seeded by one)
+
+// Order book sides
+#define BOOK_SIDE_BID 1
+#define BOOK_SIDE_ASK 2
+
+// Order book level record: one level of a depth update (depth files), or of the whole book at
+// a checkpoint (book files)
+typedef struct __attribute__((packed)) {
+    int64_t event_time;     // Event time of the update, or of the last update in the checkpoint
+    int64_t update_id;      // Final update id of the update, or of the last update in the checkpoint
+    double price;           // Price of the level
+    double quantity;        // Quantity at the price after the update (0: level removed)
+    uint8_t side;           // BOOK_SIDE_BID or BOOK_SIDE_ASK
+    uint8_t flags;          // BOOK_LEVEL_* flags
+} book_level_record_t;      // 34 bytes without padding
+
+// Order book checkpoint index record (bookindex files)
+typedef struct __attribute__((packed)) {
+    int64_t event_time;     // Event time of the last update in the checkpoint
+    int64_t update_id;      // Final update id of the last update in the checkpoint
+    uint64_t book_sequence; // Sequence of the checkpoint's first level in the book files
+    uint64_t level_count;   // Levels in the checkpoint (bids, then asks)
+    uint64_t depth_sequence; // Sequence of the first depth record after the checkpoint
+} book_index_record_t;      // 40 bytes
+
+// Panel columns of one symbol at a grid time (panel files: each row is the int64_t grid time in ms,
+// then one of these per symbol, in the order of the panel's columns file)
+typedef struct __attribute__((packed)) {
+    double last_price;      // Price of the last trade received by the grid time (NaN: none yet)
+    double volume;          // Base volume of the trades received in the volume window before it
+    int64_t kline_open_time; // Open time of the latest candle received (0: none yet)
+    double open_price;      // Latest candle, as last received (live until is_final)
+    double high_price;
+    double low_price;
+    double close_price;
+    double kline_volume;
+} panel_columns_t;          // 64 bytes
+
 // Data type enum
 typedef enum {
     DATA_TYPE_TRADE = 1,
-    DATA_TYPE_KLINE = 2
+    DATA_TYPE_KLINE = 2,
+    DATA_TYPE_DEPTH = 3,        // book_level_record_t of depth updates
+    DATA_TYPE_BOOK = 4,         // book_level_record_t of checkpoints
+    DATA_TYPE_BOOK_INDEX = 5,   // book_index_record_t
+    DATA_TYPE_PANEL = 6         // Panel rows (the size depends on the symbol count)
 } data_type_t;
 
 // Message header structure for the shared memory
 typedef struct __attribute__((packed)) {
     data_type_t type;       // Type of data (trade or kline)
     uint32_t length;        // Length of data
-    int64_t timestamp;      // System timestamp when received
+    int64_t timestamp;      // Receive time (ns since epoch, from the TSC clock of binance_clock.h)
+    uint64_t sequence;      // Index of the record in the symbol's data files of this type
     char symbol[MAX_SYMBOL_LENGTH]; // Symbol name
 } message_header_t;
 
+// One slot of a live ring
+typedef struct __attribute__((aligned(64))) {
+    atomic_uint_fast64_t sequence; // Sequence of the record in the slot (SHM_SLOT_BUSY while written)
+    message_header_t header;
+    union {
+        trade_record_t trade;
+        kline_record_t kline;
+    } record;
+} shm_slot_t;                      // 128 bytes
+
+// Live ring of one symbol's records of one type, written by the receive thread as records arrive
+// Slot i holds sequence i modulo capacity; the producer never waits for readers.
+typedef struct __attribute__((aligned(64))) {
+    atomic_uint_fast64_t published; // Records published so far (sequence of the next record)
+    uint64_t capacity;              // Number of slots (power of two)
+    shm_slot_t slots[];
+} shm_ring_t;
+
+// Calibration of the TSC clock (see binance_clock.h), published by the writer of the shared memory
+// ns = ns_base + (((ticks - tsc_base) * mult) >> shift), read under the sequence lock
+typedef struct __attribute__((aligned(64))) {
+    atomic_uint sequence;      // Odd while the calibration is rewritten
+    uint32_t source;           // CLOCK_SOURCE_TSC or CLOCK_SOURCE_REALTIME (0 until calibrated)
+    uint32_t shift;
+    uint64_t mult;             // Nanoseconds per tick << shift
+    uint64_t tsc_base;         // Ticks at the last calibration point
+    int64_t ns_base;           // CLOCK_REALTIME at tsc_base (ns since epoch)
+    uint64_t tsc_origin;       // First calibration point; the rate is measured from there
+    int64_t ns_origin;
+    uint64_t tsc_hz;           // Measured tick rate
+} clock_calibration_t;
+
+// Exchange clock estimate flags
+#define EXCHANGE_CLOCK_EVENTS 1    // Offset and drift fitted to the smallest event-time-to-receive delays
+#define EXCHANGE_CLOCK_PROBED 2    // Offset measured by server-time probes (network floor separated)
+
+// Offset of the receive clock from the exchange's clock, published by the collector
+// offset at receive time t = offset_ns + drift_ppb * (t - ref_ns) / 1e9, read under the sequence lock
+typedef struct __attribute__((aligned(64))) {
+    atomic_uint sequence;      // Odd while the estimate is rewritten
+    uint32_t flags;            // EXCHANGE_CLOCK_* (0 until estimated: offset 0)
+    int64_t ref_ns;            // Receive time the estimate refers to
+    int64_t offset_ns;         // Receive clock minus exchange clock at ref_ns
+    int64_t drift_ppb;         // Change of the offset, ns per second of receive clock
+    int64_t floor_ns;          // Smallest one-way delay seen after the offset (0 unless probed)
+    int64_t probe_rtt_ns;      // Round trip of the probe the offset comes from (0 unless probed)
+    uint32_t windows;          // Windows the fit covers
+} exchange_clock_t;
+
 // Shared memory structure
 typedef struct __attribute__((aligned(64))) {
     atomic_uint_fast64_t write_counter;  // Number of writes to shared memory
     atomic_uint_fast64_t last_update_time; // Last update timestamp
+    atomic_uint notify_seq;    // Futex word, bumped when records are published while a reader is armed
+    atomic_uint notify_armed;  // Set by a reader before it waits on notify_seq
     size_t data_offset;        // Offset where actual data begins
     size_t buffer_size;        // Size of each symbol's buffer area
     size_t symbol_count;       // Number of active symbols
     char symbols[MAX_SYMBOLS][MAX_SYMBOL_LENGTH]; // Symbol names
+    int32_t numa_node[MAX_SYMBOLS]; // NUMA node backing each symbol's buffer (-1 if unbound)
+    atomic_uint_fast64_t persisted_trades[MAX_SYMBOLS]; // Trade records already in the data files
+    atomic_uint_fast64_t persisted_klines[MAX_SYMBOLS]; // Kline records already in the data files
+                                                        // (later sequences are only in shared memory)
+    size_t trade_ring_offset;  // Offset of the live trade ring within each symbol's buffer
+    size_t kline_ring_offset;  // Offset of the live kline ring within each symbol's buffer
+    int64_t run_id;            // Collector run id (part of every data segment name)
+    char output_dir[PATH_MAX]; // Absolute output directory (segments are in <output_dir>/<symbol>/)
+    clock_calibration_t clock; // Converts the ticks of clock_ticks() to wall time
+    exchange_clock_t exchange_clock; // Converts exchange times (E, T) to the receive clock
     // Data buffers follow this header in memory
 } shared_memory_header_t;
 
+// Segmented data file writer (see binance_segment.h)
+typedef struct data_file data_file_t;
+
+// Order book rebuilt from depth updates (see binance_book.h)
+typedef struct order_book order_book_t;
+
+// Durability levels for data files
+typedef enum {
+    DURABILITY_NONE = 0,        // Leave writeback to the kernel (data survives a process crash only)
+    DURABILITY_PERIODIC,        // fdatasync every N milliseconds
+    DURABILITY_RECORDS,         // fdatasync once N records are pending
+    DURABILITY_KLINE_FINAL      // fdatasync whenever one of the symbol's klines closes
+} durability_level_t;
+
+// Durability policy of one kind of data file
+typedef struct {
+    durability_level_t level;
+    uint32_t param;             // Interval in ms (periodic) or record count (records)
+} durability_policy_t;
+
+// Durability state of one data file
+typedef struct {
+    atomic_uint_fast64_t written;           // Records handed to the kernel
+    atomic_uint_fast64_t synced;            // Records known to be on stable storage
+    atomic_int_fast64_t oldest_unsynced_ms; // Write time of the oldest unsynced record (0 if none)
+    atomic_int sync_requested;              // Set by the ingest path when the policy calls for a sync
+    int64_t last_sync_ms;                   // Time of the last sync (sync thread only)
+} file_durability_t;
+
+// What a pipeline stage does with a frame or record when the queue to the next stage is full
+typedef enum {
+    OVERFLOW_BLOCK = 0,         // Wait for room (back pressure up to the socket)
+    OVERFLOW_DROP,              // Discard it (counted)
+    OVERFLOW_SPILL              // Write it to an overflow file instead (counted)
+} overflow_policy_t;
+
+// A record waiting in a persist queue
+typedef struct {
+    int64_t event_time;         // Exchange event time (ms)
+    union {
+        trade_record_t trade;
+        kline_record_t kline;
+        book_level_record_t level;
+    } record;
+} persist_entry_t;
+
+// Bounded queue of one data file's records between the ingest path and the persist thread
+// With the spill policy, records that find the queue full continue, in order, in an unlinked
+// overflow file until the persist thread has caught up with it.
+typedef struct {
+    persist_entry_t *entries;   // PERSIST_QUEUE_ENTRIES entries
+    atomic_uint_fast64_t head;  // Entries queued (ingest path)
+    atomic_uint_fast64_t tail;  // Entries appended to the data file (persist thread)
+    uint64_t next_sequence;     // Sequence of the next record (ingest path)
+    int spilling;               // New records go to the overflow file (ingest path)
+    int spill_fd;               // Overflow file (-1 until the first spill)
+    char *spill_buffer;         // Records not yet written to the overflow file (ingest path)
+    size_t spill_fill;
+    atomic_size_t spill_pending; // Records in spill_buffer, for the persist thread
+    atomic_uint_fast64_t spill_written; // Bytes written to the overflow file (ingest path)
+    atomic_uint_fast64_t spill_read;    // Bytes of it appended to the data file (persist thread)
+    atomic_uint_fast64_t spilled;       // Records ever spilled
+    atomic_uint_fast64_t blocked;       // Times the ingest path waited for room
+} persist_queue_t;
+
+// A depth update (or a REST depth snapshot) with the update ids that chain it to the others
+typedef struct {
+    int64_t event_time;         // Event time ("E"; transaction time "T" of a snapshot)
+    int64_t first_update_id;    // First update id ("U"; lastUpdateId of a snapshot)
+    int64_t update_id;          // Final update id ("u"; lastUpdateId of a snapshot)
+    int64_t prev_update_id;     // Final update id of the update before it ("pu"; -1 if none)
+    book_level_record_t *levels; // Levels (allocated; NULL if none)
+    size_t count;
+} depth_update_t;
+
 // Symbol data structure for collecting data
 typedef struct {
     char name[MAX_SYMBOL_LENGTH];
-    FILE *trade_file;       // File for storing trade data
-    FILE *kline_file;       // File for storing kline data
+    data_file_t *trade_file; // File for storing trade data
+    data_file_t *kline_file; // File for storing kline data
     pthread_mutex_t mutex;  // Mutex for thread safety
+    file_durability_t trade_durability; // Sync progress of trade_file
+    file_durability_t kline_durability; // Sync progress of kline_file
+    persist_queue_t trade_queue; // Records on their way to trade_file
+    persist_queue_t kline_queue; // Records on their way to kline_file
+    data_file_t *depth_file;     // Depth update levels (NULL unless depth is collected)
+    data_file_t *book_file;      // Order book checkpoints
+    data_file_t *book_index_file; // Index of the checkpoints
+    persist_queue_t depth_queue; // Levels on their way to depth_file
+    order_book_t *book;          // Book rebuilt from the persisted levels (persist thread only)
+    int64_t next_checkpoint_time; // Event time from which the next checkpoint is due (persist thread only)
+    shm_ring_t *trade_ring; // Live rings in shared memory (NULL until shared memory is set up)
+    shm_ring_t *kline_ring;
     
     // Recent data storage for shared memory
     struct {
@@ -102,10 +334,21 @@ typedef struct {
         } klines;
     } recent_data;
     
-    atomic_uint_fast64_t trade_count;
-    atomic_uint_fast64_t kline_count;
-    atomic_uint_fast64_t message_count;  // Number of messages processed
-    atomic_uint_fast64_t bytes_processed; // Number of bytes processed
+    // Connection sharding
+    pthread_mutex_t ingest_mutex; // Serializes ingestion while two connections deliver the symbol
+    int64_t last_trade_id;        // Last aggregate trade id recorded (under ingest_mutex)
+    int64_t last_kline_event_time; // Event and open time of the last kline recorded (under ingest_mutex)
+    int64_t last_kline_open_time;
+    int64_t last_depth_update_id; // Final update id of the last depth update accepted (under ingest_mutex)
+    int depth_synced;             // Depth updates are recorded as they come: the book was seeded by a snapshot
+    depth_update_t *depth_backlog; // Updates held back until a snapshot covers them (ring, under ingest_mutex)
+    size_t depth_backlog_start;
+    size_t depth_backlog_count;
+    depth_update_t depth_snapshot; // Snapshot waiting for the update that continues it (levels NULL if none)
+    atomic_int depth_snapshot_wanted; // Set when the book needs a snapshot (taken by the snapshot thread)
+    atomic_int owner_shard;       // Connection whose records are recorded as they come
+    atomic_int target_shard;      // Connection the symbol is moving to (-1 if none)
+    double rate;                  // Smoothed messages/sec (balance thread only)
 } symbol_data_t;
 
 #endif /* BINANCE_COMMON_H */
\ No newline at end of file
@@ -0,0 +1,683 @@
+/**
+* binance_consumer.c
+*
+* Consumer library for Binance data collector: history from data segments, then the live ring
+*
+* A consumer first streams the symbol's data segments (older runs, then the current run) through
+* read-only mappings. Records of the current run carry the same sequence numbers in the files
+* and in the live ring, so once the segments are exhausted the consumer switches to the ring at
+* exactly the next sequence, as long as the ring still holds it; otherwise it keeps reading the
+* segments, which by then have grown past that point.
+*
+* A live consumer that falls more than a ring behind notices it from the sequence numbers,
+* seeks the data files to the first record it missed and rejoins the ring the same way.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "binance_consumer.h"
+#include "binance_segment.h"
+#include "binance_clock.h"
+
+// The notification words must lie in the page readers map writable
+_Static_assert(offsetof(shared_memory_header_t, notify_armed) + sizeof(atomic_uint) <= SHM_NOTIFY_MAP_SIZE,
+               "notification words outside the writable page");
+
+// Function declarations
+static int consumer_scan_segments(consumer_t *consumer);
+static int consumer_map_segment(consumer_t *consumer);
+static void consumer_unmap_segment(consumer_t *consumer);
+static uint64_t consumer_segment_records(consumer_t *consumer, segment_header_t *header);
+static int64_t consumer_record_time(consumer_t *consumer, const void *record);
+static int consumer_next_history(consumer_t *consumer, consumer_record_t *record);
+static int consumer_next_live(consumer_t *consumer, consumer_record_t *record);
+static int consumer_segment_base(consumer_t *consumer, size_t pos, uint64_t *base);
+
+/**
+ * Order segments by run, then by index within the run
+ */
+static int compare_segments(const void *a, const void *b) {
+    const consumer_segment_t *sa = a;
+    const consumer_segment_t *sb = b;
+
+    if (sa->run_id != sb->run_id) {
+        return sa->run_id < sb->run_id ? -1 : 1;
+    }
+    if (sa->index != sb->index) {
+        return sa->index < sb->index ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * (Re)list the symbol's segments of the consumer's type, keeping the position in the current one
+ * Segments of runs newer than the collector's current run are ignored (file consumers take all).
+ * Returns the number of segments found, or -1 on failure
+ */
+static int consumer_scan_segments(consumer_t *consumer) {
+    const char *prefix = consumer->type == DATA_TYPE_TRADE ? "trades_" : "klines_";
+    size_t prefix_len = strlen(prefix);
+    consumer_segment_t current = { 0 };
+    int have_current = consumer->segment_pos < consumer->segment_count;
+
+    if (have_current) {
+        current = consumer->segments[consumer->segment_pos];
+    }
+
+    DIR *dir = opendir(consumer->dir);
+    if (!dir) {
+        fprintf(stderr, "Failed to open segment directory %s: %s\n", consumer->dir, strerror(errno));
+        return -1;
+    }
+
+    consumer_segment_t *segments = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        long long run;
+        unsigned int index;
+        int consumed = 0;
+
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0 ||
+            sscanf(entry->d_name + prefix_len, "%lld_%u.bin%n", &run, &index, &consumed) != 2 ||
+            entry->d_name[prefix_len + consumed] != '\0' ||
+            (consumer->shm_header && run > consumer->shm_header->run_id)) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            consumer_segment_t *grown = realloc(segments, capacity * sizeof(*segments));
+            if (!grown) {
+                free(segments);
+                closedir(dir);
+                return -1;
+            }
+            segments = grown;
+        }
+
+        int len = snprintf(segments[count].path, sizeof(segments[count].path), "%s/%s",
+                           consumer->dir, entry->d_name);
+        if (len < 0 || (size_t)len >= sizeof(segments[count].path)) {
+            continue;
+        }
+        segments[count].run_id = run;
+        segments[count].index = index;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(segments, count, sizeof(*segments), compare_segments);
+
+    free(consumer->segments);
+    consumer->segments = segments;
+    consumer->segment_count = count;
+    consumer->segment_pos = 0;
+
+    if (have_current) {
+        while (consumer->segment_pos < count &&
+               compare_segments(&segments[consumer->segment_pos], &current) < 0) {
+            consumer->segment_pos++;
+        }
+
+        // The segment being read was removed: continue with the next one from its start
+        if (consumer->segment_pos == count ||
+            compare_segments(&segments[consumer->segment_pos], &current) != 0) {
+            consumer_unmap_segment(consumer);
+        }
+    }
+
+    return (int)count;
+}
+
+/**
+ * Map the segment at segment_pos read-only (a segment too short for its header maps as empty)
+ * Returns 0 on success, -1 on failure
+ */
+static int consumer_map_segment(consumer_t *consumer) {
+    const char *path = consumer->segments[consumer->segment_pos].path;
+
+    if (consumer->segment_fd == -1) {
+        consumer->segment_fd = open(path, O_RDONLY);
+        if (consumer->segment_fd == -1) {
+            fprintf(stderr, "Failed to open segment %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (fstat(consumer->segment_fd, &st) != 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size == consumer->segment_map_size ||
+        (size_t)st.st_size < sizeof(segment_header_t)) {
+        return 0;
+    }
+
+    // The file grew (stdio and direct writers) since it was mapped
+    if (consumer->segment_map) {
+        munmap(consumer->segment_map, consumer->segment_map_size);
+        consumer->segment_map = NULL;
+        consumer->segment_map_size = 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, consumer->segment_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map segment %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    consumer->segment_map = map;
+    consumer->segment_map_size = st.st_size;
+    return 0;
+}
+
+/**
+ * Drop the mapping of the segment being read
+ */
+static void consumer_unmap_segment(consumer_t *consumer) {
+    if (consumer->segment_map) {
+        munmap(consumer->segment_map, consumer->segment_map_size);
+    }
+    if (consumer->segment_fd != -1) {
+        close(consumer->segment_fd);
+    }
+
+    consumer->segment_map = NULL;
+    consumer->segment_map_size = 0;
+    consumer->segment_fd = -1;
+    consumer->segment_record = 0;
+}
+
+/**
+ * Number of complete records currently in the mapped segment; copies its header to *header
+ * The writer may still be appending, so end_offset is read once, atomically.
+ */
+static uint64_t consumer_segment_records(consumer_t *consumer, segment_header_t *header) {
+    if (!consumer->segment_map) {
+        return 0;
+    }
+
+    segment_header_t *mapped = (segment_header_t *)consumer->segment_map;
+    memcpy(header, mapped, sizeof(*header));
+    header->end_offset = __atomic_load_n(&mapped->end_offset, __ATOMIC_ACQUIRE);
+
+    if (header->magic != SEGMENT_MAGIC || header->record_size != consumer->record_size) {
+        return 0;
+    }
+
+    return segment_record_count(header, consumer->segment_map_size, consumer->record_size);
+}
+
+/**
+ * Time a record is filtered by (trade time, kline open time)
+ */
+static int64_t consumer_record_time(consumer_t *consumer, const void *record) {
+    if (consumer->type == DATA_TYPE_TRADE) {
+        return ((const trade_record_t *)record)->trade_time;
+    }
+    return ((const kline_record_t *)record)->open_time;
+}
+
+/**
+ * Open a consumer of one symbol's trades or klines
+ * History starting at since_ms is delivered first (0 for everything on disk, CONSUMER_LIVE_ONLY
+ * for none), then live records as they are published.
+ * Returns 0 on success, -1 on failure
+ */
+int consumer_open(consumer_t *consumer, const char *symbol, data_type_t type, int64_t since_ms) {
+    memset(consumer, 0, sizeof(*consumer));
+    consumer->shm_fd = -1;
+    consumer->segment_fd = -1;
+    consumer->type = type;
+    consumer->record_size = type == DATA_TYPE_TRADE ? sizeof(trade_record_t) : sizeof(kline_record_t);
+    consumer->since_ms = since_ms;
+    consumer->last_trade_id = -1;
+
+    consumer->shm_fd = shm_open("/binance_market_data", O_RDONLY, 0666);
+    if (consumer->shm_fd == -1) {
+        fprintf(stderr, "Failed to open shared memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    consumer->shared_memory = mmap(NULL, SHM_SIZE, PROT_READ, MAP_SHARED, consumer->shm_fd, 0);
+    if (consumer->shared_memory == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shared memory: %s\n", strerror(errno));
+        consumer->shared_memory = NULL;
+        consumer_close(consumer);
+        return -1;
+    }
+    consumer->shm_header = (shared_memory_header_t *)consumer->shared_memory;
+    consumer->notify = shm_map_notify();
+
+    int symbol_idx = -1;
+    for (size_t i = 0; i < consumer->shm_header->symbol_count; i++) {
+        if (strcasecmp(consumer->shm_header->symbols[i], symbol) == 0) {
+            symbol_idx = i;
+            break;
+        }
+    }
+    if (symbol_idx == -1) {
+        fprintf(stderr, "Symbol %s not found in shared memory\n", symbol);
+        consumer_close(consumer);
+        return -1;
+    }
+    strncpy(consumer->symbol, consumer->shm_header->symbols[symbol_idx], MAX_SYMBOL_LENGTH - 1);
+
+    char *buffer = (char *)consumer->shared_memory + consumer->shm_header->data_offset +
+                   symbol_idx * consumer->shm_header->buffer_size;
+    consumer->ring = (shm_ring_t *)(buffer + (type == DATA_TYPE_TRADE ? consumer->shm_header->trade_ring_offset
+                                                                      : consumer->shm_header->kline_ring_offset));
+
+    // The data files are needed for history, and to recover from overruns even when live only
+    int len = snprintf(consumer->dir, sizeof(consumer->dir), "%s/%s",
+                       consumer->shm_header->output_dir, consumer->symbol);
+    if (len < 0 || (size_t)len >= sizeof(consumer->dir)) {
+        consumer_close(consumer);
+        return -1;
+    }
+
+    if (since_ms == CONSUMER_LIVE_ONLY) {
+        consumer->phase = CONSUMER_LIVE;
+        consumer->next_sequence = atomic_load_explicit(&consumer->ring->published, memory_order_acquire);
+        return 0;
+    }
+
+    if (consumer_scan_segments(consumer) < 0) {
+        consumer_close(consumer);
+        return -1;
+    }
+
+    consumer->phase = CONSUMER_HISTORY;
+    return 0;
+}
+
+/**
+ * Open a consumer of the trades or klines in a symbol directory, without shared memory
+ * Delivers the records of every run on disk from since_ms on; consumer_next returns 0 once
+ * they are exhausted (records appended later are still picked up by calling it again).
+ * Returns 0 on success, -1 on failure
+ */
+int consumer_open_files(consumer_t *consumer, const char *dir, const char *symbol, data_type_t type,
+                        int64_t since_ms) {
+    memset(consumer, 0, sizeof(*consumer));
+    consumer->shm_fd = -1;
+    consumer->segment_fd = -1;
+    consumer->type = type;
+    consumer->record_size = type == DATA_TYPE_TRADE ? sizeof(trade_record_t) : sizeof(kline_record_t);
+    consumer->since_ms = since_ms;
+    consumer->last_trade_id = -1;
+    consumer->phase = CONSUMER_HISTORY;
+    strncpy(consumer->symbol, symbol, MAX_SYMBOL_LENGTH - 1);
+
+    int len = snprintf(consumer->dir, sizeof(consumer->dir), "%s", dir);
+    if (len < 0 || (size_t)len >= sizeof(consumer->dir) || consumer_scan_segments(consumer) < 0) {
+        consumer_close(consumer);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Deliver the next record from the data segments, switching to the live ring at the seam
+ * Returns 1 if a record was delivered, 0 if none is available yet, -1 on failure
+ */
+static int consumer_next_history(consumer_t *consumer, consumer_record_t *record) {
+    int rescanned = 0;
+
+    for (;;) {
+        if (consumer->segment_pos >= consumer->segment_count) {
+            if (rescanned) {
+                return 0;
+            }
+            if (consumer_scan_segments(consumer) < 0) {
+                return -1;
+            }
+            rescanned = 1;
+            continue;
+        }
+
+        if (consumer_map_segment(consumer) != 0) {
+            return -1;
+        }
+
+        segment_header_t header = { 0 };
+        uint64_t count = consumer_segment_records(consumer, &header);
+        int current_run = consumer->shm_header &&
+                          consumer->segments[consumer->segment_pos].run_id == consumer->shm_header->run_id;
+        int last_known = consumer->segment_pos + 1 == consumer->segment_count;
+        const char *records = consumer->segment_map + header.data_offset;
+
+        // Skip whole segments that end before the requested start
+        if (consumer->since_ms > 0 && count > 0 && !last_known && consumer->segment_record == 0 &&
+            consumer_record_time(consumer, records + (count - 1) * consumer->record_size) < consumer->since_ms) {
+            consumer->segment_record = count;
+        }
+
+        while (consumer->segment_record < count) {
+            const char *data = records + consumer->segment_record * consumer->record_size;
+            uint64_t sequence = header.base_sequence + consumer->segment_record;
+            consumer->segment_record++;
+
+            if (current_run) {
+                consumer->next_sequence = sequence + 1;
+            }
+
+            if (consumer_record_time(consumer, data) < consumer->since_ms) {
+                continue;
+            }
+            if (consumer->type == DATA_TYPE_TRADE) {
+                int64_t trade_id = ((const trade_record_t *)data)->trade_id;
+                if (trade_id <= consumer->last_trade_id) {
+                    continue;
+                }
+                consumer->last_trade_id = trade_id;
+            }
+
+            record->header.type = consumer->type;
+            record->header.length = consumer->record_size;
+            record->header.timestamp = 0;
+            record->header.sequence = sequence;
+            memcpy(record->header.symbol, consumer->symbol, MAX_SYMBOL_LENGTH);
+            memcpy(&record->record, data, consumer->record_size);
+            return 1;
+        }
+
+        if (current_run && consumer->segment_map) {
+            consumer->next_sequence = header.base_sequence + consumer->segment_record;
+        }
+
+        if (!last_known) {
+            consumer_unmap_segment(consumer);
+            consumer->segment_pos++;
+            continue;
+        }
+
+        // End of everything on disk: hand over to the ring if it still holds the next record
+        if (current_run) {
+            uint64_t published = atomic_load_explicit(&consumer->ring->published, memory_order_acquire);
+            if (consumer->next_sequence <= published &&
+                published - consumer->next_sequence <= consumer->ring->capacity) {
+                consumer_unmap_segment(consumer);
+                consumer->phase = CONSUMER_LIVE;
+                return consumer_next_live(consumer, record);
+            }
+        }
+
+        // The ring has moved on (or the current run has no segment yet): wait for the files
+        if (rescanned) {
+            return 0;
+        }
+        if (consumer_scan_segments(consumer) < 0) {
+            return -1;
+        }
+        rescanned = 1;
+    }
+}
+
+/**
+ * Deliver the next record from the live ring
+ * Returns 1 if a record was delivered, 0 if none is available yet, -1 on failure
+ */
+static int consumer_next_live(consumer_t *consumer, consumer_record_t *record) {
+    uint64_t sequence = consumer->next_sequence;
+    int ret = consumer_ring_read(consumer->ring, sequence, record);
+
+    if (ret == 0) {
+        return 0;
+    }
+
+    // Lapped: refill the missed range from disk, the history path rejoins the ring afterwards
+    if (ret < 0) {
+        consumer->overruns++;
+        if (consumer_seek(consumer, sequence) != 0) {
+            return -1;
+        }
+        return consumer_next_history(consumer, record);
+    }
+
+    consumer->next_sequence = sequence + 1;
+    if (consumer->type == DATA_TYPE_TRADE) {
+        consumer->last_trade_id = record->record.trade.trade_id;
+    }
+    return 1;
+}
+
+/**
+ * Copy one record out of a live ring
+ * Seqlock read: the slot must hold the sequence before and after the copy.
+ * Returns 1 if the record was copied, 0 if it is not published yet, -1 if it was overwritten
+ */
+int consumer_ring_read(const shm_ring_t *ring, uint64_t sequence, consumer_record_t *record) {
+    uint64_t published = atomic_load_explicit(&ring->published, memory_order_acquire);
+
+    if (sequence >= published) {
+        return 0;
+    }
+    if (published - sequence > ring->capacity) {
+        return -1;
+    }
+
+    const shm_slot_t *slot = &ring->slots[sequence & (ring->capacity - 1)];
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != sequence) {
+        return -1;
+    }
+    memcpy(&record->header, &slot->header, sizeof(record->header));
+    memcpy(&record->record, &slot->record, sizeof(record->record));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence) {
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Map the notification words at the start of the shared memory header writable
+ * Readers map shared memory read-only; arming a wait needs write access to this one page.
+ * Returns the mapping, or NULL if it cannot be made (waits then fall back to sleeping)
+ */
+shared_memory_header_t *shm_map_notify(void) {
+    int fd = shm_open("/binance_market_data", O_RDWR, 0666);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    void *page = mmap(NULL, SHM_NOTIFY_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return page == MAP_FAILED ? NULL : (shared_memory_header_t *)page;
+}
+
+/**
+ * Release a mapping made by shm_map_notify()
+ */
+void shm_unmap_notify(shared_memory_header_t *notify) {
+    if (notify) {
+        munmap(notify, SHM_NOTIFY_MAP_SIZE);
+    }
+}
+
+/**
+ * Ask the collector to wake waiters on its next publish
+ * Call before checking for new records; pass the returned value to shm_notify_wait().
+ */
+uint32_t shm_notify_arm(shared_memory_header_t *notify) {
+    if (!notify) {
+        return 0;
+    }
+    atomic_store_explicit(&notify->notify_armed, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);  // Pairs with the fence after publishing in publish_record()
+    return atomic_load_explicit(&notify->notify_seq, memory_order_acquire);
+}
+
+/**
+ * Sleep until the collector publishes a record after shm_notify_arm() returned seen, or until
+ * timeout_ms passes
+ */
+void shm_notify_wait(shared_memory_header_t *notify, uint32_t seen, int timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000 };
+
+    if (!notify) {
+        nanosleep(&timeout, NULL);
+        return;
+    }
+    syscall(SYS_futex, &notify->notify_seq, FUTEX_WAIT, seen, &timeout, NULL, 0);
+}
+
+/**
+ * Wait up to timeout_ms until the consumer may have a record to deliver
+ * Meant for after consumer_next() returned 0; in the history phase that means the files are
+ * waiting for the collector, whose next publish wakes us as well.
+ */
+void consumer_wait(consumer_t *consumer, int timeout_ms) {
+    uint32_t seen = shm_notify_arm(consumer->notify);
+
+    if (consumer->phase == CONSUMER_LIVE &&
+        atomic_load_explicit(&consumer->ring->published, memory_order_acquire) > consumer->next_sequence) {
+        return;
+    }
+    shm_notify_wait(consumer->notify, seen, timeout_ms);
+}
+
+/**
+ * Deliver the next record, from history or live
+ * Returns 1 if a record was delivered, 0 if none is available yet (poll again later), -1 on failure
+ */
+int consumer_next(consumer_t *consumer, consumer_record_t *record) {
+    if (consumer->phase == CONSUMER_HISTORY) {
+        return consumer_next_history(consumer, record);
+    }
+    return consumer_next_live(consumer, record);
+}
+
+/**
+ * Read the base sequence of the segment at pos from its header
+ * Returns 0 on success, -1 if the segment has no header yet
+ */
+static int consumer_segment_base(consumer_t *consumer, size_t pos, uint64_t *base) {
+    segment_header_t header;
+    int fd = open(consumer->segments[pos].path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+    if (n != sizeof(header) || header.magic != SEGMENT_MAGIC) {
+        return -1;
+    }
+
+    *base = header.base_sequence;
+    return 0;
+}
+
+/**
+ * Position the consumer at a sequence of the current run, read from the data files
+ * Records have a fixed size, so the segment is found by a binary search over the segments'
+ * base sequences and the record by its offset from the segment's base. The consumer returns to
+ * the live ring once it has caught up with the files. Every record from the sequence on is
+ * delivered, whatever since_ms the consumer was opened with.
+ * Returns 0 on success, -1 on failure
+ */
+int consumer_seek(consumer_t *consumer, uint64_t sequence) {
+    // Sequences are only defined for the collector's current run
+    if (!consumer->shm_header) {
+        return -1;
+    }
+
+    consumer_unmap_segment(consumer);
+    consumer->segment_pos = consumer->segment_count;
+    if (consumer_scan_segments(consumer) < 0) {
+        return -1;
+    }
+
+    size_t first = 0;
+    while (first < consumer->segment_count &&
+           consumer->segments[first].run_id < consumer->shm_header->run_id) {
+        first++;
+    }
+    if (first == consumer->segment_count) {
+        fprintf(stderr, "No data segments of the current run in %s\n", consumer->dir);
+        return -1;
+    }
+
+    // Last segment whose base sequence is not past the target (a segment without a header
+    // yet is the newest one and counts as past it)
+    size_t lo = first, hi = consumer->segment_count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        uint64_t base;
+        if (consumer_segment_base(consumer, mid, &base) == 0 && base <= sequence) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    uint64_t base;
+    if (consumer_segment_base(consumer, lo, &base) != 0 || base > sequence) {
+        fprintf(stderr, "Sequence %llu of %s is not in the data files\n",
+                (unsigned long long)sequence, consumer->symbol);
+        return -1;
+    }
+
+    consumer->segment_pos = lo;
+    consumer->segment_record = sequence - base;
+    consumer->next_sequence = sequence;
+    consumer->since_ms = 0;
+    consumer->phase = CONSUMER_HISTORY;
+    return 0;
+}
+
+/**
+ * Current time on the collector's receive clock (ns since the epoch)
+ * Subtracting header.timestamp of a live record gives the time since the collector received it.
+ * Consumers without the shared memory get CLOCK_REALTIME.
+ */
+int64_t consumer_now_ns(const consumer_t *consumer) {
+    if (consumer->shm_header && consumer->shm_header->clock.source != 0) {
+        return clock_now_ns(&consumer->shm_header->clock);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Release everything a consumer holds
+ */
+void consumer_close(consumer_t *consumer) {
+    consumer_unmap_segment(consumer);
+    free(consumer->segments);
+    consumer->segments = NULL;
+    consumer->segment_count = 0;
+
+    shm_unmap_notify(consumer->notify);
+    consumer->notify = NULL;
+
+    if (consumer->shared_memory) {
+        munmap(consumer->shared_memory, SHM_SIZE);
+        consumer->shared_memory = NULL;
+    }
+    if (consumer->shm_fd != -1) {
+        close(consumer->shm_fd);
+        consumer->shm_fd = -1;
+    }
+}
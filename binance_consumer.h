@@ -0,0 +1,103 @@
+/**
+* binance_consumer.h
+*
+* Consumer library for Binance data collector: replays a symbol's history from the data
+* segments and continues with the live shared memory ring, without a gap or duplicates
+*/
+
+#ifndef BINANCE_CONSUMER_H
+#define BINANCE_CONSUMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+// Include our common header file
+#include "binance_common.h"
+
+// since_ms value that skips history and starts with the next live record
+#define CONSUMER_LIVE_ONLY INT64_MAX
+
+// Bytes of the shared memory header mapped writable for arming waits (holds notify_seq/notify_armed)
+#define SHM_NOTIFY_MAP_SIZE 4096
+
+// A record delivered to a consumer
+// header.timestamp is the collector's receive time in ns (compare with consumer_now_ns()); it is 0
+// for records read from data files (it is only known for live records).
+typedef struct {
+    message_header_t header;
+    union {
+        trade_record_t trade;
+        kline_record_t kline;
+    } record;
+} consumer_record_t;
+
+// Where a consumer is reading from
+typedef enum {
+    CONSUMER_HISTORY = 0,     // Data segments
+    CONSUMER_LIVE = 1         // Live ring in shared memory
+} consumer_phase_t;
+
+// One data segment found on disk
+typedef struct {
+    int64_t run_id;           // Run that wrote the segment
+    uint32_t index;           // Index of the segment within its run
+    char path[PATH_MAX];
+} consumer_segment_t;
+
+// Consumer of one symbol's records of one type
+typedef struct {
+    // Shared memory
+    int shm_fd;
+    void *shared_memory;
+    shared_memory_header_t *shm_header;
+    shm_ring_t *ring;         // Live ring of the symbol and type
+    shared_memory_header_t *notify; // Writable mapping of the notification words (NULL: sleep instead)
+
+    data_type_t type;
+    size_t record_size;
+    char symbol[MAX_SYMBOL_LENGTH];
+    int64_t since_ms;         // Skip history records older than this (trade time / kline open time)
+
+    consumer_phase_t phase;
+    uint64_t next_sequence;   // Sequence (in the current run) of the next record to deliver
+    int64_t last_trade_id;    // Last trade id delivered (records of older runs are not repeated)
+    uint64_t overruns;        // Times the live ring lapped the consumer and it refilled from disk
+
+    // History
+    char dir[PATH_MAX];       // Directory holding the symbol's segments
+    consumer_segment_t *segments; // Known segments, oldest first
+    size_t segment_count;
+    size_t segment_pos;       // Segment being read
+    int segment_fd;
+    char *segment_map;        // Read-only mapping of the segment being read
+    size_t segment_map_size;
+    uint64_t segment_record;  // Index of the next record within the segment
+} consumer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Consumer functions
+int consumer_open(consumer_t *consumer, const char *symbol, data_type_t type, int64_t since_ms);
+int consumer_open_files(consumer_t *consumer, const char *dir, const char *symbol, data_type_t type,
+                        int64_t since_ms);
+int consumer_next(consumer_t *consumer, consumer_record_t *record);
+int consumer_seek(consumer_t *consumer, uint64_t sequence);
+void consumer_wait(consumer_t *consumer, int timeout_ms);
+int64_t consumer_now_ns(const consumer_t *consumer);
+void consumer_close(consumer_t *consumer);
+
+// Live ring and wake-up functions
+int consumer_ring_read(const shm_ring_t *ring, uint64_t sequence, consumer_record_t *record);
+shared_memory_header_t *shm_map_notify(void);
+void shm_unmap_notify(shared_memory_header_t *notify);
+uint32_t shm_notify_arm(shared_memory_header_t *notify);
+void shm_notify_wait(shared_memory_header_t *notify, uint32_t seen, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINANCE_CONSUMER_H */
@@ -0,0 +1,293 @@
+/**
+* binance_feed.hpp
+*
+* Header-only C++20 coroutine interface to the consumer library:
+*
+*     binance::task strategy(binance::feed &feed) {
+*         auto trades = feed.subscribe("BTCUSDT", DATA_TYPE_TRADE);
+*         while (auto record = co_await trades->next()) { ... }
+*     }
+*
+* A coroutine waiting for records is parked with its feed instead of polling. The feed's run()
+* sleeps on the collector's futex for all parked coroutines of the process at once, and resumes
+* each one when its consumer has a record. Programs with their own epoll loop use event_fd() and
+* dispatch() instead of run(). A feed and its coroutines belong to the thread that drives it.
+*
+* Link with binance_consumer.c and binance_segment.c (compiled as C).
+*/
+
+#ifndef BINANCE_FEED_HPP
+#define BINANCE_FEED_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_consumer.h"
+
+namespace binance {
+
+// Longest sleep on the futex (bounds the delay of a wake that raced with arming)
+inline constexpr int feed_wait_timeout_ms = 100;
+
+// Records a coroutine takes without suspending before others get a turn
+inline constexpr unsigned feed_burst_records = 256;
+
+class feed;
+
+/**
+ * Detached coroutine started by calling it; it runs until its first wait for a record
+ */
+class task {
+public:
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+namespace detail {
+
+// One consumer and the coroutine waiting on it
+struct stream {
+    consumer_t consumer;
+    feed *owner;
+    std::coroutine_handle<> waiter;
+    consumer_record_t record;
+    int result;               // consumer_next() result for record
+    unsigned burst;           // Records taken since the coroutine last suspended
+
+    ~stream() { consumer_close(&consumer); }
+};
+
+} // namespace detail
+
+/**
+ * Awaitable next record of a subscription
+ * Yields the record, or std::nullopt if the consumer failed.
+ */
+class next_record {
+public:
+    explicit next_record(detail::stream *stream) noexcept : stream_(stream) {}
+
+    bool await_ready() noexcept {
+        stream_->result = consumer_next(&stream_->consumer, &stream_->record);
+        if (stream_->result != 0 && ++stream_->burst < feed_burst_records) {
+            return true;
+        }
+        stream_->burst = 0;
+        return false;
+    }
+    inline void await_suspend(std::coroutine_handle<> handle);
+    std::optional<consumer_record_t> await_resume() noexcept {
+        if (stream_->result < 0) {
+            return std::nullopt;
+        }
+        return stream_->record;
+    }
+
+private:
+    detail::stream *stream_;
+};
+
+/**
+ * A coroutine's consumer of one symbol's records of one type (move-only)
+ */
+class subscription {
+public:
+    explicit subscription(std::unique_ptr<detail::stream> stream) noexcept : stream_(std::move(stream)) {}
+
+    next_record next() noexcept { return next_record(stream_.get()); }
+    const consumer_t &consumer() const noexcept { return stream_->consumer; }
+
+private:
+    std::unique_ptr<detail::stream> stream_;
+};
+
+/**
+ * Executor of the coroutines waiting for records
+ */
+class feed {
+public:
+    feed() noexcept : notify_(shm_map_notify()) {}
+    feed(const feed &) = delete;
+    feed &operator=(const feed &) = delete;
+
+    ~feed() {
+        if (bridge_.joinable()) {
+            bridge_stop_.store(true, std::memory_order_relaxed);
+            bridge_.join();
+        }
+        if (event_fd_ != -1) {
+            close(event_fd_);
+        }
+
+        // Destroying a parked coroutine closes its subscriptions
+        std::vector<detail::stream *> parked;
+        parked.swap(parked_);
+        parked.insert(parked.end(), ready_.begin(), ready_.end());
+        ready_.clear();
+        for (detail::stream *stream : parked) {
+            stream->waiter.destroy();
+        }
+        shm_unmap_notify(notify_);
+    }
+
+    /**
+     * Open a consumer (see consumer_open()); std::nullopt if the collector or symbol is missing
+     */
+    std::optional<subscription> subscribe(const char *symbol, data_type_t type,
+                                          int64_t since_ms = CONSUMER_LIVE_ONLY) {
+        auto stream = std::make_unique<detail::stream>();
+        if (consumer_open(&stream->consumer, symbol, type, since_ms) < 0) {
+            return std::nullopt;
+        }
+        stream->owner = this;
+        return subscription(std::move(stream));
+    }
+
+    /**
+     * Resume parked coroutines until none is left or stop() is called, sleeping on the futex
+     * while none has a record
+     */
+    void run() {
+        stopped_ = false;
+        while (!stopped_ && (!parked_.empty() || !ready_.empty())) {
+            uint32_t seen = shm_notify_arm(notify_);
+            if (poll() == 0 && ready_.empty()) {
+                shm_notify_wait(notify_, seen, feed_wait_timeout_ms);
+            }
+        }
+    }
+
+    /**
+     * Make run() return once the coroutine calling this suspends
+     */
+    void stop() noexcept { stopped_ = true; }
+
+    /**
+     * Descriptor that becomes readable when parked coroutines may have records, for an
+     * epoll (or io_uring) loop that calls dispatch() then. A helper thread waits on the futex.
+     * Returns the descriptor, or -1 on failure
+     */
+    int event_fd() {
+        if (event_fd_ == -1) {
+            event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (event_fd_ != -1) {
+                bridge_ = std::thread([this] { bridge(); });
+            }
+        }
+        return event_fd_;
+    }
+
+    /**
+     * Resume the parked coroutines that have records, without waiting
+     * Returns the number of coroutines resumed
+     */
+    size_t dispatch() {
+        uint64_t count;
+        if (event_fd_ != -1 && read(event_fd_, &count, sizeof(count)) < 0) {
+            // Nothing signalled; poll anyway
+        }
+        size_t resumed = poll();
+        if (!ready_.empty() && event_fd_ != -1) {
+            // Coroutines that gave up their turn still have records
+            count = 1;
+            if (write(event_fd_, &count, sizeof(count)) < 0) {
+                // Counter full: already readable
+            }
+        }
+        return resumed;
+    }
+
+    size_t parked() const noexcept { return parked_.size() + ready_.size(); }
+
+private:
+    friend class next_record;
+
+    /**
+     * Park a coroutine that suspended in next()
+     * It already holds a record (result != 0) when it only gave up its turn.
+     */
+    void park(detail::stream *stream) {
+        if (stream->result != 0) {
+            ready_.push_back(stream);
+        } else {
+            parked_.push_back(stream);
+        }
+    }
+
+    /**
+     * Resume the coroutines that gave up their turn and those whose consumer has a record
+     * Returns the number of coroutines resumed
+     */
+    size_t poll() {
+        resuming_.swap(ready_);
+        for (detail::stream *stream : parked_) {
+            stream->result = consumer_next(&stream->consumer, &stream->record);
+            if (stream->result != 0) {
+                resuming_.push_back(stream);
+            } else {
+                polled_.push_back(stream);
+            }
+        }
+        parked_.swap(polled_);
+        polled_.clear();
+
+        // Resumed coroutines park again through park() (or finish, closing their subscriptions)
+        for (detail::stream *stream : resuming_) {
+            stream->waiter.resume();
+        }
+        size_t resumed = resuming_.size();
+        resuming_.clear();
+        return resumed;
+    }
+
+    /**
+     * Helper thread of event_fd(): signal the descriptor on every publish (and on timeouts,
+     * which cover wakes lost to the arming race)
+     */
+    void bridge() {
+        uint64_t one = 1;
+        while (!bridge_stop_.load(std::memory_order_relaxed)) {
+            uint32_t seen = shm_notify_arm(notify_);
+            shm_notify_wait(notify_, seen, feed_wait_timeout_ms);
+            if (write(event_fd_, &one, sizeof(one)) < 0) {
+                // Counter full: already readable
+            }
+        }
+    }
+
+    shared_memory_header_t *notify_;
+    std::vector<detail::stream *> parked_;  // Waiting for their consumer to have a record
+    std::vector<detail::stream *> ready_;   // Holding a record, waiting for their turn
+    std::vector<detail::stream *> polled_;  // Scratch lists of poll()
+    std::vector<detail::stream *> resuming_;
+    bool stopped_ = false;
+
+    int event_fd_ = -1;
+    std::thread bridge_;
+    std::atomic<bool> bridge_stop_{ false };
+};
+
+void next_record::await_suspend(std::coroutine_handle<> handle) {
+    stream_->waiter = handle;
+    stream_->owner->park(stream_);
+}
+
+} // namespace binance
+
+#endif /* BINANCE_FEED_HPP */
@@ -0,0 +1,745 @@
+/**
+* binance_importer.c
+*
+* Imports the public historical dumps of data.binance.vision (aggTrades and 1m klines, as the
+* downloaded CSV zip archives or plain CSV files) into the collector's native data segments
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <ctype.h>
+#include <limits.h>
+#include <zlib.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_parse.h"
+
+// Parsing
+#define IMPORT_CHUNK_SIZE (4UL * 1024 * 1024)  // Decompressed bytes parsed at a time
+#define MAX_CSV_LINE 4096                      // Longest accepted CSV line
+#define MAX_IMPORT_THREADS 256
+
+// Zip format (little endian)
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50U
+#define ZIP_DATA_DESCRIPTOR_SIGNATURE 0x08074b50U
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_FLAG_DATA_DESCRIPTOR 0x0008
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATE 8
+
+// Kind of a dump, from its file name (<SYMBOL>-aggTrades-<date> or <SYMBOL>-1m-<date>)
+typedef enum {
+    DUMP_AGG_TRADES = 0,
+    DUMP_KLINES = 1
+} dump_kind_t;
+
+// Where the CSV text of a dump comes from
+typedef struct {
+    int fd;                   // Dump file
+    const unsigned char *map; // Mapping of a zip archive (NULL for plain CSV)
+    size_t map_size;
+    size_t offset;            // Next zip entry (local header offset)
+    size_t entry_end;         // End of the stored entry being read (stored entries only)
+    int method;               // Compression of the entry being read (-1: none open)
+    int flags;
+    z_stream zs;
+} import_source_t;
+
+// One dump file to import
+typedef struct {
+    const char *path;
+    dump_kind_t kind;
+    char symbol[MAX_SYMBOL_LENGTH];
+    char dir[PATH_MAX];       // Symbol directory of the segments
+    data_file_t file;         // Opened at the first record (its time names the run)
+    int file_open;
+    uint64_t records;         // Records written
+    uint64_t bad_lines;       // Lines that are neither a record nor a CSV header
+    uint64_t csv_bytes;       // Decompressed bytes parsed
+    int failed;
+} import_job_t;
+
+// Global variables
+static volatile int force_exit = 0;
+static const char *output_dir = "./data";
+static size_t segment_size = 0;        // Data segment size in bytes (0: writer default)
+static import_job_t *jobs = NULL;
+static size_t job_count = 0;
+static atomic_size_t next_job = 0;
+static pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes claiming run names
+static segment_catalog_t catalog = { .fd = -1 }; // Catalog of the output directory (shared by all jobs)
+
+// Forward declarations
+void signal_handler(int sig);
+void print_usage(const char *program_name);
+int parse_dump_name(import_job_t *job);
+int import_line(import_job_t *job, const char *line, const char *end);
+int source_open(import_source_t *source, const char *path);
+ssize_t source_read(import_source_t *source, char *buffer, size_t size);
+void source_close(import_source_t *source);
+int import_job(import_job_t *job);
+void discard_job_segments(import_job_t *job);
+void *import_thread_func(void *arg);
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
+
+/**
+ * Print usage information
+ */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <dump file>...\n", program_name);
+    printf("Imports data.binance.vision dumps (<SYMBOL>-aggTrades-<date>.zip, <SYMBOL>-1m-<date>.zip\n");
+    printf("or the CSV files inside them) into data segments\n");
+    printf("Options:\n");
+    printf("  -o, --output DIR        Output directory (default: ./data)\n");
+    printf("  -j, --jobs N            Files imported in parallel (default: number of CPUs)\n");
+    printf("  -S, --segment-size MB   Segment size in MB (default: %lu)\n", DEFAULT_MMAP_SEGMENT_SIZE >> 20);
+    printf("  -h, --help              Show this help message\n");
+}
+
+/**
+ * Derive the symbol and record kind of a dump from its file name
+ * Returns 0 on success, -1 if the name is not a supported dump
+ */
+int parse_dump_name(import_job_t *job) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s", job->path);
+    const char *base = basename(name);
+
+    const char *dash = strchr(base, '-');
+    if (!dash || dash == base || (size_t)(dash - base) >= MAX_SYMBOL_LENGTH) {
+        return -1;
+    }
+    for (size_t i = 0; i < (size_t)(dash - base); i++) {
+        job->symbol[i] = toupper((unsigned char)base[i]);
+    }
+    job->symbol[dash - base] = '\0';
+
+    if (strncmp(dash + 1, "aggTrades-", 10) == 0) {
+        job->kind = DUMP_AGG_TRADES;
+    } else if (strncmp(dash + 1, "1m-", 3) == 0) {
+        // The collector subscribes to 1m klines; other intervals would mix into the same files
+        job->kind = DUMP_KLINES;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Expect a field separator after a parsed field
+ */
+static inline const char *next_field(const char *p, const char *end) {
+    return p && p < end && *p == ',' ? p + 1 : NULL;
+}
+
+/**
+ * Skip a field that is not imported
+ */
+static inline const char *skip_field(const char *p, const char *end) {
+    if (!p) {
+        return NULL;
+    }
+    const char *comma = memchr(p, ',', end - p);
+    return comma ? comma + 1 : NULL;
+}
+
+/**
+ * Parse a true/false field (True/False in spot dumps, true/false in futures dumps)
+ */
+static inline const char *parse_bool(const char *p, const char *end, uint8_t *value) {
+    if (!p || p >= end) {
+        return NULL;
+    }
+    *value = *p == 't' || *p == 'T';
+    while (p < end && *p != ',' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Timestamps in milliseconds (spot dumps switched to microseconds in 2025)
+ */
+static inline int64_t dump_time_ms(int64_t timestamp) {
+    return timestamp >= 100000000000000LL ? timestamp / 1000 : timestamp;
+}
+
+/**
+ * Import one CSV line of a dump
+ * aggTrades: agg_trade_id,price,quantity,first_trade_id,last_trade_id,transact_time,is_buyer_maker[,is_best_match]
+ * klines:    open_time,open,high,low,close,volume,close_time,quote_volume,count,taker_buy_volume,...
+ * Returns 0 on success (including skipped header lines), -1 if the record could not be written
+ */
+int import_line(import_job_t *job, const char *line, const char *end) {
+    union {
+        trade_record_t trade;
+        kline_record_t kline;
+    } record;
+    const char *p = line;
+    int64_t time_ms = 0;
+
+    if (end > line && end[-1] == '\r') {
+        end--;
+    }
+    if (line == end) {
+        return 0;
+    }
+
+    // Fields are parsed into locals: the records are packed
+    if (job->kind == DUMP_AGG_TRADES) {
+        int64_t trade_id, transact_time;
+        double price, quantity;
+        uint8_t is_buyer_maker;
+        p = next_field(parse_int(p, end, &trade_id), end);
+        if (p) p = next_field(parse_decimal(p, end, &price), end);
+        if (p) p = next_field(parse_decimal(p, end, &quantity), end);
+        p = skip_field(skip_field(p, end), end);
+        if (p) p = next_field(parse_int(p, end, &transact_time), end);
+        p = parse_bool(p, end, &is_buyer_maker);
+        if (p) {
+            // Dumps carry no event time; the trade time stands in for it
+            time_ms = dump_time_ms(transact_time);
+            record.trade.event_time = time_ms;
+            record.trade.trade_time = time_ms;
+            record.trade.price = price;
+            record.trade.quantity = quantity;
+            record.trade.trade_id = trade_id;
+            record.trade.is_buyer_maker = is_buyer_maker;
+        }
+    } else {
+        int64_t open_time, close_time, num_trades;
+        double ohlcv[5];
+        p = next_field(parse_int(p, end, &open_time), end);
+        for (int i = 0; i < 5 && p; i++) {
+            p = next_field(parse_decimal(p, end, &ohlcv[i]), end);
+        }
+        if (p) p = next_field(parse_int(p, end, &close_time), end);
+        p = skip_field(p, end);
+        if (p) p = parse_int(p, end, &num_trades);
+        if (p) {
+            time_ms = dump_time_ms(open_time);
+            record.kline.open_time = time_ms;
+            record.kline.close_time = dump_time_ms(close_time);
+            record.kline.open_price = ohlcv[0];
+            record.kline.high_price = ohlcv[1];
+            record.kline.low_price = ohlcv[2];
+            record.kline.close_price = ohlcv[3];
+            record.kline.volume = ohlcv[4];
+            record.kline.num_trades = num_trades;
+            record.kline.is_final = 1;
+        }
+    }
+
+    if (!p) {
+        // Futures dumps start with a column header line
+        if (job->records > 0 || (*line >= '0' && *line <= '9')) {
+            job->bad_lines++;
+        }
+        return 0;
+    }
+
+    // The run is named after the first record, so imported runs sort by time with collected ones
+    if (!job->file_open) {
+        char first_path[PATH_MAX];
+        int64_t import_run_id = time_ms / 1000;
+        int len = snprintf(first_path, sizeof(first_path), "%s/%s_%lld_%06u.bin", job->dir,
+                           job->kind == DUMP_AGG_TRADES ? "trades" : "klines", (long long)import_run_id, 0);
+        if (len < 0 || (size_t)len >= sizeof(first_path)) {
+            fprintf(stderr, "Error: %s: Segment path too long in %s\n", job->path, job->dir);
+            return -1;
+        }
+
+        pthread_mutex_lock(&run_mutex);
+        if (access(first_path, F_OK) == 0) {
+            pthread_mutex_unlock(&run_mutex);
+            fprintf(stderr, "Error: %s: %s already exists (already imported?)\n", job->path, first_path);
+            return -1;
+        }
+
+        int ret = data_file_open(&job->file, WRITER_MMAP, job->kind == DUMP_AGG_TRADES ? DATA_TYPE_TRADE : DATA_TYPE_KLINE,
+                                 job->dir, job->symbol, import_run_id, segment_size);
+        pthread_mutex_unlock(&run_mutex);
+        if (ret != 0) {
+            fprintf(stderr, "Error: %s: Failed to open data file in %s\n", job->path, job->dir);
+            data_file_close(&job->file);
+            return -1;
+        }
+        job->file_open = 1;
+    }
+
+    if (data_file_append(&job->file, &record) != 0) {
+        fprintf(stderr, "Error: %s: Failed to write record: %s\n", job->path, strerror(errno));
+        return -1;
+    }
+
+    // Finalize segments as soon as they fill up
+    if (atomic_load_explicit(&job->file.retired, memory_order_relaxed)) {
+        data_file_reap(&job->file, NULL);
+    }
+
+    job->records++;
+    return 0;
+}
+
+/**
+ * Open a dump: a zip archive is mapped and read entry by entry, a plain CSV file is read as is
+ * Returns 0 on success, -1 on failure
+ */
+int source_open(import_source_t *source, const char *path) {
+    memset(source, 0, sizeof(*source));
+    source->method = -1;
+
+    source->fd = open(path, O_RDONLY);
+    if (source->fd == -1) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t len = strlen(path);
+    if (len < 4 || strcasecmp(path + len - 4, ".zip") != 0) {
+        posix_fadvise(source->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(source->fd, &st) != 0 || st.st_size < ZIP_LOCAL_HEADER_SIZE) {
+        fprintf(stderr, "Error: %s is not a zip archive\n", path);
+        source_close(source);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, source->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map %s: %s\n", path, strerror(errno));
+        source_close(source);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    source->map = map;
+    source->map_size = st.st_size;
+    return 0;
+}
+
+/**
+ * Read little-endian integers from a zip header
+ */
+static inline uint32_t zip_u32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint16_t zip_u16(const unsigned char *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Read the next bytes of CSV text
+ * Zip entries are walked through their local headers, so the central directory (and its
+ * ZIP64 extensions for archives over 4GB) is never needed; deflate streams end themselves.
+ * Returns the number of bytes read, 0 at the end of the dump, -1 on failure
+ */
+ssize_t source_read(import_source_t *source, char *buffer, size_t size) {
+    if (!source->map) {
+        ssize_t n;
+        do {
+            n = read(source->fd, buffer, size);
+        } while (n < 0 && errno == EINTR && !force_exit);
+        return n;
+    }
+
+    for (;;) {
+        if (source->method == -1) {
+            // Next entry
+            const unsigned char *header = source->map + source->offset;
+            if (source->offset + ZIP_LOCAL_HEADER_SIZE > source->map_size ||
+                zip_u32(header) != ZIP_LOCAL_HEADER_SIGNATURE) {
+                return 0;  // Central directory reached
+            }
+
+            size_t data_start = source->offset + ZIP_LOCAL_HEADER_SIZE + zip_u16(header + 26) + zip_u16(header + 28);
+            source->flags = zip_u16(header + 6);
+            source->method = zip_u16(header + 8);
+            source->offset = data_start;
+
+            if (data_start > source->map_size) {
+                return -1;
+            }
+            if (source->method == ZIP_METHOD_STORED) {
+                if (source->flags & ZIP_FLAG_DATA_DESCRIPTOR) {
+                    return -1;  // Stored entries of unknown size cannot be delimited
+                }
+                source->entry_end = data_start + zip_u32(header + 18);
+                if (source->entry_end > source->map_size) {
+                    return -1;
+                }
+            } else if (source->method == ZIP_METHOD_DEFLATE) {
+                memset(&source->zs, 0, sizeof(source->zs));
+                if (inflateInit2(&source->zs, -MAX_WBITS) != Z_OK) {
+                    return -1;
+                }
+            } else {
+                return -1;
+            }
+        }
+
+        if (source->method == ZIP_METHOD_STORED) {
+            size_t n = source->entry_end - source->offset;
+            if (n > 0) {
+                if (n > size) n = size;
+                memcpy(buffer, source->map + source->offset, n);
+                source->offset += n;
+                return n;
+            }
+        } else {
+            z_stream *zs = &source->zs;
+            zs->next_out = (unsigned char *)buffer;
+            zs->avail_out = size;
+
+            int ret = Z_OK;
+            while (zs->avail_out > 0 && ret == Z_OK) {
+                // avail_in is 32 bits: feed large archives a gigabyte at a time
+                if (zs->avail_in == 0) {
+                    size_t left = source->map_size - source->offset;
+                    zs->next_in = (unsigned char *)source->map + source->offset;
+                    zs->avail_in = left > (1U << 30) ? (1U << 30) : left;
+                    source->offset += zs->avail_in;
+                }
+                ret = inflate(zs, Z_NO_FLUSH);
+            }
+
+            if (ret != Z_OK && ret != Z_STREAM_END) {
+                inflateEnd(zs);
+                source->method = -1;
+                return -1;
+            }
+
+            size_t n = size - zs->avail_out;
+            if (ret == Z_OK || n > 0) {
+                if (ret == Z_STREAM_END) {
+                    // Return the tail now, finish the entry on the next call
+                    source->offset -= zs->avail_in;
+                    zs->avail_in = 0;
+                    inflateEnd(zs);
+                    source->method = ZIP_METHOD_STORED;
+                    source->entry_end = source->offset;
+                }
+                return n;
+            }
+
+            source->offset -= zs->avail_in;
+            inflateEnd(zs);
+        }
+
+        // Entry done: step over its data descriptor (optional signature, 32 or 64-bit sizes)
+        if (source->flags & ZIP_FLAG_DATA_DESCRIPTOR) {
+            size_t skip = 12;
+            if (source->offset + 4 <= source->map_size &&
+                zip_u32(source->map + source->offset) == ZIP_DATA_DESCRIPTOR_SIGNATURE) {
+                skip += 4;
+            }
+            if (source->offset + skip + 8 + 4 <= source->map_size &&
+                zip_u32(source->map + source->offset + skip) != ZIP_LOCAL_HEADER_SIGNATURE &&
+                zip_u32(source->map + source->offset + skip + 8) == ZIP_LOCAL_HEADER_SIGNATURE) {
+                skip += 8;
+            }
+            source->offset += skip;
+            source->flags = 0;
+        }
+        source->method = -1;
+    }
+}
+
+/**
+ * Release a dump source
+ */
+void source_close(import_source_t *source) {
+    if (source->method == ZIP_METHOD_DEFLATE) {
+        inflateEnd(&source->zs);
+    }
+    if (source->map) {
+        munmap((void *)source->map, source->map_size);
+    }
+    if (source->fd != -1) {
+        close(source->fd);
+    }
+    source->map = NULL;
+    source->fd = -1;
+}
+
+/**
+ * Remove the segments written by a failed import, so that it can simply be run again
+ */
+void discard_job_segments(import_job_t *job) {
+    for (uint32_t i = 0; i <= job->file.segment_index; i++) {
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/%s_%lld_%06u.bin", job->dir, job->file.prefix,
+                           (long long)job->file.run_id, i);
+        // A path that does not fit was never created (segment_open refuses it too)
+        if (len < 0 || (size_t)len >= sizeof(path)) {
+            break;
+        }
+        unlink(path);
+    }
+}
+
+/**
+ * Import one dump file into its own run of segments
+ * Returns 0 on success, -1 on failure (nothing of the dump is left behind)
+ */
+int import_job(import_job_t *job) {
+    import_source_t source;
+    int ret = 0;
+
+    if (mkdir(job->dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create directory %s: %s\n", job->dir, strerror(errno));
+        return -1;
+    }
+    if (source_open(&source, job->path) != 0) {
+        return -1;
+    }
+
+    // Slack after the chunk for the newline appended to an unterminated last line
+    char *buffer = malloc(IMPORT_CHUNK_SIZE + 8);
+    if (!buffer) {
+        source_close(&source);
+        return -1;
+    }
+
+    size_t fill = 0;
+    while (!force_exit) {
+        ssize_t n = source_read(&source, buffer + fill, IMPORT_CHUNK_SIZE - fill);
+        if (n < 0) {
+            fprintf(stderr, "Error: Failed to read %s\n", job->path);
+            ret = -1;
+            break;
+        }
+        job->csv_bytes += n;
+        fill += n;
+        if (n == 0 && fill > 0 && buffer[fill - 1] != '\n') {
+            buffer[fill++] = '\n';
+        }
+
+        const char *line = buffer;
+        const char *end = buffer + fill;
+        const char *newline;
+        while ((newline = memchr(line, '\n', end - line)) != NULL) {
+            if (import_line(job, line, newline) != 0) {
+                ret = -1;
+                break;
+            }
+            line = newline + 1;
+        }
+        if (ret != 0) {
+            break;
+        }
+
+        // Carry the incomplete last line over to the next chunk
+        fill = end - line;
+        memmove(buffer, line, fill);
+        if (fill > MAX_CSV_LINE) {
+            fprintf(stderr, "Error: %s: Line longer than %d bytes\n", job->path, MAX_CSV_LINE);
+            ret = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+    }
+
+    if (force_exit) {
+        ret = -1;
+    }
+
+    free(buffer);
+    source_close(&source);
+
+    if (job->file_open) {
+        data_file_close(&job->file);
+        if (ret != 0) {
+            discard_job_segments(job);
+        } else if (catalog.fd != -1 &&
+                   catalog_add_run(&catalog, job->dir, job->file.type, job->file.run_id) < 0) {
+            fprintf(stderr, "Warning: %s: Segments not cataloged (binance_catalog --rebuild adds them)\n", job->path);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Thread function importing dump files until none are left
+ */
+void *import_thread_func(void *arg) {
+    size_t i;
+
+    while (!force_exit && (i = atomic_fetch_add(&next_job, 1)) < job_count) {
+        import_job_t *job = &jobs[i];
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        job->failed = import_job(job) != 0;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%s: %s %llu %s, %.1f MB CSV in %.2f s%s\n", job->path, job->symbol,
+               (unsigned long long)job->records, job->kind == DUMP_AGG_TRADES ? "trades" : "klines",
+               job->csv_bytes / 1e6, seconds, job->failed ? " (failed, discarded)" : "");
+        if (job->bad_lines > 0) {
+            printf("%s: %llu malformed lines skipped\n", job->path, (unsigned long long)job->bad_lines);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Main function for the importer
+ */
+int main(int argc, char **argv) {
+    int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int c;
+    int opt_index = 0;
+
+    static struct option long_options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"segment-size", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "o:j:S:h", long_options, &opt_index)) != -1) {
+        switch (c) {
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'j':
+                thread_count = atoi(optarg);
+                if (thread_count < 1 || thread_count > MAX_IMPORT_THREADS) {
+                    fprintf(stderr, "Error: Invalid job count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S': {
+                long mb = atol(optarg);
+                if (mb <= 0) {
+                    fprintf(stderr, "Error: Invalid segment size: %s\n", optarg);
+                    return 1;
+                }
+                segment_size = (size_t)mb * 1024 * 1024;
+                break;
+            }
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    job_count = argc - optind;
+    jobs = calloc(job_count, sizeof(import_job_t));
+    if (!jobs) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < job_count; i++) {
+        jobs[i].path = argv[optind + i];
+        if (parse_dump_name(&jobs[i]) != 0) {
+            fprintf(stderr, "Error: %s is not an aggTrades or 1m klines dump (<SYMBOL>-aggTrades-... or <SYMBOL>-1m-...)\n",
+                    jobs[i].path);
+            free(jobs);
+            return 1;
+        }
+        int len = snprintf(jobs[i].dir, sizeof(jobs[i].dir), "%s/%s", output_dir, jobs[i].symbol);
+        if (len < 0 || (size_t)len >= sizeof(jobs[i].dir)) {
+            fprintf(stderr, "Error: Output directory path too long: %s\n", output_dir);
+            free(jobs);
+            return 1;
+        }
+    }
+
+    if (mkdir(output_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create output directory: %s\n", output_dir);
+        free(jobs);
+        return 1;
+    }
+
+    // Segments are cataloged once their import succeeded (failed imports are deleted)
+    if (catalog_open(&catalog, output_dir) != 0) {
+        fprintf(stderr, "Warning: Imported segments will not be cataloged\n");
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    if ((size_t)thread_count > job_count) {
+        thread_count = job_count;
+    }
+
+    pthread_t threads[MAX_IMPORT_THREADS];
+    int started = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[i], NULL, import_thread_func, NULL) != 0) {
+            fprintf(stderr, "Error: Failed to create import thread\n");
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        import_thread_func(NULL);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t records = 0, csv_bytes = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < job_count; i++) {
+        records += jobs[i].records;
+        csv_bytes += jobs[i].csv_bytes;
+        failed += jobs[i].failed || i >= atomic_load(&next_job);
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Imported %zu of %zu files: %llu records, %.1f MB CSV in %.2f s (%.1f MB/s)\n",
+           job_count - failed, job_count, (unsigned long long)records, csv_bytes / 1e6, seconds,
+           seconds > 0 ? csv_bytes / 1e6 / seconds : 0.0);
+
+    catalog_close(&catalog);
+    free(jobs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,1031 @@
+/**
+* binance_journal.c
+*
+* Decodes the raw frame journals of the collector (--journal) into the collector's native data
+* segments. Frames are decoded in bulk: one vectorized pass over a batch of thousands of frames
+* finds every structural character ({}[]:," outside strings), then the records are read field by
+* field off that index, with no tokenizer and no per-frame allocation.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <ctype.h>
+#include <limits.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_parse.h"
+
+// Decoding
+#define JOURNAL_BATCH_SIZE (1024 * 1024)      // Journal bytes indexed at a time (stays in L2)
+#define MAX_JOURNAL_SYMBOLS 1024
+
+// Fields a frame must carry to make a record (bit per field)
+#define TRADE_FIELDS 0x3F                     // E, a, p, q, T, m
+#define KLINE_FIELDS 0x3FF                    // E, and t, T, o, c, h, l, v, n, x of k
+
+// Structural index state carried from one 64-byte block to the next
+typedef struct {
+    uint64_t prev_escaped;    // The previous block ended in an odd run of backslashes
+    uint64_t prev_in_string;  // All ones if the previous block ended inside a string
+} index_state_t;
+
+// Cursor over the structural index of a batch
+typedef struct {
+    const char *buf;
+    const uint32_t *idx;      // Offsets of the structural characters in buf
+    size_t pos;               // Next structural
+    size_t count;
+} walker_t;
+
+// Kline update with the event time it is ordered by (not part of the record)
+typedef struct {
+    int64_t event_time;
+    kline_record_t record;
+} journal_kline_t;
+
+// Records of one symbol found in a journal
+typedef struct {
+    char name[MAX_SYMBOL_LENGTH];
+    char stream_name[MAX_SYMBOL_LENGTH]; // Symbol as spelled in stream names ("btcusdt")
+    char dir[PATH_MAX];
+    trade_record_t *trades;
+    size_t trade_count;
+    size_t trade_capacity;
+    journal_kline_t *klines;
+    size_t kline_count;
+    size_t kline_capacity;
+} journal_symbol_t;
+
+// One journal being decoded
+typedef struct {
+    const char *path;
+    int64_t run_id;           // Run of the collector that wrote the journal
+    journal_symbol_t *symbols;
+    size_t symbol_count;
+    size_t last_symbol;       // Symbol of the previous frame (frames of a symbol come in bursts)
+    uint64_t frames;
+    uint64_t other_frames;    // Subscription replies and streams that are not recorded
+    uint64_t bad_frames;
+    uint64_t duplicates;      // Records delivered twice while a symbol moved between connections
+    int out_of_memory;
+} journal_t;
+
+// Classifier of 64 bytes into bitmasks of quotes, backslashes and {}[]:, (bit i: byte i)
+typedef void (*classify_func_t)(const char *p, uint64_t *quote, uint64_t *backslash, uint64_t *op);
+
+// Global variables
+static volatile int force_exit = 0;
+static const char *output_dir = "./data";
+static segment_catalog_t catalog = { .fd = -1 }; // Catalog of the output directory
+static size_t segment_size = 0;        // Data segment size in bytes (0: writer default)
+static classify_func_t classify_block = NULL;
+static const char *classify_name = "scalar";
+
+// Forward declarations
+void signal_handler(int sig);
+void print_usage(const char *program_name);
+void select_classifier(void);
+size_t index_structurals(const char *buf, size_t len, uint32_t *indexes);
+int decode_frame(journal_t *journal, walker_t *w);
+int decode_data(journal_t *journal, walker_t *w, const char *stream, size_t stream_len);
+int decode_trade(walker_t *w, trade_record_t *record);
+int decode_kline(walker_t *w, journal_kline_t *kline);
+size_t decode_batch(journal_t *journal, const char *buf, size_t len, const uint32_t *indexes, size_t count);
+journal_symbol_t *journal_symbol(journal_t *journal, const char *stream, size_t len);
+int write_symbol(journal_t *journal, journal_symbol_t *symbol);
+int decode_journal(journal_t *journal);
+void free_journal(journal_t *journal);
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
+
+/**
+ * Print usage information
+ */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <journal_<run>.jsonl>...\n", program_name);
+    printf("Decodes frame journals written by the collector (--journal) into data segments of the\n");
+    printf("journal's run\n");
+    printf("Options:\n");
+    printf("  -o, --output DIR        Output directory (default: ./data)\n");
+    printf("  -S, --segment-size MB   Segment size in MB (default: %lu)\n", DEFAULT_MMAP_SEGMENT_SIZE >> 20);
+    printf("  -h, --help              Show this help message\n");
+}
+
+/**
+ * Classify 64 bytes one at a time (portable fallback)
+ */
+static void classify_scalar(const char *p, uint64_t *quote, uint64_t *backslash, uint64_t *op) {
+    *quote = *backslash = *op = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (p[i]) {
+            case '"': *quote |= bit; break;
+            case '\\': *backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': *op |= bit; break;
+            default: break;
+        }
+    }
+}
+
+#if defined(__x86_64__)
+/**
+ * Classify 64 bytes 16 at a time (SSE2, every x86-64 CPU)
+ * Setting bit 5 folds '[' onto '{' and ']' onto '}' (it also folds two control characters onto
+ * ':' and ',', which JSON text cannot contain unescaped), saving two comparisons.
+ */
+static void classify_sse2(const char *p, uint64_t *quote, uint64_t *backslash, uint64_t *op) {
+    uint64_t q = 0, b = 0, o = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i folded = _mm_or_si128(in, _mm_set1_epi8(0x20));
+        __m128i ops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                                _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8(':')),
+                                                _mm_cmpeq_epi8(folded, _mm_set1_epi8(','))));
+        q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('"'))) << (16 * i);
+        b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))) << (16 * i);
+        o |= (uint64_t)(uint16_t)_mm_movemask_epi8(ops) << (16 * i);
+    }
+
+    *quote = q;
+    *backslash = b;
+    *op = o;
+}
+
+/**
+ * Classify 64 bytes 32 at a time (AVX2), folding brackets like classify_sse2()
+ */
+__attribute__((target("avx2")))
+static void classify_avx2(const char *p, uint64_t *quote, uint64_t *backslash, uint64_t *op) {
+    uint64_t q = 0, b = 0, o = 0;
+
+    for (int i = 0; i < 2; i++) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+        __m256i folded = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+        __m256i ops = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                                                      _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8(':')),
+                                                      _mm256_cmpeq_epi8(folded, _mm256_set1_epi8(','))));
+        q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"'))) << (32 * i);
+        b |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))) << (32 * i);
+        o |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ops) << (32 * i);
+    }
+
+    *quote = q;
+    *backslash = b;
+    *op = o;
+}
+#endif
+
+/**
+ * Pick the widest classifier the CPU supports
+ */
+void select_classifier(void) {
+    classify_block = classify_scalar;
+    classify_name = "scalar";
+#if defined(__x86_64__)
+    classify_block = classify_sse2;
+    classify_name = "sse2";
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        classify_block = classify_avx2;
+        classify_name = "avx2";
+    }
+#endif
+}
+
+/**
+ * Inclusive prefix XOR of a bitmask: bit i becomes the parity of bits 0..i
+ */
+static inline uint64_t prefix_xor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/**
+ * Mask of the characters escaped by a backslash, given the block's backslashes
+ * A run of backslashes escapes the character after it if the run is odd; runs are told apart by
+ * the parity of their start, which one addition propagates along the run.
+ */
+static inline uint64_t escaped_chars(index_state_t *state, uint64_t backslash) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    if ((backslash | state->prev_escaped) == 0) {
+        return 0;
+    }
+
+    backslash &= ~state->prev_escaped;
+    uint64_t follows_escape = backslash << 1 | state->prev_escaped;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_sequences;
+    state->prev_escaped = __builtin_add_overflow(odd_starts, backslash, &even_sequences);
+    return (even_bits ^ (even_sequences << 1)) & follows_escape;
+}
+
+/**
+ * Index the structural characters of a buffer: every quote that is not escaped, and {}[]:,
+ * outside strings
+ * Returns the number of offsets stored in indexes (which must hold len entries)
+ */
+size_t index_structurals(const char *buf, size_t len, uint32_t *indexes) {
+    index_state_t state = { 0, 0 };
+    uint32_t *out = indexes;
+    char tail[64];
+
+    for (size_t offset = 0; offset < len; offset += 64) {
+        const char *block = buf + offset;
+        uint64_t quote, backslash, op;
+
+        // The last partial block is padded with spaces, which are not structural
+        if (len - offset < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, len - offset);
+            block = tail;
+        }
+        classify_block(block, &quote, &backslash, &op);
+
+        quote &= ~escaped_chars(&state, backslash);
+        uint64_t in_string = prefix_xor(quote) ^ state.prev_in_string;
+        state.prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+        // Opening quotes are inside their string, closing quotes are not: add both back
+        uint64_t structurals = (op & ~in_string) | quote;
+        while (structurals) {
+            *out++ = offset + __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+        }
+    }
+
+    return out - indexes;
+}
+
+/**
+ * Structural character at the cursor ('\0' at the end of the batch)
+ */
+static inline char walker_peek(const walker_t *w) {
+    return w->pos < w->count ? w->buf[w->idx[w->pos]] : '\0';
+}
+
+/**
+ * Step over an expected structural character
+ * Returns 1 if it was there, 0 otherwise
+ */
+static inline int walker_expect(walker_t *w, char c) {
+    if (walker_peek(w) != c) {
+        return 0;
+    }
+    w->pos++;
+    return 1;
+}
+
+/**
+ * Read a string (raw: escapes are left in place)
+ * Returns 1 if the cursor was on a string, 0 otherwise
+ */
+static inline int walker_string(walker_t *w, const char **str, size_t *len) {
+    if (walker_peek(w) != '"' || w->pos + 1 >= w->count) {
+        return 0;
+    }
+    *str = w->buf + w->idx[w->pos] + 1;
+    *len = w->idx[w->pos + 1] - w->idx[w->pos] - 1;
+    w->pos += 2;
+    return 1;
+}
+
+/**
+ * Text of a number or literal value: everything between the preceding ':' and the next structural
+ * Returns 1 if the value is not empty, 0 otherwise
+ */
+static inline int walker_scalar(const walker_t *w, const char **start, const char **end) {
+    if (w->pos == 0 || w->pos >= w->count) {
+        return 0;
+    }
+    const char *p = w->buf + w->idx[w->pos - 1] + 1;
+    const char *e = w->buf + w->idx[w->pos];
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r')) e--;
+    *start = p;
+    *end = e;
+    return p < e;
+}
+
+/**
+ * Step over a value of any kind
+ * Returns 1 on success, 0 if the value is not terminated within the batch
+ */
+static inline int walker_skip_value(walker_t *w) {
+    char c = walker_peek(w);
+    if (c == '"') {
+        w->pos += 2;
+    } else if (c == '{' || c == '[') {
+        int depth = 0;
+        do {
+            c = w->buf[w->idx[w->pos++]];
+            depth += (c == '{' || c == '[') - (c == '}' || c == ']');
+        } while (depth > 0 && w->pos < w->count);
+        return depth == 0;
+    }
+    // A scalar ends at the next structural, which the caller expects
+    return w->pos <= w->count;
+}
+
+/**
+ * Read an integer value
+ */
+static inline int walker_int(const walker_t *w, int64_t *value) {
+    const char *start, *end;
+    return walker_scalar(w, &start, &end) && parse_int(start, end, value) == end;
+}
+
+/**
+ * Read a decimal carried as a string ("42000.10"), as the exchange sends prices and quantities
+ */
+static inline int walker_decimal_string(walker_t *w, double *value) {
+    const char *str;
+    size_t len;
+    return walker_string(w, &str, &len) && parse_decimal(str, str + len, value) == str + len;
+}
+
+/**
+ * Read a true/false value
+ */
+static inline int walker_bool(const walker_t *w, uint8_t *value) {
+    const char *start, *end;
+    if (!walker_scalar(w, &start, &end)) {
+        return 0;
+    }
+    *value = *start == 't';
+    return *start == 't' || *start == 'f';
+}
+
+/**
+ * Decode the data object of an aggTrade frame
+ * Returns 0 on success, -1 if the object is malformed or lacks a field
+ */
+int decode_trade(walker_t *w, trade_record_t *record) {
+    int64_t event_time = 0, trade_time = 0, trade_id = 0;
+    double price = 0, quantity = 0;
+    uint8_t is_buyer_maker = 0;
+    unsigned fields = 0;
+    const char *key;
+    size_t key_len;
+
+    if (!walker_expect(w, '{')) {
+        return -1;
+    }
+    do {
+        if (!walker_string(w, &key, &key_len) || !walker_expect(w, ':')) {
+            return -1;
+        }
+        int ok = 1;
+        switch (key_len == 1 ? key[0] : '\0') {
+            case 'E': ok = walker_int(w, &event_time); fields |= 0x01; break;
+            case 'a': ok = walker_int(w, &trade_id); fields |= 0x02; break;
+            case 'p': ok = walker_decimal_string(w, &price); fields |= 0x04; break;
+            case 'q': ok = walker_decimal_string(w, &quantity); fields |= 0x08; break;
+            case 'T': ok = walker_int(w, &trade_time); fields |= 0x10; break;
+            case 'm': ok = walker_bool(w, &is_buyer_maker); fields |= 0x20; break;
+            default: ok = walker_skip_value(w); break;
+        }
+        if (!ok) {
+            return -1;
+        }
+    } while (walker_expect(w, ','));
+
+    if (!walker_expect(w, '}') || fields != TRADE_FIELDS) {
+        return -1;
+    }
+
+    record->event_time = event_time;
+    record->trade_time = trade_time;
+    record->price = price;
+    record->quantity = quantity;
+    record->trade_id = trade_id;
+    record->is_buyer_maker = is_buyer_maker;
+    return 0;
+}
+
+/**
+ * Decode the data object of a kline frame
+ * Returns 0 on success, -1 if the object is malformed or lacks a field
+ */
+int decode_kline(walker_t *w, journal_kline_t *kline) {
+    kline_record_t *record = &kline->record;
+    int64_t open_time = 0, close_time = 0, num_trades = 0;
+    double open = 0, close = 0, high = 0, low = 0, volume = 0;
+    uint8_t is_final = 0;
+    unsigned fields = 0;
+    const char *key;
+    size_t key_len;
+
+    if (!walker_expect(w, '{')) {
+        return -1;
+    }
+    do {
+        if (!walker_string(w, &key, &key_len) || !walker_expect(w, ':')) {
+            return -1;
+        }
+        int ok = 1;
+        if (key_len == 1 && key[0] == 'E') {
+            ok = walker_int(w, &kline->event_time);
+            fields |= 0x001;
+        } else if (key_len == 1 && key[0] == 'k') {
+            if (!walker_expect(w, '{')) {
+                return -1;
+            }
+            do {
+                if (!walker_string(w, &key, &key_len) || !walker_expect(w, ':')) {
+                    return -1;
+                }
+                switch (key_len == 1 ? key[0] : '\0') {
+                    case 't': ok = walker_int(w, &open_time); fields |= 0x002; break;
+                    case 'T': ok = walker_int(w, &close_time); fields |= 0x004; break;
+                    case 'o': ok = walker_decimal_string(w, &open); fields |= 0x008; break;
+                    case 'c': ok = walker_decimal_string(w, &close); fields |= 0x010; break;
+                    case 'h': ok = walker_decimal_string(w, &high); fields |= 0x020; break;
+                    case 'l': ok = walker_decimal_string(w, &low); fields |= 0x040; break;
+                    case 'v': ok = walker_decimal_string(w, &volume); fields |= 0x080; break;
+                    case 'n': ok = walker_int(w, &num_trades); fields |= 0x100; break;
+                    case 'x': ok = walker_bool(w, &is_final); fields |= 0x200; break;
+                    default: ok = walker_skip_value(w); break;
+                }
+                if (!ok) {
+                    return -1;
+                }
+            } while (walker_expect(w, ','));
+            ok = walker_expect(w, '}');
+        } else {
+            ok = walker_skip_value(w);
+        }
+        if (!ok) {
+            return -1;
+        }
+    } while (walker_expect(w, ','));
+
+    if (!walker_expect(w, '}') || fields != KLINE_FIELDS) {
+        return -1;
+    }
+
+    record->open_time = open_time;
+    record->close_time = close_time;
+    record->open_price = open;
+    record->close_price = close;
+    record->high_price = high;
+    record->low_price = low;
+    record->volume = volume;
+    record->num_trades = num_trades;
+    record->is_final = is_final;
+    return 0;
+}
+
+/**
+ * Find (or add) the symbol of a stream name ("btcusdt@aggTrade")
+ * Returns the symbol, or NULL if the name is invalid or there are too many symbols
+ */
+journal_symbol_t *journal_symbol(journal_t *journal, const char *stream, size_t len) {
+    const char *at = memchr(stream, '@', len);
+    size_t name_len = at ? (size_t)(at - stream) : 0;
+    if (name_len == 0 || name_len >= MAX_SYMBOL_LENGTH) {
+        return NULL;
+    }
+
+    if (journal->last_symbol < journal->symbol_count) {
+        journal_symbol_t *last = &journal->symbols[journal->last_symbol];
+        if (memcmp(last->stream_name, stream, name_len) == 0 && last->stream_name[name_len] == '\0') {
+            return last;
+        }
+    }
+    for (size_t i = 0; i < journal->symbol_count; i++) {
+        journal_symbol_t *symbol = &journal->symbols[i];
+        if (strncasecmp(symbol->name, stream, name_len) == 0 && symbol->name[name_len] == '\0') {
+            memcpy(symbol->stream_name, stream, name_len);
+            symbol->stream_name[name_len] = '\0';
+            journal->last_symbol = i;
+            return symbol;
+        }
+    }
+
+    if (journal->symbol_count == MAX_JOURNAL_SYMBOLS) {
+        return NULL;
+    }
+    journal_symbol_t *symbol = &journal->symbols[journal->symbol_count];
+    memset(symbol, 0, sizeof(*symbol));
+    for (size_t i = 0; i < name_len; i++) {
+        symbol->name[i] = toupper((unsigned char)stream[i]);
+    }
+    memcpy(symbol->stream_name, stream, name_len);
+    snprintf(symbol->dir, sizeof(symbol->dir), "%s/%s", output_dir, symbol->name);
+    journal->last_symbol = journal->symbol_count++;
+    return symbol;
+}
+
+/**
+ * Decode the data object of a frame of a stream into a record of the stream's symbol
+ * Returns 0 if the object was consumed, -1 if the frame is malformed
+ */
+int decode_data(journal_t *journal, walker_t *w, const char *stream, size_t stream_len) {
+    const char *at = memchr(stream, '@', stream_len);
+    int trade = at && stream + stream_len - at >= 9 && memcmp(at, "@aggTrade", 9) == 0;
+    int kline = at && stream + stream_len - at >= 6 && memcmp(at, "@kline", 6) == 0;
+    if (!trade && !kline) {
+        journal->other_frames++;
+        return walker_skip_value(w) ? 0 : -1;
+    }
+
+    journal_symbol_t *symbol = journal_symbol(journal, stream, stream_len);
+    if (!symbol) {
+        return -1;
+    }
+
+    if (trade) {
+        if (symbol->trade_count == symbol->trade_capacity) {
+            size_t capacity = symbol->trade_capacity ? symbol->trade_capacity * 2 : 65536;
+            trade_record_t *trades = realloc(symbol->trades, capacity * sizeof(trade_record_t));
+            if (!trades) {
+                journal->out_of_memory = 1;
+                return walker_skip_value(w) ? 0 : -1;
+            }
+            symbol->trades = trades;
+            symbol->trade_capacity = capacity;
+        }
+        if (decode_trade(w, &symbol->trades[symbol->trade_count]) != 0) {
+            return -1;
+        }
+        symbol->trade_count++;
+    } else {
+        if (symbol->kline_count == symbol->kline_capacity) {
+            size_t capacity = symbol->kline_capacity ? symbol->kline_capacity * 2 : 4096;
+            journal_kline_t *klines = realloc(symbol->klines, capacity * sizeof(journal_kline_t));
+            if (!klines) {
+                journal->out_of_memory = 1;
+                return walker_skip_value(w) ? 0 : -1;
+            }
+            symbol->klines = klines;
+            symbol->kline_capacity = capacity;
+        }
+        if (decode_kline(w, &symbol->klines[symbol->kline_count]) != 0) {
+            return -1;
+        }
+        symbol->kline_count++;
+    }
+    return 0;
+}
+
+/**
+ * Decode one frame ({"stream":"<symbol>@<kind>","data":{...}}) into the records of its symbol
+ * Returns 0 if the frame was decoded or is not a market data frame, -1 if it is malformed
+ */
+int decode_frame(journal_t *journal, walker_t *w) {
+    const char *key, *stream = NULL;
+    size_t key_len, stream_len = 0, data_pos = 0;
+    int data_done = 0;
+
+    if (!walker_expect(w, '{')) {
+        return -1;
+    }
+    do {
+        if (!walker_string(w, &key, &key_len) || !walker_expect(w, ':')) {
+            return -1;
+        }
+        int ok;
+        if (key_len == 6 && memcmp(key, "stream", 6) == 0) {
+            ok = walker_string(w, &stream, &stream_len);
+        } else if (key_len == 4 && memcmp(key, "data", 4) == 0 && stream) {
+            ok = decode_data(journal, w, stream, stream_len) == 0;
+            data_done = 1;
+        } else {
+            // Data ahead of its stream name is decoded once the name is known
+            if (key_len == 4 && memcmp(key, "data", 4) == 0) {
+                data_pos = w->pos;
+            }
+            ok = walker_skip_value(w);
+        }
+        if (!ok) {
+            return -1;
+        }
+    } while (walker_expect(w, ','));
+    if (!walker_expect(w, '}')) {
+        return -1;
+    }
+
+    if (data_done) {
+        return 0;
+    }
+    if (!stream || data_pos == 0) {
+        // Reply to a subscription change
+        journal->other_frames++;
+        return 0;
+    }
+
+    size_t end_pos = w->pos;
+    w->pos = data_pos;
+    int ret = decode_data(journal, w, stream, stream_len);
+    w->pos = end_pos;
+    return ret;
+}
+
+/**
+ * Decode the frames of an indexed batch of journal lines ("<receive time ms> <frame>\n")
+ * Returns len if every frame was decoded, otherwise the offset of the line after the first
+ * malformed frame: an unbalanced quote would throw off the string state of the rest of the
+ * index, so the caller indexes the batch again from there (raw newlines never occur in strings)
+ */
+size_t decode_batch(journal_t *journal, const char *buf, size_t len, const uint32_t *indexes, size_t count) {
+    walker_t w = { buf, indexes, 0, count };
+
+    while (w.pos < w.count) {
+        size_t start = indexes[w.pos];
+        journal->frames++;
+        if (decode_frame(journal, &w) != 0) {
+            journal->bad_frames++;
+            const char *newline = memchr(buf + start, '\n', len - start);
+            return newline ? (size_t)(newline + 1 - buf) : len;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Compare trades by aggregate trade id
+ */
+static int compare_trades(const void *a, const void *b) {
+    int64_t ia = ((const trade_record_t *)a)->trade_id;
+    int64_t ib = ((const trade_record_t *)b)->trade_id;
+    return (ia > ib) - (ia < ib);
+}
+
+/**
+ * Compare kline updates by event time, then open time
+ */
+static int compare_klines(const void *a, const void *b) {
+    const journal_kline_t *ka = a, *kb = b;
+    int64_t oa = ka->record.open_time, ob = kb->record.open_time;
+    if (ka->event_time != kb->event_time) {
+        return (ka->event_time > kb->event_time) - (ka->event_time < kb->event_time);
+    }
+    return (oa > ob) - (oa < ob);
+}
+
+/**
+ * Write the records of a symbol to its segments of the journal's run
+ * Frames of a symbol moving between connections arrive twice and interleaved, as they did for the
+ * collector; here the records are simply put in order and duplicates dropped.
+ * Returns 0 on success, -1 on failure
+ */
+int write_symbol(journal_t *journal, journal_symbol_t *symbol) {
+    for (int kind = 0; kind < 2; kind++) {
+        data_type_t type = kind == 0 ? DATA_TYPE_TRADE : DATA_TYPE_KLINE;
+        size_t count = kind == 0 ? symbol->trade_count : symbol->kline_count;
+        size_t kept = 0;
+        data_file_t file;
+
+        if (count == 0) {
+            continue;
+        }
+
+        // Sort only if needed (connections rarely overtake each other)
+        if (kind == 0) {
+            for (size_t i = 1; i < count; i++) {
+                if (compare_trades(&symbol->trades[i - 1], &symbol->trades[i]) > 0) {
+                    qsort(symbol->trades, count, sizeof(trade_record_t), compare_trades);
+                    break;
+                }
+            }
+        } else {
+            for (size_t i = 1; i < count; i++) {
+                if (compare_klines(&symbol->klines[i - 1], &symbol->klines[i]) > 0) {
+                    qsort(symbol->klines, count, sizeof(journal_kline_t), compare_klines);
+                    break;
+                }
+            }
+        }
+
+        if (data_file_open(&file, WRITER_MMAP, type, symbol->dir, symbol->name, journal->run_id, segment_size) != 0) {
+            fprintf(stderr, "Error: %s: Failed to open data file in %s\n", journal->path, symbol->dir);
+            data_file_close(&file);
+            return -1;
+        }
+
+        int ret = 0;
+        for (size_t i = 0; i < count && ret == 0; i++) {
+            const void *record;
+            if (kind == 0) {
+                if (i > 0 && compare_trades(&symbol->trades[i - 1], &symbol->trades[i]) == 0) {
+                    continue;
+                }
+                record = &symbol->trades[i];
+            } else {
+                if (i > 0 && compare_klines(&symbol->klines[i - 1], &symbol->klines[i]) == 0) {
+                    continue;
+                }
+                record = &symbol->klines[i].record;
+            }
+
+            if (data_file_append(&file, record) != 0) {
+                fprintf(stderr, "Error: %s: Failed to write record: %s\n", journal->path, strerror(errno));
+                ret = -1;
+            }
+            kept++;
+
+            // Finalize segments as soon as they fill up
+            if (atomic_load_explicit(&file.retired, memory_order_relaxed)) {
+                data_file_reap(&file, NULL);
+            }
+        }
+        data_file_close(&file);
+        journal->duplicates += count - kept;
+
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Decode a journal into the segments of its run
+ * Returns 0 on success, -1 on failure
+ */
+int decode_journal(journal_t *journal) {
+    char name[PATH_MAX];
+    const char *base;
+    long long run_id;
+    int name_len = 0;
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "%s", journal->path);
+    base = basename(name);
+    if (sscanf(base, "journal_%lld.jsonl%n", &run_id, &name_len) != 1 || name_len == 0 || base[name_len] != '\0') {
+        fprintf(stderr, "Error: %s: Not a journal (journal_<run>.jsonl)\n", journal->path);
+        return -1;
+    }
+    journal->run_id = run_id;
+
+    int fd = open(journal->path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", journal->path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map %s: %s\n", journal->path, strerror(errno));
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    journal->symbols = calloc(MAX_JOURNAL_SYMBOLS, sizeof(journal_symbol_t));
+    uint32_t *indexes = malloc(JOURNAL_BATCH_SIZE * sizeof(uint32_t));
+    if (!journal->symbols || !indexes) {
+        munmap((void *)map, size);
+        free(indexes);
+        return -1;
+    }
+
+    // Index and decode batch by batch; a batch ends after its last complete line
+    struct timespec start, decoded;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t offset = 0;
+    while (offset < size && !force_exit) {
+        size_t limit = size - offset < JOURNAL_BATCH_SIZE ? size - offset : JOURNAL_BATCH_SIZE;
+        const char *newline = memrchr(map + offset, '\n', limit);
+        if (!newline) {
+            if (limit < JOURNAL_BATCH_SIZE) {
+                // The collector stopped in the middle of a line
+                fprintf(stderr, "%s: Incomplete last line (%zu bytes) skipped\n", journal->path, limit);
+                break;
+            }
+            fprintf(stderr, "Error: %s: Line longer than %d bytes at offset %zu\n", journal->path,
+                    JOURNAL_BATCH_SIZE, offset);
+            ret = -1;
+            break;
+        }
+
+        size_t len = newline + 1 - (map + offset);
+        for (size_t done = 0; done < len; ) {
+            size_t count = index_structurals(map + offset + done, len - done, indexes);
+            done += decode_batch(journal, map + offset + done, len - done, indexes, count);
+        }
+        offset += len;
+        if (journal->out_of_memory) {
+            fprintf(stderr, "Error: %s: Out of memory for the records\n", journal->path);
+            ret = -1;
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &decoded);
+    free(indexes);
+    munmap((void *)map, size);
+
+    if (force_exit) {
+        ret = -1;
+    }
+
+    // Refuse runs that already exist before writing anything
+    for (size_t i = 0; i < journal->symbol_count && ret == 0; i++) {
+        journal_symbol_t *symbol = &journal->symbols[i];
+        for (int kind = 0; kind < 2; kind++) {
+            char path[PATH_MAX];
+            if ((kind == 0 ? symbol->trade_count : symbol->kline_count) == 0) {
+                continue;
+            }
+            int len = snprintf(path, sizeof(path), "%s/%s_%lld_%06u.bin", symbol->dir,
+                               kind == 0 ? "trades" : "klines", (long long)journal->run_id, 0);
+            if (len < 0 || (size_t)len >= sizeof(path)) {
+                fprintf(stderr, "Error: %s: Segment path too long in %s\n", journal->path, symbol->dir);
+                ret = -1;
+                break;
+            }
+            if (access(path, F_OK) == 0) {
+                fprintf(stderr, "Error: %s: %s already exists (already decoded?)\n", journal->path, path);
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    size_t written = 0;
+    for (; written < journal->symbol_count && ret == 0; written++) {
+        journal_symbol_t *symbol = &journal->symbols[written];
+        if (mkdir(symbol->dir, 0755) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Error: Failed to create directory %s: %s\n", symbol->dir, strerror(errno));
+            ret = -1;
+        } else if (write_symbol(journal, symbol) != 0) {
+            ret = -1;
+        }
+    }
+
+    // Nothing of a failed journal is left behind
+    if (ret != 0) {
+        for (size_t i = 0; i < written; i++) {
+            for (int kind = 0; kind < 2; kind++) {
+                char path[PATH_MAX];
+                for (uint32_t s = 0; ; s++) {
+                    int len = snprintf(path, sizeof(path), "%s/%s_%lld_%06u.bin", journal->symbols[i].dir,
+                                       kind == 0 ? "trades" : "klines", (long long)journal->run_id, s);
+                    if (len < 0 || (size_t)len >= sizeof(path) || unlink(path) != 0) {
+                        break;
+                    }
+                }
+            }
+        }
+    } else if (catalog.fd != -1) {
+        // Cataloged only once the whole journal is known to stay
+        for (size_t i = 0; i < journal->symbol_count; i++) {
+            for (int kind = 0; kind < 2; kind++) {
+                if (catalog_add_run(&catalog, journal->symbols[i].dir, kind == 0 ? DATA_TYPE_TRADE : DATA_TYPE_KLINE,
+                                    journal->run_id) < 0) {
+                    fprintf(stderr, "Warning: %s: Segments of %s not cataloged (binance_catalog --rebuild adds them)\n",
+                            journal->path, journal->symbols[i].name);
+                }
+            }
+        }
+    }
+
+    double seconds = (decoded.tv_sec - start.tv_sec) + (decoded.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: run %lld, %llu frames, %.1f MB decoded in %.3f s (%.0f MB/s, %s)\n", journal->path,
+           (long long)journal->run_id, (unsigned long long)journal->frames, offset / 1e6, seconds,
+           seconds > 0 ? offset / 1e6 / seconds : 0.0, classify_name);
+    for (size_t i = 0; i < journal->symbol_count; i++) {
+        printf("  %s: %zu trades, %zu klines\n", journal->symbols[i].name,
+               journal->symbols[i].trade_count, journal->symbols[i].kline_count);
+    }
+    if (journal->duplicates > 0 || journal->other_frames > 0 || journal->bad_frames > 0) {
+        printf("  %llu duplicate records dropped, %llu other frames, %llu malformed frames skipped\n",
+               (unsigned long long)journal->duplicates, (unsigned long long)journal->other_frames,
+               (unsigned long long)journal->bad_frames);
+    }
+    if (ret != 0) {
+        printf("%s: failed, discarded\n", journal->path);
+    }
+
+    return ret;
+}
+
+/**
+ * Release the records of a decoded journal
+ */
+void free_journal(journal_t *journal) {
+    if (journal->symbols) {
+        for (size_t i = 0; i < journal->symbol_count; i++) {
+            free(journal->symbols[i].trades);
+            free(journal->symbols[i].klines);
+        }
+        free(journal->symbols);
+        journal->symbols = NULL;
+    }
+}
+
+/**
+ * Main function for the journal decoder
+ */
+int main(int argc, char **argv) {
+    int c;
+    int opt_index = 0;
+    int failed = 0;
+
+    static struct option long_options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"segment-size", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "o:S:h", long_options, &opt_index)) != -1) {
+        switch (c) {
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'S': {
+                long mb = atol(optarg);
+                if (mb <= 0) {
+                    fprintf(stderr, "Error: Invalid segment size: %s\n", optarg);
+                    return 1;
+                }
+                segment_size = (size_t)mb * 1024 * 1024;
+                break;
+            }
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Symbol directories (<output>/<SYMBOL>) must fit PATH_MAX
+    if (strlen(output_dir) + 1 + MAX_SYMBOL_LENGTH >= PATH_MAX) {
+        fprintf(stderr, "Error: Output directory path too long: %s\n", output_dir);
+        return 1;
+    }
+
+    if (mkdir(output_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create output directory %s: %s\n", output_dir, strerror(errno));
+        return 1;
+    }
+
+    if (catalog_open(&catalog, output_dir) != 0) {
+        fprintf(stderr, "Warning: Decoded segments will not be cataloged\n");
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    select_classifier();
+
+    for (int i = optind; i < argc && !force_exit; i++) {
+        journal_t journal;
+        memset(&journal, 0, sizeof(journal));
+        journal.path = argv[i];
+        if (decode_journal(&journal) != 0) {
+            failed++;
+        }
+        free_journal(&journal);
+    }
+
+    catalog_close(&catalog);
+    return failed > 0 ? 1 : 0;
+}
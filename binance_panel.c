@@ -0,0 +1,406 @@
+/**
+* binance_panel.c
+*
+* Samples the latest state of every symbol the collector publishes on a fixed time grid and
+* appends one wide row per grid time to panel files: aligned cross-sectional snapshots (last
+* price, recent volume, live candle) without an as-of join over the per-symbol data files
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_consumer.h"
+
+#define DEFAULT_GRID_MS 100                   // Row interval
+#define DEFAULT_VOLUME_WINDOW_MS 1000         // Trades summed into the volume column
+#define MAX_VOLUME_BUCKETS 600                // Grid steps in the volume window
+#define PUBLISH_DELAY_MS 5                    // Row T is sampled this long after T, so that records
+                                              // received just before T have been published
+
+// One symbol's streams and the panel state built from them
+typedef struct {
+    char symbol[MAX_SYMBOL_LENGTH];
+    consumer_t trades;
+    consumer_t klines;
+    consumer_record_t next_trade;   // Record read past the grid time, applied to a later row
+    consumer_record_t next_kline;
+    int has_next_trade;
+    int has_next_kline;
+    double volume[MAX_VOLUME_BUCKETS]; // Trade volume received in each of the last grid steps
+    panel_columns_t columns;
+} panel_symbol_t;
+
+// Global variables
+static volatile int force_exit = 0;
+static panel_symbol_t panel[MAX_SYMBOLS];
+static size_t panel_count = 0;
+static const char *output_dir = "./panel";
+static int64_t grid_ms = DEFAULT_GRID_MS;
+static int64_t volume_window_ms = DEFAULT_VOLUME_WINDOW_MS;
+static size_t segment_size = 0;        // Panel segment size in bytes (0: writer default)
+
+// Forward declarations
+void signal_handler(int sig);
+void print_usage(const char *program_name);
+int select_symbols(const char *symbols);
+int write_columns_file(int64_t run_id);
+int drain_trades(panel_symbol_t *entry, int64_t time_ns, size_t bucket);
+int drain_klines(panel_symbol_t *entry, int64_t time_ns);
+void fill_row(char *row, int64_t time_ms, size_t buckets);
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
+
+/**
+ * Print usage information
+ */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("Options:\n");
+    printf("  -s, --symbol SYMBOLS        Comma-separated symbols to sample (default: all the collector publishes)\n");
+    printf("  -o, --output DIR            Directory for the panel files (default: ./panel)\n");
+    printf("  -g, --grid MS               Row interval in milliseconds (default: %d)\n", DEFAULT_GRID_MS);
+    printf("  -v, --volume-window MS      Volume column window, a multiple of the grid (default: %d)\n",
+           DEFAULT_VOLUME_WINDOW_MS);
+    printf("  -S, --segment-size MB       Segment size (default: 256)\n");
+    printf("  -h, --help                  Show this help message\n");
+}
+
+/**
+ * Open live-only trade and kline consumers for the selected symbols, in shared memory order
+ * Returns 0 on success, -1 on failure
+ */
+int select_symbols(const char *symbols) {
+    int fd = shm_open("/binance_market_data", O_RDONLY, 0666);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Failed to open shared memory (is the collector running?): %s\n", strerror(errno));
+        return -1;
+    }
+    shared_memory_header_t *header = mmap(NULL, sizeof(shared_memory_header_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map shared memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < header->symbol_count && i < MAX_SYMBOLS; i++) {
+        const char *symbol = header->symbols[i];
+        if (symbols) {
+            size_t symbol_len = strlen(symbol);
+            const char *p = symbols;
+            int selected = 0;
+            while (*p && !selected) {
+                size_t len = strcspn(p, ",");
+                selected = len == symbol_len && strncasecmp(p, symbol, len) == 0;
+                p += len;
+                if (*p == ',') p++;
+            }
+            if (!selected) {
+                continue;
+            }
+        }
+
+        panel_symbol_t *entry = &panel[panel_count];
+        strncpy(entry->symbol, symbol, MAX_SYMBOL_LENGTH - 1);
+        if (consumer_open(&entry->trades, symbol, DATA_TYPE_TRADE, CONSUMER_LIVE_ONLY) != 0) {
+            ret = -1;
+            break;
+        }
+        if (consumer_open(&entry->klines, symbol, DATA_TYPE_KLINE, CONSUMER_LIVE_ONLY) != 0) {
+            consumer_close(&entry->trades);
+            ret = -1;
+            break;
+        }
+        entry->columns.last_price = NAN;
+        entry->columns.open_price = NAN;
+        entry->columns.high_price = NAN;
+        entry->columns.low_price = NAN;
+        entry->columns.close_price = NAN;
+        panel_count++;
+    }
+
+    munmap(header, sizeof(shared_memory_header_t));
+    if (ret == 0 && panel_count == 0) {
+        fprintf(stderr, "Error: No symbol matches %s\n", symbols ? symbols : "(none published)");
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * Write the panel's column names and types (panel_<run>.columns, one "name type" per line)
+ * Returns 0 on success, -1 on failure
+ */
+int write_columns_file(int64_t run_id) {
+    static const char *names[] = {
+        "last_price", "volume", "kline_open_time", "open", "high", "low", "close", "kline_volume"
+    };
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/panel_%lld.columns", output_dir, (long long)run_id);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Failed to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "time_ms int64\n");
+    for (size_t i = 0; i < panel_count; i++) {
+        for (size_t c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+            fprintf(fp, "%s.%s %s\n", panel[i].symbol, names[c], c == 2 ? "int64" : "float64");
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Apply a symbol's trades received up to time_ns, adding their volume to the given bucket
+ * Returns 0 on success, -1 on failure
+ */
+int drain_trades(panel_symbol_t *entry, int64_t time_ns, size_t bucket) {
+    for (;;) {
+        if (!entry->has_next_trade) {
+            int r = consumer_next(&entry->trades, &entry->next_trade);
+            if (r <= 0) {
+                return r;
+            }
+            entry->has_next_trade = 1;
+        }
+
+        // Records refilled from the data files after an overrun have no receive time (0) and
+        // belong to the current row
+        if (entry->next_trade.header.timestamp > time_ns) {
+            return 0;
+        }
+        entry->columns.last_price = entry->next_trade.record.trade.price;
+        entry->volume[bucket] += entry->next_trade.record.trade.quantity;
+        entry->has_next_trade = 0;
+    }
+}
+
+/**
+ * Apply a symbol's klines received up to time_ns
+ * Returns 0 on success, -1 on failure
+ */
+int drain_klines(panel_symbol_t *entry, int64_t time_ns) {
+    for (;;) {
+        if (!entry->has_next_kline) {
+            int r = consumer_next(&entry->klines, &entry->next_kline);
+            if (r <= 0) {
+                return r;
+            }
+            entry->has_next_kline = 1;
+        }
+
+        if (entry->next_kline.header.timestamp > time_ns) {
+            return 0;
+        }
+        const kline_record_t *kline = &entry->next_kline.record.kline;
+        entry->columns.kline_open_time = kline->open_time;
+        entry->columns.open_price = kline->open_price;
+        entry->columns.high_price = kline->high_price;
+        entry->columns.low_price = kline->low_price;
+        entry->columns.close_price = kline->close_price;
+        entry->columns.kline_volume = kline->volume;
+        entry->has_next_kline = 0;
+    }
+}
+
+/**
+ * Lay out the row of a grid time: the time, then every symbol's columns
+ */
+void fill_row(char *row, int64_t time_ms, size_t buckets) {
+    memcpy(row, &time_ms, sizeof(time_ms));
+    row += sizeof(time_ms);
+
+    for (size_t i = 0; i < panel_count; i++) {
+        double volume = 0;
+        for (size_t b = 0; b < buckets; b++) {
+            volume += panel[i].volume[b];
+        }
+        panel[i].columns.volume = volume;
+        memcpy(row, &panel[i].columns, sizeof(panel_columns_t));
+        row += sizeof(panel_columns_t);
+    }
+}
+
+/**
+ * Main function for the panel sampler
+ */
+int main(int argc, char **argv) {
+    const char *symbol_arg = NULL;
+    int c;
+    int opt_index = 0;
+
+    static struct option long_options[] = {
+        {"symbol", required_argument, NULL, 's'},
+        {"output", required_argument, NULL, 'o'},
+        {"grid", required_argument, NULL, 'g'},
+        {"volume-window", required_argument, NULL, 'v'},
+        {"segment-size", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "s:o:g:v:S:h", long_options, &opt_index)) != -1) {
+        switch (c) {
+            case 's':
+                symbol_arg = optarg;
+                break;
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'g':
+                grid_ms = atoll(optarg);
+                if (grid_ms <= 0) {
+                    fprintf(stderr, "Error: Invalid grid interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'v':
+                volume_window_ms = atoll(optarg);
+                if (volume_window_ms <= 0) {
+                    fprintf(stderr, "Error: Invalid volume window: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S': {
+                long mb = atol(optarg);
+                if (mb <= 0) {
+                    fprintf(stderr, "Error: Invalid segment size: %s\n", optarg);
+                    return 1;
+                }
+                segment_size = (size_t)mb * 1024 * 1024;
+                break;
+            }
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    // The volume window is kept as whole grid steps
+    if (volume_window_ms % grid_ms != 0 || volume_window_ms / grid_ms > MAX_VOLUME_BUCKETS) {
+        fprintf(stderr, "Error: The volume window must be a multiple of the grid, at most %d steps\n",
+                MAX_VOLUME_BUCKETS);
+        return 1;
+    }
+    size_t buckets = volume_window_ms / grid_ms;
+
+    if (mkdir(output_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create output directory: %s\n", output_dir);
+        return 1;
+    }
+
+    if (select_symbols(symbol_arg) != 0) {
+        for (size_t i = 0; i < panel_count; i++) {
+            consumer_close(&panel[i].trades);
+            consumer_close(&panel[i].klines);
+        }
+        return 1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // Grid times are on the collector's receive clock, the clock of the records' timestamps
+    int64_t now_ns = consumer_now_ns(&panel[0].trades);
+    int64_t run_id = now_ns / 1000000000LL;
+    int64_t next_ms = (now_ns / 1000000 / grid_ms + 1) * grid_ms;
+    uint64_t rows = 0;
+    int ret = 1;
+
+    data_file_t file;
+    memset(&file, 0, sizeof(file));
+    file.record_size = sizeof(int64_t) + panel_count * sizeof(panel_columns_t);
+    char *row = malloc(file.record_size);
+    if (!row || write_columns_file(run_id) != 0) {
+        goto cleanup;
+    }
+    if (data_file_open(&file, WRITER_STDIO, DATA_TYPE_PANEL, output_dir, "PANEL", run_id,
+                       segment_size ? segment_size : DEFAULT_MMAP_SEGMENT_SIZE) != 0) {
+        fprintf(stderr, "Error: Failed to open panel file in %s\n", output_dir);
+        goto cleanup;
+    }
+
+    printf("Sampling %zu symbols every %lld ms into %s/panel_%lld_*.bin (%u-byte rows)\n", panel_count,
+           (long long)grid_ms, output_dir, (long long)run_id, file.record_size);
+
+    while (!force_exit) {
+        now_ns = consumer_now_ns(&panel[0].trades);
+        int64_t due_ns = (next_ms + PUBLISH_DELAY_MS) * 1000000;
+        if (now_ns < due_ns) {
+            int64_t wait_ns = due_ns - now_ns;
+            struct timespec wait = { wait_ns / 1000000000LL, wait_ns % 1000000000LL };
+            nanosleep(&wait, NULL);
+            continue;
+        }
+
+        // Every row that is due, in order: a late wake-up still gets a row per grid time
+        int written = 0;
+        while (next_ms * 1000000 + PUBLISH_DELAY_MS * 1000000 <= now_ns) {
+            size_t bucket = (next_ms / grid_ms) % buckets;
+            for (size_t i = 0; i < panel_count; i++) {
+                panel[i].volume[bucket] = 0;
+                if (drain_trades(&panel[i], next_ms * 1000000, bucket) != 0 ||
+                    drain_klines(&panel[i], next_ms * 1000000) != 0) {
+                    fprintf(stderr, "Error: Failed to read %s records\n", panel[i].symbol);
+                    goto done;
+                }
+            }
+
+            fill_row(row, next_ms, buckets);
+            if (data_file_append(&file, row) != 0) {
+                fprintf(stderr, "Error: Failed to write panel row: %s\n", strerror(errno));
+                goto done;
+            }
+            rows++;
+            written++;
+            next_ms += grid_ms;
+        }
+        if (written > 0) {
+            data_file_flush(&file);
+        }
+    }
+    ret = 0;
+
+done:
+    data_file_close(&file);
+    printf("Wrote %llu rows\n", (unsigned long long)rows);
+
+cleanup:
+    free(row);
+    for (size_t i = 0; i < panel_count; i++) {
+        consumer_close(&panel[i].trades);
+        consumer_close(&panel[i].klines);
+    }
+    return ret;
+}
@@ -0,0 +1,115 @@
+/**
+* binance_parse.h
+*
+* Number parsing shared by the tools that decode text into records (CSV dumps, frame journals)
+*/
+
+#ifndef BINANCE_PARSE_H
+#define BINANCE_PARSE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Powers of ten exactly representable as doubles
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parse eight ASCII digits at once (SWAR: the digits are combined pairwise inside one word)
+ * Returns 1 and stores the value if all eight bytes are digits, 0 otherwise
+ */
+static inline int parse_eight_digits(const char *p, uint64_t *value) {
+    uint64_t chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+
+    // Every byte must be 0x30..0x39: high nibble 3, and adding 6 must not carry into it
+    if (((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+         (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL) {
+        return 0;
+    }
+
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    *value = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+              (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return 1;
+}
+
+/**
+ * Accumulate a run of digits into mantissa, eight at a time where possible
+ * Returns a pointer past the digits; *count receives the number of digits
+ */
+static inline const char *parse_digits(const char *p, const char *end, uint64_t *mantissa, int *count) {
+    const char *start = p;
+    uint64_t value;
+
+    while (end - p >= 8 && parse_eight_digits(p, &value)) {
+        *mantissa = *mantissa * 100000000ULL + value;
+        p += 8;
+    }
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        *mantissa = *mantissa * 10 + (*p - '0');
+        p++;
+    }
+
+    *count = p - start;
+    return p;
+}
+
+/**
+ * Parse a decimal integer
+ * Returns a pointer to the character after the number, or NULL if there is none
+ */
+static inline const char *parse_int(const char *p, const char *end, int64_t *value) {
+    int negative = p < end && *p == '-';
+    uint64_t mantissa = 0;
+    int digits;
+
+    p = parse_digits(p + negative, end, &mantissa, &digits);
+    if (digits == 0 || digits > 18) {
+        return NULL;
+    }
+
+    *value = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+    return p;
+}
+
+/**
+ * Parse a decimal number (digits, optional fraction)
+ * Up to 15 significant digits are converted exactly, as mantissa / 10^fraction digits
+ * (both exact doubles, so the division rounds correctly); longer numbers go through strtod.
+ * Returns a pointer to the character after the number, or NULL if there is none
+ */
+static inline const char *parse_decimal(const char *p, const char *end, double *value) {
+    const char *start = p;
+    int negative = p < end && *p == '-';
+    uint64_t mantissa = 0;
+    int int_digits, frac_digits = 0;
+
+    p = parse_digits(p + negative, end, &mantissa, &int_digits);
+    if (p < end && *p == '.') {
+        p = parse_digits(p + 1, end, &mantissa, &frac_digits);
+    }
+    if (int_digits + frac_digits == 0) {
+        return NULL;
+    }
+
+    if (int_digits + frac_digits <= 15 && (p == end || (*p != 'e' && *p != 'E'))) {
+        *value = (double)mantissa / exact_powers_of_ten[frac_digits];
+        if (negative) {
+            *value = -*value;
+        }
+        return p;
+    }
+
+    // Slow path; the text must be terminated by a character that stops strtod (a newline, a
+    // quote or a JSON separator)
+    char *number_end;
+    *value = strtod(start, &number_end);
+    return number_end > end ? NULL : number_end;
+}
+
+#endif /* BINANCE_PARSE_H */
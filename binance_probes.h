@@ -0,0 +1,71 @@
+/**
+* binance_probes.h
+*
+* Static tracepoints (USDT) of the collector's hot path, provider "binance"
+*
+* A disabled probe is a single nop in the instruction stream plus an ELF note describing where its
+* arguments live, so the probes stay compiled in. Tracers enable them on the running collector:
+*
+*     bpftrace -e 'usdt:./binance_collector:binance:record_persisted { @[arg1] = count(); }'
+*
+* Builds without <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel) or with BINANCE_NO_PROBES
+* get empty probes. Timestamps of the probe hits come from the tracer (nsecs); the probes carry
+* the exchange times of the records so both clocks can be compared.
+*/
+
+#ifndef BINANCE_PROBES_H
+#define BINANCE_PROBES_H
+
+#if !defined(BINANCE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BINANCE_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef BINANCE_HAVE_PROBES
+
+// A frame arrived on a connection: connection, frame length, frame number on the connection
+#define PROBE_FRAME_RECEIVED(shard, length, frame_seq) \
+    DTRACE_PROBE3(binance, frame_received, shard, length, frame_seq)
+
+// A frame was parsed into a record: connection, symbol index, data type, exchange event time (ms),
+// aggregate trade id or kline open time
+#define PROBE_PARSE_DONE(shard, symbol_idx, type, event_time, id) \
+    DTRACE_PROBE5(binance, parse_done, shard, symbol_idx, type, event_time, id)
+
+// A record was appended to its data file: symbol index, data type, sequence, exchange event time (ms)
+#define PROBE_RECORD_PERSISTED(symbol_idx, type, sequence, event_time) \
+    DTRACE_PROBE4(binance, record_persisted, symbol_idx, type, sequence, event_time)
+
+// A record was published to its live ring: symbol index, data type, sequence, exchange event time (ms)
+#define PROBE_SHM_PUBLISHED(symbol_idx, type, sequence, event_time) \
+    DTRACE_PROBE4(binance, shm_published, symbol_idx, type, sequence, event_time)
+
+// A connection was established: connection, times it has been established (above 1: reconnected)
+#define PROBE_CONNECTION_UP(shard, established) \
+    DTRACE_PROBE2(binance, connection_up, shard, established)
+
+// A connection was lost: connection, 1 on a connection error, 0 when closed
+#define PROBE_CONNECTION_DOWN(shard, error) \
+    DTRACE_PROBE2(binance, connection_down, shard, error)
+
+#else
+
+// Arguments are still evaluated, so that builds with and without probes behave alike
+#define PROBE_FRAME_RECEIVED(shard, length, frame_seq) \
+    do { (void)(shard); (void)(length); (void)(frame_seq); } while (0)
+#define PROBE_PARSE_DONE(shard, symbol_idx, type, event_time, id) \
+    do { (void)(shard); (void)(symbol_idx); (void)(type); (void)(event_time); (void)(id); } while (0)
+#define PROBE_RECORD_PERSISTED(symbol_idx, type, sequence, event_time) \
+    do { (void)(symbol_idx); (void)(type); (void)(sequence); (void)(event_time); } while (0)
+#define PROBE_SHM_PUBLISHED(symbol_idx, type, sequence, event_time) \
+    do { (void)(symbol_idx); (void)(type); (void)(sequence); (void)(event_time); } while (0)
+#define PROBE_CONNECTION_UP(shard, established) \
+    do { (void)(shard); (void)(established); } while (0)
+#define PROBE_CONNECTION_DOWN(shard, error) \
+    do { (void)(shard); (void)(error); } while (0)
+
+#endif
+
+#endif /* BINANCE_PROBES_H */
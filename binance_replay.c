@@ -0,0 +1,731 @@
+/**
+* binance_replay.c
+*
+* Replays recorded trades and klines of several symbols, merged by event time, into the same
+* shared memory (and data files) the collector maintains, so that strategies built on the
+* consumer library run unmodified against history
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <strings.h>
+#include <signal.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_consumer.h"
+#include "binance_clock.h"
+
+#define SNAPSHOT_INTERVAL_RECORDS 4096        // Refresh the snapshot areas at least this often
+#define COLLECTOR_ALIVE_SEC 5                 // Shared memory updated this recently belongs to a live collector
+
+// One input stream: a symbol's recorded trades or klines, read from its data segments
+typedef struct {
+    consumer_t consumer;
+    size_t symbol_idx;
+    data_type_t type;
+    consumer_record_t record; // Next record of the stream
+    int64_t key;              // Its event time (ms): merge order
+    uint32_t order;           // Stream index, breaks ties so equal times replay deterministically
+} replay_stream_t;
+
+// Global variables
+static volatile int force_exit = 0;
+static symbol_data_t symbols[MAX_SYMBOLS];
+static size_t symbol_count = 0;
+static const char *input_dir = "./data";
+static const char *output_dir = "./replay";
+static segment_catalog_t catalog = { .fd = -1 }; // Catalog of the output directory's finalized segments
+static int shm_fd = -1;
+static void *shared_memory = NULL;
+static shared_memory_header_t *shm_header = NULL;
+static replay_stream_t streams[MAX_SYMBOLS * 2];
+static replay_stream_t *heap[MAX_SYMBOLS * 2];  // Min-heap of the streams with a pending record
+static size_t heap_size = 0;
+static int64_t run_id = 0;
+
+// Forward declarations
+void signal_handler(int sig);
+void print_usage(const char *program_name);
+int64_t parse_time_ms(const char *text);
+int stream_advance(replay_stream_t *stream, int64_t to_ms);
+void heap_sift_down(size_t pos);
+void heap_push(replay_stream_t *stream);
+int init_shared_memory(void);
+void cleanup_shared_memory(void);
+void publish_virtual_clock(int64_t virtual_start_ms, double rate);
+void publish_record(shm_ring_t *ring, const message_header_t *header, const void *record, size_t size);
+int replay_record(replay_stream_t *stream, int64_t virtual_ms);
+void update_snapshots(void);
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
+
+/**
+ * Print usage information
+ */
+void print_usage(const char *program_name) {
+    printf("Usage: %s -s SYMBOLS [options]\n", program_name);
+    printf("Options:\n");
+    printf("  -s, --symbol SYMBOLS    Comma-separated symbols to replay (e.g., btcusdt,ethusdt)\n");
+    printf("  -i, --input DIR         Directory holding the recorded data (default: ./data)\n");
+    printf("  -o, --output DIR        Directory for the replayed run's data files (default: ./replay)\n");
+    printf("  -f, --from TIME         Start at this time (ms since epoch or YYYY-MM-DD[THH:MM:SS], UTC)\n");
+    printf("  -t, --to TIME           Stop after this time\n");
+    printf("  -r, --rate RATE         Virtual clock speed relative to real time, or max to run free (default: 1)\n");
+    printf("  -x, --exit              Exit at the end instead of keeping the shared memory up\n");
+    printf("  -h, --help              Show this help message\n");
+}
+
+/**
+ * Parse a time argument: milliseconds since the epoch, or a UTC date with optional time
+ * Returns the time in ms, or -1 if it cannot be parsed
+ */
+int64_t parse_time_ms(const char *text) {
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    if (*end == '\0' && end != text) {
+        return value;
+    }
+
+    struct tm tm = { 0 };
+    const char *rest = strptime(text, "%Y-%m-%d", &tm);
+    if (rest && (*rest == 'T' || *rest == ' ')) {
+        rest = strptime(rest + 1, "%H:%M:%S", &tm);
+    }
+    if (!rest || *rest != '\0') {
+        return -1;
+    }
+    return (int64_t)timegm(&tm) * 1000;
+}
+
+/**
+ * Event time a record is merged by
+ * Klines carry no event time; their close time is used, so that a strategy never sees a
+ * candle before the trades it summarizes.
+ */
+static int64_t record_key(const consumer_record_t *record) {
+    if (record->header.type == DATA_TYPE_TRADE) {
+        return record->record.trade.event_time;
+    }
+    return record->record.kline.close_time;
+}
+
+/**
+ * Load the next record of a stream
+ * Returns 1 if the stream has a record up to to_ms, 0 if it is exhausted, -1 on failure
+ */
+int stream_advance(replay_stream_t *stream, int64_t to_ms) {
+    int ret = consumer_next(&stream->consumer, &stream->record);
+    if (ret != 1) {
+        return ret;
+    }
+
+    stream->key = record_key(&stream->record);
+    return stream->key <= to_ms ? 1 : 0;
+}
+
+/**
+ * Heap order: earliest event time first, then stream index
+ */
+static int stream_before(const replay_stream_t *a, const replay_stream_t *b) {
+    return a->key < b->key || (a->key == b->key && a->order < b->order);
+}
+
+/**
+ * Restore the heap below pos after the stream there moved later in time
+ */
+void heap_sift_down(size_t pos) {
+    replay_stream_t *stream = heap[pos];
+
+    for (;;) {
+        size_t child = 2 * pos + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && stream_before(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!stream_before(heap[child], stream)) {
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+
+    heap[pos] = stream;
+}
+
+/**
+ * Add a stream with a pending record to the heap
+ */
+void heap_push(replay_stream_t *stream) {
+    size_t pos = heap_size++;
+
+    while (pos > 0 && stream_before(stream, heap[(pos - 1) / 2])) {
+        heap[pos] = heap[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+
+    heap[pos] = stream;
+}
+
+/**
+ * Create the shared memory with the collector's layout
+ * Returns 0 on success, -1 on failure
+ */
+int init_shared_memory(void) {
+    // Do not take over the shared memory of a running collector
+    int existing = shm_open("/binance_market_data", O_RDONLY, 0666);
+    struct stat st;
+    if (existing != -1 && fstat(existing, &st) == 0 && (size_t)st.st_size >= sizeof(shared_memory_header_t)) {
+        shared_memory_header_t *header = mmap(NULL, sizeof(*header), PROT_READ, MAP_SHARED, existing, 0);
+        if (header != MAP_FAILED) {
+            time_t last_update = atomic_load(&header->last_update_time);
+            munmap(header, sizeof(*header));
+            if (time(NULL) - last_update < COLLECTOR_ALIVE_SEC) {
+                fprintf(stderr, "Error: A collector is running on /binance_market_data\n");
+                close(existing);
+                return -1;
+            }
+        }
+    }
+    if (existing != -1) {
+        close(existing);
+    }
+
+    shm_fd = shm_open("/binance_market_data", O_CREAT | O_RDWR, 0666);
+    if (shm_fd == -1) {
+        perror("shm_open failed");
+        return -1;
+    }
+
+    if (ftruncate(shm_fd, SHM_SIZE) == -1) {
+        perror("ftruncate failed");
+        cleanup_shared_memory();
+        return -1;
+    }
+
+    shared_memory = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shared_memory == MAP_FAILED) {
+        perror("mmap failed");
+        shared_memory = NULL;
+        cleanup_shared_memory();
+        return -1;
+    }
+
+    shm_header = (shared_memory_header_t *)shared_memory;
+    atomic_init(&shm_header->write_counter, 0);
+    atomic_init(&shm_header->last_update_time, 0);
+    atomic_init(&shm_header->notify_seq, 0);
+    atomic_init(&shm_header->notify_armed, 0);
+    memset(&shm_header->clock, 0, sizeof(shm_header->clock));
+    clock_calibrate(&shm_header->clock);
+    memset(&shm_header->exchange_clock, 0, sizeof(shm_header->exchange_clock));
+    shm_header->data_offset = sizeof(shared_memory_header_t);
+    shm_header->buffer_size = (SHM_SIZE - shm_header->data_offset) / MAX_SYMBOLS & ~(size_t)(SHM_BUFFER_ALIGN - 1);
+    shm_header->symbol_count = symbol_count;
+    shm_header->trade_ring_offset = SHM_SNAPSHOT_SIZE;
+    shm_header->kline_ring_offset = shm_header->trade_ring_offset + sizeof(shm_ring_t) +
+                                    SHM_TRADE_RING_SLOTS * sizeof(shm_slot_t);
+
+    // Consumers find the replayed run's data files like the collector's
+    shm_header->run_id = run_id;
+    if (!realpath(output_dir, shm_header->output_dir)) {
+        strncpy(shm_header->output_dir, output_dir, PATH_MAX - 1);
+        shm_header->output_dir[PATH_MAX - 1] = '\0';
+    }
+
+    for (size_t i = 0; i < MAX_SYMBOLS; i++) {
+        if (i < symbol_count) {
+            // Names were checked to fit when -s was parsed
+            size_t len = strnlen(symbols[i].name, MAX_SYMBOL_LENGTH - 1);
+            memcpy(shm_header->symbols[i], symbols[i].name, len);
+            shm_header->symbols[i][len] = '\0';
+        }
+        shm_header->numa_node[i] = -1;
+        atomic_init(&shm_header->persisted_trades[i], 0);
+        atomic_init(&shm_header->persisted_klines[i], 0);
+    }
+
+    for (size_t i = 0; i < symbol_count; i++) {
+        char *buffer = (char *)shared_memory + shm_header->data_offset + i * shm_header->buffer_size;
+        shm_ring_t *rings[2] = { (shm_ring_t *)(buffer + shm_header->trade_ring_offset),
+                                 (shm_ring_t *)(buffer + shm_header->kline_ring_offset) };
+        uint64_t capacities[2] = { SHM_TRADE_RING_SLOTS, SHM_KLINE_RING_SLOTS };
+
+        *(size_t *)buffer = 0;
+        for (int r = 0; r < 2; r++) {
+            assert(((uintptr_t)rings[r] & (SHM_BUFFER_ALIGN - 1)) == 0);
+            atomic_init(&rings[r]->published, 0);
+            rings[r]->capacity = capacities[r];
+            for (uint64_t s = 0; s < capacities[r]; s++) {
+                atomic_init(&rings[r]->slots[s].sequence, SHM_SLOT_BUSY);
+            }
+        }
+
+        symbols[i].trade_ring = rings[0];
+        symbols[i].kline_ring = rings[1];
+    }
+
+    return 0;
+}
+
+/**
+ * Clean up shared memory
+ */
+void cleanup_shared_memory(void) {
+    if (shared_memory) {
+        munmap(shared_memory, SHM_SIZE);
+        shared_memory = NULL;
+        shm_header = NULL;
+    }
+
+    if (shm_fd != -1) {
+        close(shm_fd);
+        shm_unlink("/binance_market_data");
+        shm_fd = -1;
+    }
+}
+
+/**
+ * Publish the virtual clock as the shared memory's clock calibration, so that consumer_now_ns()
+ * reads the clock of the records' timestamps: virtual_start_ms now, advancing rate times as fast
+ * as the wall clock (as fast as the wall clock when free-running, where the records run ahead)
+ * The wall-clock calibration of init_shared_memory() supplies the tick rate.
+ */
+void publish_virtual_clock(int64_t virtual_start_ms, double rate) {
+    clock_calibration_t *clock = &shm_header->clock;
+    uint64_t ticks = clock_ticks(clock);
+    long double mult = (long double)clock->mult * (rate > 0 ? rate : 1.0) * (1ULL << (CLOCK_SHIFT - clock->shift));
+
+    unsigned sequence = atomic_load_explicit(&clock->sequence, memory_order_relaxed);
+    atomic_store_explicit(&clock->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    clock->mult = (uint64_t)(mult + 0.5L);
+    clock->shift = CLOCK_SHIFT;
+    clock->tsc_base = ticks;
+    clock->ns_base = virtual_start_ms * 1000000;
+
+    atomic_store_explicit(&clock->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Publish a record to a live ring (same protocol as the collector)
+ */
+void publish_record(shm_ring_t *ring, const message_header_t *header, const void *record, size_t size) {
+    uint64_t sequence = header->sequence;
+    shm_slot_t *slot = &ring->slots[sequence & (ring->capacity - 1)];
+
+    atomic_store_explicit(&slot->sequence, SHM_SLOT_BUSY, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->header = *header;
+    memcpy(&slot->record, record, size);
+
+    atomic_store_explicit(&slot->sequence, sequence, memory_order_release);
+    atomic_store_explicit(&ring->published, sequence + 1, memory_order_release);
+
+    // Order the publish before the check of notify_armed, as shm_notify_arm() orders arming
+    // before its check of published; one side then sees the other, so no wake is missed
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&shm_header->notify_armed, memory_order_relaxed) &&
+        atomic_exchange_explicit(&shm_header->notify_armed, 0, memory_order_acq_rel)) {
+        atomic_fetch_add_explicit(&shm_header->notify_seq, 1, memory_order_release);
+        syscall(SYS_futex, &shm_header->notify_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Write a stream's pending record to the replayed run's data file, then publish it
+ * The file comes first, as in the collector, so a consumer lapped by the ring finds the
+ * record on disk.
+ * Returns 0 on success, -1 on failure
+ */
+int replay_record(replay_stream_t *stream, int64_t virtual_ms) {
+    symbol_data_t *symbol = &symbols[stream->symbol_idx];
+    int is_trade = stream->type == DATA_TYPE_TRADE;
+    data_file_t *file = is_trade ? symbol->trade_file : symbol->kline_file;
+
+    if (data_file_append(file, &stream->record.record) != 0) {
+        fprintf(stderr, "Failed to write %s data to file for symbol %s\n", is_trade ? "trade" : "kline", symbol->name);
+        return -1;
+    }
+    if (atomic_load_explicit(&file->retired, memory_order_relaxed)) {
+        data_file_reap(file, NULL);
+    }
+    atomic_store(is_trade ? &shm_header->persisted_trades[stream->symbol_idx]
+                          : &shm_header->persisted_klines[stream->symbol_idx], file->next_sequence);
+
+    message_header_t header;
+    header.type = stream->type;
+    header.length = file->record_size;
+    header.timestamp = virtual_ms * 1000000;
+    header.sequence = file->next_sequence - 1;
+    memcpy(header.symbol, symbol->name, MAX_SYMBOL_LENGTH);
+
+    // Keep the most recent records for the snapshot area
+    if (is_trade) {
+        size_t idx = symbol->recent_data.trades.next_index;
+        symbol->recent_data.trades.records[idx] = stream->record.record.trade;
+        symbol->recent_data.trades.headers[idx] = header;
+        symbol->recent_data.trades.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
+        if (symbol->recent_data.trades.count < MAX_RECORDS_PER_SYMBOL) {
+            symbol->recent_data.trades.count++;
+        }
+        publish_record(symbol->trade_ring, &header, &stream->record.record, sizeof(trade_record_t));
+    } else {
+        size_t idx = symbol->recent_data.klines.next_index;
+        symbol->recent_data.klines.records[idx] = stream->record.record.kline;
+        symbol->recent_data.klines.headers[idx] = header;
+        symbol->recent_data.klines.next_index = (idx + 1) % MAX_RECORDS_PER_SYMBOL;
+        if (symbol->recent_data.klines.count < MAX_RECORDS_PER_SYMBOL) {
+            symbol->recent_data.klines.count++;
+        }
+        publish_record(symbol->kline_ring, &header, &stream->record.record, sizeof(kline_record_t));
+    }
+
+    return 0;
+}
+
+/**
+ * Copy the recent records of every symbol to its snapshot area (trades, then klines, oldest first)
+ */
+void update_snapshots(void) {
+    const size_t trade_size = sizeof(message_header_t) + sizeof(trade_record_t);
+    const size_t kline_size = sizeof(message_header_t) + sizeof(kline_record_t);
+
+    for (size_t i = 0; i < symbol_count; i++) {
+        char *area = (char *)shared_memory + shm_header->data_offset + i * shm_header->buffer_size;
+        char *out = area + sizeof(size_t);
+        size_t space = SHM_SNAPSHOT_SIZE - sizeof(size_t);
+        size_t trades = symbols[i].recent_data.trades.count;
+        size_t klines = symbols[i].recent_data.klines.count;
+
+        if (trades * trade_size > space) {
+            trades = space / trade_size;
+        }
+        if (trades * trade_size + klines * kline_size > space) {
+            klines = (space - trades * trade_size) / kline_size;
+        }
+
+        size_t start = symbols[i].recent_data.trades.count >= MAX_RECORDS_PER_SYMBOL ?
+                       symbols[i].recent_data.trades.next_index : 0;
+        for (size_t j = 0; j < trades; j++) {
+            size_t idx = (start + j) % MAX_RECORDS_PER_SYMBOL;
+            memcpy(out, &symbols[i].recent_data.trades.headers[idx], sizeof(message_header_t));
+            memcpy(out + sizeof(message_header_t), &symbols[i].recent_data.trades.records[idx], sizeof(trade_record_t));
+            out += trade_size;
+        }
+
+        start = symbols[i].recent_data.klines.count >= MAX_RECORDS_PER_SYMBOL ?
+                symbols[i].recent_data.klines.next_index : 0;
+        for (size_t j = 0; j < klines; j++) {
+            size_t idx = (start + j) % MAX_RECORDS_PER_SYMBOL;
+            memcpy(out, &symbols[i].recent_data.klines.headers[idx], sizeof(message_header_t));
+            memcpy(out + sizeof(message_header_t), &symbols[i].recent_data.klines.records[idx], sizeof(kline_record_t));
+            out += kline_size;
+        }
+
+        *(size_t *)area = trades * trade_size + klines * kline_size;
+    }
+
+    atomic_fetch_add(&shm_header->write_counter, 1);
+}
+
+/**
+ * Main function for the replay publisher
+ */
+int main(int argc, char **argv) {
+    int ret = 0;
+    int c;
+    int opt_index = 0;
+    char *symbol_arg = NULL;
+    int64_t from_ms = 0;
+    int64_t to_ms = INT64_MAX;
+    double rate = 1.0;        // Virtual ms per real ms (0: free-running)
+    int exit_at_end = 0;
+    size_t stream_count = 0;
+
+    static struct option long_options[] = {
+        {"symbol", required_argument, NULL, 's'},
+        {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"rate", required_argument, NULL, 'r'},
+        {"exit", no_argument, NULL, 'x'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "s:i:o:f:t:r:xh", long_options, &opt_index)) != -1) {
+        switch (c) {
+            case 's':
+                symbol_arg = optarg;
+                break;
+            case 'i':
+                input_dir = optarg;
+                break;
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'f':
+            case 't': {
+                int64_t value = parse_time_ms(optarg);
+                if (value < 0) {
+                    fprintf(stderr, "Error: Invalid time: %s\n", optarg);
+                    return 1;
+                }
+                *(c == 'f' ? &from_ms : &to_ms) = value;
+                break;
+            }
+            case 'r':
+                rate = strcmp(optarg, "max") == 0 ? 0 : atof(optarg);
+                if (rate <= 0 && strcmp(optarg, "max") != 0) {
+                    fprintf(stderr, "Error: Invalid rate: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                exit_at_end = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!symbol_arg) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (char *token = strtok(symbol_arg, ","); token; token = strtok(NULL, ",")) {
+        if (symbol_count >= MAX_SYMBOLS) {
+            fprintf(stderr, "Error: Too many symbols (max %d)\n", MAX_SYMBOLS);
+            return 1;
+        }
+        for (int j = 0; token[j]; j++) {
+            token[j] = toupper((unsigned char)token[j]);
+        }
+        if (strlen(token) >= MAX_SYMBOL_LENGTH) {
+            fprintf(stderr, "Error: Symbol name too long: %s\n", token);
+            return 1;
+        }
+        snprintf(symbols[symbol_count].name, MAX_SYMBOL_LENGTH, "%s", token);
+        symbol_count++;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    if (mkdir(output_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create output directory: %s\n", output_dir);
+        return 1;
+    }
+
+    // Replaying into the input would feed the replay its own output
+    char input_path[PATH_MAX], output_path[PATH_MAX];
+    if (realpath(input_dir, input_path) && realpath(output_dir, output_path) &&
+        strcmp(input_path, output_path) == 0) {
+        fprintf(stderr, "Error: Input and output directories must differ\n");
+        return 1;
+    }
+
+    // The replay is a run of its own, named like a collector run
+    run_id = time(NULL);
+    if (catalog_open(&catalog, output_dir) != 0) {
+        fprintf(stderr, "Warning: Segments of the replayed run will not be cataloged\n");
+    }
+
+    for (size_t i = 0; i < symbol_count; i++) {
+        char dir[PATH_MAX];
+
+        // Input streams
+        int len = snprintf(dir, sizeof(dir), "%s/%s", input_dir, symbols[i].name);
+        if (len < 0 || (size_t)len >= sizeof(dir)) {
+            fprintf(stderr, "Error: Input directory path too long: %s\n", input_dir);
+            ret = 1;
+            goto cleanup;
+        }
+        for (int t = 0; t < 2; t++) {
+            replay_stream_t *stream = &streams[stream_count];
+            stream->symbol_idx = i;
+            stream->type = t == 0 ? DATA_TYPE_TRADE : DATA_TYPE_KLINE;
+            stream->order = stream_count;
+            if (consumer_open_files(&stream->consumer, dir, symbols[i].name, stream->type, from_ms) != 0) {
+                fprintf(stderr, "Error: No recorded data for symbol %s in %s\n", symbols[i].name, input_dir);
+                ret = 1;
+                goto cleanup;
+            }
+            stream_count++;
+
+            int advanced = stream_advance(stream, to_ms);
+            if (advanced < 0) {
+                ret = 1;
+                goto cleanup;
+            }
+            if (advanced) {
+                heap_push(stream);
+            }
+        }
+
+        // Output files of the replayed run
+        len = snprintf(dir, sizeof(dir), "%s/%s", output_dir, symbols[i].name);
+        if (len < 0 || (size_t)len >= sizeof(dir)) {
+            fprintf(stderr, "Error: Output directory path too long: %s\n", output_dir);
+            ret = 1;
+            goto cleanup;
+        }
+        if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Error: Failed to create directory for symbol %s\n", symbols[i].name);
+            ret = 1;
+            goto cleanup;
+        }
+        symbols[i].trade_file = calloc(1, sizeof(data_file_t));
+        symbols[i].kline_file = calloc(1, sizeof(data_file_t));
+        if (symbols[i].trade_file && symbols[i].kline_file && catalog.fd != -1) {
+            symbols[i].trade_file->catalog = &catalog;
+            symbols[i].kline_file->catalog = &catalog;
+        }
+        if (!symbols[i].trade_file || !symbols[i].kline_file ||
+            data_file_open(symbols[i].trade_file, WRITER_MMAP, DATA_TYPE_TRADE, dir, symbols[i].name, run_id, 0) != 0 ||
+            data_file_open(symbols[i].kline_file, WRITER_MMAP, DATA_TYPE_KLINE, dir, symbols[i].name, run_id, 0) != 0) {
+            fprintf(stderr, "Error: Failed to open data files for symbol %s\n", symbols[i].name);
+            ret = 1;
+            goto cleanup;
+        }
+    }
+
+    if (heap_size == 0) {
+        fprintf(stderr, "Error: No records to replay\n");
+        ret = 1;
+        goto cleanup;
+    }
+
+    if (init_shared_memory() != 0) {
+        ret = 1;
+        goto cleanup;
+    }
+
+    // Virtual clock: starts at the first record and advances with the records (paced) or as
+    // fast as the merge runs (free-running)
+    int64_t virtual_start = heap[0]->key;
+    int64_t virtual_ms = virtual_start;
+    struct timespec wall_start, now;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    publish_virtual_clock(virtual_start, rate);
+    uint64_t replayed = 0;
+
+    printf("Replaying %zu symbols from %s as run %lld (%s)\n", symbol_count, input_dir, (long long)run_id,
+           rate > 0 ? "paced" : "free-running");
+
+    while (heap_size > 0 && !force_exit) {
+        replay_stream_t *stream = heap[0];
+
+        if (rate > 0 && stream->key > virtual_ms) {
+            // Sleep until the wall clock catches up with the record's virtual time
+            int64_t offset_ns = (int64_t)((stream->key - virtual_start) / rate * 1000000.0);
+            struct timespec target = wall_start;
+            target.tv_sec += offset_ns / 1000000000;
+            target.tv_nsec += offset_ns % 1000000000;
+            if (target.tv_nsec >= 1000000000) {
+                target.tv_sec++;
+                target.tv_nsec -= 1000000000;
+            }
+
+            // Let readers see everything up to now while the replay idles
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec < target.tv_sec || (now.tv_sec == target.tv_sec && now.tv_nsec < target.tv_nsec)) {
+                update_snapshots();
+                if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) != 0) {
+                    continue;
+                }
+            }
+        }
+
+        if (stream->key > virtual_ms) {
+            virtual_ms = stream->key;
+            atomic_store(&shm_header->last_update_time, virtual_ms / 1000);
+        }
+
+        if (replay_record(stream, virtual_ms) != 0) {
+            ret = 1;
+            break;
+        }
+        if (++replayed % SNAPSHOT_INTERVAL_RECORDS == 0) {
+            update_snapshots();
+        }
+
+        int advanced = stream_advance(stream, to_ms);
+        if (advanced < 0) {
+            ret = 1;
+            break;
+        }
+        if (!advanced) {
+            heap[0] = heap[--heap_size];
+        }
+        if (heap_size > 0) {
+            heap_sift_down(0);
+        }
+    }
+
+    update_snapshots();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - wall_start.tv_sec) + (now.tv_nsec - wall_start.tv_nsec) / 1e9;
+    printf("Replayed %llu records (%.1f s of market time) in %.2f s: %.0f records/s, %.0fx real time\n",
+           (unsigned long long)replayed, (virtual_ms - virtual_start) / 1000.0, seconds,
+           seconds > 0 ? replayed / seconds : 0.0,
+           seconds > 0 ? (virtual_ms - virtual_start) / 1000.0 / seconds : 0.0);
+
+    // Strategies may still be reading the last records
+    if (!exit_at_end && ret == 0) {
+        printf("Replay finished; shared memory stays up until interrupted (Ctrl+C)\n");
+        while (!force_exit) {
+            pause();
+        }
+    }
+
+cleanup:
+    for (size_t i = 0; i < stream_count; i++) {
+        consumer_close(&streams[i].consumer);
+    }
+    for (size_t i = 0; i < symbol_count; i++) {
+        if (symbols[i].trade_file) {
+            data_file_close(symbols[i].trade_file);
+            free(symbols[i].trade_file);
+        }
+        if (symbols[i].kline_file) {
+            data_file_close(symbols[i].kline_file);
+            free(symbols[i].kline_file);
+        }
+    }
+    catalog_close(&catalog);
+    cleanup_shared_memory();
+
+    return ret;
+}
@@ -0,0 +1,1050 @@
+/**
+* binance_segment.c
+*
+* Segment writers (stdio, mmap and O_DIRECT) and segment reading helpers
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <libgen.h>
+#include <limits.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "binance_segment.h"
+
+#define CRC32C_POLY 0x82F63B78U               // Castagnoli polynomial, reflected
+#define CATALOG_READ_BUFFER (1024 * 1024)     // Bytes read at a time when cataloging a segment from disk
+
+static uint32_t crc32c_table[256];
+static int crc32c_hardware = 0;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Current wall-clock time in milliseconds
+ */
+static int64_t segment_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Size of one record of a data type (0 if it is not fixed by the type)
+ */
+size_t data_type_record_size(data_type_t type) {
+    switch (type) {
+        case DATA_TYPE_TRADE:
+            return sizeof(trade_record_t);
+        case DATA_TYPE_KLINE:
+            return sizeof(kline_record_t);
+        case DATA_TYPE_DEPTH:
+        case DATA_TYPE_BOOK:
+            return sizeof(book_level_record_t);
+        case DATA_TYPE_BOOK_INDEX:
+            return sizeof(book_index_record_t);
+        case DATA_TYPE_PANEL:
+            break;
+    }
+    return 0;
+}
+
+/**
+ * File name prefix of the segments of a data type
+ */
+const char *data_type_prefix(data_type_t type) {
+    switch (type) {
+        case DATA_TYPE_TRADE:
+            return "trades";
+        case DATA_TYPE_KLINE:
+            return "klines";
+        case DATA_TYPE_DEPTH:
+            return "depth";
+        case DATA_TYPE_BOOK:
+            return "book";
+        case DATA_TYPE_BOOK_INDEX:
+            return "bookindex";
+        case DATA_TYPE_PANEL:
+            return "panel";
+    }
+    return "unknown";
+}
+
+/**
+ * Open a data file and its first segment
+ * Tuning fields (stdio_buffer_size, pretouch, sync_on_retire) are taken from *file as set by the caller,
+ * and so is record_size for types whose records have no fixed size.
+ * Returns 0 on success, -1 on failure
+ */
+int data_file_open(data_file_t *file, writer_mode_t mode, data_type_t type, const char *dir,
+                   const char *symbol, int64_t run_id, size_t segment_size) {
+    file->mode = mode;
+    file->type = type;
+    if (data_type_record_size(type) != 0) {
+        file->record_size = data_type_record_size(type);
+    }
+    file->prefix = data_type_prefix(type);
+    file->run_id = run_id;
+    file->segment_size = segment_size;
+    file->segment_index = 0;
+    file->next_sequence = 0;
+
+    if (mode == WRITER_MMAP && file->segment_size == 0) {
+        file->segment_size = DEFAULT_MMAP_SEGMENT_SIZE;
+    }
+    if (file->segment_size && file->segment_size < SEGMENT_DATA_OFFSET + file->record_size) {
+        fprintf(stderr, "Segment size %zu is too small for a single record\n", file->segment_size);
+        return -1;
+    }
+
+    strncpy(file->symbol, symbol, MAX_SYMBOL_LENGTH - 1);
+    file->symbol[MAX_SYMBOL_LENGTH - 1] = '\0';
+    strncpy(file->dir, dir, sizeof(file->dir) - 1);
+    file->dir[sizeof(file->dir) - 1] = '\0';
+
+    atomic_init(&file->retired, NULL);
+
+    segment_t *segment = segment_open(file);
+    atomic_init(&file->current, segment);
+
+    return segment ? 0 : -1;
+}
+
+/**
+ * Create the next segment of a data file, named <prefix>_<run id>_<segment index>.bin
+ * Returns the new segment, or NULL on failure
+ */
+segment_t *segment_open(data_file_t *file) {
+    segment_t *segment = calloc(1, sizeof(segment_t));
+    if (!segment) {
+        return NULL;
+    }
+
+    if (snprintf(segment->path, sizeof(segment->path), "%s/%s_%lld_%06u.bin", file->dir, file->prefix,
+                 (long long)file->run_id, file->segment_index) >= (int)sizeof(segment->path)) {
+        fprintf(stderr, "Segment path too long in %s\n", file->dir);
+        free(segment);
+        return NULL;
+    }
+    segment->capacity = file->segment_size;
+    segment->base_sequence = file->next_sequence;
+    segment->entry.record_type = file->type;
+    segment->entry.record_size = file->record_size;
+    segment->entry.segment_index = file->segment_index;
+    segment->entry.run_id = file->run_id;
+    memcpy(segment->entry.symbol, file->symbol, MAX_SYMBOL_LENGTH);
+    segment->entry.base_sequence = segment->base_sequence;
+    segment->fd = -1;
+    segment->data_offset = file->mode == WRITER_DIRECT ? DIRECT_BLOCK_SIZE : SEGMENT_DATA_OFFSET;
+
+    segment_header_t header = {0};
+    header.magic = SEGMENT_MAGIC;
+    header.version = SEGMENT_VERSION;
+    header.record_type = file->type;
+    header.record_size = file->record_size;
+    header.data_offset = segment->data_offset;
+    header.created_time = segment_time_ms();
+    header.base_sequence = segment->base_sequence;
+    memcpy(header.symbol, file->symbol, MAX_SYMBOL_LENGTH);
+
+    if (file->mode == WRITER_MMAP) {
+        segment->fd = open(segment->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (segment->fd == -1) {
+            fprintf(stderr, "Failed to create segment %s: %s\n", segment->path, strerror(errno));
+            free(segment);
+            return NULL;
+        }
+
+        // Size the file to the full segment up front (sparse), then allocate the first extent
+        // (or all of it when pre-touching, since every page is about to be faulted in anyway)
+        segment->allocated = segment->capacity < SEGMENT_EXTENT_SIZE ? segment->capacity : SEGMENT_EXTENT_SIZE;
+        if (file->pretouch) {
+            segment->allocated = segment->capacity;
+        }
+        if (ftruncate(segment->fd, segment->capacity) != 0 ||
+            fallocate(segment->fd, 0, 0, segment->allocated) != 0) {
+            fprintf(stderr, "Failed to preallocate segment %s: %s\n", segment->path, strerror(errno));
+            close(segment->fd);
+            free(segment);
+            return NULL;
+        }
+
+        segment->map = mmap(NULL, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if (segment->map == MAP_FAILED) {
+            fprintf(stderr, "Failed to map segment %s: %s\n", segment->path, strerror(errno));
+            close(segment->fd);
+            free(segment);
+            return NULL;
+        }
+
+        // Sequential appends: read-ahead is wasted on the writer side
+        madvise(segment->map, segment->capacity, MADV_SEQUENTIAL);
+        
+        // Write-fault every page now so appends never take a page fault
+        if (file->pretouch) {
+            long page_size = sysconf(_SC_PAGESIZE);
+            for (size_t off = 0; off < segment->capacity; off += page_size) {
+                ((volatile char *)segment->map)[off] = 0;
+            }
+        }
+
+        header.end_offset = SEGMENT_DATA_OFFSET;
+        segment->header = (segment_header_t *)segment->map;
+        memcpy(segment->header, &header, sizeof(header));
+    } else if (file->mode == WRITER_DIRECT) {
+        segment->fd = open(segment->path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (segment->fd == -1) {
+            fprintf(stderr, "Failed to create segment %s with O_DIRECT: %s\n", segment->path, strerror(errno));
+            free(segment);
+            return NULL;
+        }
+
+        // Header block first; end_offset stays 0 (file size is authoritative) until finalized
+        for (int b = 0; b < 2; b++) {
+            segment->blocks[b].data = aligned_alloc(DIRECT_BLOCK_SIZE, DIRECT_BLOCK_SIZE);
+        }
+        if (!segment->blocks[0].data || !segment->blocks[1].data) {
+            close(segment->fd);
+            free(segment->blocks[0].data);
+            free(segment->blocks[1].data);
+            free(segment);
+            return NULL;
+        }
+        memset(segment->blocks[0].data, 0, DIRECT_BLOCK_SIZE);
+        memcpy(segment->blocks[0].data, &header, sizeof(header));
+        if (pwrite(segment->fd, segment->blocks[0].data, DIRECT_BLOCK_SIZE, 0) != DIRECT_BLOCK_SIZE) {
+            fprintf(stderr, "Failed to write segment header to %s: %s\n", segment->path, strerror(errno));
+            close(segment->fd);
+            free(segment->blocks[0].data);
+            free(segment->blocks[1].data);
+            free(segment);
+            return NULL;
+        }
+
+        for (int b = 0; b < 2; b++) {
+            memset(segment->blocks[b].data, 0, DIRECT_BLOCK_SIZE);
+            segment->blocks[b].offset = segment->data_offset + b * DIRECT_BLOCK_SIZE;
+            segment->blocks[b].fill = 0;
+            atomic_init(&segment->blocks[b].pending, 0);
+        }
+        segment->active = 0;
+        atomic_init(&segment->flushed_end, segment->data_offset);
+        pthread_mutex_init(&segment->block_mutex, NULL);
+        pthread_cond_init(&segment->block_cond, NULL);
+    } else {
+        segment->fp = fopen(segment->path, "wb");
+        if (!segment->fp) {
+            fprintf(stderr, "Failed to create segment %s: %s\n", segment->path, strerror(errno));
+            free(segment);
+            return NULL;
+        }
+        segment->fd = fileno(segment->fp);
+
+        // Give stdio a buffer that already exists instead of letting it allocate lazily
+        if (file->stdio_buffer_size > 0) {
+            segment->stdio_buffer = malloc(file->stdio_buffer_size);
+            if (segment->stdio_buffer) {
+                if (file->pretouch) {
+                    memset(segment->stdio_buffer, 0, file->stdio_buffer_size);
+                }
+                setvbuf(segment->fp, segment->stdio_buffer, _IOFBF, file->stdio_buffer_size);
+            }
+        }
+
+        // end_offset stays 0 (file size is authoritative) until the segment is finalized
+        char padded[SEGMENT_DATA_OFFSET] = {0};
+        memcpy(padded, &header, sizeof(header));
+        if (fwrite(padded, sizeof(padded), 1, segment->fp) != 1 || fflush(segment->fp) != 0) {
+            fprintf(stderr, "Failed to write segment header to %s\n", segment->path);
+            fclose(segment->fp);
+            free(segment->stdio_buffer);
+            free(segment);
+            return NULL;
+        }
+    }
+
+    atomic_init(&segment->end, segment->data_offset);
+    return segment;
+}
+
+/**
+ * Hand the active block of a direct segment to the writer and switch to the other buffer
+ * Blocks (backpressure) if the writer has not written the other buffer yet.
+ */
+static void segment_submit_block(data_file_t *file, segment_t *segment) {
+    direct_block_t *block = &segment->blocks[segment->active];
+    atomic_store_explicit(&block->pending, 1, memory_order_release);
+    if (file->wake_writer) {
+        file->wake_writer();
+    }
+
+    segment->active ^= 1;
+    direct_block_t *next = &segment->blocks[segment->active];
+
+    if (atomic_load_explicit(&next->pending, memory_order_acquire)) {
+        pthread_mutex_lock(&segment->block_mutex);
+        while (atomic_load_explicit(&next->pending, memory_order_acquire)) {
+            pthread_cond_wait(&segment->block_cond, &segment->block_mutex);
+        }
+        pthread_mutex_unlock(&segment->block_mutex);
+    }
+
+    next->offset = block->offset + DIRECT_BLOCK_SIZE;
+    next->fill = 0;
+}
+
+/**
+ * Write the pending blocks of a direct segment, lowest file offset first
+ * A partial block (only pending once the segment is finalized) is zero-padded to the block size.
+ * Returns the number of blocks written, or -1 on a write error
+ */
+static int direct_write_blocks(segment_t *segment, int partial) {
+    direct_block_t *order[2] = { &segment->blocks[0], &segment->blocks[1] };
+    if (order[1]->offset < order[0]->offset) {
+        order[0] = &segment->blocks[1];
+        order[1] = &segment->blocks[0];
+    }
+
+    int written = 0;
+    for (int b = 0; b < 2; b++) {
+        direct_block_t *block = order[b];
+        if (!atomic_load_explicit(&block->pending, memory_order_acquire) ||
+            (block->fill < DIRECT_BLOCK_SIZE && !partial)) {
+            continue;
+        }
+
+        if (block->fill < DIRECT_BLOCK_SIZE) {
+            memset(block->data + block->fill, 0, DIRECT_BLOCK_SIZE - block->fill);
+        }
+        if (pwrite(segment->fd, block->data, DIRECT_BLOCK_SIZE, block->offset) != DIRECT_BLOCK_SIZE) {
+            fprintf(stderr, "Failed to write block to %s: %s\n", segment->path, strerror(errno));
+            return -1;
+        }
+        atomic_store_explicit(&segment->flushed_end, block->offset + block->fill, memory_order_release);
+
+        pthread_mutex_lock(&segment->block_mutex);
+        atomic_store_explicit(&block->pending, 0, memory_order_release);
+        pthread_cond_broadcast(&segment->block_cond);
+        pthread_mutex_unlock(&segment->block_mutex);
+        written++;
+    }
+
+    return written;
+}
+
+/**
+ * Write the full blocks of a direct segment that are waiting for the writer
+ * Must only be called from the thread that owns segment finalization.
+ * Returns the number of blocks written, or -1 on a write error
+ */
+int segment_write_blocks(data_file_t *file, segment_t *segment) {
+    if (file->mode != WRITER_DIRECT) {
+        return 0;
+    }
+    return direct_write_blocks(segment, 0);
+}
+
+/**
+ * Logical end of the records that have reached the file (the direct writer lags the appender)
+ */
+size_t segment_flushed_end(data_file_t *file, segment_t *segment) {
+    if (file->mode == WRITER_DIRECT) {
+        return atomic_load_explicit(&segment->flushed_end, memory_order_acquire);
+    }
+    return atomic_load_explicit(&segment->end, memory_order_acquire);
+}
+
+/**
+ * Append one record to a data file, rotating to a new segment when the current one is full
+ * Returns 0 on success, -1 on failure
+ */
+int data_file_append(data_file_t *file, const void *record) {
+    segment_t *segment = atomic_load_explicit(&file->current, memory_order_relaxed);
+    size_t end = atomic_load_explicit(&segment->end, memory_order_relaxed);
+
+    if (segment->capacity && end + file->record_size > segment->capacity) {
+        file->segment_index++;
+        segment_t *next = segment_open(file);
+        if (!next) {
+            file->segment_index--;
+            return -1;
+        }
+
+        // Retire the full segment before publishing the new one, so whoever sees the new
+        // current segment also finds every older segment on the retired list
+        segment_t *head = atomic_load_explicit(&file->retired, memory_order_relaxed);
+        do {
+            segment->next_retired = head;
+        } while (!atomic_compare_exchange_weak_explicit(&file->retired, &head, segment,
+                                                        memory_order_release, memory_order_relaxed));
+        atomic_store_explicit(&file->current, next, memory_order_release);
+
+        segment = next;
+        end = segment->data_offset;
+    }
+
+    if (file->mode == WRITER_MMAP) {
+        // Grow the allocated part one extent at a time (stores past it could SIGBUS on ENOSPC)
+        if (end + file->record_size > segment->allocated) {
+            size_t extent = segment->capacity - segment->allocated;
+            if (extent > SEGMENT_EXTENT_SIZE) extent = SEGMENT_EXTENT_SIZE;
+            if (fallocate(segment->fd, 0, segment->allocated, extent) != 0) {
+                return -1;
+            }
+            segment->allocated += extent;
+        }
+
+        memcpy(segment->map + end, record, file->record_size);
+        __atomic_store_n(&segment->header->end_offset, end + file->record_size, __ATOMIC_RELEASE);
+    } else if (file->mode == WRITER_DIRECT) {
+        // Records may straddle blocks: copy what fits, submit the full block, continue in the other one
+        const char *src = record;
+        size_t left = file->record_size;
+        while (left > 0) {
+            direct_block_t *block = &segment->blocks[segment->active];
+            size_t room = DIRECT_BLOCK_SIZE - block->fill;
+            size_t n = left < room ? left : room;
+
+            memcpy(block->data + block->fill, src, n);
+            block->fill += n;
+            src += n;
+            left -= n;
+
+            if (block->fill == DIRECT_BLOCK_SIZE) {
+                segment_submit_block(file, segment);
+            }
+        }
+    } else {
+        if (fwrite(record, file->record_size, 1, segment->fp) != 1) {
+            return -1;
+        }
+    }
+
+    if (file->catalog) {
+        catalog_entry_add(&segment->entry, file->type, record, file->record_size);
+    }
+
+    atomic_store_explicit(&segment->end, end + file->record_size, memory_order_release);
+    file->next_sequence++;
+    return 0;
+}
+
+/**
+ * Hand appended records to the kernel
+ * mmap segments need nothing: the stores are already in the page cache, and direct segments
+ * are written block by block by the maintenance thread.
+ */
+void data_file_flush(data_file_t *file) {
+    if (file->mode == WRITER_STDIO) {
+        segment_t *segment = atomic_load_explicit(&file->current, memory_order_relaxed);
+        fflush(segment->fp);
+    }
+}
+
+/**
+ * Finalize a segment that is no longer appended to: record its logical end, release the unused
+ * preallocated tail, optionally sync it, and close it
+ */
+void segment_finalize(data_file_t *file, segment_t *segment) {
+    uint64_t end = atomic_load_explicit(&segment->end, memory_order_acquire);
+
+    if (segment->map) {
+        __atomic_store_n(&segment->header->end_offset, end, __ATOMIC_RELEASE);
+        munmap(segment->map, segment->capacity);
+        if (ftruncate(segment->fd, end) != 0) {
+            fprintf(stderr, "Failed to truncate segment %s: %s\n", segment->path, strerror(errno));
+        }
+    } else if (file->mode == WRITER_DIRECT) {
+        // Patch end_offset in the header block first, so readers never count the padding of
+        // the partial last block as records, then write that block and cut the padding off
+        char *block = aligned_alloc(DIRECT_BLOCK_SIZE, DIRECT_BLOCK_SIZE);
+        if (block && pread(segment->fd, block, DIRECT_BLOCK_SIZE, 0) == DIRECT_BLOCK_SIZE) {
+            ((segment_header_t *)block)->end_offset = end;
+            if (pwrite(segment->fd, block, DIRECT_BLOCK_SIZE, 0) != DIRECT_BLOCK_SIZE) {
+                fprintf(stderr, "Failed to finalize segment header of %s\n", segment->path);
+            }
+        } else {
+            fprintf(stderr, "Failed to read segment header of %s\n", segment->path);
+        }
+        free(block);
+
+        direct_block_t *last = &segment->blocks[segment->active];
+        if (last->fill > 0) {
+            atomic_store_explicit(&last->pending, 1, memory_order_release);
+        }
+        direct_write_blocks(segment, 1);
+
+        if (ftruncate(segment->fd, end) != 0) {
+            fprintf(stderr, "Failed to truncate segment %s: %s\n", segment->path, strerror(errno));
+        }
+    } else if (segment->fp) {
+        fflush(segment->fp);
+        if (pwrite(segment->fd, &end, sizeof(end), offsetof(segment_header_t, end_offset)) != sizeof(end)) {
+            fprintf(stderr, "Failed to finalize segment header of %s\n", segment->path);
+        }
+    }
+
+    if (file->sync_on_retire && fdatasync(segment->fd) != 0) {
+        fprintf(stderr, "Failed to sync segment %s: %s\n", segment->path, strerror(errno));
+    }
+
+    // Listed only once complete (and synced, if the file is synced at all)
+    if (file->catalog && catalog_append(file->catalog, &segment->entry) != 0) {
+        fprintf(stderr, "Failed to add segment %s to %s: %s\n", segment->path, file->catalog->path, strerror(errno));
+    }
+
+    if (segment->fp) {
+        fclose(segment->fp);
+    } else if (segment->fd != -1) {
+        close(segment->fd);
+    }
+
+    if (file->mode == WRITER_DIRECT) {
+        free(segment->blocks[0].data);
+        free(segment->blocks[1].data);
+        pthread_mutex_destroy(&segment->block_mutex);
+        pthread_cond_destroy(&segment->block_cond);
+    }
+
+    free(segment->stdio_buffer);
+    free(segment);
+}
+
+/**
+ * Finalize every retired segment of a data file, except keep (which stays on the retired list)
+ * Must only be called from the thread that owns segment finalization.
+ * Returns the number of segments finalized
+ */
+int data_file_reap(data_file_t *file, segment_t *keep) {
+    segment_t *segment = atomic_exchange_explicit(&file->retired, NULL, memory_order_acquire);
+    int count = 0;
+
+    while (segment) {
+        segment_t *next = segment->next_retired;
+
+        if (segment == keep) {
+            segment_t *head = atomic_load_explicit(&file->retired, memory_order_relaxed);
+            do {
+                segment->next_retired = head;
+            } while (!atomic_compare_exchange_weak_explicit(&file->retired, &head, segment,
+                                                            memory_order_release, memory_order_relaxed));
+        } else {
+            segment_finalize(file, segment);
+            count++;
+        }
+
+        segment = next;
+    }
+
+    return count;
+}
+
+/**
+ * Finalize all segments of a data file (no appends may be in flight)
+ */
+void data_file_close(data_file_t *file) {
+    data_file_reap(file, NULL);
+
+    segment_t *segment = atomic_exchange(&file->current, NULL);
+    if (segment) {
+        segment_finalize(file, segment);
+    }
+}
+
+/**
+ * Read the segment header of a data file and position the stream at the first record
+ * Returns 1 for a segment, 0 for a headerless record dump (header is zeroed), -1 on read failure
+ */
+int segment_read_header(FILE *fp, segment_header_t *header) {
+    if (fseek(fp, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    if (fread(header, sizeof(*header), 1, fp) == 1 && header->magic == SEGMENT_MAGIC) {
+        if (fseek(fp, header->data_offset, SEEK_SET) != 0) {
+            return -1;
+        }
+        return 1;
+    }
+
+    memset(header, 0, sizeof(*header));
+    return fseek(fp, 0, SEEK_SET) == 0 ? 0 : -1;
+}
+
+/**
+ * Number of complete records in a data file, given its header and current size
+ */
+uint64_t segment_record_count(const segment_header_t *header, uint64_t file_size, size_t record_size) {
+    uint64_t end = header->end_offset ? header->end_offset : file_size;
+
+    if (end > file_size) {
+        end = file_size;
+    }
+    if (end <= header->data_offset || record_size == 0) {
+        return 0;
+    }
+
+    return (end - header->data_offset) / record_size;
+}
+
+/**
+ * Whether a segment has been finalized (no more records will be appended to it)
+ * Live mmap segments also have an end_offset, but their file still has the preallocated size.
+ */
+int segment_is_finalized(const segment_header_t *header, uint64_t file_size) {
+    return header->magic == SEGMENT_MAGIC && header->end_offset != 0 && header->end_offset == file_size;
+}
+
+/**
+ * Path of the segment that follows the one at path in its run (same directory, next index)
+ * Returns 0 on success, -1 if path does not name a segment
+ */
+int segment_next_path(const char *path, char *next, size_t size) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    char prefix[16];
+    long long run;
+    unsigned int index;
+    int consumed = 0;
+    if (sscanf(name, "%15[a-z]_%lld_%u.bin%n", prefix, &run, &index, &consumed) != 3 || name[consumed] != '\0') {
+        return -1;
+    }
+
+    int len = snprintf(next, size, "%.*s%s_%lld_%06u.bin", (int)(name - path), path, prefix, run, index + 1);
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+/**
+ * Follow a data file as its writer appends to it, and its successor segments after rollover
+ * Each complete record is passed to on_record; a line naming each new segment is printed as it
+ * is entered. Waits on inotify events for the file and its directory; stores into a live mmap
+ * segment raise no events, so those are re-checked every second. Stops when *stop is set.
+ * Returns 0 when stopped, 1 on error
+ */
+int segment_follow(const char *file_path, uint64_t start, size_t record_size, segment_record_fn on_record,
+                   void *arg, volatile int *stop) {
+    char current[PATH_MAX], next_path[PATH_MAX], dir[PATH_MAX];
+
+    snprintf(current, sizeof(current), "%s", file_path);
+    snprintf(dir, sizeof(dir), "%s", file_path);
+
+    void *record = malloc(record_size);
+    if (!record) {
+        fprintf(stderr, "Failed to allocate a %zu-byte record\n", record_size);
+        return 1;
+    }
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("Failed to initialize inotify");
+        free(record);
+        return 1;
+    }
+
+    // New segments appear in the same directory
+    if (inotify_add_watch(inotify_fd, dirname(dir), IN_CREATE | IN_MOVED_TO) == -1) {
+        perror("Failed to watch directory");
+        close(inotify_fd);
+        free(record);
+        return 1;
+    }
+
+    while (!*stop) {
+        // Plain reads at explicit offsets: a stdio stream could serve stale buffered data
+        int fd = open(current, O_RDONLY);
+        if (fd == -1) {
+            perror("Failed to open file");
+            break;
+        }
+
+        int wd = inotify_add_watch(inotify_fd, current, IN_MODIFY | IN_CLOSE_WRITE);
+        if (wd == -1) {
+            perror("Failed to watch file");
+            close(fd);
+            break;
+        }
+
+        uint64_t next = start;
+        int rolled_over = 0;
+
+        while (!*stop) {
+            struct stat st;
+            segment_header_t header;
+            if (fstat(fd, &st) != 0) {
+                perror("Failed to read file");
+                break;
+            }
+            if ((size_t)st.st_size < sizeof(header) ||
+                pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SEGMENT_MAGIC) {
+                memset(&header, 0, sizeof(header));
+            }
+
+            // Decode whatever complete records have been appended since the last pass
+            uint64_t record_count = segment_record_count(&header, st.st_size, record_size);
+            if (next < record_count) {
+                while (next < record_count &&
+                       pread(fd, record, record_size, header.data_offset + next * record_size) == (ssize_t)record_size) {
+                    on_record(record, arg);
+                    next++;
+                }
+                fflush(stdout);
+                continue;
+            }
+
+            // Hop to the next segment once this one is finalized and its successor exists
+            if (segment_is_finalized(&header, st.st_size) &&
+                segment_next_path(current, next_path, sizeof(next_path)) == 0 &&
+                access(next_path, F_OK) == 0) {
+                rolled_over = 1;
+                break;
+            }
+
+            int live_mmap = header.magic == SEGMENT_MAGIC && header.end_offset != 0 &&
+                            header.end_offset < (uint64_t)st.st_size;
+
+            struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+            if (poll(&pfd, 1, live_mmap ? 1000 : -1) > 0) {
+                char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                if (read(inotify_fd, events, sizeof(events)) < 0) {
+                    perror("Failed to read inotify events");
+                    break;
+                }
+            }
+        }
+
+        inotify_rm_watch(inotify_fd, wd);
+        close(fd);
+
+        if (!rolled_over) {
+            break;
+        }
+
+        printf("\nSegment: %s\n", next_path);
+        snprintf(current, sizeof(current), "%s", next_path);
+        start = 0;
+    }
+
+    close(inotify_fd);
+    free(record);
+    return *stop ? 0 : 1;
+}
+
+/**
+ * Build the CRC-32C table and check for the SSE4.2 crc32 instruction
+ */
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+/**
+ * CRC-32C with the crc32 instruction, 8 bytes at a time
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t size) {
+    uint64_t c = crc;
+
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    }
+
+    return (uint32_t)c;
+}
+#endif
+
+/**
+ * Continue a CRC-32C (Castagnoli) over more data; start with crc 0
+ */
+uint32_t segment_crc32c(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *p = data;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_hardware) {
+        return ~crc32c_sse42(crc, p, size);
+    }
+#endif
+    while (size--) {
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * Add one record to a catalog entry: its count, time and id ranges and checksum
+ */
+void catalog_entry_add(catalog_entry_t *entry, data_type_t type, const void *record, size_t size) {
+    int64_t time = 0, id = -1;
+
+    switch (type) {
+        case DATA_TYPE_TRADE:
+            time = ((const trade_record_t *)record)->trade_time;
+            id = ((const trade_record_t *)record)->trade_id;
+            break;
+        case DATA_TYPE_KLINE: {
+            const kline_record_t *kline = record;
+            time = kline->open_time;
+            if (entry->interval_ms == 0) {
+                entry->interval_ms = kline->close_time - kline->open_time + 1;
+            }
+            break;
+        }
+        case DATA_TYPE_DEPTH:
+        case DATA_TYPE_BOOK:
+            time = ((const book_level_record_t *)record)->event_time;
+            id = ((const book_level_record_t *)record)->update_id;
+            break;
+        case DATA_TYPE_BOOK_INDEX:
+            time = ((const book_index_record_t *)record)->event_time;
+            id = ((const book_index_record_t *)record)->update_id;
+            break;
+        case DATA_TYPE_PANEL:
+            memcpy(&time, record, sizeof(time));
+            break;
+    }
+
+    if (entry->record_count == 0) {
+        entry->first_time = entry->last_time = time;
+        entry->first_id = entry->last_id = id;
+    } else {
+        if (time < entry->first_time) entry->first_time = time;
+        if (time > entry->last_time) entry->last_time = time;
+        if (id < entry->first_id) entry->first_id = id;
+        if (id > entry->last_id) entry->last_id = id;
+    }
+    entry->record_count++;
+    entry->checksum = segment_crc32c(entry->checksum, record, size);
+}
+
+/**
+ * Open (creating it if needed) the catalog of an output directory for appending
+ * A partial entry left at the end by a crash is cut off, so later entries stay aligned.
+ * Returns 0 on success, -1 on failure
+ */
+int catalog_open(segment_catalog_t *catalog, const char *dir) {
+    struct stat st;
+
+    snprintf(catalog->path, sizeof(catalog->path), "%s/%s", dir, CATALOG_FILE);
+    catalog->fd = open(catalog->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (catalog->fd == -1) {
+        fprintf(stderr, "Failed to open catalog %s: %s\n", catalog->path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(catalog->fd, &st) == 0 && st.st_size % sizeof(catalog_entry_t) != 0 &&
+        ftruncate(catalog->fd, st.st_size - st.st_size % sizeof(catalog_entry_t)) != 0) {
+        fprintf(stderr, "Failed to truncate partial entry of %s: %s\n", catalog->path, strerror(errno));
+    }
+    return 0;
+}
+
+/**
+ * Append an entry to a catalog in a single write
+ * Returns 0 on success, -1 on failure
+ */
+int catalog_append(segment_catalog_t *catalog, const catalog_entry_t *entry) {
+    catalog_entry_t record = *entry;
+
+    record.magic = CATALOG_MAGIC;
+    record.version = CATALOG_VERSION;
+    record.codec = CATALOG_CODEC_RAW;
+    if (record.record_count == 0) {
+        record.first_time = record.last_time = 0;
+        record.first_id = record.last_id = -1;
+    }
+
+    return write(catalog->fd, &record, sizeof(record)) == sizeof(record) ? 0 : -1;
+}
+
+/**
+ * Close a catalog opened with catalog_open()
+ */
+void catalog_close(segment_catalog_t *catalog) {
+    if (catalog->fd != -1) {
+        close(catalog->fd);
+        catalog->fd = -1;
+    }
+}
+
+/**
+ * Read every complete entry of the catalog of a directory
+ * Returns the entries (to be freed by the caller), or NULL with *count 0 if there are none
+ */
+catalog_entry_t *catalog_read(const char *dir, size_t *count) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    *count = 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, CATALOG_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(catalog_entry_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t capacity = st.st_size / sizeof(catalog_entry_t);
+    catalog_entry_t *entries = malloc(capacity * sizeof(catalog_entry_t));
+    ssize_t n = entries ? pread(fd, entries, capacity * sizeof(catalog_entry_t), 0) : -1;
+    close(fd);
+    if (n <= 0) {
+        free(entries);
+        return NULL;
+    }
+
+    // Keep the entries written by a writer that understood this format
+    size_t kept = 0;
+    for (size_t i = 0; i < (size_t)n / sizeof(catalog_entry_t); i++) {
+        if (entries[i].magic == CATALOG_MAGIC && entries[i].version == CATALOG_VERSION) {
+            entries[kept++] = entries[i];
+        }
+    }
+
+    *count = kept;
+    if (kept == 0) {
+        free(entries);
+        return NULL;
+    }
+    return entries;
+}
+
+/**
+ * Build the catalog entry of a finalized segment by reading it back
+ * Returns 1 on success, 0 if it is not a finalized segment, -1 on failure
+ */
+int catalog_scan_segment(const char *path, catalog_entry_t *entry) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    char prefix[16];
+    long long run;
+    unsigned int index;
+    int consumed = 0;
+    if (sscanf(name, "%15[a-z]_%lld_%u.bin%n", prefix, &run, &index, &consumed) != 3 || name[consumed] != '\0') {
+        return 0;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    struct stat st;
+    segment_header_t header;
+    if (fstat(fileno(fp), &st) != 0 || segment_read_header(fp, &header) != 1 ||
+        !segment_is_finalized(&header, st.st_size) || header.record_size == 0 ||
+        strcmp(prefix, data_type_prefix((data_type_t)header.record_type)) != 0) {
+        fclose(fp);
+        return 0;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->record_type = header.record_type;
+    entry->record_size = header.record_size;
+    entry->segment_index = index;
+    entry->run_id = run;
+    memcpy(entry->symbol, header.symbol, MAX_SYMBOL_LENGTH);
+    entry->base_sequence = header.base_sequence;
+
+    // Whole records at a time
+    uint64_t left = segment_record_count(&header, st.st_size, header.record_size);
+    size_t batch = CATALOG_READ_BUFFER / header.record_size;
+    if (batch == 0) {
+        batch = 1;
+    }
+    char *buffer = malloc(batch * header.record_size);
+    int ret = buffer ? 1 : -1;
+
+    while (ret == 1 && left > 0) {
+        size_t n = left < batch ? left : batch;
+        if (fread(buffer, header.record_size, n, fp) != n) {
+            ret = -1;
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            catalog_entry_add(entry, (data_type_t)header.record_type, buffer + i * header.record_size,
+                              header.record_size);
+        }
+        left -= n;
+    }
+
+    free(buffer);
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * Read a finalized segment back and add its entry to a catalog
+ * For writers that only know at the end whether their segments stay (importer, journal decoder),
+ * and for cataloging segments written before the catalog existed.
+ * Returns 1 if the segment was added, 0 if it is not a finalized segment, -1 on failure
+ */
+int catalog_add_segment(segment_catalog_t *catalog, const char *path) {
+    catalog_entry_t entry;
+
+    int ret = catalog_scan_segment(path, &entry);
+    if (ret == 1 && catalog_append(catalog, &entry) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * Add every finalized segment of one run of a data file to a catalog
+ * Returns the number of segments added, or -1 on failure
+ */
+int catalog_add_run(segment_catalog_t *catalog, const char *dir, data_type_t type, int64_t run_id) {
+    int added = 0;
+
+    for (uint32_t index = 0; ; index++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s_%lld_%06u.bin", dir, data_type_prefix(type), (long long)run_id, index);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+
+        int r = catalog_add_segment(catalog, path);
+        if (r < 0) {
+            fprintf(stderr, "Failed to add segment %s to %s\n", path, catalog->path);
+            return -1;
+        }
+        added += r;
+    }
+
+    return added;
+}
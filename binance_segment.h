@@ -0,0 +1,179 @@
+/**
+* binance_segment.h
+*
+* On-disk segment format and data file writers for Binance data collector and related applications
+*/
+
+#ifndef BINANCE_SEGMENT_H
+#define BINANCE_SEGMENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Include our common header file
+#include "binance_common.h"
+
+// Segment format
+#define SEGMENT_MAGIC 0x47455342U             // "BSEG" in a little-endian file
+#define SEGMENT_VERSION 1
+#define SEGMENT_DATA_OFFSET 64                // Records start right after the 64-byte header
+
+// Segment sizing
+#define DEFAULT_MMAP_SEGMENT_SIZE (256UL * 1024 * 1024)  // 256MB per mmap segment
+#define SEGMENT_EXTENT_SIZE (16UL * 1024 * 1024)         // mmap segments are fallocate()d 16MB at a time
+#define DIRECT_BLOCK_SIZE 4096                           // O_DIRECT I/O unit; direct segments put records after one header block
+
+// Segment catalog
+#define CATALOG_FILE "catalog.bin"            // In the output directory, beside the symbol directories
+#define CATALOG_MAGIC 0x54414342U             // "BCAT" in a little-endian file
+#define CATALOG_VERSION 1
+#define CATALOG_CODEC_RAW 0                   // Fixed-size records as appended, uncompressed
+
+// Segment file header (first 64 bytes of every data file written by the collector;
+// direct segments pad it to a whole block)
+// Files without the magic are headerless record dumps from older collectors.
+typedef struct {
+    uint32_t magic;           // SEGMENT_MAGIC
+    uint16_t version;         // SEGMENT_VERSION
+    uint16_t record_type;     // data_type_t of the records
+    uint32_t record_size;     // Size of one record in bytes
+    uint32_t data_offset;     // Offset of the first record from the start of the file
+    int64_t created_time;     // Creation time (ms since epoch)
+    uint64_t base_sequence;   // Sequence number of the first record in this segment
+    uint64_t end_offset;      // Logical end of the records (0 if the file size is authoritative)
+    char symbol[MAX_SYMBOL_LENGTH]; // Symbol name
+    uint8_t reserved[8];
+} segment_header_t;           // 64 bytes
+
+// Catalog entry: one finalized segment, described well enough to plan a query without opening it
+// The catalog is an append-only sequence of these; the segment is <dir>/<symbol>/<prefix>_<run id>_<index>.bin.
+typedef struct {
+    uint32_t magic;           // CATALOG_MAGIC
+    uint16_t version;         // CATALOG_VERSION
+    uint16_t record_type;     // data_type_t of the records
+    uint32_t record_size;     // Size of one record in bytes
+    uint32_t segment_index;   // Index of the segment within its run
+    int64_t run_id;           // Run that wrote the segment
+    char symbol[MAX_SYMBOL_LENGTH]; // Symbol name
+    uint64_t base_sequence;   // Sequence number of the first record
+    uint64_t record_count;    // Records in the segment
+    int64_t first_time;       // Earliest record time in ms (trade time, kline open time or event time; 0 if empty)
+    int64_t last_time;        // Latest record time
+    int64_t first_id;         // Smallest trade id or update id (-1 for types without one)
+    int64_t last_id;          // Largest trade id or update id
+    int64_t interval_ms;      // Kline interval (0 for other types)
+    uint32_t codec;           // CATALOG_CODEC_*
+    uint32_t checksum;        // CRC-32C of the records
+    uint8_t reserved[24];
+} catalog_entry_t;            // 128 bytes
+
+// Open catalog of an output directory (appends are single O_APPEND writes, so several writers
+// and processes can share one)
+typedef struct {
+    int fd;
+    char path[PATH_MAX];
+} segment_catalog_t;
+
+// Writer backends for data files
+typedef enum {
+    WRITER_STDIO = 0,         // Buffered stdio appends
+    WRITER_MMAP = 1,          // Preallocated, memory-mapped segments (an append is a memcpy)
+    WRITER_DIRECT = 2         // O_DIRECT block writes from double-buffered, block-aligned buffers
+} writer_mode_t;
+
+// Block buffer of a direct segment
+typedef struct {
+    char *data;               // DIRECT_BLOCK_SIZE bytes, block aligned
+    off_t offset;             // File offset the block is written at
+    size_t fill;              // Valid bytes in the block (the rest is padding)
+    atomic_int pending;       // Set when the block is waiting to be written
+} direct_block_t;
+
+// One segment of a data file
+typedef struct segment {
+    struct segment *next_retired; // Link in the owning data file's retired list
+    int fd;                   // Segment file descriptor
+    FILE *fp;                 // stdio stream (stdio writer)
+    char *stdio_buffer;       // Pre-touched stdio buffer (NULL for the stdio default)
+    char *map;                // Mapping of the whole segment (mmap writer)
+    segment_header_t *header; // Header inside the mapping (mmap writer)
+    size_t capacity;          // Maximum size of the segment in bytes (0 if unbounded)
+    size_t allocated;         // Bytes preallocated with fallocate (mmap writer)
+    atomic_size_t end;        // Logical end of the records in bytes
+    size_t writeback_end;     // Bytes already handed to writeback (maintenance thread only)
+    size_t data_offset;       // Offset of the first record
+    direct_block_t blocks[2]; // Double buffer (direct writer); the appender fills blocks[active]
+    int active;
+    atomic_size_t flushed_end; // Bytes written to the file by the direct writer (records only up to here are on disk)
+    pthread_mutex_t block_mutex; // Lets the appender wait for a block buffer to be written
+    pthread_cond_t block_cond;
+    uint64_t base_sequence;   // Sequence number of the first record
+    catalog_entry_t entry;    // Catalog entry, built as records are appended (if the file has a catalog)
+    char path[PATH_MAX];      // Segment file path
+} segment_t;
+
+// A data file: the sequence of segments holding one symbol's records of one type
+// Appends come from a single thread; a maintenance thread syncs and finalizes retired segments.
+typedef struct data_file {
+    writer_mode_t mode;
+    data_type_t type;
+    uint32_t record_size;
+    char symbol[MAX_SYMBOL_LENGTH];
+    char dir[PATH_MAX];       // Directory holding the segments
+    const char *prefix;       // File name prefix (see data_type_prefix())
+    int64_t run_id;           // Collector run id (start time), part of every segment name
+    size_t segment_size;      // Rotate to a new segment at this size (0: never, stdio only)
+    size_t stdio_buffer_size; // Pre-touched stdio buffer size (0: stdio default)
+    int pretouch;             // Fault in buffers and mappings when a segment is opened
+    int sync_on_retire;       // fdatasync segments when they are finalized
+    void (*wake_writer)(void); // Called when a direct block is ready to be written (may be NULL)
+    segment_catalog_t *catalog; // Catalog finalized segments are added to (NULL: none)
+    uint32_t segment_index;   // Index of the current segment within the run
+    uint64_t next_sequence;   // Sequence number of the next record
+    _Atomic(segment_t *) current;  // Segment being appended to
+    _Atomic(segment_t *) retired;  // Rotated-out segments waiting to be finalized
+} data_file_t;
+
+// Record types
+size_t data_type_record_size(data_type_t type);
+const char *data_type_prefix(data_type_t type);
+
+// Writer functions
+int data_file_open(data_file_t *file, writer_mode_t mode, data_type_t type, const char *dir,
+                   const char *symbol, int64_t run_id, size_t segment_size);
+int data_file_append(data_file_t *file, const void *record);
+void data_file_flush(data_file_t *file);
+int segment_write_blocks(data_file_t *file, segment_t *segment);
+size_t segment_flushed_end(data_file_t *file, segment_t *segment);
+int data_file_reap(data_file_t *file, segment_t *keep);
+void data_file_close(data_file_t *file);
+segment_t *segment_open(data_file_t *file);
+void segment_finalize(data_file_t *file, segment_t *segment);
+
+// Called by segment_follow() with each complete record
+typedef void (*segment_record_fn)(const void *record, void *arg);
+
+// Reader functions
+int segment_read_header(FILE *fp, segment_header_t *header);
+uint64_t segment_record_count(const segment_header_t *header, uint64_t file_size, size_t record_size);
+int segment_is_finalized(const segment_header_t *header, uint64_t file_size);
+int segment_next_path(const char *path, char *next, size_t size);
+int segment_follow(const char *file_path, uint64_t start, size_t record_size, segment_record_fn on_record,
+                   void *arg, volatile int *stop);
+
+// Catalog functions
+uint32_t segment_crc32c(uint32_t crc, const void *data, size_t size);
+void catalog_entry_add(catalog_entry_t *entry, data_type_t type, const void *record, size_t size);
+int catalog_open(segment_catalog_t *catalog, const char *dir);
+int catalog_append(segment_catalog_t *catalog, const catalog_entry_t *entry);
+void catalog_close(segment_catalog_t *catalog);
+catalog_entry_t *catalog_read(const char *dir, size_t *count);
+int catalog_scan_segment(const char *path, catalog_entry_t *entry);
+int catalog_add_segment(segment_catalog_t *catalog, const char *path);
+int catalog_add_run(segment_catalog_t *catalog, const char *dir, data_type_t type, int64_t run_id);
+
+#endif /* BINANCE_SEGMENT_H */
@@ -18,9 +18,40 @@
 #include <ctype.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/ioctl.h>
 
 // Include our common header file
 #include "binance_common.h"
+#include "binance_consumer.h"
+
+// Continuous mode frame limits
+#define MAX_FRAME_LINES 1024
+#define FRAME_LINE_SIZE 192
+#define MAX_VIEW_RECORDS 256                  // Records kept per symbol and type for display
+#define IDLE_REFRESH_MS 1000                  // Redraw at least this often (clock in the header)
+
+// Tap mode
+#define TAP_BUFFER_SIZE (256 * 1024)          // Output is written in chunks of up to this size
+#define TAP_BATCH_RECORDS 1024                // Records taken from one consumer before moving to the next
+#define TAP_TYPE_TRADE 1
+#define TAP_TYPE_KLINE 2
+
+// Tap output formats
+typedef enum {
+    TAP_NONE = 0,
+    TAP_JSON = 1,             // One JSON object per line
+    TAP_BINARY = 2            // uint32 length, then message_header_t and the record
+} tap_format_t;
+
+// Rendered recent records of one symbol, updated incrementally from the live rings
+typedef struct {
+    uint64_t seen[2];                         // Next trade/kline sequence to render
+    char lines[2][MAX_VIEW_RECORDS][FRAME_LINE_SIZE]; // Formatted records (ring of max_records)
+    size_t count[2];
+    size_t next[2];
+} symbol_view_t;
 
 // Global variables
 static volatile int force_exit = 0;
@@ -28,6 +59,12 @@ static int shm_fd = -1;
 static void *shared_memory = NULL;
 static shared_memory_header_t *shm_header = NULL;
 static int max_records = 10; // Default max records to display
+static symbol_view_t views[MAX_SYMBOLS];
+static char frames[2][MAX_FRAME_LINES][FRAME_LINE_SIZE]; // Current and previous frame
+static int frame_lines[2];
+static int frame_current = 0;
+static char tap_buffer[TAP_BUFFER_SIZE];
+static size_t tap_length = 0;
 
 // Function declarations
 void signal_handler(int sig);
@@ -36,6 +73,16 @@ void print_shared_memory_info();
 void display_symbol_data(const char *symbol);
 void display_all_symbols_data();
 void print_formatted_time(int64_t timestamp);
+void format_time_cached(int64_t timestamp, char *buffer, size_t size);
+shm_ring_t *symbol_ring(size_t symbol_idx, data_type_t type);
+void update_symbol_view(size_t symbol_idx);
+int frame_add(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void render_frame(int symbol_idx);
+void flush_frame(void);
+void run_continuous(const char *symbol, int interval_ms);
+int tap_flush(void);
+int tap_record(const consumer_record_t *record, tap_format_t format);
+int run_tap(const char *symbols, int types, tap_format_t format);
 
 /**
  * Signal handler for clean exit
@@ -50,10 +97,12 @@ void signal_handler(int sig) {
 void print_usage(const char *program_name) {
     printf("Usage: %s [options]\n", program_name);
     printf("Options:\n");
-    printf("  -s SYMBOL    Display data for specific symbol (e.g., BTCUSDT)\n");
-    printf("  -c           Continuous mode: update display periodically\n");
-    printf("  -i INTERVAL  Update interval in milliseconds for continuous mode (default: 1000)\n");
+    printf("  -s SYMBOL    Display data for specific symbol (e.g., BTCUSDT; tap mode takes a comma-separated list)\n");
+    printf("  -c           Continuous mode: redraw as records are published\n");
+    printf("  -i INTERVAL  Minimum interval between redraws in milliseconds (default: 1000)\n");
     printf("  -n COUNT     Maximum number of records to display per symbol (default: 10)\n");
+    printf("  -t FORMAT    Tap mode: write every new record once to stdout as json (NDJSON) or binary\n");
+    printf("  -T TYPE      Tap mode record type: trade, kline or all (default: all)\n");
     printf("  -h           Display this help message\n");
 }
 
@@ -96,6 +145,13 @@ void print_shared_memory_info() {
     printf("  Data offset: %zu bytes\n", shm_header->data_offset);
     printf("  Buffer size per symbol: %zu bytes\n", shm_header->buffer_size);
     printf("  Total shared memory size: %d bytes\n", SHM_SIZE);
+    
+    // NUMA node owning each symbol's buffer (only meaningful when the collector bound it)
+    for (size_t i = 0; i < shm_header->symbol_count; i++) {
+        if (shm_header->numa_node[i] >= 0) {
+            printf("  %s buffer: NUMA node %d\n", shm_header->symbols[i], shm_header->numa_node[i]);
+        }
+    }
 }
 
 /**
@@ -143,9 +199,9 @@ void display_symbol_data(const char *symbol) {
         return;
     }
     
-    if (data_size > shm_header->buffer_size - sizeof(size_t)) {
+    if (data_size > SHM_SNAPSHOT_SIZE - sizeof(size_t)) {
         printf("Warning: Data size (%zu) is larger than available buffer size (%zu), might be corrupt\n",
-              data_size, shm_header->buffer_size - sizeof(size_t));
+              data_size, (size_t)SHM_SNAPSHOT_SIZE - sizeof(size_t));
         return;
     }
     
@@ -196,6 +252,9 @@ void display_symbol_data(const char *symbol) {
             print_formatted_time(trade->event_time);
             printf("\n        Price: %.8f, Qty: %.8f, TradeID: %lld, BuyerMaker: %d\n",
                   trade->price, trade->quantity, trade->trade_id, trade->is_buyer_maker);
+            printf("        Sequence: %llu%s\n", (unsigned long long)header->sequence,
+                  header->sequence >= atomic_load(&shm_header->persisted_trades[symbol_idx]) ?
+                  " (not yet in data file)" : "");
             
             offset += header->length;
             record_count++;
@@ -216,6 +275,9 @@ void display_symbol_data(const char *symbol) {
             printf("\n        OHLC: %.8f, %.8f, %.8f, %.8f, Vol: %.8f, Trades: %lld, Final: %d\n",
                   kline->open_price, kline->high_price, kline->low_price, kline->close_price,
                   kline->volume, kline->num_trades, kline->is_final);
+            printf("        Sequence: %llu%s\n", (unsigned long long)header->sequence,
+                  header->sequence >= atomic_load(&shm_header->persisted_klines[symbol_idx]) ?
+                  " (not yet in data file)" : "");
             
             offset += header->length;
             record_count++;
@@ -247,6 +309,417 @@ void display_all_symbols_data() {
     }
 }
 
+/**
+ * Format a timestamp like print_formatted_time, calling localtime only when the second changes
+ */
+void format_time_cached(int64_t timestamp, char *buffer, size_t size) {
+    static time_t cached_second = -1;
+    static char cached[20];
+    
+    time_t time_val = timestamp / 1000;  // Convert from milliseconds to seconds
+    if (time_val != cached_second) {
+        struct tm *tm_info = localtime(&time_val);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", tm_info);
+        cached_second = time_val;
+    }
+    snprintf(buffer, size, "%s.%03lld", cached, (long long)(timestamp % 1000));
+}
+
+/**
+ * Live ring of a symbol's trades or klines
+ */
+shm_ring_t *symbol_ring(size_t symbol_idx, data_type_t type) {
+    char *buffer = (char *)shared_memory + shm_header->data_offset + symbol_idx * shm_header->buffer_size;
+    return (shm_ring_t *)(buffer + (type == DATA_TYPE_TRADE ? shm_header->trade_ring_offset
+                                                            : shm_header->kline_ring_offset));
+}
+
+/**
+ * Format the records published since the last update of a symbol's view
+ * Only the newest max_records of them are formatted; older ones would scroll off anyway.
+ */
+void update_symbol_view(size_t symbol_idx) {
+    symbol_view_t *view = &views[symbol_idx];
+    data_type_t types[2] = { DATA_TYPE_TRADE, DATA_TYPE_KLINE };
+    
+    for (int t = 0; t < 2; t++) {
+        shm_ring_t *ring = symbol_ring(symbol_idx, types[t]);
+        uint64_t published = atomic_load_explicit(&ring->published, memory_order_acquire);
+        uint64_t sequence = view->seen[t];
+        
+        if (published > (uint64_t)max_records && sequence < published - max_records) {
+            sequence = published - max_records;
+        }
+        
+        for (; sequence < published; sequence++) {
+            consumer_record_t record;
+            if (consumer_ring_read(ring, sequence, &record) != 1) {
+                continue;
+            }
+            
+            char *line = view->lines[t][view->next[t]];
+            char time_str[32], close_time_str[32];
+            
+            if (types[t] == DATA_TYPE_TRADE) {
+                trade_record_t *trade = &record.record.trade;
+                format_time_cached(trade->trade_time, time_str, sizeof(time_str));
+                snprintf(line, FRAME_LINE_SIZE, "  [TRADE] #%-10llu %s  Price: %.8f  Qty: %.8f  TradeID: %lld  BuyerMaker: %d",
+                         (unsigned long long)sequence, time_str, trade->price, trade->quantity,
+                         (long long)trade->trade_id, trade->is_buyer_maker);
+            } else {
+                kline_record_t *kline = &record.record.kline;
+                format_time_cached(kline->open_time, time_str, sizeof(time_str));
+                format_time_cached(kline->close_time, close_time_str, sizeof(close_time_str));
+                snprintf(line, FRAME_LINE_SIZE, "  [KLINE] #%-10llu %s - %s  OHLC: %.8f, %.8f, %.8f, %.8f  Vol: %.8f  Final: %d",
+                         (unsigned long long)sequence, time_str, close_time_str,
+                         kline->open_price, kline->high_price, kline->low_price, kline->close_price,
+                         kline->volume, kline->is_final);
+            }
+            
+            view->next[t] = (view->next[t] + 1) % max_records;
+            if (view->count[t] < (size_t)max_records) {
+                view->count[t]++;
+            }
+        }
+        
+        view->seen[t] = published;
+    }
+}
+
+/**
+ * Append a line to the frame being rendered
+ * Returns 0 on success, -1 if the frame is full
+ */
+int frame_add(const char *format, ...) {
+    int *lines = &frame_lines[frame_current];
+    if (*lines >= MAX_FRAME_LINES) {
+        return -1;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    vsnprintf(frames[frame_current][*lines], FRAME_LINE_SIZE, format, args);
+    va_end(args);
+    
+    (*lines)++;
+    return 0;
+}
+
+/**
+ * Render the continuous mode display into the current frame (symbol_idx -1 for all symbols)
+ */
+void render_frame(int symbol_idx) {
+    time_t current_time = time(NULL);
+    time_t last_update = atomic_load(&shm_header->last_update_time);
+    char time_str[32];
+    
+    frame_lines[frame_current] = 0;
+    
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&last_update));
+    frame_add("=== Binance Market Data Shared Memory ===");
+    frame_add("Last update: %s (%d seconds ago), write counter: %llu, symbols: %zu",
+              time_str, (int)difftime(current_time, last_update),
+              (unsigned long long)atomic_load(&shm_header->write_counter), shm_header->symbol_count);
+    frame_add("%s", "");
+    
+    for (size_t i = 0; i < shm_header->symbol_count; i++) {
+        if (symbol_idx >= 0 && (size_t)symbol_idx != i) {
+            continue;
+        }
+        
+        update_symbol_view(i);
+        symbol_view_t *view = &views[i];
+        
+        frame_add("%s: %llu trades, %llu klines (%llu / %llu in data files)", shm_header->symbols[i],
+                  (unsigned long long)view->seen[0], (unsigned long long)view->seen[1],
+                  (unsigned long long)atomic_load(&shm_header->persisted_trades[i]),
+                  (unsigned long long)atomic_load(&shm_header->persisted_klines[i]));
+        
+        // Oldest to newest
+        for (int t = 0; t < 2; t++) {
+            size_t start = (view->next[t] + max_records - view->count[t]) % max_records;
+            for (size_t j = 0; j < view->count[t]; j++) {
+                frame_add("%s", view->lines[t][(start + j) % max_records]);
+            }
+        }
+        
+        frame_add("%s", "");
+    }
+}
+
+/**
+ * Send the lines that differ from the previous frame to the terminal in a single write
+ */
+void flush_frame(void) {
+    static char output[MAX_FRAME_LINES * (FRAME_LINE_SIZE + 16)];
+    size_t length = 0;
+    int columns = FRAME_LINE_SIZE;
+    struct winsize ws;
+    
+    // Wrapped lines would shift every row below them
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_col < columns) {
+        columns = ws.ws_col;
+    }
+    int previous = frame_current ^ 1;
+    int lines = frame_lines[frame_current] > frame_lines[previous] ?
+                frame_lines[frame_current] : frame_lines[previous];
+    
+    for (int i = 0; i < lines; i++) {
+        if (i >= frame_lines[frame_current]) {
+            // Line no longer used: clear it
+            length += snprintf(output + length, sizeof(output) - length, "\033[%d;1H\033[K", i + 1);
+        } else if (i >= frame_lines[previous] ||
+                   strcmp(frames[frame_current][i], frames[previous][i]) != 0) {
+            length += snprintf(output + length, sizeof(output) - length, "\033[%d;1H%.*s\033[K",
+                               i + 1, columns, frames[frame_current][i]);
+        }
+    }
+    
+    if (length > 0 && write(STDOUT_FILENO, output, length) < 0) {
+        perror("write");
+    }
+    
+    frame_current = previous;
+}
+
+/**
+ * Continuous mode: redraw whenever records are published, at most once per interval
+ * Waits on the collector's futex word instead of sleeping for a fixed interval.
+ */
+void run_continuous(const char *symbol, int interval_ms) {
+    int symbol_idx = -1;
+    
+    if (symbol) {
+        for (size_t i = 0; i < shm_header->symbol_count; i++) {
+            if (strcasecmp(shm_header->symbols[i], symbol) == 0) {
+                symbol_idx = i;
+                break;
+            }
+        }
+        if (symbol_idx == -1) {
+            printf("Symbol %s not found in shared memory\n", symbol);
+            return;
+        }
+    }
+    
+    if (max_records > MAX_VIEW_RECORDS) {
+        max_records = MAX_VIEW_RECORDS;
+    }
+    
+    shared_memory_header_t *notify = shm_map_notify();
+    
+    printf("\033[2J");
+    fflush(stdout);
+    
+    while (!force_exit) {
+        struct timespec frame_start, now;
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        
+        render_frame(symbol_idx);
+        flush_frame();
+        
+        // Wait for new records (or the idle refresh), then keep at least interval_ms between frames
+        uint32_t seen = shm_notify_arm(notify);
+        int pending = 0;
+        for (size_t i = 0; i < shm_header->symbol_count && !pending; i++) {
+            if (symbol_idx >= 0 && (size_t)symbol_idx != i) {
+                continue;
+            }
+            pending = atomic_load(&symbol_ring(i, DATA_TYPE_TRADE)->published) != views[i].seen[0] ||
+                      atomic_load(&symbol_ring(i, DATA_TYPE_KLINE)->published) != views[i].seen[1];
+        }
+        if (!pending) {
+            shm_notify_wait(notify, seen, IDLE_REFRESH_MS);
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - frame_start.tv_sec) * 1000 +
+                          (now.tv_nsec - frame_start.tv_nsec) / 1000000;
+        if (elapsed_ms < interval_ms) {
+            usleep((interval_ms - elapsed_ms) * 1000);
+        }
+    }
+    
+    // Leave the cursor below the display
+    printf("\033[%d;1H\n", frame_lines[frame_current ^ 1] + 1);
+    shm_unmap_notify(notify);
+}
+
+/**
+ * Write the buffered tap output to stdout
+ * Returns 0 on success, -1 if stdout is gone
+ */
+int tap_flush(void) {
+    size_t offset = 0;
+    
+    while (offset < tap_length) {
+        ssize_t n = write(STDOUT_FILENO, tap_buffer + offset, tap_length - offset);
+        if (n < 0) {
+            if (errno == EINTR && !force_exit) {
+                continue;
+            }
+            return -1;
+        }
+        offset += n;
+    }
+    
+    tap_length = 0;
+    return 0;
+}
+
+/**
+ * Append one record to the tap output, flushing the buffer when it fills up
+ * Returns 0 on success, -1 if stdout is gone
+ */
+int tap_record(const consumer_record_t *record, tap_format_t format) {
+    // Largest encoding of one record (a kline as JSON is about 400 bytes)
+    if (TAP_BUFFER_SIZE - tap_length < 1024 && tap_flush() != 0) {
+        return -1;
+    }
+    
+    char *out = tap_buffer + tap_length;
+    size_t space = TAP_BUFFER_SIZE - tap_length;
+    int length;
+    
+    if (format == TAP_BINARY) {
+        uint32_t frame_size = sizeof(message_header_t) + record->header.length;
+        memcpy(out, &frame_size, sizeof(frame_size));
+        memcpy(out + sizeof(frame_size), record, frame_size);
+        length = sizeof(frame_size) + frame_size;
+    } else if (record->header.type == DATA_TYPE_TRADE) {
+        const trade_record_t *trade = &record->record.trade;
+        length = snprintf(out, space,
+                          "{\"symbol\":\"%s\",\"type\":\"trade\",\"sequence\":%llu,\"timestamp\":%lld,"
+                          "\"event_time\":%lld,\"trade_time\":%lld,\"trade_id\":%lld,"
+                          "\"price\":%.8f,\"quantity\":%.8f,\"is_buyer_maker\":%s}\n",
+                          record->header.symbol, (unsigned long long)record->header.sequence,
+                          (long long)record->header.timestamp, (long long)trade->event_time,
+                          (long long)trade->trade_time, (long long)trade->trade_id,
+                          trade->price, trade->quantity, trade->is_buyer_maker ? "true" : "false");
+    } else {
+        const kline_record_t *kline = &record->record.kline;
+        length = snprintf(out, space,
+                          "{\"symbol\":\"%s\",\"type\":\"kline\",\"sequence\":%llu,\"timestamp\":%lld,"
+                          "\"open_time\":%lld,\"close_time\":%lld,"
+                          "\"open\":%.8f,\"high\":%.8f,\"low\":%.8f,\"close\":%.8f,"
+                          "\"volume\":%.8f,\"num_trades\":%lld,\"is_final\":%s}\n",
+                          record->header.symbol, (unsigned long long)record->header.sequence,
+                          (long long)record->header.timestamp,
+                          (long long)kline->open_time, (long long)kline->close_time,
+                          kline->open_price, kline->high_price, kline->low_price, kline->close_price,
+                          kline->volume, (long long)kline->num_trades, kline->is_final ? "true" : "false");
+    }
+    
+    if (length < 0 || (size_t)length >= space) {
+        return 0;
+    }
+    tap_length += length;
+    return 0;
+}
+
+/**
+ * Tap mode: stream every record published from now on to stdout exactly once
+ * One live-only consumer per symbol and type; a consumer lapped by the ring refills from the
+ * data files, so a slow pipe delays records but does not lose them. Output is flushed whenever
+ * the consumers are drained, before waiting on the collector's futex word.
+ * Returns 0 when interrupted, 1 on error
+ */
+int run_tap(const char *symbols, int types, tap_format_t format) {
+    static consumer_t consumers[MAX_SYMBOLS * 2];
+    size_t consumer_count = 0;
+    int ret = 1;
+    
+    // Select the symbols, in shared memory order
+    for (size_t i = 0; i < shm_header->symbol_count && i < MAX_SYMBOLS; i++) {
+        const char *symbol = shm_header->symbols[i];
+        if (symbols) {
+            size_t symbol_len = strlen(symbol);
+            const char *p = symbols;
+            int selected = 0;
+            while (*p && !selected) {
+                size_t len = strcspn(p, ",");
+                selected = len == symbol_len && strncasecmp(p, symbol, len) == 0;
+                p += len;
+                if (*p == ',') p++;
+            }
+            if (!selected) {
+                continue;
+            }
+        }
+        
+        for (int t = 0; t < 2; t++) {
+            data_type_t type = t == 0 ? DATA_TYPE_TRADE : DATA_TYPE_KLINE;
+            if (!(types & (t == 0 ? TAP_TYPE_TRADE : TAP_TYPE_KLINE))) {
+                continue;
+            }
+            if (consumer_open(&consumers[consumer_count], symbol, type, CONSUMER_LIVE_ONLY) != 0) {
+                goto cleanup;
+            }
+            consumer_count++;
+        }
+    }
+    
+    if (consumer_count == 0) {
+        fprintf(stderr, "No symbol matches %s\n", symbols);
+        return 1;
+    }
+    
+    // A closed pipe ends the tap through write() errors
+    signal(SIGPIPE, SIG_IGN);
+    shared_memory_header_t *notify = shm_map_notify();
+    
+    while (!force_exit) {
+        int delivered = 0;
+        
+        for (size_t i = 0; i < consumer_count; i++) {
+            consumer_record_t record;
+            int n = 0;
+            int r = 0;
+            while (n < TAP_BATCH_RECORDS && (r = consumer_next(&consumers[i], &record)) == 1) {
+                if (tap_record(&record, format) != 0) {
+                    goto done;
+                }
+                n++;
+            }
+            if (r < 0) {
+                fprintf(stderr, "Failed to read %s records\n", consumers[i].symbol);
+                goto done;
+            }
+            delivered += n;
+        }
+        
+        if (delivered > 0) {
+            continue;
+        }
+        
+        if (tap_flush() != 0) {
+            goto done;
+        }
+        
+        // Nothing left: sleep until the collector publishes (rechecking after arming)
+        uint32_t seen = shm_notify_arm(notify);
+        int pending = 0;
+        for (size_t i = 0; i < consumer_count && !pending; i++) {
+            pending = consumers[i].phase != CONSUMER_LIVE ||
+                      atomic_load(&consumers[i].ring->published) != consumers[i].next_sequence;
+        }
+        if (!pending) {
+            shm_notify_wait(notify, seen, IDLE_REFRESH_MS);
+        }
+    }
+    ret = 0;
+    
+done:
+    tap_flush();
+    shm_unmap_notify(notify);
+    
+cleanup:
+    for (size_t i = 0; i < consumer_count; i++) {
+        consumer_close(&consumers[i]);
+    }
+    return ret;
+}
+
 /**
  * Main function
  */
@@ -254,6 +727,8 @@ int main(int argc, char **argv) {
     int c;
     int continuous = 0;
     int interval_ms = 1000;  // Default 1 second
+    tap_format_t tap_format = TAP_NONE;
+    int tap_types = TAP_TYPE_TRADE | TAP_TYPE_KLINE;
     char *specific_symbol = NULL;
     
     // Register signal handler
@@ -261,7 +736,7 @@ int main(int argc, char **argv) {
     signal(SIGTERM, signal_handler);
     
     // Parse command line arguments
-    while ((c = getopt(argc, argv, "s:ci:n:h")) != -1) {
+    while ((c = getopt(argc, argv, "s:ci:n:t:T:h")) != -1) {
         switch (c) {
             case 's':
                 specific_symbol = optarg;
@@ -271,12 +746,34 @@ int main(int argc, char **argv) {
                 break;
             case 'i':
                 interval_ms = atoi(optarg);
-                if (interval_ms < 100) interval_ms = 100;
+                if (interval_ms < 1) interval_ms = 1;
                 break;
             case 'n':
                 max_records = atoi(optarg);
                 if (max_records < 1) max_records = 1;
                 break;
+            case 't':
+                if (strcmp(optarg, "json") == 0) {
+                    tap_format = TAP_JSON;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    tap_format = TAP_BINARY;
+                } else {
+                    fprintf(stderr, "Error: Invalid tap format: %s (json or binary)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'T':
+                if (strcmp(optarg, "trade") == 0) {
+                    tap_types = TAP_TYPE_TRADE;
+                } else if (strcmp(optarg, "kline") == 0) {
+                    tap_types = TAP_TYPE_KLINE;
+                } else if (strcmp(optarg, "all") == 0) {
+                    tap_types = TAP_TYPE_TRADE | TAP_TYPE_KLINE;
+                } else {
+                    fprintf(stderr, "Error: Invalid record type: %s (trade, kline or all)\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -304,20 +801,13 @@ int main(int argc, char **argv) {
     shm_header = (shared_memory_header_t *)shared_memory;
     
     // Display mode
-    if (continuous) {
-        printf("Continuous mode: Press Ctrl+C to exit\n");
-        while (!force_exit) {
-            printf("\033[2J\033[H");  // Clear screen and move cursor to top
-            print_shared_memory_info();
-            
-            if (specific_symbol) {
-                display_symbol_data(specific_symbol);
-            } else {
-                display_all_symbols_data();
-            }
-            
-            usleep(interval_ms * 1000);
-        }
+    if (tap_format != TAP_NONE) {
+        int ret = run_tap(specific_symbol, tap_types, tap_format);
+        munmap(shared_memory, SHM_SIZE);
+        close(shm_fd);
+        return ret;
+    } else if (continuous) {
+        run_continuous(specific_symbol, interval_ms);
     } else {
         print_shared_memory_info();
         
@@ -0,0 +1,466 @@
+/**
+* binance_views.hpp
+*
+* Header-only C++20 views over Binance data collector data: typed, zero-copy spans over
+* mapped data segments, readers of the live shared memory rings, and scan kernels over both
+*
+* The layouts are checked at compile time against binance_common.h and binance_segment.h, so a
+* change to a record or header fails to build here instead of being misread at run time.
+* Records are packed structs: they are read through spans of the structs themselves (alignment
+* 1), which the compiler turns into the same unaligned loads as a hand-written pointer loop.
+*/
+
+#ifndef BINANCE_VIEWS_HPP
+#define BINANCE_VIEWS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Include our common header file
+#include "binance_common.h"
+#include "binance_segment.h"
+
+namespace binance {
+
+// Segment format version the views understand
+inline constexpr uint16_t segment_layout_version = 1;
+
+// Layout checks (update the views together with the C structures)
+static_assert(SEGMENT_VERSION == segment_layout_version, "segment format changed");
+static_assert(sizeof(segment_header_t) == SEGMENT_DATA_OFFSET);
+static_assert(offsetof(segment_header_t, record_type) == 6);
+static_assert(offsetof(segment_header_t, record_size) == 8);
+static_assert(offsetof(segment_header_t, data_offset) == 12);
+static_assert(offsetof(segment_header_t, base_sequence) == 24);
+static_assert(offsetof(segment_header_t, end_offset) == 32);
+static_assert(offsetof(segment_header_t, symbol) == 40);
+
+static_assert(sizeof(trade_record_t) == 41 && alignof(trade_record_t) == 1);
+static_assert(offsetof(trade_record_t, event_time) == 0);
+static_assert(offsetof(trade_record_t, trade_time) == 8);
+static_assert(offsetof(trade_record_t, price) == 16);
+static_assert(offsetof(trade_record_t, quantity) == 24);
+static_assert(offsetof(trade_record_t, trade_id) == 32);
+static_assert(offsetof(trade_record_t, is_buyer_maker) == 40);
+
+static_assert(sizeof(kline_record_t) == 65 && alignof(kline_record_t) == 1);
+static_assert(offsetof(kline_record_t, open_time) == 0);
+static_assert(offsetof(kline_record_t, close_time) == 8);
+static_assert(offsetof(kline_record_t, open_price) == 16);
+static_assert(offsetof(kline_record_t, close_price) == 24);
+static_assert(offsetof(kline_record_t, high_price) == 32);
+static_assert(offsetof(kline_record_t, low_price) == 40);
+static_assert(offsetof(kline_record_t, volume) == 48);
+static_assert(offsetof(kline_record_t, num_trades) == 56);
+static_assert(offsetof(kline_record_t, is_final) == 64);
+
+static_assert(sizeof(message_header_t) == 40);
+static_assert(offsetof(message_header_t, sequence) == 16);
+static_assert(offsetof(message_header_t, symbol) == 24);
+
+static_assert(sizeof(shm_slot_t) == 128);
+static_assert(sizeof(shm_ring_t) == 64);
+
+// Compile-time description of a record type
+template <typename Record>
+struct record_traits;
+
+template <>
+struct record_traits<trade_record_t> {
+    static constexpr data_type_t type = DATA_TYPE_TRADE;
+    static constexpr std::string_view prefix = "trades";
+    // Time records are ordered and filtered by (as in the consumer library)
+    static int64_t time(const trade_record_t &record) noexcept { return record.trade_time; }
+};
+
+template <>
+struct record_traits<kline_record_t> {
+    static constexpr data_type_t type = DATA_TYPE_KLINE;
+    static constexpr std::string_view prefix = "klines";
+    static int64_t time(const kline_record_t &record) noexcept { return record.open_time; }
+};
+
+template <typename Record>
+concept record_type = requires(const Record &record) {
+    { record_traits<Record>::type } -> std::convertible_to<data_type_t>;
+    { record_traits<Record>::time(record) } -> std::same_as<int64_t>;
+};
+
+// A field of a record at a compile-time offset
+template <typename Record, typename T, std::size_t Offset>
+struct field {
+    using record = Record;
+    using value_type = T;
+    static constexpr std::size_t offset = Offset;
+    static_assert(Offset + sizeof(T) <= sizeof(Record));
+
+    static T load(const Record &r) noexcept {
+        T value;
+        std::memcpy(&value, reinterpret_cast<const std::byte *>(&r) + Offset, sizeof(T));
+        return value;
+    }
+};
+
+#define BINANCE_FIELD(record, name, member) \
+    inline constexpr field<record, decltype(record::member), offsetof(record, member)> name {}
+
+namespace trade {
+BINANCE_FIELD(trade_record_t, event_time, event_time);
+BINANCE_FIELD(trade_record_t, trade_time, trade_time);
+BINANCE_FIELD(trade_record_t, price, price);
+BINANCE_FIELD(trade_record_t, quantity, quantity);
+BINANCE_FIELD(trade_record_t, trade_id, trade_id);
+BINANCE_FIELD(trade_record_t, is_buyer_maker, is_buyer_maker);
+} // namespace trade
+
+namespace kline {
+BINANCE_FIELD(kline_record_t, open_time, open_time);
+BINANCE_FIELD(kline_record_t, close_time, close_time);
+BINANCE_FIELD(kline_record_t, open_price, open_price);
+BINANCE_FIELD(kline_record_t, close_price, close_price);
+BINANCE_FIELD(kline_record_t, high_price, high_price);
+BINANCE_FIELD(kline_record_t, low_price, low_price);
+BINANCE_FIELD(kline_record_t, volume, volume);
+BINANCE_FIELD(kline_record_t, num_trades, num_trades);
+BINANCE_FIELD(kline_record_t, is_final, is_final);
+} // namespace kline
+
+#undef BINANCE_FIELD
+
+/**
+ * Read-only mapping of a whole file (move-only)
+ */
+class mapped_file {
+public:
+    mapped_file() noexcept = default;
+    mapped_file(mapped_file &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    mapped_file &operator=(mapped_file &&other) noexcept {
+        if (this != &other) {
+            reset();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    ~mapped_file() { reset(); }
+
+    /**
+     * Map a file; std::nullopt on failure (errno tells why)
+     */
+    static std::optional<mapped_file> open(const char *path) noexcept {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return std::nullopt;
+        }
+
+        struct stat st;
+        mapped_file file;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                file.data_ = static_cast<const std::byte *>(map);
+                file.size_ = st.st_size;
+            }
+        }
+
+        int saved_errno = errno;
+        close(fd);
+        if (!file.data_ && st.st_size > 0) {
+            errno = saved_errno;
+            return std::nullopt;
+        }
+        return file;
+    }
+
+    std::span<const std::byte> bytes() const noexcept { return { data_, size_ }; }
+
+private:
+    void reset() noexcept {
+        if (data_) {
+            munmap(const_cast<std::byte *>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const std::byte *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/**
+ * Typed view of the records in one data segment (or a headerless record dump)
+ * The record count is fixed when the view is made; make a new view to see later appends.
+ */
+template <record_type Record>
+class segment_view {
+public:
+    /**
+     * View the bytes of a segment of Record; std::nullopt if they hold another record type,
+     * an unknown format version, or a header that does not fit
+     */
+    static std::optional<segment_view> from_bytes(std::span<const std::byte> bytes) noexcept {
+        segment_view view;
+
+        if (bytes.size() >= sizeof(segment_header_t)) {
+            std::memcpy(&view.header_, bytes.data(), sizeof(view.header_));
+        }
+
+        if (view.header_.magic == SEGMENT_MAGIC) {
+            // A live mmap segment moves end_offset as it appends
+            view.header_.end_offset = __atomic_load_n(
+                &reinterpret_cast<const segment_header_t *>(bytes.data())->end_offset, __ATOMIC_ACQUIRE);
+            if (view.header_.version != segment_layout_version ||
+                view.header_.record_type != record_traits<Record>::type ||
+                view.header_.record_size != sizeof(Record) ||
+                view.header_.data_offset > bytes.size()) {
+                return std::nullopt;
+            }
+        } else {
+            // Headerless dump of an older collector: records from the first byte
+            view.header_ = segment_header_t{};
+        }
+
+        uint64_t end = view.header_.end_offset ? view.header_.end_offset : bytes.size();
+        end = std::min<uint64_t>(end, bytes.size());
+        std::size_t count = end > view.header_.data_offset ? (end - view.header_.data_offset) / sizeof(Record) : 0;
+
+        view.records_ = { reinterpret_cast<const Record *>(bytes.data() + view.header_.data_offset), count };
+        return view;
+    }
+
+    const segment_header_t &header() const noexcept { return header_; }
+    bool has_header() const noexcept { return header_.magic == SEGMENT_MAGIC; }
+    uint64_t base_sequence() const noexcept { return header_.base_sequence; }
+    std::span<const Record> records() const noexcept { return records_; }
+
+    /**
+     * Sequence number of a record of this view
+     */
+    uint64_t sequence_of(const Record &record) const noexcept {
+        return header_.base_sequence + (&record - records_.data());
+    }
+
+private:
+    segment_header_t header_{};
+    std::span<const Record> records_;
+};
+
+// Result of reading a live ring slot
+enum class ring_read {
+    ok,                       // Record copied
+    not_published,            // Sequence not published yet
+    overwritten               // Sequence already overwritten (the reader was lapped)
+};
+
+/**
+ * Typed reader of a live ring in shared memory (seqlock protocol of the collector)
+ */
+template <record_type Record>
+class ring_view {
+public:
+    explicit ring_view(const shm_ring_t *ring) noexcept : ring_(ring) {}
+
+    uint64_t published() const noexcept { return ring_->published.load(std::memory_order_acquire); }
+    uint64_t capacity() const noexcept { return ring_->capacity; }
+
+    /**
+     * Copy the record with the given sequence (and optionally its message header)
+     */
+    ring_read read(uint64_t sequence, Record &record, message_header_t *header = nullptr) const noexcept {
+        uint64_t end = published();
+        if (sequence >= end) {
+            return ring_read::not_published;
+        }
+        if (end - sequence > ring_->capacity) {
+            return ring_read::overwritten;
+        }
+
+        const shm_slot_t &slot = ring_->slots[sequence & (ring_->capacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != sequence) {
+            return ring_read::overwritten;
+        }
+        if (header) {
+            std::memcpy(header, &slot.header, sizeof(*header));
+        }
+        std::memcpy(&record, &slot.record, sizeof(Record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            return ring_read::overwritten;
+        }
+        return ring_read::ok;
+    }
+
+    /**
+     * Pass every published record from next on to f(record, sequence), advancing next
+     * Stops at the first record that is not published yet or was overwritten (check
+     * next against published() - capacity() to tell the two apart).
+     * Returns the number of records passed
+     */
+    template <typename F>
+    uint64_t drain(uint64_t &next, F &&f) const {
+        uint64_t count = 0;
+        Record record;
+        while (read(next, record) == ring_read::ok) {
+            f(record, next);
+            next++;
+            count++;
+        }
+        return count;
+    }
+
+private:
+    const shm_ring_t *ring_;
+};
+
+/**
+ * Read-only mapping of the collector's shared memory (move-only)
+ */
+class shm_view {
+public:
+    shm_view(shm_view &&other) noexcept : memory_(std::exchange(other.memory_, nullptr)) {}
+    shm_view &operator=(shm_view &&) = delete;
+    shm_view(const shm_view &) = delete;
+    shm_view &operator=(const shm_view &) = delete;
+    ~shm_view() {
+        if (memory_) {
+            munmap(memory_, SHM_SIZE);
+        }
+    }
+
+    /**
+     * Map the shared memory; std::nullopt if the collector is not running (errno tells why)
+     */
+    static std::optional<shm_view> open() noexcept {
+        int fd = shm_open("/binance_market_data", O_RDONLY, 0666);
+        if (fd == -1) {
+            return std::nullopt;
+        }
+        void *memory = mmap(nullptr, SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            return std::nullopt;
+        }
+        return shm_view(memory);
+    }
+
+    const shared_memory_header_t &header() const noexcept {
+        return *static_cast<const shared_memory_header_t *>(memory_);
+    }
+
+    /**
+     * Index of a symbol (case-insensitive), or -1 if the collector does not track it
+     */
+    int find_symbol(const char *symbol) const noexcept {
+        for (std::size_t i = 0; i < header().symbol_count && i < MAX_SYMBOLS; i++) {
+            if (strcasecmp(header().symbols[i], symbol) == 0) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Live ring of a symbol's records of one type
+     */
+    template <record_type Record>
+    ring_view<Record> ring(std::size_t symbol_idx) const noexcept {
+        const char *buffer = static_cast<const char *>(memory_) + header().data_offset + symbol_idx * header().buffer_size;
+        std::size_t offset = record_traits<Record>::type == DATA_TYPE_TRADE ? header().trade_ring_offset
+                                                                             : header().kline_ring_offset;
+        return ring_view<Record>(reinterpret_cast<const shm_ring_t *>(buffer + offset));
+    }
+
+private:
+    explicit shm_view(void *memory) noexcept : memory_(memory) {}
+
+    void *memory_;
+};
+
+// Scan kernels over spans of records
+
+/**
+ * Records with from_ms <= time < to_ms (records are stored in time order)
+ */
+template <record_type Record>
+std::span<const Record> time_range(std::span<const Record> records, int64_t from_ms, int64_t to_ms) noexcept {
+    auto by_time = [](const Record &record, int64_t time) { return record_traits<Record>::time(record) < time; };
+    auto first = std::lower_bound(records.begin(), records.end(), from_ms, by_time);
+    auto last = std::lower_bound(first, records.end(), to_ms, by_time);
+    return records.subspan(first - records.begin(), last - first);
+}
+
+/**
+ * Sum of a field over the records
+ */
+template <typename Record, typename T, std::size_t Offset>
+T sum(std::span<const Record> records, field<Record, T, Offset>) noexcept {
+    T total{};
+    for (const Record &record : records) {
+        total += field<Record, T, Offset>::load(record);
+    }
+    return total;
+}
+
+/**
+ * Smallest and largest value of a field (std::nullopt for no records)
+ */
+template <typename Record, typename T, std::size_t Offset>
+std::optional<std::pair<T, T>> min_max(std::span<const Record> records, field<Record, T, Offset>) noexcept {
+    if (records.empty()) {
+        return std::nullopt;
+    }
+    T low = field<Record, T, Offset>::load(records.front());
+    T high = low;
+    for (const Record &record : records.subspan(1)) {
+        T value = field<Record, T, Offset>::load(record);
+        low = std::min(low, value);
+        high = std::max(high, value);
+    }
+    return std::pair{ low, high };
+}
+
+/**
+ * Volume-weighted average price of trades (0 for no volume)
+ */
+inline double vwap(std::span<const trade_record_t> trades) noexcept {
+    double notional = 0, volume = 0;
+    for (const trade_record_t &t : trades) {
+        notional += t.price * t.quantity;
+        volume += t.quantity;
+    }
+    return volume > 0 ? notional / volume : 0;
+}
+
+/**
+ * Traded volume of final klines (non-final updates repeat the volume of their candle)
+ */
+inline double final_volume(std::span<const kline_record_t> klines) noexcept {
+    double volume = 0;
+    for (const kline_record_t &k : klines) {
+        if (k.is_final) {
+            volume += k.volume;
+        }
+    }
+    return volume;
+}
+
+} // namespace binance
+
+#endif /* BINANCE_VIEWS_HPP */
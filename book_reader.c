@@ -0,0 +1,332 @@
+/**
+* book_reader.c
+*
+* A tool to restore a symbol's order book as of any past time from the depth data collected
+* by binance_data_collector --depth
+*
+* The collector writes three segmented files per symbol and run: depth (every level of every
+* depth update), book (the whole book at each checkpoint) and bookindex (one entry per
+* checkpoint). The book at time T is the last checkpoint at or before T, plus the depth records
+* that follow it up to T; nothing before that checkpoint is read. A book is complete only once a
+* depth snapshot was applied after the last gap in the updates; before that it holds only the
+* levels updated since, and is reported as partial.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+// Record structures, the segment format and the book are shared with the collector
+#include "binance_common.h"
+#include "binance_segment.h"
+#include "binance_book.h"
+
+// Sequential reader of one data file of a run, across its segments
+typedef struct {
+    char dir[PATH_MAX];
+    const char *prefix;
+    long long run_id;
+    size_t record_size;
+    unsigned int segment_index; // Index of the open segment
+    FILE *fp;
+    uint64_t data_offset;       // Offset of the open segment's first record
+    uint64_t base;              // Sequence of the open segment's first record
+    uint64_t next;              // Sequence of the next record
+    uint64_t end;               // Sequence after the open segment's last complete record
+} record_cursor_t;
+
+/**
+ * Milliseconds elapsed since start (monotonic clock)
+ */
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Convert Unix timestamp (ms) to human-readable date
+void format_timestamp(int64_t timestamp, char *buffer, size_t size) {
+    time_t time_val = timestamp / 1000;
+    struct tm *tm_info = localtime(&time_val);
+    size_t len = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
+    snprintf(buffer + len, size - len, ".%03d", (int)(timestamp % 1000));
+}
+
+/**
+ * Open segment number index of a cursor's data file
+ * Returns 0 on success, -1 if the segment does not exist or is not a segment of the expected type
+ */
+int cursor_open_segment(record_cursor_t *cursor, unsigned int index) {
+    char path[PATH_MAX];
+    struct stat st;
+    segment_header_t header;
+
+    int len = snprintf(path, sizeof(path), "%s/%s_%lld_%06u.bin", cursor->dir, cursor->prefix, cursor->run_id, index);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        fprintf(stderr, "Segment path too long: %s/%s_%lld_%06u.bin\n", cursor->dir, cursor->prefix, cursor->run_id,
+                index);
+        return -1;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    if (fstat(fileno(fp), &st) != 0 || segment_read_header(fp, &header) != 1 ||
+        header.record_size != cursor->record_size) {
+        fprintf(stderr, "Not a %s segment: %s\n", cursor->prefix, path);
+        fclose(fp);
+        return -1;
+    }
+
+    if (cursor->fp) {
+        fclose(cursor->fp);
+    }
+    cursor->fp = fp;
+    cursor->segment_index = index;
+    cursor->data_offset = header.data_offset;
+    cursor->base = header.base_sequence;
+    cursor->next = header.base_sequence;
+    cursor->end = header.base_sequence + segment_record_count(&header, st.st_size, cursor->record_size);
+    return 0;
+}
+
+/**
+ * Position a cursor at a record sequence, hopping over whole segments by their headers
+ * Returns 0 on success, -1 if the sequence is past the end of the data
+ */
+int cursor_seek(record_cursor_t *cursor, uint64_t sequence) {
+    // Segments are searched forward; start over from the first if the target is behind
+    if (sequence < cursor->base && cursor_open_segment(cursor, 0) != 0) {
+        return -1;
+    }
+    while (sequence >= cursor->end) {
+        if (cursor_open_segment(cursor, cursor->segment_index + 1) != 0) {
+            return -1;
+        }
+    }
+
+    if (fseek(cursor->fp, (long)(cursor->data_offset + (sequence - cursor->base) * cursor->record_size),
+              SEEK_SET) != 0) {
+        return -1;
+    }
+    cursor->next = sequence;
+    return 0;
+}
+
+/**
+ * Read the next record, continuing in the next segment at the end of one
+ * Returns 1 if a record was read, 0 at the end of the data
+ */
+int cursor_next(record_cursor_t *cursor, void *record) {
+    while (cursor->next >= cursor->end) {
+        if (cursor_open_segment(cursor, cursor->segment_index + 1) != 0) {
+            return 0;
+        }
+    }
+    if (fread(record, cursor->record_size, 1, cursor->fp) != 1) {
+        return 0;
+    }
+    cursor->next++;
+    return 1;
+}
+
+/**
+ * Set up a cursor on the data file of a type in a run's directory, at its first record
+ * Returns 0 on success, -1 if the file has no first segment
+ */
+int cursor_init(record_cursor_t *cursor, const char *dir, data_type_t type, long long run_id) {
+    memset(cursor, 0, sizeof(*cursor));
+    snprintf(cursor->dir, sizeof(cursor->dir), "%s", dir);
+    cursor->prefix = data_type_prefix(type);
+    cursor->run_id = run_id;
+    cursor->record_size = data_type_record_size(type);
+    return cursor_open_segment(cursor, 0);
+}
+
+/**
+ * Print the best levels of both sides
+ */
+void print_book(const order_book_t *book, size_t depth) {
+    printf("%-15s %-15s | %-15s %-15s\n", "Bid Qty", "Bid Price", "Ask Price", "Ask Qty");
+    printf("%-15s %-15s | %-15s %-15s\n", "---------------", "---------------", "---------------",
+           "---------------");
+
+    for (size_t i = 0; i < depth && (i < book->bids.count || i < book->asks.count); i++) {
+        if (i < book->bids.count) {
+            printf("%-15.8f %-15.8f | ", book->bids.levels[i].quantity, book->bids.levels[i].price);
+        } else {
+            printf("%-15s %-15s | ", "", "");
+        }
+        if (i < book->asks.count) {
+            printf("%-15.8f %-15.8f\n", book->asks.levels[i].price, book->asks.levels[i].quantity);
+        } else {
+            printf("\n");
+        }
+    }
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <depth_file>\n", program_name);
+    printf("  depth_file - Any segment of a run's depth file (depth_<run>_<index>.bin); the book and\n");
+    printf("               bookindex files of the run are read from the same directory\n");
+    printf("Options:\n");
+    printf("  -t, --time=MS      Restore the book as of this exchange event time (ms since epoch;\n");
+    printf("                     default: the end of the data)\n");
+    printf("  -n, --levels=N     Levels to display per side (default: 10)\n");
+    printf("  -h, --help         Show this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    int64_t target_time = INT64_MAX;
+    size_t levels = 10;
+
+    static struct option long_options[] = {
+        {"time", required_argument, 0, 't'},
+        {"levels", required_argument, 0, 'n'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:n:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 't':
+                target_time = strtoll(optarg, NULL, 10);
+                break;
+            case 'n':
+                if (atoi(optarg) <= 0) {
+                    printf("Invalid level count: %s\n", optarg);
+                    return 1;
+                }
+                levels = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // The run is named by the depth segment: <dir>/depth_<run>_<index>.bin
+    char path[PATH_MAX], dir[PATH_MAX];
+    long long run_id;
+    unsigned int index;
+    int consumed = 0;
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+    snprintf(dir, sizeof(dir), "%s", dirname(path));
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+    const char *name = basename(path);
+    if (sscanf(name, "depth_%lld_%u.bin%n", &run_id, &index, &consumed) != 2 || name[consumed] != '\0') {
+        printf("Not a depth segment: %s\n", argv[optind]);
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    record_cursor_t depth, book_file, book_index;
+    if (cursor_init(&depth, dir, DATA_TYPE_DEPTH, run_id) != 0) {
+        printf("No depth data for run %lld in %s\n", run_id, dir);
+        return 1;
+    }
+
+    // Last checkpoint at or before the target time (none: start from the beginning of the run)
+    book_index_record_t checkpoint, entry;
+    int have_checkpoint = 0;
+    uint64_t checkpoints = 0;
+    if (cursor_init(&book_index, dir, DATA_TYPE_BOOK_INDEX, run_id) == 0) {
+        while (cursor_next(&book_index, &entry) && entry.event_time <= target_time) {
+            checkpoint = entry;
+            have_checkpoint = 1;
+            checkpoints++;
+        }
+        fclose(book_index.fp);
+    }
+
+    order_book_t book;
+    book_init(&book);
+    uint64_t depth_sequence = 0;
+
+    if (have_checkpoint) {
+        book_level_record_t level;
+        if (cursor_init(&book_file, dir, DATA_TYPE_BOOK, run_id) != 0 ||
+            cursor_seek(&book_file, checkpoint.book_sequence) != 0) {
+            printf("Checkpoint at sequence %llu is missing from the book files\n",
+                   (unsigned long long)checkpoint.book_sequence);
+            return 1;
+        }
+        for (uint64_t i = 0; i < checkpoint.level_count; i++) {
+            if (!cursor_next(&book_file, &level) || book_apply(&book, &level) != 0) {
+                printf("Checkpoint at sequence %llu is incomplete\n", (unsigned long long)checkpoint.book_sequence);
+                return 1;
+            }
+        }
+        fclose(book_file.fp);
+        depth_sequence = checkpoint.depth_sequence;
+    }
+
+    // Apply the updates after the checkpoint, whole updates only, up to the target time
+    book_level_record_t level;
+    uint64_t updates = 0, applied = 0;
+    if (cursor_seek(&depth, depth_sequence) == 0) {
+        while (cursor_next(&depth, &level)) {
+            if (level.flags & BOOK_LEVEL_FIRST) {
+                if (level.event_time > target_time) {
+                    break;
+                }
+                updates++;
+            }
+            if (book_apply(&book, &level) != 0) {
+                printf("Out of memory\n");
+                return 1;
+            }
+            applied++;
+        }
+    }
+    fclose(depth.fp);
+
+    double took = elapsed_ms(&start);
+
+    char time_str[32];
+    printf("Run %lld, %s\n", run_id, dir);
+    if (have_checkpoint) {
+        format_timestamp(checkpoint.event_time, time_str, sizeof(time_str));
+        printf("Checkpoint: %s (update %lld, %llu levels), checkpoint %llu of the run\n", time_str,
+               (long long)checkpoint.update_id, (unsigned long long)checkpoint.level_count,
+               (unsigned long long)checkpoints);
+    } else {
+        printf("Checkpoint: none before the requested time, replayed from the start of the run\n");
+    }
+    printf("Replayed: %llu updates (%llu levels) in %.3f ms\n", (unsigned long long)updates,
+           (unsigned long long)applied, took);
+    if (!book.complete) {
+        printf("Warning: The book is partial: no depth snapshot was applied after the start of the run\n"
+               "         or the last missed depth update\n");
+    }
+    if (book.update_id < 0) {
+        printf("The book is empty at the requested time\n");
+        book_free(&book);
+        return 0;
+    }
+    format_timestamp(book.event_time, time_str, sizeof(time_str));
+    printf("Book as of %s (update %lld): %zu bids, %zu asks\n\n", time_str, (long long)book.update_id,
+           book.bids.count, book.asks.count);
+
+    print_book(&book, levels);
+    book_free(&book);
+    return 0;
+}
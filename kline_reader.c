@@ -9,19 +9,24 @@
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
 
-// Must match the structure in binance_data_collector.c
-typedef struct __attribute__((packed)) {
-    int64_t open_time;      // Kline open time
-    int64_t close_time;     // Kline close time
-    double open_price;      // Open price
-    double close_price;     // Close price
-    double high_price;      // High price
-    double low_price;       // Low price
-    double volume;          // Base asset volume
-    int64_t num_trades;     // Number of trades
-    uint8_t is_final;       // Indicates if this kline is final
-} kline_record_t;
+// Record structures and the segment format are shared with the collector
+#include "binance_common.h"
+#include "binance_segment.h"
+
+static volatile int force_exit = 0;
+
+/**
+ * Signal handler for clean exit
+ */
+void signal_handler(int sig) {
+    force_exit = 1;
+}
 
 // Convert Unix timestamp to human-readable date
 void format_timestamp(int64_t timestamp, char *buffer, size_t size) {
@@ -30,21 +35,74 @@ void format_timestamp(int64_t timestamp, char *buffer, size_t size) {
     strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
 }
 
+// Display one kline record
+void print_kline_record(const kline_record_t *record) {
+    char open_time_str[32], close_time_str[32];
+
+    // Format timestamps
+    format_timestamp(record->open_time, open_time_str, sizeof(open_time_str));
+    format_timestamp(record->close_time, close_time_str, sizeof(close_time_str));
+
+    printf("%-24s %-24s %-12.8f %-12.8f %-12.8f %-12.8f %-15.8f %-10lld %s\n",
+           open_time_str, close_time_str,
+           record->open_price, record->close_price,
+           record->high_price, record->low_price,
+           record->volume, (long long)record->num_trades,
+           record->is_final ? "Yes" : "No");
+}
+
+/**
+ * segment_follow() callback: display one record
+ */
+void follow_record(const void *record, void *arg) {
+    print_kline_record((const kline_record_t *)record);
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <kline_file> [count]\n", program_name);
+    printf("  kline_file - Path to binary kline file\n");
+    printf("  count      - Number of records to display (default: all)\n");
+    printf("Options:\n");
+    printf("  -f, --follow   Keep displaying records as they are appended, following segment rollover\n");
+    printf("  -h, --help     Show this help message\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <kline_file> [count]\n", argv[0]);
-        printf("  kline_file - Path to binary kline file\n");
-        printf("  count      - Number of records to display (default: all)\n");
+    int follow = 0;
+    
+    static struct option long_options[] = {
+        {"follow", no_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int option_index = 0;
+    int c;
+    
+    while ((c = getopt_long(argc, argv, "fh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'f':
+                follow = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    
+    if (optind >= argc) {
+        print_usage(argv[0]);
         return 1;
     }
     
-    const char *file_path = argv[1];
+    const char *file_path = argv[optind];
     int max_count = -1; // Default to all records
     
-    if (argc >= 3) {
-        max_count = atoi(argv[2]);
+    if (optind + 1 < argc) {
+        max_count = atoi(argv[optind + 1]);
         if (max_count <= 0) {
-            printf("Invalid count: %s\n", argv[2]);
+            printf("Invalid count: %s\n", argv[optind + 1]);
             return 1;
         }
     }
@@ -60,13 +118,30 @@ int main(int argc, char *argv[]) {
     long file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
     
+    // Read the segment header (older files are plain record dumps without one)
+    segment_header_t header;
+    int has_header = segment_read_header(file, &header);
+    if (has_header < 0) {
+        perror("Failed to read file");
+        fclose(file);
+        return 1;
+    }
+    if (has_header && header.record_type != DATA_TYPE_KLINE) {
+        printf("Not a kline file: %s\n", file_path);
+        fclose(file);
+        return 1;
+    }
+    
     // Calculate number of records
     size_t record_size = sizeof(kline_record_t);
-    size_t record_count = file_size / record_size;
+    size_t record_count = segment_record_count(&header, file_size, record_size);
     
     printf("File: %s\n", file_path);
     printf("File size: %ld bytes\n", file_size);
     printf("Record size: %zu bytes\n", record_size);
+    if (has_header) {
+        printf("Segment: %s, first sequence %llu\n", header.symbol, (unsigned long long)header.base_sequence);
+    }
     printf("Total records: %zu\n\n", record_count);
     
     // Display header
@@ -81,25 +156,15 @@ int main(int argc, char *argv[]) {
     // Read and display records
     int count = 0;
     kline_record_t record;
-    char open_time_str[32], close_time_str[32];
     
-    while (fread(&record, record_size, 1, file) == 1) {
+    while ((size_t)count < record_count && fread(&record, record_size, 1, file) == 1) {
         // Check if we've reached the maximum count
         if (max_count > 0 && count >= max_count) {
             break;
         }
         
-        // Format timestamps
-        format_timestamp(record.open_time, open_time_str, sizeof(open_time_str));
-        format_timestamp(record.close_time, close_time_str, sizeof(close_time_str));
-        
         // Display record
-        printf("%-24s %-24s %-12.8f %-12.8f %-12.8f %-12.8f %-15.8f %-10lld %s\n", 
-               open_time_str, close_time_str, 
-               record.open_price, record.close_price, 
-               record.high_price, record.low_price, 
-               record.volume, (long long)record.num_trades, 
-               record.is_final ? "Yes" : "No");
+        print_kline_record(&record);
         
         count++;
     }
@@ -107,5 +172,15 @@ int main(int argc, char *argv[]) {
     printf("\nDisplayed %d out of %zu records\n", count, record_count);
     
     fclose(file);
+    
+    if (follow) {
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+        
+        printf("Following %s (Ctrl+C to exit)\n\n", file_path);
+        fflush(stdout);
+        return segment_follow(file_path, record_count, sizeof(kline_record_t), follow_record, NULL, &force_exit);
+    }
+    
     return 0;
 }
\ No newline at end of file